@@ -13,110 +13,1980 @@
    See the License for the specific language governing permissions and
    limitations under the License.
  ********************************/
+#include <err.h>
+#include <math.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include <crush/bufout.h>
+#include <crush/collate.h>
 #include <crush/dbfr.h>
 #include <crush/general.h>
+#include <crush/linesplit.h>
+#include <crush/numparse.h>
+#include <crush/parchunk.h>
+#include <crush/timestamp.h>
+
+#include "aggregate_main.h"
+#include "aggregate.h"
+
+#define AGG_TMP_BUF_SIZE 64
+
+/* groups which don't fit in memory are spilled to this many temporary
+   files, by key hash. */
+#define AGG_SPILL_PARTS 16
+
+/* the most new groups between checks of how much memory is in use.  with
+   a small budget, memory is checked more often; see spill_interval(). */
+#define AGG_SPILL_CHECK_INTERVAL 4096
+
+/* a spill file which still doesn't fit in memory after being split up this
+   many times is aggregated regardless. */
+#define AGG_SPILL_MAX_LEVEL 4
+
+/* the initial number of slots in a table of groups.  a worker's partitions
+   share this between them; see part_table_size(). */
+#define AGG_TABLE_SZ 1024
+
+/* the widest precision a min or max keeps; its record has a byte for it. */
+#define AGG_MAX_PRECISION 255
+
+/* the array of TYPE at offset MEMBER of conf.layout in a group's record. */
+#define AGG_ARRAY(agg, type, member) \
+  ((type *) ((char *) (agg) + conf.layout.member))
+
+/* tests and sets bit N of a group's flags: min I is bit I, and max I is bit
+   conf.mins.count + I. */
+#define AGG_FLAG(agg, n) \
+  (AGG_ARRAY(agg, unsigned char, flags)[(n) / 8] & (1 << (n) % 8))
+#define AGG_SET_FLAG(agg, n) \
+  (AGG_ARRAY(agg, unsigned char, flags)[(n) / 8] |= 1 << (n) % 8)
+
+/* a group's number of lines and the most it may be over, and where it is
+   in its partition's heap.  they are only in the record with --top-k and
+   --top-k-groups. */
+#define AGG_LINES(agg) (*AGG_ARRAY(agg, u_int64_t, lines))
+#define AGG_OVERCOUNT(agg) (*AGG_ARRAY(agg, u_int64_t, overcounts))
+#define AGG_HEAP_POS(agg) (*AGG_ARRAY(agg, u_int32_t, heap_positions))
+
+char *delim;
+struct agg_conf conf;
+bufout_t *out;                  /* where aggregated lines are printed */
+size_t max_memory;              /* memory for groups, or 0 for no limit */
+FILE *state_out;                /* where groups are written for a later
+                                   --merge-state, or NULL to print them */
+
+/* converts field i of a split line.  returns the number of bytes converted
+   (0 if the field is not a number), or -1 if the field is empty or
+   missing. */
+static int field_number(const linesplit_t *split, int i, numparse_t *num) {
+  if (i < 0 || i >= split->n_fields || linesplit_field_len(split, i) == 0)
+    return -1;
+  return numparse(linesplit_field_ptr(split, i),
+                  linesplit_field_len(split, i), num);
+}
+
+int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
+                          const char *header, const char *delim) {
+  if (args->keys) {
+    conf->keys.count = expand_nums(args->keys, &(conf->keys.indexes),
+                                   &(conf->keys.size));
+  } else if (args->key_labels) {
+    conf->keys.count = expand_label_list(args->key_labels, header,
+                                         delim, &(conf->keys.indexes),
+                                         &(conf->keys.size));
+    args->preserve = 1;
+  }
+  if (conf->keys.count < 0)
+    return conf->keys.count;
+  decrement_values(conf->keys.indexes, conf->keys.count);
+
+  if (args->sums) {
+    conf->sums.count = expand_nums(args->sums, &(conf->sums.indexes),
+                                   &(conf->sums.size));
+  } else if (args->sum_labels) {
+    conf->sums.count = expand_label_list(args->sum_labels, header,
+                                         delim, &(conf->sums.indexes),
+                                         &(conf->sums.size));
+    args->preserve = 1;
+  }
+  if (conf->sums.count < 0) {
+    return conf->sums.count;
+  } else if (conf->sums.count > 0) {
+    decrement_values(conf->sums.indexes, conf->sums.count);
+    if (! conf->sums.precisions)
+      conf->sums.precisions = xcalloc(conf->sums.count, sizeof(int));
+  }
+
+  if (args->counts) {
+    conf->counts.count = expand_nums(args->counts, &(conf->counts.indexes),
+                                &(conf->counts.size));
+  } else if (args->count_labels) {
+    conf->counts.count = expand_label_list(args->count_labels, header,
+                                      delim, &(conf->counts.indexes),
+                                      &(conf->counts.size));
+    args->preserve = 1;
+  }
+  if (conf->counts.count < 0)
+    return conf->counts.count;
+  else if (conf->counts.count > 0)
+    decrement_values(conf->counts.indexes, conf->counts.count);
+
+  if (args->averages) {
+    conf->averages.count = expand_nums(args->averages, &(conf->averages.indexes),
+                                  &(conf->averages.size));
+  } else if (args->average_labels) {
+    conf->averages.count = expand_label_list(args->average_labels, header,
+                                        delim, &(conf->averages.indexes),
+                                        &(conf->averages.size));
+    args->preserve = 1;
+  }
+  if (conf->averages.count < 0) {
+    return conf->averages.count;
+  } else if (conf->averages.count > 0) {
+    decrement_values(conf->averages.indexes, conf->averages.count);
+    if (! conf->averages.precisions)
+      conf->averages.precisions = xcalloc(conf->averages.count, sizeof(int));
+  }
+
+  if (args->mins) {
+    conf->mins.count = expand_nums(args->mins, &(conf->mins.indexes),
+                              &(conf->mins.size));
+  } else if (args->min_labels) {
+    conf->mins.count = expand_label_list(args->min_labels, header, delim,
+                                    &(conf->mins.indexes),
+                                    &(conf->mins.size));
+  }
+  if (conf->mins.count < 0) {
+    return conf->mins.count;
+  } else if (conf->mins.count > 0) {
+    decrement_values(conf->mins.indexes, conf->mins.count);
+  }
+
+  if (args->maxs) {
+    conf->maxs.count = expand_nums(args->maxs, &(conf->maxs.indexes),
+                              &(conf->maxs.size));
+  } else if (args->max_labels) {
+    conf->maxs.count = expand_label_list(args->max_labels, header, delim,
+                                    &(conf->maxs.indexes),
+                                    &(conf->maxs.size));
+  }
+  if (conf->maxs.count < 0) {
+    return conf->maxs.count;
+  } else if (conf->maxs.count > 0) {
+    decrement_values(conf->maxs.indexes, conf->maxs.count);
+  }
+
+  if (args->distincts) {
+    conf->distincts.count = expand_nums(args->distincts,
+                                        &(conf->distincts.indexes),
+                                        &(conf->distincts.size));
+  } else if (args->distinct_labels) {
+    conf->distincts.count = expand_label_list(args->distinct_labels, header,
+                                              delim,
+                                              &(conf->distincts.indexes),
+                                              &(conf->distincts.size));
+  }
+  if (conf->distincts.count < 0) {
+    return conf->distincts.count;
+  } else if (conf->distincts.count > 0) {
+    decrement_values(conf->distincts.indexes, conf->distincts.count);
+  }
+
+  if (args->percentiles) {
+    conf->percentiles.count = expand_nums(args->percentiles,
+                                          &(conf->percentiles.indexes),
+                                          &(conf->percentiles.size));
+  } else if (args->percentile_labels) {
+    conf->percentiles.count = expand_label_list(args->percentile_labels,
+                                                header, delim,
+                                                &(conf->percentiles.indexes),
+                                                &(conf->percentiles.size));
+  }
+  if (conf->percentiles.count < 0) {
+    return conf->percentiles.count;
+  } else if (conf->percentiles.count > 0) {
+    decrement_values(conf->percentiles.indexes, conf->percentiles.count);
+    if (! conf->percentiles.precisions)
+      conf->percentiles.precisions = xcalloc(conf->percentiles.count,
+                                             sizeof(int));
+  }
+
+  return 0;
+}
+
+/* the length of a line without its linebreak, as chomp() would leave it. */
+static size_t line_body_len(const char *line, size_t len) {
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    len--;
+  return len;
+}
+
+/* FNV-1a over LEN more bytes. */
+static unsigned int key_hash_update(unsigned int hash, const char *s,
+                                    size_t len) {
+  while (len-- > 0)
+    hash = (hash ^ (unsigned char) *s++) * 16777619;
+  return hash;
+}
+
+/* hashes the key fields of a split line as they would be joined into a
+   key string, so that key_hash_str() gives the same result for the key. */
+static unsigned int key_hash_fields(const linesplit_t *split) {
+  unsigned int hash = 2166136261U;
+  size_t delim_len = strlen(delim);
+  int i, field;
+
+  for (i = 0; i < conf.keys.count; i++) {
+    if (i)
+      hash = key_hash_update(hash, delim, delim_len);
+    field = conf.keys.indexes[i];
+    if (field < split->n_fields)
+      hash = key_hash_update(hash, linesplit_field_ptr(split, field),
+                             linesplit_field_len(split, field));
+  }
+  return hash;
+}
+
+static unsigned int key_hash_str(const char *key) {
+  return key_hash_update(2166136261U, key, strlen(key));
+}
+
+/* scrambles a key hash differently for each SEED, so that the partitions
+   chosen with one seed are spread evenly over those chosen with another. */
+static unsigned int key_mix(unsigned int hash, unsigned int seed) {
+  hash ^= seed * 0x9e3779b9;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+/* the spill file a key goes to when groups which have already been split
+   up LEVEL times are split up again. */
+static int spill_part(const char *key, int level) {
+  return key_mix(key_hash_str(key), level + 1) % AGG_SPILL_PARTS;
+}
+
+/* the memory held by the distinct and percentile sketches of a group. */
+static size_t agg_sketches_size(const struct aggregation *agg) {
+  const hll_t *distincts = AGG_ARRAY(agg, hll_t, distincts);
+  const tdigest_t *percentiles = AGG_ARRAY(agg, tdigest_t, percentiles);
+  size_t size = 0;
+  int i;
+
+  for (i = 0; i < conf.distincts.count; i++)
+    size += hll_size(&distincts[i]);
+  for (i = 0; i < conf.percentiles.count; i++)
+    size += tdigest_size(&percentiles[i]);
+  return size;
+}
+
+/* roughly the memory taken by a table of groups, not counting their
+   records. */
+static size_t groups_size(const hashtbl_t *groups) {
+  return groups->arrsz * (sizeof(ht_elem_t) + sizeof(unsigned int)) +
+         mempool_size(groups->key_pool);
+}
+
+/* converts a --max-memory argument: a number of bytes, optionally followed
+   by K, M or G.  returns -1 if it isn't valid, or is less than a byte,
+   since a size of 0 would mean no limit at all. */
+static int parse_memory_size(const char *s, size_t *size) {
+  char *end;
+  double n = strtod(s, &end);
+
+  if (end == s || n <= 0)
+    return -1;
+  switch (*end) {
+    case 'g': case 'G': n *= 1024;
+      /* fall through */
+    case 'm': case 'M': n *= 1024;
+      /* fall through */
+    case 'k': case 'K': n *= 1024; end++;
+    default: break;
+  }
+  if (*end != '\0' || n < 1 || n >= (double) (size_t) -1)
+    return -1;
+  *size = n;
+  return 0;
+}
+
+/* converts a --grouping-sets argument: sets of 1-based positions in the
+   list of N_KEYS key fields, such as "1,2:1:", where the empty set is the
+   grand total.  returns the number of sets, or -1 if it isn't valid. */
+static int parse_grouping_sets(const char *s, int n_keys,
+                               unsigned int **sets) {
+  char *copy = xstrdup(s), *set = copy, *next;
+  unsigned int all = (1U << n_keys) - 1;
+  int *positions = NULL, n = 0, sz = 4, i;
+  size_t positions_sz = 0;
+  ssize_t n_positions;
+
+  *sets = xmalloc(sizeof(unsigned int) * sz);
+  do {
+    if ((next = strchr(set, ':')))
+      *next++ = '\0';
+    if (n == sz)
+      *sets = xrealloc(*sets, sizeof(unsigned int) * (sz *= 2));
+    (*sets)[n] = all;
+    if (*set) {
+      n_positions = expand_nums(set, &positions, &positions_sz);
+      if (n_positions <= 0) {
+        n = -1;
+        break;
+      }
+      for (i = 0; i < n_positions; i++) {
+        if (positions[i] < 1 || positions[i] > n_keys) {
+          n = -1;
+          break;
+        }
+        (*sets)[n] &= ~(1U << (n_keys - positions[i]));
+      }
+      if (n < 0)
+        break;
+    }
+    /* a set given twice would be aggregated twice into the same groups. */
+    for (i = 0; i < n && (*sets)[i] != (*sets)[n]; i++)
+      ;
+    if (i == n)
+      n++;
+  } while ((set = next));
+  free(positions);
+  free(copy);
+  return n;
+}
+
+/* converts a --buckets argument: a list of 1-based positions in the list
+   of N_KEYS key fields, each with the width of its buckets, such as
+   "1:hour,3:15m".  returns -1 if it isn't valid. */
+static int parse_buckets(const char *s, int n_keys, long long **buckets) {
+  char *copy = xstrdup(s), *spec = copy, *next, *width, *end;
+  long position;
+  int retval = 0;
+
+  *buckets = xcalloc(n_keys, sizeof(long long));
+  do {
+    if ((next = strchr(spec, ',')))
+      *next++ = '\0';
+    if (! (width = strchr(spec, ':'))) {
+      retval = -1;
+      break;
+    }
+    *width++ = '\0';
+    position = strtol(spec, &end, 10);
+    if (end == spec || *end != '\0' || position < 1 || position > n_keys ||
+        timestamp_parse_width(width, &(*buckets)[position - 1]) != 0) {
+      retval = -1;
+      break;
+    }
+  } while ((spec = next));
+  free(copy);
+  return retval;
+}
+
+/* the number of fields at the start of an output line which make up its
+   key, counting the grouping set marker. */
+static int key_columns(void) {
+  return conf.keys.count + (conf.n_grouping_sets > 0);
+}
+
+/* converts a positive whole number.  returns -1 if it isn't valid. */
+static int parse_count(const char *s, size_t *n) {
+  char *end;
+  long l = strtol(s, &end, 10);
+
+  if (end == s || *end != '\0' || l <= 0)
+    return -1;
+  *n = l;
+  return 0;
+}
+
+/* opens an anonymous temporary file in $TMPDIR, or /tmp. */
+static FILE * spill_open(void) {
+  const char *dir = getenv("TMPDIR");
+  char *path;
+  FILE *fp = NULL;
+  int fd;
+
+  if (! dir || ! *dir)
+    dir = "/tmp";
+  path = xmalloc(strlen(dir) + sizeof("/aggregate.XXXXXX"));
+  sprintf(path, "%s/aggregate.XXXXXX", dir);
+  fd = mkstemp(path);
+  if (fd >= 0)
+    fp = fdopen(fd, "w+");
+  if (! fp) {
+    warn("%s", path);
+    exit(EXIT_FILE_ERR);
+  }
+  unlink(path);
+  free(path);
+  return fp;
+}
+
+/* gives up if a temporary file couldn't be written or read. */
+static void spill_check(FILE *fp) {
+  if (ferror(fp)) {
+    warn("temporary file");
+    exit(EXIT_FILE_ERR);
+  }
+}
+
+/* writes a group to a spill file or a state file: the length of its key,
+   the key, its record and then its distinct and percentile sketches.  the
+   record is written just as it is in memory, so the file can only be read
+   back on the same kind of machine, by a build of aggregate with the same
+   record layout. */
+static void spill_write(FILE *fp, const char *key,
+                        const struct aggregation *agg) {
+  u_int32_t key_len = strlen(key);
+
+  hll_t *distincts = AGG_ARRAY(agg, hll_t, distincts);
+  tdigest_t *percentiles = AGG_ARRAY(agg, tdigest_t, percentiles);
+  int i;
+
+  fwrite(&key_len, sizeof(key_len), 1, fp);
+  fwrite(key, 1, key_len, fp);
+  fwrite(agg, conf.layout.size, 1, fp);
+  for (i = 0; i < conf.distincts.count; i++)
+    hll_save(&distincts[i], fp);
+  for (i = 0; i < conf.percentiles.count; i++)
+    tdigest_save(&percentiles[i], fp);
+}
+
+/* reads the next group from a spill file into AGG.  its key is stored in
+   *KEY, which is grown as needed.  returns 0 at the end of the file. */
+static int spill_read(FILE *fp, char **key, size_t *key_sz,
+                      struct aggregation *agg) {
+  hll_t *distincts = AGG_ARRAY(agg, hll_t, distincts);
+  tdigest_t *percentiles = AGG_ARRAY(agg, tdigest_t, percentiles);
+  u_int32_t key_len;
+  int i, ok;
+
+  if (fread(&key_len, sizeof(key_len), 1, fp) != 1) {
+    spill_check(fp);
+    return 0;
+  }
+  if (*key_sz < key_len + 1) {
+    *key_sz = key_len + 1;
+    *key = xrealloc(*key, *key_sz);
+  }
+  ok = fread(*key, 1, key_len, fp) == key_len &&
+       fread(agg, conf.layout.size, 1, fp) == 1;
+  for (i = 0; i < conf.distincts.count; i++) {
+    if (! ok || hll_load(&distincts[i], fp) != 0) {
+      distincts[i].data = NULL;
+      ok = 0;
+    }
+  }
+  for (i = 0; i < conf.percentiles.count; i++) {
+    if (! ok || tdigest_load(&percentiles[i], fp) != 0) {
+      percentiles[i].centroids = NULL;
+      ok = 0;
+    }
+  }
+  if (! ok) {
+    spill_check(fp);
+    warnx("state or temporary file is truncated");
+    exit(EXIT_FILE_ERR);
+  }
+  (*key)[key_len] = '\0';
+  return 1;
+}
+
+/* a state file, written by --write-state and read by --merge-state, starts
+   with this header.  after it come the delimiter, which the keys stored in
+   the file are joined with, the percentiles reported, the output
+   precision of each sum, average and percentile field, and the output
+   header line, if there is one.  the groups follow, each written just as
+   it is to a spill file, so a state file can only be read on a machine
+   like the one which wrote it. */
+#define AGG_STATE_MAGIC "crushagg"
+#define AGG_STATE_VERSION 2
+
+struct agg_state_header {
+  char magic[8];
+  u_int32_t version;
+  u_int32_t record_size;        /* conf.layout.size */
+  u_int32_t n_keys;
+  u_int32_t n_sums;
+  u_int32_t n_counts;
+  u_int32_t n_averages;
+  u_int32_t n_mins;
+  u_int32_t n_maxs;
+  u_int32_t n_distincts;
+  u_int32_t n_percentiles;
+  u_int32_t n_percents;
+  u_int32_t distinct_precision;
+  u_int32_t header_len;
+  u_int32_t delim_len;
+};
+
+/* writes everything in a state file up to its groups. */
+static void state_write_header(FILE *fp, const char *header,
+                               size_t header_len) {
+  struct agg_state_header h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, AGG_STATE_MAGIC, sizeof(h.magic));
+  h.version = AGG_STATE_VERSION;
+  h.record_size = conf.layout.size;
+  h.n_keys = key_columns();
+  h.n_sums = conf.sums.count;
+  h.n_counts = conf.counts.count;
+  h.n_averages = conf.averages.count;
+  h.n_mins = conf.mins.count;
+  h.n_maxs = conf.maxs.count;
+  h.n_distincts = conf.distincts.count;
+  h.n_percentiles = conf.percentiles.count;
+  h.n_percents = conf.n_percents;
+  h.distinct_precision = conf.distinct_precision;
+  h.header_len = header_len;
+  h.delim_len = strlen(delim);
+
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(delim, 1, h.delim_len, fp);
+  fwrite(conf.percents, sizeof(double), conf.n_percents, fp);
+  if (conf.sums.count)
+    fwrite(conf.sums.precisions, sizeof(int), conf.sums.count, fp);
+  if (conf.averages.count)
+    fwrite(conf.averages.precisions, sizeof(int), conf.averages.count, fp);
+  if (conf.percentiles.count)
+    fwrite(conf.percentiles.precisions, sizeof(int), conf.percentiles.count,
+           fp);
+  if (header_len)
+    fwrite(header, 1, header_len, fp);
+}
+
+/* reads N precisions from a state file, and widens those in PRECISIONS to
+   match. */
+static int state_read_precisions(FILE *fp, int *precisions, int n) {
+  int precision, i;
+
+  for (i = 0; i < n; i++) {
+    if (fread(&precision, sizeof(int), 1, fp) != 1)
+      return -1;
+    if (precisions[i] < precision)
+      precisions[i] = precision;
+  }
+  return 0;
+}
+
+/* reads everything in a state file up to its groups.  the first file sets
+   up conf, and its header line is stored in *HEADER; the others must have
+   been written with the same fields.  the first file's delimiter is used
+   from then on, unless DELIM_GIVEN says the one in delim was asked for
+   explicitly, in which case it must match.  returns 0 on success, -1 if the
+   file is not a state file or is truncated, -2 if it doesn't match, or -3
+   if it was written with a different delimiter. */
+static int state_read_header(FILE *fp, int first, int delim_given,
+                             char **header, size_t *header_len) {
+  struct agg_state_header h;
+  double percent;
+  char *line;
+  int i;
+
+  if (fread(&h, sizeof(h), 1, fp) != 1 ||
+      memcmp(h.magic, AGG_STATE_MAGIC, sizeof(h.magic)) != 0 ||
+      h.version != AGG_STATE_VERSION)
+    return -1;
+
+  line = xmalloc(h.delim_len + 1);
+  if (fread(line, 1, h.delim_len, fp) != h.delim_len) {
+    free(line);
+    return -1;
+  }
+  line[h.delim_len] = '\0';
+  if ((! first || delim_given) && ! str_eq(line, delim)) {
+    free(line);
+    return -3;
+  }
+  if (first)
+    delim = line;
+  else
+    free(line);
+
+  if (first) {
+    conf.keys.count = h.n_keys;
+    conf.sums.count = h.n_sums;
+    conf.counts.count = h.n_counts;
+    conf.averages.count = h.n_averages;
+    conf.mins.count = h.n_mins;
+    conf.maxs.count = h.n_maxs;
+    conf.distincts.count = h.n_distincts;
+    conf.percentiles.count = h.n_percentiles;
+    conf.n_percents = h.n_percents;
+    conf.distinct_precision = h.distinct_precision;
+    conf.sums.precisions = xcalloc(h.n_sums + 1, sizeof(int));
+    conf.averages.precisions = xcalloc(h.n_averages + 1, sizeof(int));
+    conf.percentiles.precisions = xcalloc(h.n_percentiles + 1, sizeof(int));
+    conf.percents = xmalloc(sizeof(double) * (h.n_percents + 1));
+    if (fread(conf.percents, sizeof(double), h.n_percents, fp) !=
+        h.n_percents)
+      return -1;
+    agg_layout_init(&conf.layout, &conf);
+  } else {
+    if (h.n_keys != conf.keys.count || h.n_sums != conf.sums.count ||
+        h.n_counts != conf.counts.count ||
+        h.n_averages != conf.averages.count ||
+        h.n_mins != conf.mins.count || h.n_maxs != conf.maxs.count ||
+        h.n_distincts != conf.distincts.count ||
+        h.n_percentiles != conf.percentiles.count ||
+        h.n_percents != conf.n_percents ||
+        h.distinct_precision != conf.distinct_precision)
+      return -2;
+    for (i = 0; i < conf.n_percents; i++) {
+      if (fread(&percent, sizeof(double), 1, fp) != 1)
+        return -1;
+      if (percent != conf.percents[i])
+        return -2;
+    }
+  }
+  if (h.record_size != conf.layout.size)
+    return -2;
+
+  if (state_read_precisions(fp, conf.sums.precisions, conf.sums.count) != 0 ||
+      state_read_precisions(fp, conf.averages.precisions,
+                            conf.averages.count) != 0 ||
+      state_read_precisions(fp, conf.percentiles.precisions,
+                            conf.percentiles.count) != 0)
+    return -1;
+
+  line = xmalloc(h.header_len + 1);
+  if (fread(line, 1, h.header_len, fp) != h.header_len) {
+    free(line);
+    return -1;
+  }
+  if (first) {
+    *header = line;
+    *header_len = h.header_len;
+  } else {
+    free(line);
+  }
+  return 0;
+}
+
+/* finishes writing a state file. */
+static int state_close(FILE *fp) {
+  if (fp == stdout)
+    return fflush(fp);
+  return fclose(fp);
+}
+
+/* writes every group in a table to the spill file for its key at LEVEL,
+   opening the files as they are needed, and empties the table, leaving it
+   with SIZE slots.  the records themselves are left for the caller to
+   free. */
+static void spill_groups(hashtbl_t *groups, FILE **spills, int level,
+                         size_t size) {
+  size_t i;
+  int s;
+
+  for (i = 0; i < groups->arrsz; i++) {
+    if (! groups->hashes[i])
+      continue;
+    s = spill_part(groups->arr[i].key, level);
+    if (! spills[s])
+      spills[s] = spill_open();
+    spill_write(spills[s], groups->arr[i].key, groups->arr[i].data);
+  }
+  ht_destroy(groups);
+  ht_init(groups, size, NULL, (void (*)) free_agg);
+}
+
+/* a group, with the key it is stored under. */
+struct agg_ranked {
+  char *key;
+  struct aggregation *agg;
+};
+
+/* whether group A belongs above group B in the top groups: it has more
+   lines, or as many and a key which comes first byte by byte. */
+static int ranks_above(const struct agg_ranked *a, const struct agg_ranked *b) {
+  if (AGG_LINES(a->agg) != AGG_LINES(b->agg))
+    return AGG_LINES(a->agg) > AGG_LINES(b->agg);
+  return strcmp(a->key, b->key) < 0;
+}
+
+static int ranked_cmp(const void *a, const void *b) {
+  if (ranks_above(a, b))
+    return -1;
+  return ranks_above(b, a);
+}
+
+/* the conf.top_k best groups out of those offered so far, in a heap with
+   the lowest ranked of them at the root. */
+struct agg_top {
+  struct agg_ranked *heap;
+  size_t n;
+};
+
+static void top_init(struct agg_top *top) {
+  top->heap = xmalloc(sizeof(struct agg_ranked) * conf.top_k);
+  top->n = 0;
+}
+
+/* considers a group for the top groups.  returns the group which doesn't
+   make it, either this one or one which it pushed out, or one with a NULL
+   key if none is left out yet. */
+static struct agg_ranked top_offer(struct agg_top *top, char *key,
+                                   struct aggregation *agg) {
+  struct agg_ranked group = { key, agg }, left_out = { NULL, NULL }, tmp;
+  size_t i, child;
+
+  if (top->n < conf.top_k) {
+    for (i = top->n++; i > 0 &&
+         ranks_above(&top->heap[(i - 1) / 2], &group); i = (i - 1) / 2)
+      top->heap[i] = top->heap[(i - 1) / 2];
+    top->heap[i] = group;
+    return left_out;
+  }
+  if (! ranks_above(&group, &top->heap[0]))
+    return group;
+
+  left_out = top->heap[0];
+  top->heap[0] = group;
+  for (i = 0; (child = 2 * i + 1) < top->n; i = child) {
+    if (child + 1 < top->n &&
+        ranks_above(&top->heap[child], &top->heap[child + 1]))
+      child++;
+    if (! ranks_above(&top->heap[i], &top->heap[child]))
+      break;
+    tmp = top->heap[i];
+    top->heap[i] = top->heap[child];
+    top->heap[child] = tmp;
+  }
+  return left_out;
+}
+
+/* puts the top groups in order, best first. */
+static void top_finish(struct agg_top *top) {
+  qsort(top->heap, top->n, sizeof(struct agg_ranked), ranked_cmp);
+}
+
+/* the groups of a partition while the top groups are being estimated: a
+   heap with the group with the fewest lines at the root, which is
+   replaced by any new group once the heap is full.  the new group takes
+   over its line count, as the most it may have had already (the
+   Space-Saving algorithm). */
+struct agg_summary {
+  struct agg_ranked *heap;
+  size_t n;
+  size_t capacity;
+  size_t n_evicted;       /* groups replaced so far */
+  size_t dead_key_bytes;  /* their keys, still in the table's key pool */
+};
+
+static void summary_place(struct agg_summary *summary, size_t i,
+                          struct agg_ranked group) {
+  summary->heap[i] = group;
+  AGG_HEAP_POS(group.agg) = i;
+}
+
+/* moves the group at I towards the root while it has fewer lines than its
+   parent. */
+static void summary_up(struct agg_summary *summary, size_t i) {
+  struct agg_ranked group = summary->heap[i];
+
+  for (; i > 0 && AGG_LINES(summary->heap[(i - 1) / 2].agg) >
+                  AGG_LINES(group.agg); i = (i - 1) / 2)
+    summary_place(summary, i, summary->heap[(i - 1) / 2]);
+  summary_place(summary, i, group);
+}
+
+/* moves the group at I away from the root while it has more lines than
+   either child, as it may after a line has been added to it. */
+static void summary_down(struct agg_summary *summary, size_t i) {
+  struct agg_ranked group = summary->heap[i];
+  size_t child;
+
+  while ((child = 2 * i + 1) < summary->n) {
+    if (child + 1 < summary->n &&
+        AGG_LINES(summary->heap[child + 1].agg) <
+        AGG_LINES(summary->heap[child].agg))
+      child++;
+    if (AGG_LINES(summary->heap[child].agg) >= AGG_LINES(group.agg))
+      break;
+    summary_place(summary, i, summary->heap[child]);
+    i = child;
+  }
+  summary_place(summary, i, group);
+}
+
+/* the key of the table element whose data is at SLOT. */
+static char * slot_key(void **slot) {
+  return ((ht_elem_t *) ((char *) slot - offsetof(ht_elem_t, data)))->key;
+}
+
+/* moves a partition's groups to a new table, leaving behind the keys of
+   groups which have been replaced. */
+static void summary_compact(struct agg_summary *summary, hashtbl_t *part) {
+  hashtbl_t fresh;
+  void **slot;
+  size_t i;
+
+  ht_init(&fresh, part->arrsz, NULL, (void (*)) free_agg);
+  for (i = 0; i < summary->n; i++) {
+    slot = ht_upsert(&fresh, summary->heap[i].key, NULL);
+    *slot = summary->heap[i].agg;
+    summary->heap[i].key = slot_key(slot);
+  }
+  part->free = NULL;
+  ht_destroy(part);
+  *part = fresh;
+  summary->dead_key_bytes = 0;
+}
+
+static void init_agg(struct aggregation *agg);
+
+/* gives the group just added to a partition at SLOT a record: a new one,
+   or that of the group with the fewest lines, which is removed. */
+static struct aggregation * summary_add(struct agg_summary *summary,
+                                        hashtbl_t *part, void **slot,
+                                        mempool_t *records) {
+  char *key = slot_key(slot);
+  struct aggregation *agg;
+  u_int64_t lines;
+
+  if (summary->n < summary->capacity) {
+    agg = *slot = alloc_agg(records);
+    summary->heap[summary->n].key = key;
+    summary->heap[summary->n].agg = agg;
+    summary_up(summary, summary->n++);
+    return agg;
+  }
+
+  agg = summary->heap[0].agg;
+  lines = AGG_LINES(agg);
+  summary->dead_key_bytes += strlen(summary->heap[0].key) + 1;
+  summary->n_evicted++;
+  ht_delete(part, summary->heap[0].key);
+  init_agg(agg);
+  AGG_LINES(agg) = AGG_OVERCOUNT(agg) = lines;
+  *ht_upsert(part, key, NULL) = agg;
+  summary->heap[0].key = key;
+  if (summary->dead_key_bytes > mempool_used(part->key_pool) / 2)
+    summary_compact(summary, part);
+  return agg;
+}
+
+/* with --watermark, a group which has a window of time, and can be
+   printed once the window closes. */
+struct agg_open {
+  long long end;          /* the end of its window */
+  char *key;
+  struct aggregation *agg;
+};
+
+/* with --watermark, the groups whose windows have not closed yet, in a
+   heap with the earliest end at the root, and the records of groups which
+   have been printed, to be used again. */
+struct agg_stream {
+  struct agg_open *heap;
+  size_t n, sz;
+  struct aggregation **spare;
+  size_t n_spare, spare_sz;
+  long long watermark;    /* the latest time seen, less the lateness */
+  int started;            /* whether a time has been seen yet */
+  long long line_time;    /* the current line's time, if it has one */
+  long long line_end;     /* and the end of its window */
+  int line_has_time;
+  size_t dead_key_bytes;  /* keys of printed groups, still in the table's
+                             key pool */
+  size_t n_late;          /* lines which arrived after their window had
+                             been printed */
+  int sort;
+};
+
+/* one worker's share of the aggregation: its groups, divided among
+   partitions by key hash so that each partition can be merged with the
+   same partition of the other workers on its own, and the output
+   precision of the sum and average fields in the lines it has seen. */
+struct agg_worker {
+  hashtbl_t *parts;
+  int n_parts;
+  mempool_t *records;           /* the records of the groups in parts */
+  size_t sketches_size;         /* memory held by their distinct sketches */
+  int *sum_precisions;
+  int *average_precisions;
+  int *percentile_precisions;
+  linesplit_t split;            /* fields of the current line */
+  size_t budget;                /* memory for all of the workers' groups,
+                                   or 0 for no limit */
+  size_t *used;                 /* the memory they're known to take */
+  size_t reported;              /* this worker's part of *used */
+  size_t empty_size;            /* worker_size() when it has no groups */
+  size_t n_new;                 /* groups added since memory was checked */
+  size_t check_interval;        /* how many of them to allow */
+  FILE *spills[AGG_SPILL_PARTS];  /* groups which didn't fit in memory */
+  size_t n_spilled;             /* the number of groups written to spills */
+  struct agg_summary *summaries;  /* for each partition, when the top
+                                     groups are being estimated */
+  struct aggregation **values;  /* the current line's group in each
+                                   grouping set */
+  char *key_buf;                /* a line's key, when it is built up */
+  size_t key_buf_sz;
+  struct agg_stream *stream;    /* with --watermark */
+};
+
+/* all of the workers.  there is a partition for each worker. */
+struct agg_pool {
+  struct agg_worker *workers;
+  int n_workers;
+  int n_claimed;                /* workers taken by threads in this run */
+  size_t used;                  /* memory taken by the workers' groups */
+};
+
+/* the number of new groups to allow between checks of memory use against
+   BUDGET, or 0 for no limit: few enough that their records take up only a small part of it,
+   so a small budget isn't overrun by far. */
+static size_t spill_interval(size_t budget) {
+  size_t n = budget / 16 / conf.layout.size;
+
+  if (budget == 0)
+    return AGG_SPILL_CHECK_INTERVAL;
+  if (n < 1)
+    return 1;
+  if (n > AGG_SPILL_CHECK_INTERVAL)
+    return AGG_SPILL_CHECK_INTERVAL;
+  return n;
+}
+
+/* the initial number of slots in each of a worker's N_PARTS partitions.
+   with many threads there are a great many partitions, so together they
+   start out no bigger than a single table. */
+static size_t part_table_size(int n_parts) {
+  if (n_parts >= AGG_TABLE_SZ)
+    return 1;
+  return AGG_TABLE_SZ / n_parts;
+}
+
+static size_t worker_size(const struct agg_worker *worker);
+
+static void agg_pool_init(struct agg_pool *pool, int n_workers) {
+  struct agg_worker *worker;
+  int i, j;
+
+  pool->workers = xmalloc(sizeof(struct agg_worker) * n_workers);
+  pool->n_workers = n_workers;
+  pool->n_claimed = 0;
+  pool->used = 0;
+  for (i = 0; i < n_workers; i++) {
+    worker = &pool->workers[i];
+    worker->parts = xmalloc(sizeof(hashtbl_t) * n_workers);
+    worker->n_parts = n_workers;
+    for (j = 0; j < n_workers; j++)
+      ht_init(&worker->parts[j], part_table_size(n_workers), NULL,
+              (void (*)) free_agg);
+    worker->records = mempool_create(4096);
+    worker->sketches_size = 0;
+    worker->sum_precisions = xcalloc(conf.sums.count + 1, sizeof(int));
+    worker->average_precisions = xcalloc(conf.averages.count + 1,
+                                         sizeof(int));
+    worker->percentile_precisions = xcalloc(conf.percentiles.count + 1,
+                                            sizeof(int));
+    linesplit_init(&worker->split, 0);
+    worker->budget = max_memory;
+    worker->used = &pool->used;
+    worker->reported = 0;
+    worker->n_new = 0;
+    memset(worker->spills, 0, sizeof(worker->spills));
+    worker->n_spilled = 0;
+    worker->values = xmalloc(sizeof(struct aggregation *) *
+                             (conf.n_grouping_sets + 1));
+    worker->key_buf = NULL;
+    worker->key_buf_sz = 0;
+    worker->stream = NULL;
+    worker->summaries = NULL;
+    if (conf.top_k_groups) {
+      /* the groups are held in fixed memory instead. */
+      worker->budget = 0;
+      worker->summaries = xmalloc(sizeof(struct agg_summary) * n_workers);
+      for (j = 0; j < n_workers; j++) {
+        worker->summaries[j].capacity =
+            (conf.top_k_groups + n_workers - 1) / n_workers;
+        worker->summaries[j].heap = xmalloc(
+            sizeof(struct agg_ranked) * worker->summaries[j].capacity);
+        worker->summaries[j].n = 0;
+        worker->summaries[j].n_evicted = 0;
+        worker->summaries[j].dead_key_bytes = 0;
+      }
+    }
+    /* the workers share the budget, but any one of them may have most of
+       the groups. */
+    worker->check_interval = spill_interval(worker->budget / n_workers);
+    worker->empty_size = worker_size(worker);
+  }
+}
+
+/* writes out all of a worker's groups to its spill files. */
+static void spill_worker(struct agg_worker *worker) {
+  int p;
+
+  for (p = 0; p < worker->n_parts; p++) {
+    worker->n_spilled += worker->parts[p].nelems;
+    spill_groups(&worker->parts[p], worker->spills, 0,
+                 part_table_size(worker->n_parts));
+  }
+  mempool_destroy(worker->records);
+  worker->records = mempool_create(4096);
+  worker->sketches_size = 0;
+}
+
+/* roughly the memory taken by a worker's groups, and by its tables and
+   pools while they're empty. */
+static size_t worker_size(const struct agg_worker *worker) {
+  size_t size = mempool_size(worker->records) + worker->sketches_size;
+  int p;
+
+  for (p = 0; p < worker->n_parts; p++)
+    size += groups_size(&worker->parts[p]);
+  return size;
+}
+
+/* brings the memory the workers are known to use up to date with this
+   one's groups, leaving out what its tables take while they're empty, and
+   spills its groups if that's more than the budget. */
+static void check_budget(struct agg_worker *worker) {
+  size_t size = worker_size(worker) - worker->empty_size;
+
+  if (__sync_add_and_fetch(worker->used, size - worker->reported) <=
+      worker->budget) {
+    worker->reported = size;
+    return;
+  }
+  spill_worker(worker);
+  __sync_fetch_and_sub(worker->used, size);
+  worker->reported = 0;
+}
+
+/* every thread of a parchunk_run() takes a worker of its own. */
+static void * agg_thread_init(void *arg) {
+  struct agg_pool *pool = arg;
+  return &pool->workers[__sync_fetch_and_add(&pool->n_claimed, 1)];
+}
+
+/* adds the fields of a line to the aggregations of N groups: the line's
+   group in each grouping set.  each field is converted only once. */
+static void update_agg(struct agg_worker *worker, const linesplit_t *split,
+                       struct aggregation **values, int n) {
+  struct aggregation *value;
+  unsigned char *precisions;
+  double *mins, *maxs;
+  hll_t *distinct;
+  tdigest_t *percentile;
+  numparse_t num;
+  u_int64_t hash;
+  size_t sketch_size;
+  int i, g;
+
+  for (g = 0; conf.top_k && g < n; g++)
+    AGG_LINES(values[g]) += 1;
+
+  /* sums */
+  for (i = 0; i < conf.sums.count; i++) {
+    if (field_number(split, conf.sums.indexes[i], &num) >= 0) {
+      if (worker->sum_precisions[i] < num.precision)
+        worker->sum_precisions[i] = num.precision;
+      for (g = 0; g < n; g++)
+        AGG_ARRAY(values[g], double, sums)[i] += num.value;
+    }
+  }
+
+  /* averages */
+  for (i = 0; i < conf.averages.count; i++) {
+    if (field_number(split, conf.averages.indexes[i], &num) >= 0) {
+      if (worker->average_precisions[i] < num.precision)
+        worker->average_precisions[i] = num.precision;
+      for (g = 0; g < n; g++) {
+        AGG_ARRAY(values[g], double, average_sums)[i] += num.value;
+        AGG_ARRAY(values[g], u_int32_t, average_counts)[i] += 1;
+      }
+    }
+  }
+
+  /* counts */
+  for (i = 0; i < conf.counts.count; i++) {
+    if (conf.counts.indexes[i] < split->n_fields &&
+        linesplit_field_len(split, conf.counts.indexes[i]) > 0) {
+      for (g = 0; g < n; g++)
+        AGG_ARRAY(values[g], u_int32_t, counts)[i] += 1;
+    }
+  }
+
+  /* mins and maxs keep the precision of the value they came from, and the
+     widest one where equal values are written differently, so that the
+     result doesn't depend on the order of the input. */
+  for (i = 0; i < conf.mins.count; i++) {
+    if (field_number(split, conf.mins.indexes[i], &num) > 0) {
+      if (num.precision > AGG_MAX_PRECISION)
+        num.precision = AGG_MAX_PRECISION;
+      for (g = 0; g < n; g++) {
+        value = values[g];
+        mins = AGG_ARRAY(value, double, mins);
+        precisions = AGG_ARRAY(value, unsigned char, min_precisions);
+        if (! AGG_FLAG(value, i) || num.value < mins[i] ||
+            (num.value == mins[i] && num.precision > precisions[i])) {
+          mins[i] = num.value;
+          precisions[i] = num.precision;
+        }
+        AGG_SET_FLAG(value, i);
+      }
+    }
+  }
+
+  for (i = 0; i < conf.maxs.count; i++) {
+    if (field_number(split, conf.maxs.indexes[i], &num) > 0) {
+      if (num.precision > AGG_MAX_PRECISION)
+        num.precision = AGG_MAX_PRECISION;
+      for (g = 0; g < n; g++) {
+        value = values[g];
+        maxs = AGG_ARRAY(value, double, maxs);
+        precisions = AGG_ARRAY(value, unsigned char, max_precisions);
+        if (! AGG_FLAG(value, conf.mins.count + i) || num.value > maxs[i] ||
+            (num.value == maxs[i] && num.precision > precisions[i])) {
+          maxs[i] = num.value;
+          precisions[i] = num.precision;
+        }
+        AGG_SET_FLAG(value, conf.mins.count + i);
+      }
+    }
+  }
+
+  for (i = 0; i < conf.distincts.count; i++) {
+    if (conf.distincts.indexes[i] < split->n_fields &&
+        linesplit_field_len(split, conf.distincts.indexes[i]) > 0) {
+      hash = hll_hash(linesplit_field_ptr(split, conf.distincts.indexes[i]),
+                      linesplit_field_len(split, conf.distincts.indexes[i]));
+      for (g = 0; g < n; g++) {
+        distinct = &AGG_ARRAY(values[g], hll_t, distincts)[i];
+        sketch_size = hll_size(distinct);
+        hll_add_hash(distinct, hash);
+        worker->sketches_size += hll_size(distinct) - sketch_size;
+      }
+    }
+  }
+
+  for (i = 0; i < conf.percentiles.count; i++) {
+    if (field_number(split, conf.percentiles.indexes[i], &num) > 0) {
+      if (worker->percentile_precisions[i] < num.precision)
+        worker->percentile_precisions[i] = num.precision;
+      for (g = 0; g < n; g++) {
+        percentile = &AGG_ARRAY(values[g], tdigest_t, percentiles)[i];
+        sketch_size = tdigest_size(percentile);
+        tdigest_add(percentile, num.value);
+        worker->sketches_size += tdigest_size(percentile) - sketch_size;
+      }
+    }
+  }
+}
+
+/* makes sure the worker's key buffer has room for LEN bytes of key and
+   MORE after them. */
+static void key_buf_reserve(struct agg_worker *worker, size_t len,
+                            size_t more) {
+  if (worker->key_buf_sz < len + more) {
+    worker->key_buf_sz = (len + more) * 2;
+    worker->key_buf = xrealloc(worker->key_buf, worker->key_buf_sz);
+  }
+}
+
+/* builds the key of a line's group in grouping set G in the worker's key
+   buffer: the set's marker if there are grouping sets, and then each key
+   field, left empty if it is not in the set, or as the start of its bucket
+   of time if it has one.  returns the length of the key. */
+static size_t grouping_key(struct agg_worker *worker,
+                           const linesplit_t *split, int g) {
+  unsigned int omitted = conf.n_grouping_sets ? conf.grouping_sets[g] : 0;
+  size_t delim_len = strlen(delim), field_len, len = 0;
+  timestamp_format_t format;
+  long long seconds;
+  const char *text;
+  int i, field;
+
+  if (worker->stream)
+    worker->stream->line_has_time = 0;
+  if (conf.n_grouping_sets) {
+    key_buf_reserve(worker, 0, 16);
+    len = sprintf(worker->key_buf, "%u", omitted);
+  }
+  for (i = 0; i < conf.keys.count; i++) {
+    field = conf.keys.indexes[i];
+    field_len = 0;
+    if (! (omitted & 1U << (conf.keys.count - 1 - i)) &&
+        field < split->n_fields)
+      field_len = linesplit_field_len(split, field);
+    key_buf_reserve(worker, len,
+                    delim_len + field_len + TIMESTAMP_MAX_LEN + 1);
+    if (conf.n_grouping_sets || i) {
+      memcpy(worker->key_buf + len, delim, delim_len);
+      len += delim_len;
+    }
+    if (field_len == 0)
+      continue;
+
+    text = linesplit_field_ptr(split, field);
+    if (conf.buckets && conf.buckets[i] &&
+        timestamp_parse(text, field_len, &seconds, &format) == 0 &&
+        (field_len = timestamp_format(
+             worker->key_buf + len,
+             timestamp_floor(seconds, conf.buckets[i]), &format))) {
+      len += field_len;
+      if (worker->stream && i == conf.window_key) {
+        worker->stream->line_time = seconds;
+        worker->stream->line_end = timestamp_floor(seconds, conf.buckets[i]) +
+                                   conf.buckets[i];
+        worker->stream->line_has_time = 1;
+      }
+      continue;
+    }
+    memcpy(worker->key_buf + len, text, field_len);
+    len += field_len;
+  }
+  return len;
+}
+
+/* a record for a new group whose entry in a table is at SLOT, which is
+   put in the heap of open groups if the current line has a time. */
+static struct aggregation * stream_add(struct agg_worker *worker,
+                                       void **slot) {
+  struct agg_stream *stream = worker->stream;
+  struct agg_open group;
+  size_t i;
+
+  if (stream->n_spare) {
+    group.agg = stream->spare[--stream->n_spare];
+    init_agg(group.agg);
+  } else {
+    group.agg = alloc_agg(worker->records);
+  }
+  if (! stream->line_has_time)
+    return group.agg;
+
+  group.end = stream->line_end;
+  group.key = slot_key(slot);
+  if (stream->n == stream->sz) {
+    stream->sz = stream->sz ? stream->sz * 2 : 1024;
+    stream->heap = xrealloc(stream->heap, sizeof(struct agg_open) * stream->sz);
+  }
+  for (i = stream->n++; i > 0 && stream->heap[(i - 1) / 2].end > group.end;
+       i = (i - 1) / 2)
+    stream->heap[i] = stream->heap[(i - 1) / 2];
+  stream->heap[i] = group;
+  return group.agg;
+}
+
+/* takes the group at the root of the heap of open groups off it. */
+static struct agg_open stream_pop(struct agg_stream *stream) {
+  struct agg_open root = stream->heap[0], last = stream->heap[--stream->n];
+  size_t i, child;
+
+  for (i = 0; (child = 2 * i + 1) < stream->n; i = child) {
+    if (child + 1 < stream->n &&
+        stream->heap[child + 1].end < stream->heap[child].end)
+      child++;
+    if (stream->heap[child].end >= last.end)
+      break;
+    stream->heap[i] = stream->heap[child];
+  }
+  if (stream->n)
+    stream->heap[i] = last;
+  return root;
+}
+
+/* moves a table's groups to a new table, leaving behind the keys of the
+   groups which have been printed. */
+static void stream_compact(struct agg_stream *stream, hashtbl_t *part) {
+  hashtbl_t fresh;
+  void **slot;
+  size_t i;
+
+  ht_init(&fresh, part->nelems * 2 + 1024, NULL, (void (*)) free_agg);
+  for (i = 0; i < stream->n; i++) {
+    slot = ht_upsert(&fresh, stream->heap[i].key, NULL);
+    *slot = stream->heap[i].agg;
+    stream->heap[i].key = slot_key(slot);
+  }
+  /* and the groups which have no window. */
+  for (i = 0; i < part->arrsz; i++) {
+    if (part->hashes[i] &&
+        ! *(slot = ht_upsert(&fresh, part->arr[i].key, NULL)))
+      *slot = part->arr[i].data;
+  }
+  part->free = NULL;
+  ht_destroy(part);
+  *part = fresh;
+  stream->dead_key_bytes = 0;
+}
+
+/* brings the output precisions up to date with those of a worker's lines. */
+static void combine_precisions(const struct agg_worker *worker) {
+  int i;
+
+  for (i = 0; i < conf.sums.count; i++) {
+    if (conf.sums.precisions[i] < worker->sum_precisions[i])
+      conf.sums.precisions[i] = worker->sum_precisions[i];
+  }
+  for (i = 0; i < conf.averages.count; i++) {
+    if (conf.averages.precisions[i] < worker->average_precisions[i])
+      conf.averages.precisions[i] = worker->average_precisions[i];
+  }
+  for (i = 0; i < conf.percentiles.count; i++) {
+    if (conf.percentiles.precisions[i] < worker->percentile_precisions[i])
+      conf.percentiles.precisions[i] = worker->percentile_precisions[i];
+  }
+}
+
+/* moves the watermark up to the current line's time, and prints and
+   forgets the groups whose windows it has passed. */
+static void stream_advance(struct agg_worker *worker, bufout_t *chunk_out) {
+  struct agg_stream *stream = worker->stream;
+  hashtbl_t *part = &worker->parts[0];
+  struct agg_open group;
+  char **keys;
+  size_t n_keys, i;
+
+  if (! stream->line_has_time ||
+      (stream->started &&
+       stream->line_time - conf.lateness <= stream->watermark))
+    return;
+  stream->watermark = stream->line_time - conf.lateness;
+  stream->started = 1;
+  if (! stream->n || stream->heap[0].end > stream->watermark)
+    return;
+
+  combine_precisions(worker);
+  keys = xmalloc(sizeof(char *) * stream->n);
+  for (n_keys = 0; stream->n && stream->heap[0].end <= stream->watermark; ) {
+    group = stream_pop(stream);
+    keys[n_keys++] = group.key;
+  }
+  if (stream->sort)
+    collate_sort(keys, n_keys, delim);
+
+  for (i = 0; i < n_keys; i++) {
+    group.agg = ht_get(part, keys[i]);
+    print_keys_and_agg_vals(chunk_out, keys[i], group.agg);
+    if (stream->n_spare == stream->spare_sz) {
+      stream->spare_sz = stream->spare_sz ? stream->spare_sz * 2 : 1024;
+      stream->spare = xrealloc(stream->spare, sizeof(struct aggregation *) *
+                                              stream->spare_sz);
+    }
+    stream->spare[stream->n_spare++] = group.agg;
+    stream->dead_key_bytes += strlen(keys[i]) + 1;
+    ht_delete(part, keys[i]);
+  }
+  free(keys);
+  bufout_flush(chunk_out);
+  if (stream->dead_key_bytes > mempool_used(part->key_pool) / 2)
+    stream_compact(stream, part);
+}
+
+/* the record of the group whose entry in partition P is at SLOT, which is
+   made if the group is new. */
+static struct aggregation * group_record(struct agg_worker *worker, int p,
+                                         void **slot) {
+  if (*slot)
+    return *slot;
+  if (worker->summaries)
+    return summary_add(&worker->summaries[p], &worker->parts[p], slot,
+                       worker->records);
+  worker->n_new++;
+  if (worker->stream)
+    return *slot = stream_add(worker, slot);
+  return *slot = alloc_agg(worker->records);
+}
+
+/* aggregates every line of a chunk into the worker's partitions. */
+static int aggregate_chunk(void *state, const char *data, size_t len,
+                           size_t line_no, bufout_t *chunk_out) {
+  struct agg_worker *worker = state;
+  linesplit_t *split = &worker->split;
+  const char *end = data + len;
+  size_t line_len, key_len;
+  void **slot;
+  int n_groups = conf.n_grouping_sets ? conf.n_grouping_sets : 1;
+  int p = 0, g, n;
+
+  for (; data < end; data += line_len) {
+    line_len = parchunk_line_len(data, end);
+    linesplit_n(split, data, line_body_len(data, line_len), delim);
+
+    /* find the line's group in each grouping set first, so that the fields
+       are converted only once for all of them.  a group being estimated
+       is updated right away, so that it can't be replaced by the next. */
+    for (n = 0, g = 0; g < n_groups; g++) {
+      if (conf.n_grouping_sets || conf.buckets) {
+        key_len = grouping_key(worker, split, g);
+        if (worker->stream && worker->stream->line_has_time &&
+            worker->stream->started &&
+            worker->stream->line_end <= worker->stream->watermark) {
+          /* its window has been printed already. */
+          worker->stream->n_late++;
+          continue;
+        }
+        if (worker->n_parts > 1)
+          p = key_mix(key_hash_update(2166136261U, worker->key_buf, key_len),
+                      0) % worker->n_parts;
+        slot = ht_upsert_n(&worker->parts[p], worker->key_buf, key_len,
+                           NULL);
+      } else {
+        if (worker->n_parts > 1)
+          p = key_mix(key_hash_fields(split), 0) % worker->n_parts;
+        slot = ht_upsert_fields(&worker->parts[p], split, conf.keys.indexes,
+                                conf.keys.count, delim, NULL);
+      }
+      if (!slot) {
+        warnx("failed to store value in hashtable.");
+        continue;
+      }
+      worker->values[n] = group_record(worker, p, slot);
+      if (worker->summaries) {
+        update_agg(worker, split, &worker->values[n], 1);
+        summary_down(&worker->summaries[p], AGG_HEAP_POS(worker->values[n]));
+      } else {
+        n++;
+      }
+    }
+    update_agg(worker, split, worker->values, n);
+    if (worker->stream)
+      stream_advance(worker, chunk_out);
+
+    if (worker->n_new >= worker->check_interval) {
+      worker->n_new = 0;
+      if (worker->budget)
+        check_budget(worker);
+    }
+  }
+  return 0;
+}
+
+/* adds to a group's line count, as lines it may have had. */
+static void add_overcount(struct aggregation *agg, u_int64_t n) {
+  AGG_LINES(agg) += n;
+  AGG_OVERCOUNT(agg) += n;
+}
+
+/* merges partition P of every worker into that of the first worker.  the
+   records stay in the pools they were allocated from, but anything they
+   hold which has been merged is freed.
+
+   when the top groups are being estimated, a group which one worker
+   doesn't have may still have had as many lines there as that worker's
+   group with the fewest, if the worker has had to replace any groups.
+   each group is given those lines up front, and they are taken away again
+   for each worker it turns out to have been found by. */
+static void merge_partition(void *arg, size_t p) {
+  struct agg_pool *pool = arg;
+  hashtbl_t *into = &pool->workers[0].parts[p], *from;
+  struct agg_summary *summary;
+  u_int64_t floors[PARCHUNK_MAX_THREADS], total_floor = 0;
+  void **slot;
+  size_t i;
+  int w;
+
+  for (w = 0; conf.top_k_groups && w < pool->n_workers; w++) {
+    summary = &pool->workers[w].summaries[p];
+    floors[w] = summary->n_evicted ? AGG_LINES(summary->heap[0].agg) : 0;
+    total_floor += floors[w];
+  }
+  for (i = 0; total_floor && i < into->arrsz; i++) {
+    if (into->hashes[i])
+      add_overcount(into->arr[i].data, total_floor - floors[0]);
+  }
+
+  for (w = 1; w < pool->n_workers; w++) {
+    from = &pool->workers[w].parts[p];
+    for (i = 0; i < from->arrsz; i++) {
+      if (! from->hashes[i])
+        continue;
+      slot = ht_upsert(into, from->arr[i].key, NULL);
+      if (*slot) {
+        merge_agg(*slot, from->arr[i].data);
+        if (total_floor) {
+          AGG_LINES(*slot) -= floors[w];
+          AGG_OVERCOUNT(*slot) -= floors[w];
+        }
+      } else {
+        *slot = from->arr[i].data;
+        from->arr[i].data = NULL;
+        if (total_floor)
+          add_overcount(*slot, total_floor - floors[w]);
+      }
+    }
+    ht_destroy(from);
+  }
+}
+
+/* prints the merged partitions of the first worker.  returns the number
+   of groups printed. */
+static size_t print_merged(struct agg_pool *pool, int sort) {
+  hashtbl_t *aggregations = pool->workers[0].parts;
+  struct aggregation *value;
+  char **key_array;
+  size_t n_hash_elems = 0, i;
+  struct agg_top top;
+  int w;
+
+  for (w = 0; w < pool->n_workers; w++)
+    n_hash_elems += aggregations[w].nelems;
+
+  if (conf.top_k) {
+    top_init(&top);
+    for (w = 0; w < pool->n_workers; w++) {
+      for (i = 0; i < aggregations[w].arrsz; i++) {
+        if (aggregations[w].hashes[i])
+          top_offer(&top, aggregations[w].arr[i].key,
+                    aggregations[w].arr[i].data);
+      }
+    }
+    top_finish(&top);
+    for (i = 0; i < top.n; i++)
+      print_keys_and_agg_vals(out, top.heap[i].key, top.heap[i].agg);
+    free(top.heap);
+    return n_hash_elems;
+  }
+
+  key_array = xmalloc(sizeof(char *) * (n_hash_elems + 1));
+  for (i = 0, w = 0; w < pool->n_workers; w++)
+    i += ht_keys(&aggregations[w], key_array + i);
+
+  if (sort) {
+    collate_sort(key_array, n_hash_elems, delim);
+  }
+
+  for (i = 0; i < n_hash_elems; i++) {
+    value = (struct aggregation *) ht_get(
+        &aggregations[key_mix(key_hash_str(key_array[i]), 0) %
+                      pool->n_workers],
+        key_array[i]);
+    print_keys_and_agg_vals(out, key_array[i], value);
+  }
+  free(key_array);
+  return n_hash_elems;
+}
+
+/* output lines from the groups of one spill partition, in one or more
+   temporary files which are each sorted if the output is to be. */
+struct agg_runs {
+  FILE **files;
+  size_t n_files;
+  size_t files_sz;
+  size_t n_groups;
+};
+
+/* the state shared by the tasks which aggregate the spill files. */
+struct agg_reduce {
+  struct agg_pool *pool;
+  struct agg_runs *runs;        /* the output of each spill partition */
+  size_t budget;                /* memory for each task's groups */
+  int sort;
+};
+
+/* prints a table of groups to a new run.  with --top-k, only the groups
+   which might be among the top ones are kept, written as they are in
+   spill files, and with --write-state all of them are written that way. */
+static void write_run(hashtbl_t *groups, int sort, struct agg_runs *runs) {
+  char **keys;
+  size_t n, i;
+  bufout_t *run_out;
+  struct agg_top top;
+  FILE *fp;
+
+  if (groups->nelems == 0)
+    return;
+  fp = spill_open();
+  if (conf.top_k) {
+    top_init(&top);
+    for (i = 0; i < groups->arrsz; i++) {
+      if (groups->hashes[i])
+        top_offer(&top, groups->arr[i].key, groups->arr[i].data);
+    }
+    for (i = 0; i < top.n; i++)
+      spill_write(fp, top.heap[i].key, top.heap[i].agg);
+    spill_check(fp);
+    n = groups->nelems;
+    free(top.heap);
+  } else if (state_out) {
+    for (i = 0; i < groups->arrsz; i++) {
+      if (groups->hashes[i])
+        spill_write(fp, groups->arr[i].key, groups->arr[i].data);
+    }
+    spill_check(fp);
+    n = groups->nelems;
+  } else {
+    keys = xmalloc(sizeof(char *) * groups->nelems);
+    n = ht_keys(groups, keys);
+    if (sort)
+      collate_sort(keys, n, delim);
+
+    run_out = bufout_init(fp);
+    for (i = 0; i < n; i++)
+      print_keys_and_agg_vals(run_out, keys[i], ht_get(groups, keys[i]));
+    if (bufout_close(run_out) != 0) {
+      warn("temporary file");
+      exit(EXIT_FILE_ERR);
+    }
+    free(keys);
+  }
+
+  if (runs->n_files == runs->files_sz) {
+    runs->files_sz = runs->files_sz ? runs->files_sz * 2 : 4;
+    runs->files = xrealloc(runs->files, sizeof(FILE *) * runs->files_sz);
+  }
+  runs->files[runs->n_files++] = fp;
+  runs->n_groups += n;
+}
+
+/* aggregates the groups in some spill files, which have already been split
+   up LEVEL times and are each positioned at their first group, and prints
+   them to a new run.  if they don't fit in the
+   budget they are split up once more, and each part is done in turn. */
+static void reduce_spills(FILE **spills, size_t n_spills, int level,
+                          const struct agg_reduce *reduce,
+                          struct agg_runs *runs) {
+  hashtbl_t groups;
+  mempool_t *records = mempool_create(4096);
+  size_t sketches_size = 0;
+  FILE *parts[AGG_SPILL_PARTS];
+  struct aggregation *agg = xmalloc(conf.layout.size);
+  char *key = NULL;
+  size_t key_sz = 0, n_new = 0, i;
+  size_t check_interval = spill_interval(reduce->budget);
+  int split = 0, s;
+  void **slot;
+
+  ht_init(&groups, AGG_TABLE_SZ, NULL, (void (*)) free_agg);
+  memset(parts, 0, sizeof(parts));
+  for (i = 0; i < n_spills; i++) {
+    while (spill_read(spills[i], &key, &key_sz, agg)) {
+      if (split) {
+        s = spill_part(key, level);
+        if (! parts[s])
+          parts[s] = spill_open();
+        spill_write(parts[s], key, agg);
+        free_agg(agg);
+        continue;
+      }
+
+      slot = ht_upsert(&groups, key, NULL);
+      if (*slot) {
+        sketches_size -= agg_sketches_size(*slot);
+        merge_agg(*slot, agg);
+        sketches_size += agg_sketches_size(*slot);
+        free_agg(agg);
+        continue;
+      }
+      /* the copy takes over the sketches of the one read. */
+      *slot = memcpy(alloc_agg(records), agg, conf.layout.size);
+      sketches_size += agg_sketches_size(*slot);
+      if (++n_new % check_interval == 0 &&
+          level < AGG_SPILL_MAX_LEVEL &&
+          groups_size(&groups) + mempool_size(records) + sketches_size >
+          reduce->budget) {
+        spill_groups(&groups, parts, level, AGG_TABLE_SZ);
+        split = 1;
+      }
+    }
+    fclose(spills[i]);
+  }
+  free(key);
+  free(agg);
+
+  if (split) {
+    for (s = 0; s < AGG_SPILL_PARTS; s++) {
+      if (parts[s]) {
+        spill_check(parts[s]);
+        rewind(parts[s]);
+        reduce_spills(&parts[s], 1, level + 1, reduce, runs);
+      }
+    }
+  } else {
+    write_run(&groups, reduce->sort, runs);
+  }
+  ht_destroy(&groups);
+  mempool_destroy(records);
+}
+
+/* aggregates spill partition S of every worker. */
+static void reduce_partition(void *arg, size_t s) {
+  const struct agg_reduce *reduce = arg;
+  FILE *spills[PARCHUNK_MAX_THREADS];
+  size_t n_spills = 0;
+  int w;
+
+  for (w = 0; w < reduce->pool->n_workers; w++) {
+    if (reduce->pool->workers[w].spills[s]) {
+      spill_check(reduce->pool->workers[w].spills[s]);
+      rewind(reduce->pool->workers[w].spills[s]);
+      spills[n_spills++] = reduce->pool->workers[w].spills[s];
+    }
+  }
+  reduce_spills(spills, n_spills, 1, reduce, &reduce->runs[s]);
+}
 
-#include "aggregate_main.h"
-#include "aggregate.h"
+static void spill_pool_worker(void *arg, size_t w) {
+  struct agg_pool *pool = arg;
+  spill_worker(&pool->workers[w]);
+}
 
-#define AGG_TMP_BUF_SIZE 64
+/* a run being merged, and the sort key of its current line. */
+struct agg_run_head {
+  dbfr_t *reader;
+  collate_key_t key;
+};
+
+/* restores the heap order of runs by their current lines, from I down. */
+static void run_heap_down(struct agg_run_head **heap, size_t n, size_t i) {
+  struct agg_run_head *tmp;
+  size_t child;
+
+  while ((child = 2 * i + 1) < n) {
+    if (child + 1 < n &&
+        collate_key_cmp(&heap[child + 1]->key, &heap[child]->key) < 0)
+      child++;
+    if (collate_key_cmp(&heap[child]->key, &heap[i]->key) >= 0)
+      break;
+    tmp = heap[i];
+    heap[i] = heap[child];
+    heap[child] = tmp;
+    i = child;
+  }
+}
 
-char *delim;
-struct agg_conf conf;
+/* reads the next line of a run, and works out its sort key from the key
+   fields at the start of it.  returns 0 at the end of the run. */
+static int run_advance(struct agg_run_head *head, linesplit_t *split,
+                       const int *key_fields) {
+  if (dbfr_getline(head->reader) <= 0)
+    return 0;
+  linesplit(split, head->reader->current_line, delim);
+  collate_key_fields(&head->key, split, key_fields, key_columns());
+  return 1;
+}
 
-int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
-                          const char *header, const char *delim) {
-  if (args->keys) {
-    conf->keys.count = expand_nums(args->keys, &(conf->keys.indexes),
-                                   &(conf->keys.size));
-  } else if (args->key_labels) {
-    conf->keys.count = expand_label_list(args->key_labels, header,
-                                         delim, &(conf->keys.indexes),
-                                         &(conf->keys.size));
-    args->preserve = 1;
+/* prints the top groups from the runs of every spill partition, which hold
+   the top groups of each part of the spills.  returns the number of groups
+   they were chosen from. */
+static size_t print_top_runs(struct agg_runs *runs) {
+  struct agg_top top;
+  struct agg_ranked left_out;
+  struct aggregation *agg = xmalloc(conf.layout.size);
+  char *key = NULL;
+  size_t key_sz = 0, n_groups = 0, i, j;
+
+  top_init(&top);
+  for (i = 0; i < AGG_SPILL_PARTS; i++) {
+    n_groups += runs[i].n_groups;
+    for (j = 0; j < runs[i].n_files; j++) {
+      rewind(runs[i].files[j]);
+      while (spill_read(runs[i].files[j], &key, &key_sz, agg)) {
+        /* the copy takes over the sketches of the one read. */
+        left_out = top_offer(&top, xstrdup(key),
+                             memcpy(xmalloc(conf.layout.size), agg,
+                                    conf.layout.size));
+        if (left_out.key) {
+          free(left_out.key);
+          free_agg(left_out.agg);
+          free(left_out.agg);
+        }
+      }
+      fclose(runs[i].files[j]);
+    }
+    free(runs[i].files);
   }
-  if (conf->keys.count < 0)
-    return conf->keys.count;
-  decrement_values(conf->keys.indexes, conf->keys.count);
 
-  if (args->sums) {
-    conf->sums.count = expand_nums(args->sums, &(conf->sums.indexes),
-                                   &(conf->sums.size));
-  } else if (args->sum_labels) {
-    conf->sums.count = expand_label_list(args->sum_labels, header,
-                                         delim, &(conf->sums.indexes),
-                                         &(conf->sums.size));
-    args->preserve = 1;
+  top_finish(&top);
+  for (i = 0; i < top.n; i++) {
+    print_keys_and_agg_vals(out, top.heap[i].key, top.heap[i].agg);
+    free(top.heap[i].key);
+    free_agg(top.heap[i].agg);
+    free(top.heap[i].agg);
   }
-  if (conf->sums.count < 0) {
-    return conf->sums.count;
-  } else if (conf->sums.count > 0) {
-    decrement_values(conf->sums.indexes, conf->sums.count);
-    conf->sums.precisions = xcalloc(conf->sums.count, sizeof(int));
+  free(top.heap);
+  free(key);
+  free(agg);
+  return n_groups;
+}
+
+/* prints the runs of every spill partition, merging them into one sorted
+   stream if SORT is set.  returns the number of groups printed. */
+static size_t print_runs(struct agg_runs *runs, int sort) {
+  struct agg_run_head *heads, **heap;
+  linesplit_t split;
+  int *key_fields;
+  size_t n_runs = 0, n_heap = 0, n_groups = 0, i, j;
+
+  for (i = 0; i < AGG_SPILL_PARTS; i++) {
+    n_runs += runs[i].n_files;
+    n_groups += runs[i].n_groups;
+  }
+  heads = xmalloc(sizeof(struct agg_run_head) * (n_runs + 1));
+  heap = xmalloc(sizeof(struct agg_run_head *) * (n_runs + 1));
+  key_fields = xmalloc(sizeof(int) * (key_columns() + 1));
+  for (i = 0; i < key_columns(); i++)
+    key_fields[i] = i;
+  linesplit_init(&split, 0);
+
+  for (n_runs = 0, i = 0; i < AGG_SPILL_PARTS; i++) {
+    for (j = 0; j < runs[i].n_files; j++, n_runs++) {
+      rewind(runs[i].files[j]);
+      heads[n_runs].reader = dbfr_init(runs[i].files[j]);
+      collate_key_init(&heads[n_runs].key);
+    }
+    free(runs[i].files);
   }
 
-  if (args->counts) {
-    conf->counts.count = expand_nums(args->counts, &(conf->counts.indexes),
-                                &(conf->counts.size));
-  } else if (args->count_labels) {
-    conf->counts.count = expand_label_list(args->count_labels, header,
-                                      delim, &(conf->counts.indexes),
-                                      &(conf->counts.size));
-    args->preserve = 1;
+  if (! sort) {
+    for (i = 0; i < n_runs; i++) {
+      while (dbfr_getline(heads[i].reader) > 0)
+        bufout_write(out, heads[i].reader->current_line,
+                     heads[i].reader->current_line_len);
+    }
+  } else {
+    for (i = 0; i < n_runs; i++) {
+      if (run_advance(&heads[i], &split, key_fields))
+        heap[n_heap++] = &heads[i];
+    }
+    for (i = n_heap; i-- > 0;)
+      run_heap_down(heap, n_heap, i);
+    while (n_heap > 0) {
+      bufout_write(out, heap[0]->reader->current_line,
+                   heap[0]->reader->current_line_len);
+      if (! run_advance(heap[0], &split, key_fields))
+        heap[0] = heap[--n_heap];
+      run_heap_down(heap, n_heap, 0);
+    }
   }
-  if (conf->counts.count < 0)
-    return conf->counts.count;
-  else if (conf->counts.count > 0)
-    decrement_values(conf->counts.indexes, conf->counts.count);
 
-  if (args->averages) {
-    conf->averages.count = expand_nums(args->averages, &(conf->averages.indexes),
-                                  &(conf->averages.size));
-  } else if (args->average_labels) {
-    conf->averages.count = expand_label_list(args->average_labels, header,
-                                        delim, &(conf->averages.indexes),
-                                        &(conf->averages.size));
-    args->preserve = 1;
+  for (i = 0; i < n_runs; i++) {
+    dbfr_close(heads[i].reader);
+    collate_key_destroy(&heads[i].key);
   }
-  if (conf->averages.count < 0) {
-    return conf->averages.count;
-  } else if (conf->averages.count > 0) {
-    decrement_values(conf->averages.indexes, conf->averages.count);
-    conf->averages.precisions = xcalloc(conf->averages.count, sizeof(int));
+  linesplit_destroy(&split);
+  free(key_fields);
+  free(heap);
+  free(heads);
+  return n_groups;
+}
+
+/* appends the runs of every spill partition, which hold groups as they
+   are written to spill files, to a state file.  returns the number of
+   groups. */
+static size_t copy_runs(struct agg_runs *runs, FILE *fp) {
+  char buf[64 * 1024];
+  size_t n_groups = 0, len, i, j;
+
+  for (i = 0; i < AGG_SPILL_PARTS; i++) {
+    n_groups += runs[i].n_groups;
+    for (j = 0; j < runs[i].n_files; j++) {
+      rewind(runs[i].files[j]);
+      while ((len = fread(buf, 1, sizeof(buf), runs[i].files[j])) > 0)
+        fwrite(buf, 1, len, fp);
+      spill_check(runs[i].files[j]);
+      fclose(runs[i].files[j]);
+    }
+    free(runs[i].files);
   }
+  return n_groups;
+}
 
-  if (args->mins) {
-    conf->mins.count = expand_nums(args->mins, &(conf->mins.indexes),
-                              &(conf->mins.size));
-  } else if (args->min_labels) {
-    conf->mins.count = expand_label_list(args->min_labels, header, delim,
-                                    &(conf->mins.indexes),
-                                    &(conf->mins.size));
+/* writes the merged partitions of the first worker to a state file.
+   returns the number of groups written. */
+static size_t write_merged(struct agg_pool *pool, FILE *fp) {
+  hashtbl_t *aggregations = pool->workers[0].parts;
+  size_t n_groups = 0, i;
+  int w;
+
+  for (w = 0; w < pool->n_workers; w++) {
+    for (i = 0; i < aggregations[w].arrsz; i++) {
+      if (aggregations[w].hashes[i])
+        spill_write(fp, aggregations[w].arr[i].key,
+                    aggregations[w].arr[i].data);
+    }
+    n_groups += aggregations[w].nelems;
   }
-  if (conf->mins.count < 0) {
-    return conf->mins.count;
-  } else if (conf->mins.count > 0) {
-    decrement_values(conf->mins.indexes, conf->mins.count);
-    conf->mins.precisions = xcalloc(conf->mins.count, sizeof(int));
+  return n_groups;
+}
+
+/* combines the groups in the state files named on the command line, or
+   standard input, and prints them or writes them to a new state file.
+   they are merged as spill files are, so --max-memory applies. */
+static int merge_states(struct cmdargs *args, int argc, char *argv[],
+                        int optind) {
+  FILE **states, *in;
+  size_t n_states = 0, states_sz = 4, header_len = 0, n_groups;
+  char *header = NULL, *name = "-";
+  struct agg_reduce reduce;
+  int ret;
+
+  states = xmalloc(sizeof(FILE *) * states_sz);
+  if (optind == argc) {
+    in = stdin;
+  } else {
+    in = nextfile(argc, argv, &optind, "r");
+    name = argv[optind - 1];
   }
+  if (in == NULL)
+    return EXIT_FILE_ERR;
 
-  if (args->maxs) {
-    conf->maxs.count = expand_nums(args->maxs, &(conf->maxs.indexes),
-                              &(conf->maxs.size));
-  } else if (args->max_labels) {
-    conf->maxs.count = expand_label_list(args->max_labels, header, delim,
-                                    &(conf->maxs.indexes),
-                                    &(conf->maxs.size));
+  while (in != NULL) {
+    ret = state_read_header(in, n_states == 0, args->delim != NULL, &header,
+                            &header_len);
+    if (ret != 0) {
+      fprintf(stderr, "%s: %s: %s\n", argv[0], name,
+              ret == -1 ? "not a state file, or truncated" :
+              ret == -2 ? "written with different fields" :
+                          "written with a different delimiter");
+      return EXIT_FILE_ERR;
+    }
+    if (n_states == states_sz)
+      states = xrealloc(states, sizeof(FILE *) * (states_sz *= 2));
+    states[n_states++] = in;
+    in = nextfile(argc, argv, &optind, "r");
+    name = argv[optind - 1];
   }
-  if (conf->maxs.count < 0) {
-    return conf->maxs.count;
-  } else if (conf->maxs.count > 0) {
-    decrement_values(conf->maxs.indexes, conf->maxs.count);
-    conf->maxs.precisions = xmalloc(sizeof(int) * conf->maxs.count);
-    memset(conf->maxs.precisions, 0, sizeof(int) * conf->maxs.count);
+
+  setlocale(LC_ALL, "");
+  setlocale(LC_COLLATE, "");
+  collate_init(args->byte_order);
+
+  out = bufout_init(stdout);
+  if (! state_out)
+    bufout_write(out, header, header_len);
+
+  reduce.pool = NULL;
+  reduce.runs = xcalloc(AGG_SPILL_PARTS, sizeof(struct agg_runs));
+  reduce.budget = max_memory ? max_memory : (size_t) -1;
+  reduce.sort = ! args->nosort;
+  reduce_spills(states, n_states, 0, &reduce, &reduce.runs[0]);
+
+  if (state_out) {
+    state_write_header(state_out, header, header_len);
+    n_groups = copy_runs(reduce.runs, state_out);
+  } else {
+    n_groups = print_runs(reduce.runs, reduce.sort);
   }
+  free(reduce.runs);
 
-  return 0;
+  if (bufout_close(out) != 0) {
+    warn("stdout");
+    return EXIT_FILE_ERR;
+  }
+  if (state_out && (ferror(state_out) || state_close(state_out) != 0)) {
+    warn("%s", args->write_state);
+    return EXIT_FILE_ERR;
+  }
+  if (args->verbose)
+    fprintf(stderr, "%s: %lu keys from %lu state files\n", argv[0],
+            (unsigned long) n_groups, (unsigned long) n_states);
+
+  free(header);
+  free(states);
+  return EXIT_OKAY;
 }
 
 /** @brief  
@@ -130,27 +2000,83 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
   */
 int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
 
-  int i, n;
+  int i, j, w;
 
-  hashtbl_t aggregations;
-  struct aggregation *value;
-  char **key_array;
+  struct agg_pool pool;
+  parchunk_ops_t ops = { aggregate_chunk, agg_thread_init, NULL, &pool };
+  int n_threads = 1;
+  int distinct_precision;
+  size_t top_k = 0, top_k_groups = 0;
+  double *percents;
+  int n_percents;
+  struct agg_reduce reduce;
 
-  size_t n_hash_elems;
+  size_t n_hash_elems, n_spilled, key_bytes, key_bytes_reserved;
 
   FILE *in;                     /* input file */
   dbfr_t *in_reader;
+  char *header;                 /* copy of the first line of a file */
 
   char *outbuf;                 /* buffer for a line of output */
   size_t outbuf_sz;             /* size of the output buffer */
 
   char default_delim[] = { 0xFE, 0x00 };  /* default delimiter string */
+  bufout_t *header_out = bufout_init_mem();  /* the output header line */
 
-  if (! args->keys && ! args->key_labels) {
+  if (! args->merge_state && ! args->keys && ! args->key_labels) {
     fprintf(stderr, "%s: -k or -K must be specified\n", argv[0]);
     return EXIT_HELP;
   }
 
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", argv[0], args->threads);
+    return EXIT_HELP;
+  }
+
+  if ((distinct_precision = hll_parse_precision(args->distinct_precision))
+      < 0) {
+    fprintf(stderr, "%s: bad distinct precision: %s\n", argv[0],
+            args->distinct_precision);
+    return EXIT_HELP;
+  }
+
+  if ((n_percents = tdigest_parse_percents(args->percents ? args->percents
+                                                          : "50,95,99",
+                                           &percents)) < 0) {
+    fprintf(stderr, "%s: bad percentiles: %s\n", argv[0], args->percents);
+    return EXIT_HELP;
+  }
+
+  if (args->top_k && parse_count(args->top_k, &top_k) != 0) {
+    fprintf(stderr, "%s: bad number of top groups: %s\n", argv[0],
+            args->top_k);
+    return EXIT_HELP;
+  }
+  if (args->top_k_groups) {
+    if (! top_k) {
+      fprintf(stderr, "%s: -e requires -t\n", argv[0]);
+      return EXIT_HELP;
+    }
+    if (parse_count(args->top_k_groups, &top_k_groups) != 0 ||
+        top_k_groups < top_k) {
+      fprintf(stderr, "%s: bad number of groups to hold: %s\n", argv[0],
+              args->top_k_groups);
+      return EXIT_HELP;
+    }
+  }
+
+  if (top_k && (args->write_state || args->merge_state)) {
+    fprintf(stderr, "%s: -t can't be used with -w or -m\n", argv[0]);
+    return EXIT_HELP;
+  }
+
+  max_memory = 0;
+  if (args->max_memory && parse_memory_size(args->max_memory,
+                                            &max_memory) != 0) {
+    fprintf(stderr, "%s: bad memory size: %s\n", argv[0], args->max_memory);
+    return EXIT_HELP;
+  }
+
   delim = args->delim;
   if (!delim)
     delim = getenv("DELIMITER");
@@ -160,6 +2086,23 @@ int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
   else
     delim = default_delim;
 
+  state_out = NULL;
+  if (args->write_state) {
+    if (str_eq(args->write_state, "-"))
+      state_out = stdout;
+    else
+      state_out = fopen(args->write_state, "w");
+    if (! state_out) {
+      warn("%s", args->write_state);
+      return EXIT_FILE_ERR;
+    }
+  }
+
+  if (args->merge_state) {
+    free(percents);
+    return merge_states(args, argc, argv, optind);
+  }
+
   if (optind == argc)
     in = stdin;
   else
@@ -168,13 +2111,75 @@ int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
   if (in == NULL)
     return EXIT_FILE_ERR;
 
-  in_reader = dbfr_init(in);
+  in_reader = dbfr_mmap_init(in);
 
   memset(&conf, 0, sizeof(conf));
-  if (configure_aggregation(&conf, args, in_reader->next_line, delim) != 0) {
+  conf.distinct_precision = distinct_precision;
+  conf.percents = percents;
+  conf.n_percents = n_percents;
+  conf.top_k = top_k;
+  conf.top_k_groups = top_k_groups;
+  header = dbfr_next_line_dup(in_reader);
+  if (configure_aggregation(&conf, args, header, delim) != 0) {
     fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
     return EXIT_HELP;
   }
+  agg_layout_init(&conf.layout, &conf);
+
+  if (args->rollup || args->grouping_sets) {
+    if (args->rollup && args->grouping_sets) {
+      fprintf(stderr, "%s: -R and -g can't be used together\n", argv[0]);
+      return EXIT_HELP;
+    }
+    if (conf.keys.count > 31) {
+      fprintf(stderr, "%s: too many key fields for grouping sets\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    if (args->rollup) {
+      /* all of the keys, then all but the last, and so on down to none. */
+      conf.n_grouping_sets = conf.keys.count + 1;
+      conf.grouping_sets = xmalloc(sizeof(unsigned int) *
+                                   conf.n_grouping_sets);
+      for (i = 0; i < conf.n_grouping_sets; i++)
+        conf.grouping_sets[i] = (1U << i) - 1;
+    } else if ((conf.n_grouping_sets = parse_grouping_sets(
+                    args->grouping_sets, conf.keys.count,
+                    &conf.grouping_sets)) < 0) {
+      fprintf(stderr, "%s: bad grouping sets: %s\n", argv[0],
+              args->grouping_sets);
+      return EXIT_HELP;
+    }
+  }
+
+  if (args->buckets &&
+      parse_buckets(args->buckets, conf.keys.count, &conf.buckets) != 0) {
+    fprintf(stderr, "%s: bad buckets: %s\n", argv[0], args->buckets);
+    return EXIT_HELP;
+  }
+
+  if (args->watermark) {
+    if (! conf.buckets) {
+      fprintf(stderr, "%s: -W needs a key field with -b\n", argv[0]);
+      return EXIT_HELP;
+    }
+    if (n_threads > 1 || max_memory || top_k || state_out ||
+        conf.n_grouping_sets) {
+      fprintf(stderr, "%s: -W can't be used with -T, -M, -t, -w, -R or -g\n",
+              argv[0]);
+      return EXIT_HELP;
+    }
+    if (strcmp(args->watermark, "0") != 0 &&
+        timestamp_parse_width(args->watermark, &conf.lateness) != 0) {
+      fprintf(stderr, "%s: bad watermark lateness: %s\n", argv[0],
+              args->watermark);
+      return EXIT_HELP;
+    }
+    conf.watermark = 1;
+    for (conf.window_key = 0; ! conf.buckets[conf.window_key];
+         conf.window_key++)
+      ;
+  }
 
 #ifdef CRUSH_DEBUG
   fprintf(stderr, "%d keys: ", conf.keys.count);
@@ -195,286 +2200,280 @@ int aggregate(struct cmdargs *args, int argc, char *argv[], int optind) {
   outbuf = NULL;
   outbuf_sz = 0;
 
-  /* set locale with values from the environment so strcoll()
-     will work correctly. */
+  /* set locale with values from the environment so keys
+     collate correctly. */
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
+  collate_init(args->byte_order);
 
   if (args->preserve) {
-    size_t str_len;
-
     if (dbfr_getline(in_reader) <= 0) {
       fprintf(stderr, "%s: unexpected end of file\n", getenv("_"));
       exit(EXIT_FILE_ERR);
     }
-    chomp(in_reader->current_line);
+    chomp(header);
 
-    outbuf = xmalloc(in_reader->current_line_len);
     outbuf_sz = in_reader->current_line_len;
+    outbuf = xmalloc(outbuf_sz);
 
-    extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
+    extract_fields_to_string(header, outbuf, outbuf_sz,
                              conf.keys.indexes, conf.keys.count, delim, NULL);
-    fputs(outbuf, stdout);
+    if (conf.n_grouping_sets)
+      bufout_printf(header_out, "Grouping%s", delim);
+    bufout_puts(header_out, outbuf);
     if (args->labels) {
-    	printf("%s%s", delim, args->labels);
+    	bufout_printf(header_out, "%s%s", delim, args->labels);
     } else {
       if (conf.sums.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
+        extract_fields_to_string(header, outbuf, outbuf_sz,
                                  conf.sums.indexes, conf.sums.count, delim,
                                  args->auto_label ? "-Sum" : NULL);
-        printf("%s%s", delim, outbuf);
+        bufout_printf(header_out, "%s%s", delim, outbuf);
       }
 
       if (conf.counts.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
+        extract_fields_to_string(header, outbuf, outbuf_sz,
                                  conf.counts.indexes, conf.counts.count, delim,
                                  args->auto_label ? "-Count" : NULL);
-        printf("%s%s", delim, outbuf);
+        bufout_printf(header_out, "%s%s", delim, outbuf);
       }
 
       if (conf.averages.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
+        extract_fields_to_string(header, outbuf, outbuf_sz,
                                  conf.averages.indexes, conf.averages.count,
                                  delim, args->auto_label ? "-Average" : NULL);
-        printf("%s%s", delim, outbuf);
+        bufout_printf(header_out, "%s%s", delim, outbuf);
       }
 
       if (conf.mins.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
+        extract_fields_to_string(header, outbuf, outbuf_sz,
                                  conf.mins.indexes, conf.mins.count, delim,
                                  args->auto_label ? "-Min" : NULL);
-        printf("%s%s", delim, outbuf);
+        bufout_printf(header_out, "%s%s", delim, outbuf);
       }
 
       if (conf.maxs.count) {
-        extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
+        extract_fields_to_string(header, outbuf, outbuf_sz,
                                  conf.maxs.indexes, conf.maxs.count, delim,
                                  args->auto_label ? "-Min" : NULL);
-        printf("%s%s", delim, outbuf);
-      }
-    }
-
-    fputs("\n", stdout);
-  }
-
-  ht_init(&aggregations, 1024, NULL, (void (*)) free_agg);
-  /* ht_init( &aggregations, 1024, NULL, free ); */
-
-  n_hash_elems = 0;
-
-  /* loop through all files */
-  while (in != NULL) {
-    char tmpbuf[AGG_TMP_BUF_SIZE];
-    size_t tmplen;
-    int in_hash;
-
-    /* loop through each line of the file */
-    while (dbfr_getline(in_reader) > 0) {
-      chomp(in_reader->current_line);
-      if (in_reader->current_line_len > outbuf_sz) {
-        outbuf = xrealloc(outbuf, in_reader->current_line_len + 32);
-        outbuf_sz = in_reader->current_line_len + 32;
-      }
-
-      extract_fields_to_string(in_reader->current_line, outbuf, outbuf_sz,
-                               conf.keys.indexes, conf.keys.count, delim, NULL);
-
-      value = (struct aggregation *) ht_get(&aggregations, outbuf);
-      if (!value) {
-        in_hash = 0;
-        value = alloc_agg(conf.sums.count, conf.counts.count,
-                          conf.averages.count, conf.mins.count,
-                          conf.maxs.count);
-      } else {
-        in_hash = 1;
+        bufout_printf(header_out, "%s%s", delim, outbuf);
       }
 
-      /* sums */
-      for (i = 0; i < conf.sums.count; i++) {
-        tmplen =
-          get_line_field(tmpbuf, in_reader->current_line,
-                         AGG_TMP_BUF_SIZE - 1, conf.sums.indexes[i], delim);
-        if (tmplen > 0) {
-          n = float_str_precision(tmpbuf);
-          if (conf.sums.precisions[i] < n)
-            conf.sums.precisions[i] = n;
-          value->sums[i] += atof(tmpbuf);
-        }
-      }
-
-      /* averages */
-      for (i = 0; i < conf.averages.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.averages.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          n = float_str_precision(tmpbuf);
-          if (conf.averages.precisions[i] < n)
-            conf.averages.precisions[i] = n;
-          value->average_sums[i] += atof(tmpbuf);
-          value->average_counts[i] += 1;
-        }
+      if (conf.distincts.count) {
+        extract_fields_to_string(header, outbuf, outbuf_sz,
+                                 conf.distincts.indexes, conf.distincts.count,
+                                 delim,
+                                 args->auto_label ? "-Distinct" : NULL);
+        bufout_printf(header_out, "%s%s", delim, outbuf);
       }
 
-      /* counts */
-      for (i = 0; i < conf.counts.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.counts.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          value->counts[i] += 1;
-        }
-      }
-
-      /* mins */
-      for (i = 0; i < conf.mins.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.mins.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          double cur_val;
-          n = sscanf(tmpbuf, "%lf", &cur_val);
-          if (n) {
-            if (cur_val < value->numeric_mins[i] ||
-                ! value->mins_initialized[i]) {
-              value->numeric_mins[i] = cur_val;
-              conf.mins.precisions[i] = float_str_precision(tmpbuf);
-            }
-            value->mins_initialized[i] = 1;
-          }
-        }
+      for (i = 0; i < conf.percentiles.count; i++) {
+        extract_fields_to_string(header, outbuf, outbuf_sz,
+                                 &conf.percentiles.indexes[i], 1, delim,
+                                 NULL);
+        for (j = 0; j < conf.n_percents; j++)
+          bufout_printf(header_out, "%s%s-P%g", delim, outbuf,
+                        conf.percents[j]);
       }
 
-      /* maxs */
-      for (i = 0; i < conf.maxs.count; i++) {
-        tmplen = get_line_field(tmpbuf, in_reader->current_line,
-                                AGG_TMP_BUF_SIZE - 1, conf.maxs.indexes[i],
-                                delim);
-        if (tmplen > 0) {
-          double cur_val;
-          n = sscanf(tmpbuf, "%lf", &cur_val);
-          if (n) {
-            if (cur_val > value->numeric_maxs[i] ||
-                ! value->maxs_initialized[i]) {
-              value->numeric_maxs[i] = cur_val;
-              conf.maxs.precisions[i] = float_str_precision(tmpbuf);
-            }
-            value->maxs_initialized[i] = 1;
-          }
-        }
-      }
+      if (conf.top_k)
+        bufout_printf(header_out, "%sLines", delim);
+      if (conf.top_k_groups)
+        bufout_printf(header_out, "%sLines-Overcount", delim);
+    }
 
-      if (!in_hash) {
-        if (ht_put(&aggregations, outbuf, value) != 0)
-          fprintf(stderr, "%s: failed to store value in hashtable.\n",
-                  getenv("_"));
-        n_hash_elems++;
-      }
+    bufout_putc(header_out, '\n');
+    free(outbuf);
+  }
+  free(header);
+
+  out = bufout_init(stdout);
+  if (! state_out)
+    bufout_write(out, header_out->buf, header_out->len);
+  agg_pool_init(&pool, n_threads);
+  if (conf.watermark) {
+    pool.workers[0].stream = xcalloc(1, sizeof(struct agg_stream));
+    pool.workers[0].stream->sort = ! args->nosort;
+  }
 
-    }
+  /* loop through all files */
+  while (in != NULL) {
+    pool.n_claimed = 0;
+    parchunk_run(in_reader, out, n_threads, &ops);
     dbfr_close(in_reader);
     in = nextfile(argc, argv, &optind, "r");
     if (in) {
-      in_reader = dbfr_init(in);
+      in_reader = dbfr_mmap_init(in);
       /* reconfigure fields (needed if labels were used) */
-      if (configure_aggregation(&conf, args, in_reader->next_line, delim) != 0) {
+      header = dbfr_next_line_dup(in_reader);
+      if (configure_aggregation(&conf, args, header, delim) != 0) {
         fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
         return EXIT_HELP;
       }
+      free(header);
       if (args->preserve)
         dbfr_getline(in_reader);
     }
   }
 
-  /* Print all of the output. */
-  key_array = xmalloc(sizeof(char *) * n_hash_elems);
-  ht_keys(&aggregations, key_array);
+  /* combine the workers' precisions. */
+  for (w = 0; w < pool.n_workers; w++)
+    combine_precisions(&pool.workers[w]);
 
-  if (! args->nosort) {
-    qsort(key_array, n_hash_elems, sizeof(char *),
-          (int (*)(const void *, const void *)) key_strcmp);
-  }
+  key_bytes = key_bytes_reserved = n_spilled = 0;
+  for (w = 0; w < pool.n_workers; w++)
+    n_spilled += pool.workers[w].n_spilled;
 
-  for (i = 0; i < n_hash_elems; i++) {
-    value = (struct aggregation *) ht_get(&aggregations, key_array[i]);
-    print_keys_and_agg_vals(key_array[i], value);
+  if (n_spilled == 0) {
+    /* combine the workers' partitions, and print them. */
+    parchunk_each(pool.n_workers, n_threads, merge_partition, &pool);
+    for (w = 0; w < pool.n_workers; w++) {
+      key_bytes += mempool_used(pool.workers[0].parts[w].key_pool);
+      key_bytes_reserved += mempool_size(pool.workers[0].parts[w].key_pool);
+    }
+    if (state_out) {
+      state_write_header(state_out, header_out->buf, header_out->len);
+      n_hash_elems = write_merged(&pool, state_out);
+    } else {
+      n_hash_elems = print_merged(&pool, ! args->nosort);
+    }
+  } else {
+    /* spill what's left too, then aggregate each spill partition of every
+       worker on its own. */
+    parchunk_each(pool.n_workers, n_threads, spill_pool_worker, &pool);
+    for (n_spilled = 0, w = 0; w < pool.n_workers; w++)
+      n_spilled += pool.workers[w].n_spilled;
+    reduce.pool = &pool;
+    reduce.runs = xcalloc(AGG_SPILL_PARTS, sizeof(struct agg_runs));
+    reduce.budget = max_memory / n_threads;
+    reduce.sort = ! args->nosort;
+    parchunk_each(AGG_SPILL_PARTS, n_threads, reduce_partition, &reduce);
+    if (conf.top_k) {
+      n_hash_elems = print_top_runs(reduce.runs);
+    } else if (state_out) {
+      state_write_header(state_out, header_out->buf, header_out->len);
+      n_hash_elems = copy_runs(reduce.runs, state_out);
+    } else {
+      n_hash_elems = print_runs(reduce.runs, reduce.sort);
+    }
+    free(reduce.runs);
   }
 
-  free(key_array);
-
-  ht_destroy(&aggregations);
-
-  return EXIT_OKAY;
-}
-
-int key_strcmp(char **a, char **b) {
-  char fa[256], fb[256];
-  int retval = 0;
-  int i;
-  int alen, blen;
-
-  /* avoid comparing nulls */
-  if (!*a && !*b)
-    return 0;
-  if (!*a && *b)
-    return -1;
-  if (*a && !*b)
-    return 1;
-
-  i = 0;
-  while (retval == 0) {
-    alen = get_line_field(fa, *a, 255, i, delim);
-    blen = get_line_field(fb, *b, 255, i, delim);
-    if (alen < 0 || blen < 0)
-      break;
-    retval = strcoll(fa, fb);
-    i++;
+  if (bufout_close(out) != 0) {
+    warn("stdout");
+    return EXIT_FILE_ERR;
   }
+  if (state_out && (ferror(state_out) || state_close(state_out) != 0)) {
+    warn("%s", args->write_state);
+    return EXIT_FILE_ERR;
+  }
+  bufout_close(header_out);
 
-  return retval;
-}
-
-int float_str_precision(char *d) {
-  char *p;
-  int after_dot;
-  if (!d)
-    return 0;
+  if (args->verbose) {
+    if (n_spilled > 0)
+      fprintf(stderr, "%s: %lu keys, spilled to temporary files\n", argv[0],
+              (unsigned long) n_hash_elems);
+    else
+      fprintf(stderr, "%s: %lu keys, %lu key bytes (%lu reserved)\n",
+              argv[0], (unsigned long) n_hash_elems,
+              (unsigned long) key_bytes, (unsigned long) key_bytes_reserved);
+  }
 
-  p = strchr(d, '.');
-  if (p == NULL) {
-    return 0;
+  for (w = 0; w < pool.n_workers; w++)
+    ht_destroy(&pool.workers[0].parts[w]);
+  for (w = 0; w < pool.n_workers; w++) {
+    free(pool.workers[w].parts);
+    mempool_destroy(pool.workers[w].records);
+    free(pool.workers[w].sum_precisions);
+    free(pool.workers[w].average_precisions);
+    free(pool.workers[w].percentile_precisions);
+    linesplit_destroy(&pool.workers[w].split);
+    free(pool.workers[w].values);
+    free(pool.workers[w].key_buf);
+    if (pool.workers[w].stream) {
+      if (pool.workers[w].stream->n_late)
+        fprintf(stderr, "%s: %lu lines arrived after their window was "
+                "printed, and were dropped\n", argv[0],
+                (unsigned long) pool.workers[w].stream->n_late);
+      free(pool.workers[w].stream->heap);
+      free(pool.workers[w].stream->spare);
+      free(pool.workers[w].stream);
+    }
+    if (pool.workers[w].summaries) {
+      for (i = 0; i < pool.n_workers; i++)
+        free(pool.workers[w].summaries[i].heap);
+      free(pool.workers[w].summaries);
+    }
   }
-  after_dot = p - d + 1;
-  return (strlen(d) - after_dot);
+  free(pool.workers);
+  free(percents);
+  free(conf.grouping_sets);
+  free(conf.buckets);
+
+  return EXIT_OKAY;
 }
 
-int print_keys_and_agg_vals(char *key, struct aggregation *val) {
-  int i;
-  fputs(key, stdout);
+int print_keys_and_agg_vals(bufout_t *out, char *key,
+                            struct aggregation *val) {
+  double *sums = AGG_ARRAY(val, double, sums);
+  double *average_sums = AGG_ARRAY(val, double, average_sums);
+  double *mins = AGG_ARRAY(val, double, mins);
+  double *maxs = AGG_ARRAY(val, double, maxs);
+  u_int32_t *counts = AGG_ARRAY(val, u_int32_t, counts);
+  u_int32_t *average_counts = AGG_ARRAY(val, u_int32_t, average_counts);
+  unsigned char *min_precisions = AGG_ARRAY(val, unsigned char,
+                                            min_precisions);
+  unsigned char *max_precisions = AGG_ARRAY(val, unsigned char,
+                                            max_precisions);
+  hll_t *distincts = AGG_ARRAY(val, hll_t, distincts);
+  tdigest_t *percentiles = AGG_ARRAY(val, tdigest_t, percentiles);
+  int i, j;
+  bufout_puts(out, key);
   for (i = 0; i < conf.sums.count; i++) {
-    printf("%s%.*f", delim, conf.sums.precisions[i], val->sums[i]);
+    bufout_puts(out, delim);
+    bufout_put_double(out, sums[i], conf.sums.precisions[i]);
   }
   for (i = 0; i < conf.counts.count; i++) {
-    printf("%s%d", delim, val->counts[i]);
+    bufout_puts(out, delim);
+    bufout_put_long(out, counts[i]);
   }
   for (i = 0; i < conf.averages.count; i++) {
-    printf("%s%.*f", delim, conf.averages.precisions[i] + 2,
-           val->average_sums[i] / val->average_counts[i]);
+    bufout_puts(out, delim);
+    bufout_put_double(out, average_sums[i] / average_counts[i],
+                      conf.averages.precisions[i] + 2);
   }
   for (i = 0; i < conf.mins.count; i++) {
-    if (val->mins_initialized[i])
-      printf("%s%.*f", delim, conf.mins.precisions[i], val->numeric_mins[i]);
-    else
-      fputs(delim, stdout);
+    bufout_puts(out, delim);
+    if (AGG_FLAG(val, i))
+      bufout_put_double(out, mins[i], min_precisions[i]);
   }
   for (i = 0; i < conf.maxs.count; i++) {
-    if (val->maxs_initialized[i])
-      printf("%s%.*f", delim, conf.maxs.precisions[i], val->numeric_maxs[i]);
-    else
-      fputs(delim, stdout);
+    bufout_puts(out, delim);
+    if (AGG_FLAG(val, conf.mins.count + i))
+      bufout_put_double(out, maxs[i], max_precisions[i]);
   }
-  fputs("\n", stdout);
-  return 0;
+  for (i = 0; i < conf.distincts.count; i++) {
+    bufout_puts(out, delim);
+    bufout_put_long(out, (long long) floor(hll_estimate(&distincts[i]) + 0.5));
+  }
+  for (i = 0; i < conf.percentiles.count; i++) {
+    for (j = 0; j < conf.n_percents; j++) {
+      bufout_puts(out, delim);
+      if (tdigest_count(&percentiles[i]) > 0)
+        bufout_put_double(out, tdigest_quantile(&percentiles[i],
+                                                conf.percents[j] / 100),
+                          conf.percentiles.precisions[i] + 2);
+    }
+  }
+  if (conf.top_k) {
+    bufout_puts(out, delim);
+    bufout_put_long(out, AGG_LINES(val));
+  }
+  if (conf.top_k_groups) {
+    bufout_puts(out, delim);
+    bufout_put_long(out, AGG_OVERCOUNT(val));
+  }
+  return bufout_putc(out, '\n');
 }
 
 void ht_print_keys_and_agg_vals(void *htelem) {
@@ -482,7 +2481,7 @@ void ht_print_keys_and_agg_vals(void *htelem) {
   struct aggregation *val;
   key = ((ht_elem_t *) htelem)->key;
   val = ((ht_elem_t *) htelem)->data;
-  print_keys_and_agg_vals(key, val);
+  print_keys_and_agg_vals(out, key, val);
 }
 
 void extract_fields_to_string(char *line, char *destbuf, size_t destbuf_sz,
@@ -522,61 +2521,137 @@ void decrement_values(int *array, size_t sz) {
   }
 }
 
-struct aggregation *alloc_agg(int nsum, int ncount, int naverage, int nmin,
-                              int nmax) {
-  struct aggregation *agg;
+void agg_layout_init(struct agg_layout *layout, const struct agg_conf *conf) {
+  size_t n_flags = conf->mins.count + conf->maxs.count;
+
+  /* the widest values go first, so that each is aligned. */
+  layout->sums = 0;
+  layout->average_sums = layout->sums + sizeof(double) * conf->sums.count;
+  layout->mins = layout->average_sums +
+                 sizeof(double) * conf->averages.count;
+  layout->maxs = layout->mins + sizeof(double) * conf->mins.count;
+  layout->lines = layout->maxs + sizeof(double) * conf->maxs.count;
+  layout->overcounts = layout->lines + sizeof(u_int64_t) * (conf->top_k > 0);
+  layout->distincts = layout->overcounts +
+                      sizeof(u_int64_t) * (conf->top_k_groups > 0);
+  layout->percentiles = layout->distincts +
+                        sizeof(hll_t) * conf->distincts.count;
+  layout->counts = layout->percentiles +
+                   sizeof(tdigest_t) * conf->percentiles.count;
+  layout->average_counts = layout->counts +
+                           sizeof(u_int32_t) * conf->counts.count;
+  layout->heap_positions = layout->average_counts +
+                           sizeof(u_int32_t) * conf->averages.count;
+  layout->min_precisions = layout->heap_positions +
+                           sizeof(u_int32_t) * (conf->top_k_groups > 0);
+  layout->max_precisions = layout->min_precisions + conf->mins.count;
+  layout->flags = layout->max_precisions + conf->maxs.count;
+  layout->size = layout->flags + (n_flags + 7) / 8;
+  layout->size = (layout->size + sizeof(double) - 1) / sizeof(double) *
+                 sizeof(double);
+  if (layout->size == 0)
+    layout->size = sizeof(double);
+}
 
-  agg = xmalloc(sizeof(struct aggregation));
-  memset(agg, 0, sizeof(struct aggregation));
+/* zeroes out a record and gives it empty sketches. */
+static void init_agg(struct aggregation *agg) {
+  hll_t *distincts;
+  tdigest_t *percentiles;
+  int i;
 
-  if (nsum > 0) {
-    agg->sums = xmalloc(sizeof(double) * nsum);
-    memset(agg->sums, 0, sizeof(double) * nsum);
-  }
+  memset(agg, 0, conf.layout.size);
+  distincts = AGG_ARRAY(agg, hll_t, distincts);
+  for (i = 0; i < conf.distincts.count; i++)
+    hll_init(&distincts[i], conf.distinct_precision);
+  percentiles = AGG_ARRAY(agg, tdigest_t, percentiles);
+  for (i = 0; i < conf.percentiles.count; i++)
+    tdigest_init(&percentiles[i], TDIGEST_DEFAULT_COMPRESSION);
+}
 
-  if (ncount > 0) {
-    agg->counts = xmalloc(sizeof(u_int32_t) * ncount);
-    memset(agg->counts, 0, sizeof(u_int32_t) * ncount);
-  }
+struct aggregation *alloc_agg(mempool_t *records) {
+  struct aggregation *agg = mempool_alloc_aligned(records, conf.layout.size,
+                                                  sizeof(double));
+  init_agg(agg);
+  return agg;
+}
 
-  if (naverage > 0) {
-    agg->average_sums = xmalloc(sizeof(double) * naverage);
-    memset(agg->average_sums, 0, sizeof(double) * naverage);
+void merge_agg(struct aggregation *into, const struct aggregation *from) {
+  double *into_doubles = AGG_ARRAY(into, double, sums);
+  const double *from_doubles = AGG_ARRAY(from, double, sums);
+  u_int32_t *into_counts = AGG_ARRAY(into, u_int32_t, counts);
+  const u_int32_t *from_counts = AGG_ARRAY(from, u_int32_t, counts);
+  double *into_mins = AGG_ARRAY(into, double, mins);
+  const double *from_mins = AGG_ARRAY(from, double, mins);
+  double *into_maxs = AGG_ARRAY(into, double, maxs);
+  const double *from_maxs = AGG_ARRAY(from, double, maxs);
+  unsigned char *into_min_precisions = AGG_ARRAY(into, unsigned char,
+                                                 min_precisions);
+  const unsigned char *from_min_precisions = AGG_ARRAY(from, unsigned char,
+                                                       min_precisions);
+  unsigned char *into_max_precisions = AGG_ARRAY(into, unsigned char,
+                                                 max_precisions);
+  const unsigned char *from_max_precisions = AGG_ARRAY(from, unsigned char,
+                                                       max_precisions);
+  hll_t *into_distincts = AGG_ARRAY(into, hll_t, distincts);
+  const hll_t *from_distincts = AGG_ARRAY(from, hll_t, distincts);
+  tdigest_t *into_percentiles = AGG_ARRAY(into, tdigest_t, percentiles);
+  const tdigest_t *from_percentiles = AGG_ARRAY(from, tdigest_t, percentiles);
+  int i, n;
 
-    agg->average_counts = xmalloc(sizeof(u_int32_t) * naverage);
-    memset(agg->average_counts, 0, sizeof(u_int32_t) * naverage);
+  /* sums and average sums are next to each other, as are counts and
+     average counts. */
+  n = conf.sums.count + conf.averages.count;
+  for (i = 0; i < n; i++)
+    into_doubles[i] += from_doubles[i];
+  n = conf.counts.count + conf.averages.count;
+  for (i = 0; i < n; i++)
+    into_counts[i] += from_counts[i];
+  if (conf.top_k)
+    AGG_LINES(into) += AGG_LINES(from);
+  if (conf.top_k_groups)
+    AGG_OVERCOUNT(into) += AGG_OVERCOUNT(from);
+
+  /* the same rules as for single values in update_agg(). */
+  for (i = 0; i < conf.mins.count; i++) {
+    if (! AGG_FLAG(from, i))
+      continue;
+    if (! AGG_FLAG(into, i) || from_mins[i] < into_mins[i] ||
+        (from_mins[i] == into_mins[i] &&
+         from_min_precisions[i] > into_min_precisions[i])) {
+      into_mins[i] = from_mins[i];
+      into_min_precisions[i] = from_min_precisions[i];
+    }
+    AGG_SET_FLAG(into, i);
   }
-
-  if (nmin > 0) {
-    agg->numeric_mins = xmalloc(sizeof(double) * nmin);
-    memset(agg->numeric_mins, 0, sizeof(double) * nmin);
-    agg->mins_initialized = xmalloc(sizeof(int) * nmin);
-    memset(agg->mins_initialized, 0, nmin);
+  for (i = 0; i < conf.maxs.count; i++) {
+    if (! AGG_FLAG(from, conf.mins.count + i))
+      continue;
+    if (! AGG_FLAG(into, conf.mins.count + i) || from_maxs[i] > into_maxs[i] ||
+        (from_maxs[i] == into_maxs[i] &&
+         from_max_precisions[i] > into_max_precisions[i])) {
+      into_maxs[i] = from_maxs[i];
+      into_max_precisions[i] = from_max_precisions[i];
+    }
+    AGG_SET_FLAG(into, conf.mins.count + i);
   }
 
-  if (nmax > 0) {
-    agg->numeric_maxs = xmalloc(sizeof(double) * nmax);
-    memset(agg->numeric_maxs, 0, sizeof(double) * nmax);
-    agg->maxs_initialized = xmalloc(sizeof(int) * nmax);
-    memset(agg->maxs_initialized, 0, nmax);
-  }
-  return agg;
+  for (i = 0; i < conf.distincts.count; i++)
+    hll_merge(&into_distincts[i], &from_distincts[i]);
+  for (i = 0; i < conf.percentiles.count; i++)
+    tdigest_merge(&into_percentiles[i], &from_percentiles[i]);
 }
 
 void free_agg(struct aggregation *agg) {
-  if (!agg)
+  hll_t *distincts;
+  tdigest_t *percentiles;
+  int i;
+
+  if (! agg)
     return;
-  if (agg->counts)
-    free(agg->counts);
-  if (agg->sums)
-    free(agg->sums);
-  if (agg->average_sums)
-    free(agg->average_sums);
-  if (agg->average_counts)
-    free(agg->average_counts);
-  if (agg->numeric_mins)
-    free(agg->numeric_mins);
-  if (agg->numeric_maxs)
-    free(agg->numeric_maxs);
-  free(agg);
+  distincts = AGG_ARRAY(agg, hll_t, distincts);
+  for (i = 0; i < conf.distincts.count; i++)
+    hll_destroy(&distincts[i]);
+  percentiles = AGG_ARRAY(agg, tdigest_t, percentiles);
+  for (i = 0; i < conf.percentiles.count; i++)
+    tdigest_destroy(&percentiles[i]);
 }
@@ -20,9 +20,14 @@
 #include <assert.h>
 #include <locale.h>
 
+#include <crush/bufout.h>
 #include <crush/ffutils.h>
 #include <crush/hashtbl.h>
+#include <crush/hll.h>
+#include <crush/linesplit.h>
 #include <crush/linklist.h>
+#include <crush/mempool.h>
+#include <crush/tdigest.h>
 
 #ifndef AGGREGATE_H
 #define AGGREGATE_H
@@ -33,7 +38,35 @@ struct agg_conf_field {
   ssize_t count;  /**< number of elems in the index array.  This may hold a
                        negative return code from expand_nums() or
                        expand_label_list(). */
-  int *precisions;  /**< precision of output for each field. */
+  int *precisions;  /**< precision of output for each field.  Mins and maxs
+                         keep theirs in each group's record instead. */
+};
+
+/** where each of a group's values is kept in its record, as byte offsets.
+    the values of each kind are consecutive, one for each field. */
+struct agg_layout {
+  size_t sums;            /**< a double for each sum field. */
+  size_t average_sums;    /**< a double for each average field. */
+  size_t mins;            /**< a double for each min field. */
+  size_t maxs;            /**< a double for each max field. */
+  size_t lines;           /**< with --top-k, a u_int64_t: the number of
+                               lines in the group. */
+  size_t overcounts;      /**< with --top-k-groups, a u_int64_t: the most
+                               the number of lines may be over by. */
+  size_t distincts;       /**< an hll_t for each distinct field. */
+  size_t percentiles;     /**< a tdigest_t for each percentile field. */
+  size_t counts;          /**< a u_int32_t for each count field. */
+  size_t average_counts;  /**< a u_int32_t for each average field. */
+  size_t heap_positions;  /**< with --top-k-groups, a u_int32_t: where the
+                               group is in its partition's heap. */
+  size_t min_precisions;  /**< an unsigned char for each min field: the
+                               output precision of the min. */
+  size_t max_precisions;  /**< the same for each max field. */
+  size_t flags;           /**< a bit for each min field and then each max
+                               field, set once a populated input field has
+                               been found. */
+  size_t size;            /**< the size of a record, a multiple of
+                               sizeof(double). */
 };
 
 struct agg_conf {
@@ -43,22 +76,38 @@ struct agg_conf {
   struct agg_conf_field averages;
   struct agg_conf_field mins;
   struct agg_conf_field maxs;
+  struct agg_conf_field distincts;
+  struct agg_conf_field percentiles;
+  int distinct_precision;  /**< the precision of the distincts' sketches. */
+  double *percents;        /**< the percentiles reported for each
+                                percentile field. */
+  int n_percents;          /**< the number of elements in percents. */
+  size_t top_k;            /**< how many groups to print, by number of
+                                lines, or 0 for all of them. */
+  size_t top_k_groups;     /**< the most groups each worker holds while
+                                estimating the top groups, or 0 to find
+                                them exactly. */
+  unsigned int *grouping_sets;  /**< for each grouping set, a bit for each
+                                     key field left out of it, the first
+                                     key field being the highest bit. */
+  int n_grouping_sets;     /**< the number of grouping sets, or 0 if every
+                                line has just the one group. */
+  long long *buckets;      /**< for each key field, the width in seconds
+                                of the buckets of time it is grouped by, or
+                                0.  NULL if none of them are. */
+  int watermark;           /**< whether groups are printed as soon as
+                                their window of time has closed. */
+  int window_key;          /**< with watermark, the key field whose bucket
+                                of time is each group's window. */
+  long long lateness;      /**< with watermark, how long after the end of
+                                its window a line may still arrive, in
+                                seconds. */
+  struct agg_layout layout;
 };
 
-struct aggregation {
-  u_int32_t *counts;
-  double *sums;
-  u_int32_t *average_counts;
-  double *average_sums;
-  double *numeric_mins;
-  /* for each min field, whether a populated input field has been found yet. */
-  char *mins_initialized;
-  double *numeric_maxs;
-  /* for each max field, whether a populated input field has been found yet. */
-  char *maxs_initialized;
-  /* char *string_mins; */
-  /* char *string_maxs; */
-};
+/* a group's aggregation: a single record of conf.layout.size bytes, with
+   its values where conf.layout says. */
+struct aggregation;
 
 int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
                           const char *header, const char *delim);
@@ -66,22 +115,30 @@ void extract_fields_to_string(char *line, char *destbuf, size_t destbuf_sz,
                               int *fields, size_t nfields, char *delim,
                               char *suffix);
 void decrement_values(int *array, size_t sz);
-int print_keys_and_agg_vals(char *key, struct aggregation *val);
+int print_keys_and_agg_vals(bufout_t *out, char *key,
+                            struct aggregation *val);
 void ht_print_keys_and_agg_vals(void *htelem);
-int key_strcmp(char **a, char **b);
-int float_str_precision(char *d);
 
 
-/** @brief allocates and initializes an aggregation struct
+/** @brief works out the layout of the records holding each group's
+  * aggregation, once the fields to aggregate are known. */
+void agg_layout_init(struct agg_layout *layout, const struct agg_conf *conf);
+
+/** @brief allocates and initializes a group's aggregation.
   *
-  * @param nsum number of fields to sum
-  * @param ncount number of fields to count
+  * @param records the memory pool to allocate the record from.  it is freed
+  *                along with the pool.
   *
-  * @return a shiny new, zeroed-out structure
+  * @return a shiny new, zeroed-out record
   */
-struct aggregation *alloc_agg(int nsum, int ncount, int naverage, int nmin,
-                              int nmax);
+struct aggregation *alloc_agg(mempool_t *records);
+
+/** @brief adds one group's aggregation into another's, as if the lines
+  * aggregated into FROM had been aggregated into INTO. */
+void merge_agg(struct aggregation *into, const struct aggregation *from);
 
+/** @brief frees the memory a group's aggregation holds outside its record.
+  * the record itself belongs to its memory pool. */
 void free_agg(struct aggregation *agg);
 
 
@@ -0,0 +1,30 @@
+test_number=12
+description="top groups by number of lines"
+
+subtest_desc=("exact" "estimated, with room for every group"
+              "estimated, with groups replaced")
+subtest_opts=(
+''
+'-e 4'
+'-e 2'
+)
+
+for subtest in `seq 0 2`; do
+  expected="$test_dir/test_$test_number.$subtest.expected"
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+
+  eval $bin -p -k 2 -s 4 -t 2 \
+       "${subtest_opts[$subtest]}" \
+       "$test_dir/test.in" \
+       > "$outfile"
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ]; then
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" PASS
+    rm "$outfile"
+  fi
+done
@@ -0,0 +1,47 @@
+test_number=13
+description="state files"
+
+expected="$test_dir/test_$test_number.expected"
+state1="$test_dir/test_$test_number.1.state"
+state2="$test_dir/test_$test_number.2.state"
+opts="-K Text-1 -S Numeric-1,Numeric-2 -N Numeric-2 -U Text-2 -L"
+
+outfile="$test_dir/test_$test_number.1.actual"
+$bin $opts -w "$state1" "$test_dir/test.in" &&
+  $bin $opts -w - "$test_dir/test.in2" > "$state2" &&
+  $bin -m "$state1" - < "$state2" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description (merge)" FAIL
+else
+  test_status $test_number 1 "$description (merge)" PASS
+  rm "$outfile"
+fi
+
+outfile="$test_dir/test_$test_number.2.actual"
+$bin -m -w "$state1.merged" "$state1" "$state2" &&
+  $bin -m "$state1.merged" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 2 "$description (merge of merged states)" FAIL
+else
+  test_status $test_number 2 "$description (merge of merged states)" PASS
+  rm "$outfile"
+fi
+
+outfile="$test_dir/test_$test_number.3.actual"
+DELIMITER=, $bin -m "$state1" "$state2" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 3 "$description (delimiter from the state)" FAIL
+else
+  test_status $test_number 3 "$description (delimiter from the state)" PASS
+  rm "$outfile"
+fi
+
+if $bin -d , -m "$state1" "$state2" > /dev/null 2>&1; then
+  test_status $test_number 4 "$description (conflicting delimiter)" FAIL
+else
+  test_status $test_number 4 "$description (conflicting delimiter)" PASS
+fi
+rm -f "$state1" "$state2" "$state1.merged"
@@ -0,0 +1,28 @@
+test_number=14
+description="grouping sets"
+
+subtest_desc=("rollup" "grouping sets")
+subtest_opts=(
+'-R'
+'-g "2:1,2:"'
+)
+
+for subtest in `seq 0 1`; do
+  expected="$test_dir/test_$test_number.$subtest.expected"
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+
+  eval $bin -p -k 1,2 -s 4 -c 4 \
+       "${subtest_opts[$subtest]}" \
+       "$test_dir/test.in" \
+       > "$outfile"
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ]; then
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" PASS
+    rm "$outfile"
+  fi
+done
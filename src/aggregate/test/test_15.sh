@@ -0,0 +1,28 @@
+test_number=15
+description="time buckets"
+
+subtest_desc=("hour" "half hour")
+subtest_opts=(
+'-K Time -b 1:hour'
+'-K Host,Time -b 2:30m'
+)
+
+for subtest in `seq 0 1`; do
+  expected="$test_dir/test_$test_number.$subtest.expected"
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+
+  eval $bin -S Bytes -c 3 \
+       "${subtest_opts[$subtest]}" \
+       "$test_dir/test.in3" \
+       > "$outfile"
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ]; then
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" PASS
+    rm "$outfile"
+  fi
+done
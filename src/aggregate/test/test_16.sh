@@ -0,0 +1,28 @@
+test_number=16
+description="watermark"
+
+subtest_desc=("no lateness" "lateness")
+subtest_opts=(
+'-W 0'
+'-W 10m'
+)
+
+for subtest in `seq 0 1`; do
+  expected="$test_dir/test_$test_number.$subtest.expected"
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+
+  eval $bin -K Time,Host -S Bytes -b 1:hour \
+       "${subtest_opts[$subtest]}" \
+       "$test_dir/test.in4" \
+       > "$outfile" 2> /dev/null
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ]; then
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" PASS
+    rm "$outfile"
+  fi
+done
@@ -0,0 +1,14 @@
+test_number=17
+description="counts skip blank and missing fields"
+
+expected="$test_dir/test_$test_number.expected"
+outfile="$test_dir/test_$test_number.actual"
+
+$bin -k 1 -c 2,3 "$test_dir/test.in5" > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description" FAIL
+else
+  test_status $test_number 1 "$description" PASS
+  rm "$outfile"
+fi
@@ -0,0 +1,36 @@
+test_number=19
+description="spilled to disk"
+
+# each of these must give the same output as it does in the earlier test.
+subtest_desc=("multi-key, multi-sum" "averages" "counts and auto-labels"
+              "labels with 2 input files" "distinct counts" "percentiles"
+              "rollup" "counts of blank fields")
+subtest_opts=(
+'-p -k 1,2 -s 3,4 "$test_dir/test.in"'
+'-p -k 1 -s 3,4 -a 3,4 "$test_dir/test.in"'
+'-p -k 1 -s 3 -c 1 -a 4 -L "$test_dir/test.in"'
+'-p -K Text-1,Text-2 -S Numeric-1,Numeric-2 -C Numeric-1,Numeric-2 \
+ -A Numeric-1,Numeric-2 -L "$test_dir/test.in" "$test_dir/test.in2"'
+'-p -k 1 -u 2,4 "$test_dir/test.in"'
+'-p -k 1 -q 4 -y 0,50,100 "$test_dir/test.in"'
+'-p -k 1,2 -s 4 -c 4 -R "$test_dir/test.in"'
+'-k 1 -c 2,3 "$test_dir/test.in5"'
+)
+subtest_expected=(01 02 04 06.1 10 11 14.0 17)
+
+for subtest in `seq 0 7`; do
+  expected="$test_dir/test_${subtest_expected[$subtest]}.expected"
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+
+  eval $bin -M 1k "${subtest_opts[$subtest]}" > "$outfile"
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ]; then
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" PASS
+    rm "$outfile"
+  fi
+done
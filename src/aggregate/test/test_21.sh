@@ -0,0 +1,31 @@
+test_number=21
+description="many threads, within the memory limit"
+
+# the limit is shared by the threads, so none of these should spill.
+subtest_desc=("multi-key, multi-sum" "distinct counts" "percentiles")
+subtest_opts=(
+'-p -k 1,2 -s 3,4 "$test_dir/test.in"'
+'-p -k 1 -u 2,4 "$test_dir/test.in"'
+'-p -k 1 -q 4 -y 0,50,100 "$test_dir/test.in"'
+)
+subtest_expected=(01 10 11)
+
+for subtest in `seq 0 2`; do
+  expected="$test_dir/test_${subtest_expected[$subtest]}.expected"
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+  errfile="$test_dir/test_$test_number.$subtest.err"
+
+  eval $bin -v -T 32 -M 32k "${subtest_opts[$subtest]}" > "$outfile" \
+    2> "$errfile"
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ] ||
+     grep -q spilled "$errfile"; then
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_desc[$subtest]})" PASS
+    rm "$outfile" "$errfile"
+  fi
+done
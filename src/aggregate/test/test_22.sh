@@ -0,0 +1,36 @@
+test_number=22
+description="piped input"
+
+outfile="$test_dir/test_$test_number.0.actual"
+expected="$test_dir/test_01.expected"
+
+cat "$test_dir/test.in" | $bin -p -k 1,2 -s 3,4 > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 0 "$description" FAIL
+else
+  test_status $test_number 0 "$description" PASS
+  rm "$outfile"
+fi
+
+# several megabytes, so that the lines cross the reader's blocks.
+subtest_opts=("" "-T 4")
+expected="$test_dir/test_$test_number.expected"
+for subtest in 1 2; do
+  outfile="$test_dir/test_$test_number.$subtest.actual"
+
+  awk 'BEGIN { print "key\tvalue";
+               for (i = 0; i < 300000; i++) print "k" i % 7 "\t" i }' |
+    $bin -p ${subtest_opts[$subtest - 1]} -k 1 -s 2 -c 2 > "$outfile"
+
+  if [ $? -ne 0 ] ||
+     [ "`diff -q $outfile $expected`" ]; then
+    test_status $test_number $subtest \
+                "$description (${subtest_opts[$subtest - 1]:-one thread})" FAIL
+  else
+    test_status $test_number $subtest \
+                "$description (${subtest_opts[$subtest - 1]:-one thread})" PASS
+    rm "$outfile"
+  fi
+done
@@ -17,6 +17,10 @@
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
+#include <crush/hll.h>
+#include <crush/linesplit.h>
+#include <crush/numparse.h>
+#include <crush/tdigest.h>
 #include "aggregate2_main.h"
 
 struct agg_conf {
@@ -29,6 +33,13 @@ struct agg_conf {
   int *sum_precisions;
   int *join_fields;
   int njoins;
+  int *distinct_fields;
+  int ndistincts;
+  int *percentile_fields;
+  int npercentiles;
+  int *percentile_precisions;
+  double *percents;
+  int npercents;
   /* averages not implemented in agg2 yet.
   int *average_fields; 
   size_t average_fields_sz;
@@ -47,13 +58,13 @@ static void print_line(FILE * out,
                        const int *counts,
                        size_t ncounts,
                        const double *sums, int nsums, int *sum_precisions,
-                       char **joins, size_t njoins);
+                       char **joins, size_t njoins,
+                       const hll_t *distincts, size_t ndistincts,
+                       tdigest_t *percentiles, const struct agg_conf *conf);
 
 static int extract_keys(char *target, const char *source, const char *delim,
                         int *keys, size_t nkeys, const char *suffix);
 
-static int float_precision(char *n);
-
 /** @brief  
   * 
   * @param args contains the parsed cmd-line options & arguments.
@@ -70,11 +81,10 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   FILE *in, *out;
   dbfr_t *in_reader;
+  linesplit_t split;            /* fields of the current line */
 
   struct agg_conf conf;
 
-  int cur_precision;
-
   char *cur_keys = NULL, *prev_keys = NULL;
   int prev_keys_initialized = 0;
   size_t keybuf_sz = 0;
@@ -83,12 +93,15 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
   double *cur_sums = NULL;
   char **cur_joins = NULL;
   int *cur_join_sizes = NULL;
+  hll_t *cur_distincts = NULL;
+  tdigest_t *cur_percentiles = NULL;
+  int distinct_precision;
   size_t join_str_len;
   int join_len;
 
   char field_buf[1024];         /* FIXME: should be dynamically resized */
-  double f;                     /* numeric value of sum fields */
-  int i;                        /* counter */
+  numparse_t num;               /* numeric value of sum fields */
+  int i, j;                     /* counters */
 
   if (! (args->keys || args->key_labels)) {
     fprintf(stderr, "%s: either -k or -K must be specified.\n", argv[0]);
@@ -98,10 +111,19 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
   /* individually these args are not required. */
   if (!(args->sums || args->sum_labels) &&
       !(args->counts || args->count_labels) &&
-      !(args->joins || args->join_labels)) {
+      !(args->joins || args->join_labels) &&
+      !(args->distincts || args->distinct_labels) &&
+      !(args->percentiles || args->percentile_labels)) {
     fprintf(stderr,
-            "%s: at least one of -s/-S, -c/-C, or -j/-J must be specified.\n",
-            argv[0]);
+            "%s: at least one of -s/-S, -c/-C, -j/-J, -u/-U, or -q/-Q must "
+            "be specified.\n", argv[0]);
+    return EXIT_HELP;
+  }
+
+  if ((distinct_precision = hll_parse_precision(args->distinct_precision))
+      < 0) {
+    fprintf(stderr, "%s: bad distinct precision: %s\n", argv[0],
+            args->distinct_precision);
     return EXIT_HELP;
   }
 
@@ -124,6 +146,12 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
   in_reader = dbfr_init(in);
 
   memset(&conf, 0, sizeof(conf));
+  if ((conf.npercents = tdigest_parse_percents(args->percents
+                                               ? args->percents : "50,95,99",
+                                               &conf.percents)) < 0) {
+    fprintf(stderr, "%s: bad percentiles: %s\n", argv[0], args->percents);
+    return EXIT_HELP;
+  }
   if (configure_aggregation(&conf, args, in_reader->next_line, args->delim)
       != 0) {
     fprintf(stderr, "%s: error parsing field arguments.\n", argv[0]);
@@ -157,6 +185,18 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
     }
   }
 
+  if (conf.ndistincts > 0) {
+    cur_distincts = xmalloc(sizeof(hll_t) * conf.ndistincts);
+    for (i = 0; i < conf.ndistincts; i++)
+      hll_init(&cur_distincts[i], distinct_precision);
+  }
+
+  if (conf.npercentiles > 0) {
+    cur_percentiles = xmalloc(sizeof(tdigest_t) * conf.npercentiles);
+    for (i = 0; i < conf.npercentiles; i++)
+      tdigest_init(&cur_percentiles[i], TDIGEST_DEFAULT_COMPRESSION);
+  }
+
   /* this can be resized later */
   cur_keys = xmalloc(sizeof(char) * 1024);
   prev_keys = xmalloc(sizeof(char) * 1024);
@@ -210,12 +250,33 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
         }
         fprintf(out, "%s%s", args->delim, cur_keys);
       }
+
+      if (conf.ndistincts > 0) {
+        if (extract_keys(cur_keys, in_reader->current_line, args->delim,
+                         conf.distinct_fields, conf.ndistincts,
+                         args->auto_label ? "-Distinct" : NULL) != 0) {
+          fprintf(stderr, "%s: malformatted input for -u/-U\n", argv[0]);
+          return EXIT_FILE_ERR;
+        }
+        fprintf(out, "%s%s", args->delim, cur_keys);
+      }
+
+      for (i = 0; i < conf.npercentiles; i++) {
+        if (extract_keys(cur_keys, in_reader->current_line, args->delim,
+                         &conf.percentile_fields[i], 1, NULL) != 0) {
+          fprintf(stderr, "%s: malformatted input for -q/-Q\n", argv[0]);
+          return EXIT_FILE_ERR;
+        }
+        for (j = 0; j < conf.npercents; j++)
+          fprintf(out, "%s%s-P%g", args->delim, cur_keys, conf.percents[j]);
+      }
     }
     fputs("\n", out);
   }
 
   cur_keys[0] = '\0';
   prev_keys[0] = '\0';
+  linesplit_init(&split, 0);
 
   while (in) {
     while (dbfr_getline(in_reader) > 0) {
@@ -235,36 +296,39 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
       if (prev_keys_initialized && !str_eq(cur_keys, prev_keys)) {
         print_line(out, prev_keys, args->delim, cur_counts,
                    conf.ncounts, cur_sums,
-                   conf.nsums, conf.sum_precisions, cur_joins, conf.njoins);
+                   conf.nsums, conf.sum_precisions, cur_joins, conf.njoins,
+                   cur_distincts, conf.ndistincts, cur_percentiles, &conf);
 
         memset(cur_counts, 0, conf.ncounts * sizeof(int));
         memset(cur_sums, 0, conf.nsums * sizeof(double));
         for (i = 0; i < conf.njoins; i++) cur_joins[i][0] = '\0';
+        for (i = 0; i < conf.ndistincts; i++) hll_clear(&cur_distincts[i]);
+        for (i = 0; i < conf.npercentiles; i++)
+          tdigest_clear(&cur_percentiles[i]);
       }
 
+      linesplit(&split, in_reader->current_line, args->delim);
+
       for (i = 0; i < conf.ncounts; i++) {
-        get_line_field(field_buf, in_reader->current_line, 1023,
-                       conf.count_fields[i], args->delim);
-        if (field_buf[0] != '\0') {
+        if (conf.count_fields[i] < split.n_fields &&
+            linesplit_field_len(&split, conf.count_fields[i]) > 0) {
           cur_counts[i]++;
         }
       }
 
       for (i = 0; i < conf.nsums; i++) {
-        get_line_field(field_buf, in_reader->current_line, 1023,
-                       conf.sum_fields[i], args->delim);
-        f = atof(field_buf);
-        cur_sums[i] += f;
-
-        cur_precision = float_precision(field_buf);
-
-        if (cur_precision > conf.sum_precisions[i])
-          conf.sum_precisions[i] = cur_precision;
+        if (conf.sum_fields[i] >= split.n_fields)
+          continue;
+        numparse(linesplit_field_ptr(&split, conf.sum_fields[i]),
+                 linesplit_field_len(&split, conf.sum_fields[i]), &num);
+        cur_sums[i] += num.value;
+
+        if (num.precision > conf.sum_precisions[i])
+          conf.sum_precisions[i] = num.precision;
       }
 
       for (i = 0; i < conf.njoins; i++) {
-        get_line_field(field_buf, in_reader->current_line, 1023,
-                       conf.join_fields[i], args->delim);
+        linesplit_get_field(field_buf, &split, 1023, conf.join_fields[i]);
         join_len = strlen(field_buf) + join_str_len + strlen(cur_joins[i]);
         if (join_len >= cur_join_sizes[i])
           cur_joins[i] = xrealloc(cur_joins[i], cur_join_sizes[i] = join_len+1);
@@ -276,6 +340,26 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
         }
       }
 
+      for (i = 0; i < conf.ndistincts; i++) {
+        if (conf.distinct_fields[i] < split.n_fields &&
+            linesplit_field_len(&split, conf.distinct_fields[i]) > 0) {
+          hll_add(&cur_distincts[i],
+                  linesplit_field_ptr(&split, conf.distinct_fields[i]),
+                  linesplit_field_len(&split, conf.distinct_fields[i]));
+        }
+      }
+
+      for (i = 0; i < conf.npercentiles; i++) {
+        if (conf.percentile_fields[i] >= split.n_fields ||
+            numparse(linesplit_field_ptr(&split, conf.percentile_fields[i]),
+                     linesplit_field_len(&split, conf.percentile_fields[i]),
+                     &num) <= 0)
+          continue;
+        tdigest_add(&cur_percentiles[i], num.value);
+        if (num.precision > conf.percentile_precisions[i])
+          conf.percentile_precisions[i] = num.precision;
+      }
+
       strcpy(prev_keys, cur_keys);
       prev_keys_initialized = 1;
     }
@@ -295,8 +379,17 @@ int aggregate2(struct cmdargs *args, int argc, char *argv[], int optind) {
   }
 
   print_line(out, prev_keys, args->delim, cur_counts, conf.ncounts,
-             cur_sums, conf.nsums, conf.sum_precisions, cur_joins, conf.njoins);
-
+             cur_sums, conf.nsums, conf.sum_precisions, cur_joins, conf.njoins,
+             cur_distincts, conf.ndistincts, cur_percentiles, &conf);
+
+  linesplit_destroy(&split);
+  for (i = 0; i < conf.ndistincts; i++)
+    hll_destroy(&cur_distincts[i]);
+  free(cur_distincts);
+  for (i = 0; i < conf.npercentiles; i++)
+    tdigest_destroy(&cur_percentiles[i]);
+  free(cur_percentiles);
+  free(conf.percents);
   free(cur_counts);
   free(cur_sums);
   free(cur_keys);
@@ -369,6 +462,38 @@ int configure_aggregation(struct agg_conf *conf, struct cmdargs *args,
     return conf->njoins;
   else if (conf->njoins > 0)
     decrement_values(conf->join_fields, conf->njoins);
+
+  ignore_sz = 0;
+  if (args->distincts) {
+    conf->ndistincts = expand_nums(args->distincts, &(conf->distinct_fields),
+                                   &ignore_sz);
+  } else if (args->distinct_labels) {
+    conf->ndistincts = expand_label_list(args->distinct_labels, header, delim,
+                                         &(conf->distinct_fields),
+                                         &ignore_sz);
+    args->preserve_header = 1;
+  }
+  if (conf->ndistincts < 0)
+    return conf->ndistincts;
+  else if (conf->ndistincts > 0)
+    decrement_values(conf->distinct_fields, conf->ndistincts);
+
+  ignore_sz = 0;
+  if (args->percentiles) {
+    conf->npercentiles = expand_nums(args->percentiles,
+                                     &(conf->percentile_fields), &ignore_sz);
+  } else if (args->percentile_labels) {
+    conf->npercentiles = expand_label_list(args->percentile_labels, header,
+                                           delim, &(conf->percentile_fields),
+                                           &ignore_sz);
+    args->preserve_header = 1;
+  }
+  if (conf->npercentiles < 0) {
+    return conf->npercentiles;
+  } else if (conf->npercentiles > 0) {
+    decrement_values(conf->percentile_fields, conf->npercentiles);
+    conf->percentile_precisions = xcalloc(conf->npercentiles, sizeof(int));
+  }
 /*
   if (args->averages) {
     conf->naverages = expand_nums(args->averages, &(conf->average_fields),
@@ -424,8 +549,12 @@ static void print_line(FILE * out,
                        size_t ncounts,
                        const double *sums, int nsums, int *sum_precisions,
                        char **joins,
-                       size_t njoins) {
-  int i;
+                       size_t njoins,
+                       const hll_t *distincts,
+                       size_t ndistincts,
+                       tdigest_t *percentiles,
+                       const struct agg_conf *conf) {
+  int i, j;
   fputs(keys, out);
 
   for (i = 0; i < nsums; i++) {
@@ -441,17 +570,18 @@ static void print_line(FILE * out,
     fputs(joins[i], out);
   }
 
-  fputs("\n", out);
-}
-
+  for (i = 0; i < ndistincts; i++) {
+    fprintf(out, "%s%.0f", delim, hll_estimate(&distincts[i]));
+  }
 
-static int float_precision(char *n) {
-  char *dot;
-  if (n == NULL || n[0] == '\0')
-    return 0;
-  dot = strchr(n, '.');
-  if (dot == NULL)
-    return 0;
+  for (i = 0; i < conf->npercentiles; i++) {
+    for (j = 0; j < conf->npercents; j++) {
+      fputs(delim, out);
+      if (tdigest_count(&percentiles[i]) > 0)
+        fprintf(out, "%.*f", conf->percentile_precisions[i] + 2,
+                tdigest_quantile(&percentiles[i], conf->percents[j] / 100));
+    }
+  }
 
-  return strlen(dot) - 1;
+  fputs("\n", out);
 }
@@ -34,6 +34,40 @@ function test_status {
   esac
 }
 
+# print each run of identical lines on stdin as its length and the line, so
+# that long output can be checked against a short expected file.  lines
+# which go missing, or come out of order, change the runs.
+function runs {
+  awk 'NR == 1 || $0 != last { if (NR > 1) print n, last; last = $0; n = 0 }
+       { n++ }
+       END { if (NR > 0) print n, last }'
+}
+
+# run a command on INPUT, with its output going to /dev/full, which fails
+# every write with ENOSPC.  the command must fail, naming TARGET, what it
+# was writing to, in its error message.
+function test_write_error {
+  local test_num="$1"
+  local subtest="$2"
+  local description="$3"
+  local target="$4"
+  local input="$5"
+  local errors="$test_dir/test_$test_num.$subtest.err"
+  shift 5
+
+  if [ ! -w /dev/full ]; then
+    test_status $test_num $subtest "$description" SKIP
+    return
+  fi
+  printf '%b' "$input" | "$@" > /dev/full 2> $errors
+  if [ ${PIPESTATUS[1]} -eq 0 ] || ! grep -q "$target" $errors; then
+    test_status $test_num $subtest "$description" FAIL
+  else
+    test_status $test_num $subtest "$description" PASS
+    rm $errors
+  fi
+}
+
 cd `dirname "$1"`
 . `basename "$1"`
 
@@ -16,6 +16,102 @@
 #include "convdate_main.h"
 #include "convdate.h"
 
+#include <err.h>
+
+#include <crush/bufout.h>
+#include <crush/general.h>
+#include <crush/linesplit.h>
+#include <crush/parchunk.h>
+
+/* the size of a formatted output date. */
+#define CONVDATE_DATE_SZ 64
+
+/* the conversion to do, shared by every thread. */
+struct convdate_conf {
+  const char *delim;
+  int field_no;                 /* the field number specified by the user */
+  const char *input_format;
+  const char *output_format;
+  int verbose;
+};
+
+/* a thread's split line, and the copy of its date which strptime() reads. */
+struct convdate_worker {
+  const struct convdate_conf *conf;
+  linesplit_t split;
+  char *text;                   /* null-terminated copy of the date onward */
+  size_t text_sz;
+};
+
+static void * convdate_thread_init(void *arg) {
+  struct convdate_worker *worker = xmalloc(sizeof(struct convdate_worker));
+  worker->conf = arg;
+  linesplit_init(&worker->split, 0);
+  worker->text = NULL;
+  worker->text_sz = 0;
+  return worker;
+}
+
+static void convdate_thread_destroy(void *state) {
+  struct convdate_worker *worker = state;
+  linesplit_destroy(&worker->split);
+  free(worker->text);
+  free(worker);
+}
+
+/* converts the date field of every line of a chunk.  lines where the field
+   is missing, empty or not a date are passed through unchanged. */
+static int convdate_chunk(void *state, const char *data, size_t len,
+                          size_t line_no, bufout_t *out) {
+  struct convdate_worker *worker = state;
+  const struct convdate_conf *conf = worker->conf;
+  linesplit_t *split = &worker->split;
+  const char *end = data + len, *field;
+  size_t line_len, field_len, text_len;
+  struct tm storage;            /* storage for the time */
+  char date[CONVDATE_DATE_SZ];
+
+  for (; data < end; data += line_len, line_no++) {
+    line_len = parchunk_line_len(data, end);
+    if (linesplit_n(split, data, line_len, conf->delim) <= conf->field_no ||
+        linesplit_field_len(split, conf->field_no) == 0) {
+      if (conf->verbose) {
+        fprintf(stderr, "%s: line %lu: did not find the field at %i\n",
+                getenv("_"), (unsigned long) line_no, conf->field_no + 1);
+      }
+      bufout_write(out, data, line_len);
+      continue;
+    }
+    field = linesplit_field_ptr(split, conf->field_no);
+    field_len = linesplit_field_len(split, conf->field_no);
+
+    /* strptime() needs a null-terminated string, and may read past the end
+       of the field. */
+    text_len = data + line_len - field;
+    if (worker->text_sz < text_len + 1) {
+      worker->text_sz = text_len + 1;
+      worker->text = xrealloc(worker->text, worker->text_sz);
+    }
+    memcpy(worker->text, field, text_len);
+    worker->text[text_len] = '\0';
+
+    memset(&storage, 0, sizeof(storage));
+    if (strptime(worker->text, conf->input_format, &storage)) {
+      bufout_write(out, data, field - data);
+      bufout_write(out, date, strftime(date, CONVDATE_DATE_SZ,
+                                       conf->output_format, &storage));
+      bufout_write(out, field + field_len, text_len - field_len);
+    } else {
+      if (conf->verbose) {
+        fprintf(stderr, "%s: line %lu: could not convert date \"%.*s\"\n",
+                getenv("_"), (unsigned long) line_no, (int) field_len, field);
+      }
+      bufout_write(out, data, line_len);
+    }
+  }
+  return 0;
+}
+
 /** @brief  
   * 
   * @param args contains the parsed cmd-line options & arguments.
@@ -34,21 +130,22 @@ int convdate(struct cmdargs *args, int argc, char *argv[], int optind) {
   /* input & output files */
   FILE *in = stdin;
   dbfr_t *in_reader;
-  FILE *out = stdout;
-  unsigned long lineno = 0;
+  bufout_t *out;
 
   int field_no; /* the field number specified by the user */
 
-  struct tm storage = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };  /* storage for the time */
-
-  char date[64] = "";
+  struct convdate_conf conf;
+  parchunk_ops_t ops = { convdate_chunk, convdate_thread_init,
+                         convdate_thread_destroy, &conf };
+  int n_threads = 1;
 
-  size_t size = 0;
-  int start = 0;
-  int end = 0;
-  int result = 0;
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", getenv("_"),
+            args->threads);
+    return EXIT_HELP;
+  }
 
-  in_reader = dbfr_init(in);
+  in_reader = dbfr_mmap_init(in);
 
   // Set default delimiter if necessary.
   if (!args->delim) {
@@ -64,7 +161,13 @@ int convdate(struct cmdargs *args, int argc, char *argv[], int optind) {
   } else if (args->field) {
     field_no = atoi(args->field) - 1;
   } else if (args->field_label) {
-    field_no = field_str(args->field_label, in_reader->next_line, args->delim);
+    /* lines from a mapped file are not null-terminated. */
+    size_t header_len = in_reader->next_line ? in_reader->next_line_len : 0;
+    char *header = xmalloc(header_len + 1);
+    memcpy(header, in_reader->next_line, header_len);
+    header[header_len] = '\0';
+    field_no = field_str(args->field_label, header, args->delim);
+    free(header);
     args->preserve_header = 1;
   }
 
@@ -81,44 +184,25 @@ int convdate(struct cmdargs *args, int argc, char *argv[], int optind) {
     args->output_format = default_output_format;
   }
 
+  out = bufout_init(stdout);
   if (args->preserve_header) {
     if (dbfr_getline(in_reader) > 0) {
-      fprintf(out, "%s", in_reader->current_line);
-      lineno++;
+      bufout_write(out, in_reader->current_line, in_reader->current_line_len);
     }
   }
 
-  while (dbfr_getline(in_reader) > 0) {
-    lineno++;
-    result = get_line_pos(in_reader->current_line, field_no,
-                          args->delim, &start, &end);
-    if (result) {
-      if (strptime(in_reader->current_line + start, args->input_format,
-                   &storage)) {
-        size = strftime(date, 64, args->output_format, &storage);
-        in_reader->current_line[start] = '\0';
-        fprintf(out, "%s%s%s", in_reader->current_line, date,
-                in_reader->current_line + end + 1);
-      } else {
-        if (args->verbose) {
-          fprintf(stderr, "%s: line %lu: could not convert date \"%.*s\"\n",
-                  getenv("_"), lineno, end - start + 1,
-                  in_reader->current_line + start);
-        }
-        fprintf(out, "%s", in_reader->current_line);
-      }
-
-    } else {  /* get_line_pos returned false - pass line through */
-      if (args->verbose) {
-        fprintf(stderr, "%s: line %lu: did not find the field at %i\n",
-                getenv("_"), lineno, field_no + 1);
-      }
-
-      fprintf(out, "%s", in_reader->current_line);
-    }
-  }
+  conf.delim = args->delim;
+  conf.field_no = field_no;
+  conf.input_format = args->input_format;
+  conf.output_format = args->output_format;
+  conf.verbose = args->verbose;
+  parchunk_run(in_reader, out, n_threads, &ops);
 
   dbfr_close(in_reader);
+  if (bufout_close(out) != 0) {
+    warn("stdout");
+    return EXIT_FILE_ERR;
+  }
 
   return EXIT_OKAY;
 }
@@ -0,0 +1,47 @@
+test_number=05
+description="missing date fields"
+
+expected=$test_dir/test_$test_number.expected
+expected_err=$test_dir/test_$test_number.err.expected
+input=$test_dir/test_$test_number.in
+output=$test_dir/test_$test_number.out
+errors=$test_dir/test_$test_number.err
+
+cat > $input << "END_TEST"
+Field-0	Date
+hello	10-11-2008-16:32:08
+empty	
+short
+END_TEST
+
+# lines without the field are passed through, and reported as such.
+cat > $expected << "END_EXPECT"
+Field-0	Date
+hello	2008-10-11-16:32:08
+empty	
+short
+END_EXPECT
+
+cat > $expected_err << "END_EXPECT"
+line 3: did not find the field at 2
+line 4: did not find the field at 2
+END_EXPECT
+
+$bin -v -F Date < $input > $output 2> $errors
+if [ $? -ne 0 ] ||
+   [ "`diff -q $expected $output`" ] ||
+   [ "`sed 's/^[^:]*: //' $errors | diff -q - $expected_err`" ]; then
+  test_status $test_number 1 "$description" FAIL
+else
+  test_status $test_number 1 "$description" PASS
+  rm $output $errors
+fi
+
+$bin -T 2 -F Date < $input > $output
+if [ $? -ne 0 ] ||
+   [ "`diff -q $expected $output`" ]; then
+  test_status $test_number 2 "$description (threads)" FAIL
+else
+  test_status $test_number 2 "$description (threads)" PASS
+  rm $expected $expected_err $input $output
+fi
@@ -0,0 +1,55 @@
+test_number=06
+description="linebreaks and threads"
+
+input=$test_dir/test_$test_number.in
+expected=$test_dir/test_$test_number.expected
+
+# the linebreak of each line is kept, even when the last line has none.
+printf 'Field-0\tDate\r\nhello\t10-11-2008-16:32:08\r\n' > $input
+printf 'empty\t\nbye\t01-02-2009-00:00:01' >> $input
+printf 'Field-0\tDate\r\nhello\t2008-10-11-16:32:08\r\n' > $expected
+printf 'empty\t\nbye\t2009-01-02-00:00:01' >> $expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.out
+$bin -F Date < $input > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (mapped)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (mapped)" PASS
+  rm $output
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.out
+cat $input | $bin -T 2 -F Date > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (piped, threads)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (piped, threads)" PASS
+  rm $output
+fi
+
+test $has_error || rm $input $expected
+
+# enough lines for several chunks, so that they are divided up between the
+# threads.  each of the 40 runs has its own date, and must come out whole
+# and in order.
+expected=$test_dir/test_$test_number.big.expected
+awk 'BEGIN { for (r = 0; r < 40; r++)
+               printf "5000 r%d\t2009-01-01-00:%02d:00\n", r, r }' > $expected
+
+subtest=3
+output=$test_dir/test_$test_number.$subtest.out
+awk 'BEGIN { for (i = 0; i < 200000; i++) {
+               r = int(i / 5000)
+               printf "r%d\t01-01-2009-00:%02d:00\n", r, r } }' |
+  $bin -T 3 -f 2 | runs > $output
+if [ ${PIPESTATUS[1]} -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (several chunks)" FAIL
+else
+  test_status $test_number $subtest "$description (several chunks)" PASS
+  rm $expected $output
+fi
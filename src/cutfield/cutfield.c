@@ -15,11 +15,85 @@
  ********************************/
 #include "cutfield_main.h"
 #include <err.h>
+#include <string.h>
 
+#include <crush/bufout.h>
+#include <crush/general.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
+#include <crush/linesplit.h>
+#include <crush/parchunk.h>
 #include <crush/qsort_helper.h>
 
+/* the fields to remove, shared by every thread. */
+struct cut_conf {
+  const char *delim;
+  const int *field_list;
+};
+
+/* lines are split into fields afresh by each thread. */
+struct cut_worker {
+  const struct cut_conf *conf;
+  linesplit_t split;
+};
+
+static void * cut_thread_init(void *arg) {
+  struct cut_worker *worker = xmalloc(sizeof(struct cut_worker));
+  worker->conf = arg;
+  linesplit_init(&worker->split, 0);
+  return worker;
+}
+
+static void cut_thread_destroy(void *state) {
+  struct cut_worker *worker = state;
+  linesplit_destroy(&worker->split);
+  free(worker);
+}
+
+/* removes the configured fields from every line of a chunk. */
+static int cut_chunk(void *state, const char *data, size_t len,
+                     size_t line_no, bufout_t *out) {
+  struct cut_worker *worker = state;
+  const char *delim = worker->conf->delim;
+  const int *field_list = worker->conf->field_list;
+  linesplit_t *split = &worker->split;
+  const char *end = data + len, *tail;
+  size_t line_len, n_fields;
+  int next_field_to_skip;     /* index into field_list */
+  int i;                      /* index of current input field */
+  int first_field_printed;    /* used to control delimiter output */
+  int field_length;
+
+  for (; data < end; data += line_len) {
+    line_len = parchunk_line_len(data, end);
+    next_field_to_skip = 0;
+    n_fields = linesplit_n(split, data, line_len, delim);
+    first_field_printed = 0;
+
+    for (i = 0; i < n_fields; i++) {
+      if (field_list[next_field_to_skip] == i + 1) {
+        ++next_field_to_skip;
+        continue;
+      }
+
+      if (first_field_printed)
+        bufout_puts(out, delim);
+
+      field_length = linesplit_field_len(split, i);
+      if (field_length > 0)
+        bufout_write(out, linesplit_field_ptr(split, i), field_length);
+      first_field_printed = 1;
+    }
+
+    /* print everything after the last field in the
+     * line (preserves input line-break style) */
+    tail = linesplit_field_ptr(split, n_fields - 1) +
+           linesplit_field_len(split, n_fields - 1);
+    bufout_write(out, tail, data + line_len - tail);
+  }
+  return 0;
+}
+
 /** @brief  
   * 
   * @param args contains the parsed cmd-line options & arguments.
@@ -38,21 +112,29 @@ int cutfield(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   FILE *in;
   dbfr_t *in_reader;
-  size_t n_fields = 0;  /* the number of fields from input file */
-  int field_length;
+  bufout_t *out;
+  struct cut_conf conf;
+  parchunk_ops_t ops = { cut_chunk, cut_thread_init, cut_thread_destroy,
+                         &conf };
+  int n_threads = 1;
 
   if (! (args->fields || args->field_labels)) {
     fprintf(stderr, "%s: -f or -F must be specified.\n", argv[0]);
     return EXIT_HELP;
   }
 
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", argv[0], args->threads);
+    return EXIT_HELP;
+  }
+
   if (optind >= argc) {
     in = stdin;
   } else {
     in = nextfile(argc, argv, &optind, "r");
   }
   if (in)
-    in_reader = dbfr_init(in);
+    in_reader = dbfr_mmap_init(in);
 
   if (args->output_fname) {
     if (!freopen(args->output_fname, "w", stdout)) {
@@ -75,9 +157,11 @@ int cutfield(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   if (args->fields) {
     field_list_sz = expand_nums(args->fields, &field_list, &field_list_sz);
-  } else if (args->field_labels) {
-    field_list_sz = expand_label_list(args->field_labels, in_reader->next_line,
+  } else if (args->field_labels && in_reader->next_line) {
+    char *header = dbfr_next_line_dup(in_reader);
+    field_list_sz = expand_label_list(args->field_labels, header,
                                       args->delim, &field_list, &field_list_sz);
+    free(header);
   }
   if (field_list_sz < 1) {
     fprintf(stderr, "%s: error expanding field list.\n", argv[0]);
@@ -86,54 +170,24 @@ int cutfield(struct cmdargs *args, int argc, char *argv[], int optind) {
   qsort(field_list, field_list_sz, sizeof(field_list[0]),
         (qsort_cmp_func_t) qsort_intcmp);
 
-  while (in) {
-    int next_field_to_skip;     /* index into field_list */
-    int i;                      /* index of current input field */
-    int f_first, f_last;        /* position of first and last char
-                                   in a field */
-    int first_field_printed;    /* used to control delimiter output */
-
-    while (dbfr_getline(in_reader) > 0) {
-      next_field_to_skip = 0;
-      n_fields = fields_in_line(in_reader->current_line, args->delim);
-      first_field_printed = 0;
-
-      for (i = 0; i < n_fields; i++) {
-        if (field_list[next_field_to_skip] == i + 1) {
-          ++next_field_to_skip;
-          continue;
-        }
-        field_length = get_line_pos(in_reader->current_line, i, args->delim,
-                                    &f_first, &f_last);
-        if (field_length < 0)
-          continue;
-
-        if (first_field_printed)
-          printf("%s", args->delim);
-
-        if (field_length > 0)
-          printf("%.*s", f_last - f_first + 1,
-                 &(in_reader->current_line[f_first]));
-        first_field_printed = 1;
-      }
-
-      /* print everything after the last field in the
-       * line (preserves input line-break style) */
-      field_length = get_line_pos(in_reader->current_line, n_fields - 1,
-                                  args->delim, &f_first, &f_last);
-      if (field_length > 0)
-        printf("%s", &(in_reader->current_line[f_last + 1]));
-      else
-        printf("%s", &(in_reader->current_line[f_last]));
+  conf.delim = args->delim;
+  conf.field_list = field_list;
+  out = bufout_init(stdout);
 
-    }
+  while (in) {
+    parchunk_run(in_reader, out, n_threads, &ops);
     dbfr_close(in_reader);
     in = nextfile(argc, argv, &optind, "r");
     if (in)
-      in_reader = dbfr_init(in);
+      in_reader = dbfr_mmap_init(in);
   }
 
   free(field_list);
 
+  if (bufout_close(out) != 0) {
+    warn("%s", args->output_fname ? args->output_fname :
+                args->append_fname ? args->append_fname : "stdout");
+    return EXIT_FILE_ERR;
+  }
   return EXIT_OKAY;
 }
@@ -0,0 +1,53 @@
+test_number=05
+description="linebreaks and threads"
+
+input=$test_dir/test_$test_number.in
+expected=$test_dir/test_$test_number.expected
+
+# the linebreak of each line is kept, even when the last line has none.
+printf 'k,a,b\n1,a1,b1\r\n2,a5,b2\n3,a5,b3\r\n4,a1,b4' > $input
+printf 'k,b\n1,b1\r\n2,b2\n3,b3\r\n4,b4' > $expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.out
+$bin -f 2 -d , $input > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (mapped)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (mapped)" PASS
+  rm $output
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.out
+cat $input | $bin -T 2 -f 2 -d , > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (piped, threads)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (piped, threads)" PASS
+  rm $output
+fi
+
+test $has_error || rm $input $expected
+
+# enough lines for several chunks, so that they are divided up between the
+# threads, in 40 runs of 5000 which must come out whole and in order.
+input=$test_dir/test_$test_number.big.in
+expected=$test_dir/test_$test_number.big.expected
+awk 'BEGIN { for (i = 0; i < 200000; i++)
+               printf "%d,r%d,,x%d\n", i, int(i / 5000), i }' > $input
+awk 'BEGIN { for (r = 0; r < 40; r++) print 5000, "r" r "," }' > $expected
+
+subtest=3
+output=$test_dir/test_$test_number.$subtest.out
+$bin -T 3 -f 1,4 -d , $input | runs > $output
+if [ ${PIPESTATUS[0]} -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (several chunks)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (several chunks)" PASS
+  rm $output
+  rm $input $expected
+fi
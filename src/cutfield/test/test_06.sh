@@ -0,0 +1,5 @@
+test_number=06
+description="write errors are reported"
+
+test_write_error $test_number 1 "$description (-o)" /dev/full 'a,b\nc,d\n' \
+  $bin -f 1 -d , -o /dev/full
@@ -13,7 +13,10 @@
    See the License for the specific language governing permissions and
    limitations under the License.
  ********************************/
+#include <errno.h>
+
 #include <crush/general.h>
+#include <crush/linesplit.h>
 #include "deltaforce_main.h"
 #include "deltaforce.h"
 
@@ -22,8 +25,16 @@
 #endif
 
 
-#define Fputs(s,f)					\
-	do { if ( fputs((s), (f)) == EOF ) {		\
+/* writes the current line of a reader.  lines from a memory-mapped file
+   stay put, so they are passed through by reference, and a long stretch of
+   unchanged lines goes out without being copied. */
+#define Fputs(r,o)					\
+	do { if ( (dbfr_lines_persist(r) ?				\
+		   bufout_write_ref((o), (r)->current_line,	\
+				    (r)->current_line_len) :	\
+		   bufout_write((o), (r)->current_line,	\
+				(r)->current_line_len)) != 0 ) {	\
+		errno = (o)->error;				\
 		warn("error writing to output:");	\
 		return EXIT_FILE_ERR;			\
 	} } while ( 0 )
@@ -34,6 +45,10 @@ int *keyfields = NULL;          /* array of fields common to both files */
 size_t keyfields_sz = 0;
 ssize_t nkeys;
 
+/* holds the fields of a line while its key is being built */
+linesplit_t key_split;
+struct line_key left_line_key, right_line_key;
+
 /** @brief opens all the files necessary, sets a default
   * delimiter if none was specified, and calls the
   * merge_files() function.
@@ -49,6 +64,8 @@ int deltaforce(struct cmdargs *args, int argc, char *argv[], int optind) {
   char default_delimiter[] = { 0xfe, 0x00 };
   FILE *left, *right, *out;     /* the two inputs & the output file ptrs */
   dbfr_t *left_reader, *right_reader;
+  bufout_t *out_buf;
+  char *header;
   int fd_tmp, retval;           /* file descriptor and return value */
   int i;
 
@@ -76,7 +93,7 @@ int deltaforce(struct cmdargs *args, int argc, char *argv[], int optind) {
       return EXIT_FILE_ERR;
     }
   }
-  left_reader = dbfr_init(left);
+  left_reader = dbfr_mmap_init(left);
 
   if (str_eq(argv[optind + 1], "-")) {
     right = stdin;
@@ -90,7 +107,7 @@ int deltaforce(struct cmdargs *args, int argc, char *argv[], int optind) {
       return EXIT_FILE_ERR;
     }
   }
-  right_reader = dbfr_init(right);
+  right_reader = dbfr_mmap_init(right);
 
   if (!args->outfile) {
     out = stdout;
@@ -117,8 +134,10 @@ int deltaforce(struct cmdargs *args, int argc, char *argv[], int optind) {
   if (args->keys) {
     nkeys = expand_nums(args->keys, &keyfields, &keyfields_sz);
   } else if (args->key_labels) {
-    nkeys = expand_label_list(args->key_labels, left_reader->next_line, delim,
+    header = dbfr_next_line_dup(left_reader);
+    nkeys = expand_label_list(args->key_labels, header, delim,
                               &keyfields, &keyfields_sz);
+    free(header);
   } else {
     keyfields = xmalloc(sizeof(int));
     keyfields[0] = 1;
@@ -134,29 +153,38 @@ int deltaforce(struct cmdargs *args, int argc, char *argv[], int optind) {
   for (i = 0; i < nkeys; i++)
     keyfields[i]--;
 
-  /* set locale with values from the environment so strcoll()
-     will work correctly. */
+  /* set locale with values from the environment so keys
+     collate correctly. */
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
+  collate_init(args->byte_order);
+
+  out_buf = bufout_init(out);
+  linesplit_init(&key_split, 0);
+  retval = merge_files(left_reader, right_reader, out_buf, args);
+  linesplit_destroy(&key_split);
+  collate_key_destroy(&left_line_key.key);
+  collate_key_destroy(&right_line_key.key);
+  if (bufout_close(out_buf) != 0 && retval == EXIT_OKAY) {
+    warn("error writing to output:");
+    retval = EXIT_FILE_ERR;
+  }
 
-  retval = merge_files(left_reader, right_reader, out, args);
-
-  fclose(left);
-  fclose(right);
+  dbfr_close(left_reader);
+  dbfr_close(right_reader);
   fclose(out);
 
   return retval;
 }
 
 
-int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
+int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, bufout_t *out,
                 struct cmdargs *args) {
 
   int retval = EXIT_OKAY;
 
-  char field_right[MAX_FIELD_LEN + 1];  /* buffer for holding field values */
-
-  int i;                        /* general-purpose counter */
+  /* whether each reader's current line is still waiting to be merged. */
+  int have_left = 0, have_right = 0;
 
   /** @todo take into account that files a & b might have the same fields in
 	  * a different order.
@@ -168,45 +196,39 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
 
   while (!left_reader->eof) {
 
-    if (left_reader->current_line == NULL ||
-        left_reader->current_line[0] == '\0') {
+    if (!have_left) {
       /* get a line from the full set */
-      if (dbfr_getline(left_reader) <= 0) {
-        free(left_reader->current_line);
-        left_reader->current_line = NULL;
+      if (dbfr_getline(left_reader) <= 0)
         break;
-      }
+      have_left = 1;
     }
 
-    if (right_reader->current_line == NULL ||
-        right_reader->current_line[0] == '\0') {
+    if (!have_right) {
       if (right_reader->eof) {
         /* no more delta data to merge in: just dump
            the rest of the full data set. */
-        Fputs(left_reader->current_line, out);
+        Fputs(left_reader, out);
         while (dbfr_getline(left_reader) > 0)
-          Fputs(left_reader->current_line, out);
+          Fputs(left_reader, out);
+        have_left = 0;
         continue;
       }
 
       /* get a line from the delta set */
-      if (dbfr_getline(right_reader) <= 0) {
-        free(right_reader->current_line);
-        right_reader->current_line = NULL;
+      if (dbfr_getline(right_reader) <= 0)
         continue;
-      }
+      have_right = 1;
     }
 
-    keycmp = compare_keys(left_reader->current_line,
-                          right_reader->current_line);
+    keycmp = compare_keys(left_reader, right_reader);
 
     switch (keycmp) {
         /* keys equal - print the delta line and scan
            forward in both files the next time around. */
       case 0:
-        Fputs(right_reader->current_line, out);
-        right_reader->current_line[0] = '\0';
-        left_reader->current_line[0] = '\0';
+        Fputs(right_reader, out);
+        have_right = 0;
+        have_left = 0;
         break;
 
         /* delta line greater than full-set line.
@@ -214,29 +236,32 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
            line for later.
          */
       case -1:
-        Fputs(left_reader->current_line, out);
-        left_reader->current_line[0] = '\0';
+        Fputs(left_reader, out);
+        have_left = 0;
         break;
 
         /* delta line less than full-set line: the full
            set did not previously contain the key from
            delta. */
       case 1:
-        Fputs(right_reader->current_line, out);
-        right_reader->current_line[0] = '\0';
+        Fputs(right_reader, out);
+        have_right = 0;
         break;
     }
   }
 
-  if (right_reader->current_line != NULL &&
-      right_reader->current_line[0] != '\0')
-    Fputs(right_reader->current_line, out);
+  if (have_right)
+    Fputs(right_reader, out);
 
   if (! right_reader->eof) {
     while (dbfr_getline(right_reader) > 0)
-      Fputs(right_reader->current_line, out);
+      Fputs(right_reader, out);
   }
 
+  /* the readers' lines are about to go away. */
+  if (bufout_release(out) != 0)
+    retval = EXIT_FILE_ERR;
+
   if (keyfields)
     free(keyfields);
 
@@ -244,41 +269,30 @@ int merge_files(dbfr_t *left_reader, dbfr_t *right_reader, FILE * out,
 }
 
 
-int compare_keys(char *buffer_left, char *buffer_right) {
-  int keycmp = 0;
-  int i;
-  char field_left[MAX_FIELD_LEN + 1];
-  char field_right[MAX_FIELD_LEN + 1];
-
-  // printf("inside compare_keys([%s], [%s])\n", buffer_left, buffer_right);
-  if (buffer_left == NULL && buffer_right == NULL) {
-    return LEFT_RIGHT_EQUAL;
+/* gets the collation key of a reader's current line, building it if it
+   isn't already in the cache. */
+static const collate_key_t * line_key(struct line_key *cache,
+                                      const dbfr_t *reader) {
+  if (cache->line_no != reader->line_no) {
+    linesplit_n(&key_split, reader->current_line, reader->current_line_len,
+                delim);
+    collate_key_fields(&cache->key, &key_split, keyfields, nkeys);
+    cache->line_no = reader->line_no;
   }
+  return &cache->key;
+}
 
-  /* these special cases may seem counter-intuitive, but saying that
-     a NULL line is greater than a non-NULL line results in
-     the non-NULL line getting printed and a new line read in.
-   */
-  if (buffer_left == NULL)
-    return LEFT_GREATER;
-
-  if (buffer_right == NULL)
-    return RIGHT_GREATER;
-
-  for (i = 0; i < nkeys; i++) {
-    get_line_field(field_left, buffer_left, MAX_FIELD_LEN, keyfields[i], delim);
-    get_line_field(field_right, buffer_right, MAX_FIELD_LEN, keyfields[i],
-                   delim);
-    /* printf("Comparing (%s) to (%s) inside compare_keys\n", field_left, field_right); */
-    if ((keycmp = strcoll(field_left, field_right)) != 0)
-      break;
-  }
+
+int compare_keys(dbfr_t *left, dbfr_t *right) {
+  int keycmp;
+
+  keycmp = collate_key_cmp(line_key(&left_line_key, left),
+                           line_key(&right_line_key, right));
 
   /* ensure predictable return values */
   if (keycmp == 0)
     return 0;
   if (keycmp < 0)
     return -1;
-  if (keycmp > 0)
-    return 1;
+  return 1;
 }
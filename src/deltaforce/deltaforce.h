@@ -18,6 +18,8 @@
 # include <config.h>
 #endif
 
+#include <crush/bufout.h>
+#include <crush/collate.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
 
@@ -68,7 +70,15 @@
 #define LEFT_RIGHT_EQUAL   0
 
 
-int merge_files(dbfr_t *left, dbfr_t *right, FILE * out, struct cmdargs *args);
-int compare_keys(char *buffer_left, char *buffer_right);
+/* the collation key of an input's current line, so that a line which is
+   compared several times is only transformed once. */
+struct line_key {
+  collate_key_t key;
+  size_t line_no;
+};
+
+int merge_files(dbfr_t *left, dbfr_t *right, bufout_t *out,
+                struct cmdargs *args);
+int compare_keys(dbfr_t *left, dbfr_t *right);
 
 #endif /* DELTAFORCE_H */
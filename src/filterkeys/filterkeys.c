@@ -17,9 +17,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <crush/bufout.h>
 #include <crush/general.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
+#include <crush/linesplit.h>
 #include "filterkeys_main.h"
 #include "filterkeys.h"
 
@@ -31,6 +33,15 @@ char default_delim[2] = { 0xfe, 0x00 };
 char *delim;
 struct fkeys_conf fk_conf;
 
+/* a null-terminated copy of a reader's current line, which is only a view
+   if the reader has mapped its file. */
+static char * current_line_dup(const dbfr_t *reader) {
+  char *line = xmalloc(reader->current_line_len + 1);
+  memcpy(line, reader->current_line, reader->current_line_len);
+  line[reader->current_line_len] = '\0';
+  return line;
+}
+
 /* parse key fields */
 static int configure_filterkeys(struct fkeys_conf *conf, 
                                 struct cmdargs *args,
@@ -38,6 +49,7 @@ static int configure_filterkeys(struct fkeys_conf *conf,
                                 dbfr_t *stream_reader) {
   size_t arrsz=0, brrsz=0;
   int i, j;
+  char *stream_header;
 
   memset(conf, 0x0, sizeof(struct fkeys_conf));
 
@@ -50,9 +62,10 @@ static int configure_filterkeys(struct fkeys_conf *conf,
         filter_reader->current_line,
         delim, &conf->aindexes, &arrsz);
 
-    conf->key_count = expand_label_list(args->key_labels,
-                                        stream_reader->current_line,
+    stream_header = current_line_dup(stream_reader);
+    conf->key_count = expand_label_list(args->key_labels, stream_header,
                                         delim, &conf->bindexes, &brrsz);
+    free(stream_header);
     /* preserve header implied */
     args->preserve_header = 1;
 
@@ -74,8 +87,9 @@ static int configure_filterkeys(struct fkeys_conf *conf,
     dbfr_getline(stream_reader);
   
     char label_left[MAX_FIELD_LEN + 1], label_right[MAX_FIELD_LEN + 1];
+    stream_header = current_line_dup(stream_reader);
     int nfields_filter = fields_in_line(filter_reader->current_line, delim);
-    int nfields_stream = fields_in_line(stream_reader->current_line, delim);
+    int nfields_stream = fields_in_line(stream_header, delim);
 
     j = (nfields_filter < nfields_stream ? nfields_filter : nfields_stream);
     conf->aindexes = (int*)malloc(sizeof(int) * j);
@@ -86,7 +100,7 @@ static int configure_filterkeys(struct fkeys_conf *conf,
       for (j = 0; j < nfields_stream; j++) {
         get_line_field(label_left, filter_reader->current_line,
             MAX_FIELD_LEN, i, delim);
-        get_line_field(label_right, stream_reader->current_line,
+        get_line_field(label_right, stream_header,
             MAX_FIELD_LEN, j, delim);
 
         if (strcmp(label_left, label_right) == 0) {
@@ -96,6 +110,7 @@ static int configure_filterkeys(struct fkeys_conf *conf,
           break;
         }
       }
+    free(stream_header);
 
     /* preserve header implied */
     args->preserve_header = 1;
@@ -111,25 +126,31 @@ static int configure_filterkeys(struct fkeys_conf *conf,
 
 /* reconfigure_filterkeys() */
 
+/* the length of the key made by concatenating some fields of a line */
+static size_t key_len(const linesplit_t *split, const int *indexes,
+                      ssize_t key_count) {
+  size_t len = 0;
+  int i;
+  for (i = 0; i < key_count; i++) {
+    if (indexes[i] < split->n_fields)
+      len += linesplit_field_len(split, indexes[i]);
+  }
+  return len;
+}
+
 /* load the filter from the filter file */
 static int load_filter(struct fkeys_conf *conf, dbfr_t *filter_reader) {
-  char *t_keybuf;
-  int i, acum_len;
+  linesplit_t split;
 
   ht_init(&conf->filter, 1024, NULL, NULL);
+  linesplit_init(&split, 0);
   while (dbfr_getline(filter_reader) > 0) {
-
-    t_keybuf = (char *) xmalloc(filter_reader->current_line_sz);
-    for (acum_len = 0, i = 0; i < conf->key_count; i++)
-      acum_len += get_line_field(t_keybuf + acum_len,
-                                 filter_reader->current_line,
-                                 filter_reader->current_line_sz - acum_len,
-                                 conf->aindexes[i], delim);
-    if (acum_len > 0)
-      ht_put(&conf->filter, t_keybuf, (void*)0xDEADBEEF);
-      //bst_insert(&conf->ftree, t_keybuf);
+    linesplit(&split, filter_reader->current_line, delim);
+    if (key_len(&split, conf->aindexes, conf->key_count) > 0)
+      ht_put_fields(&conf->filter, &split, conf->aindexes, conf->key_count,
+                    "", (void*)0xDEADBEEF);
   }
-  conf->key_buffer_sz = filter_reader->current_line_sz;
+  linesplit_destroy(&split);
 
   return 0;
 }
@@ -145,9 +166,12 @@ static int load_filter(struct fkeys_conf *conf, dbfr_t *filter_reader) {
  */
 int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   FILE *ffile, *outfile;
+  bufout_t *out;
   dbfr_t *filter_reader, *stream_reader;
-  char *t_keybuf;
-  int i, acum_len;
+  dbfr_batch_t batch;
+  dbfr_line_t *line;
+  linesplit_t split;
+  size_t i;
 
   if (args->outfile) {
     if ((outfile = fopen(args->outfile, "w")) == NULL) {
@@ -157,6 +181,7 @@ int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   } else {
     outfile = stdout;
   }
+  out = bufout_init(outfile);
 
   /* choose field delimiter */
   if (!(delim = (args->delim ? args->delim : getenv("DELIMITER"))))
@@ -177,10 +202,11 @@ int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   }
   filter_reader = dbfr_init( ffile );
 
-  /* input files */
+  /* input files.  lines which pass the filter are written straight out of
+     the mapped file. */
   if (!(ffile = (optind < argc ? nextfile(argc, argv, &optind, "r") : stdin)))
     return EXIT_FILE_ERR;
-  stream_reader = dbfr_init( ffile );
+  stream_reader = dbfr_mmap_init( ffile );
 
 
   if (configure_filterkeys(&fk_conf, args, filter_reader, stream_reader) != 0) {
@@ -195,33 +221,34 @@ int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
     /* if indexes where supplied read the header */
     if (args->akeys && args->bkeys)
       dbfr_getline(stream_reader);
-    fputs(stream_reader->current_line, outfile);
+    bufout_write(out, stream_reader->current_line,
+                 stream_reader->current_line_len);
   }
 
-  t_keybuf = (char *) xmalloc(fk_conf.key_buffer_sz);
+  linesplit_init(&split, 0);
+  dbfr_batch_init(&batch);
   while (ffile) {
-    while (dbfr_getline(stream_reader) > 0) {
-
-      for (acum_len = 0, i = 0;
-           i < fk_conf.key_count && fk_conf.key_buffer_sz > acum_len;
-           i++) {
-        acum_len += get_line_field(t_keybuf + acum_len,
-                                   stream_reader->current_line,
-                                   fk_conf.key_buffer_sz - acum_len,
-                                   fk_conf.bindexes[i], delim);
-      }
-
-      if (acum_len > 0) {
-        int found = (ht_get(&fk_conf.filter, t_keybuf) ==
-                     (void*) 0xDEADBEEF ? 1 : 0);
-        if (found ^ args->invert)
-          fputs(stream_reader->current_line, outfile);
+    while (dbfr_getlines(stream_reader, &batch, DBFR_BATCH_LINES) > 0) {
+      for (i = 0; i < batch.n_lines; i++) {
+        line = &batch.lines[i];
+        linesplit_n(&split, line->line, line->len, delim);
+
+        if (key_len(&split, fk_conf.bindexes, fk_conf.key_count) > 0) {
+          int found = (ht_get_fields(&fk_conf.filter, &split, fk_conf.bindexes,
+                                     fk_conf.key_count, "") ==
+                       (void*) 0xDEADBEEF ? 1 : 0);
+          if (found ^ args->invert)
+            bufout_write_ref(out, line->line, line->len);
+        }
       }
+      if (! dbfr_lines_persist(stream_reader))
+        bufout_release(out);
     }
 
+    bufout_release(out);
     dbfr_close(stream_reader);
     if ((ffile = nextfile(argc, argv, &optind, "r"))) {
-      stream_reader = dbfr_init( ffile );
+      stream_reader = dbfr_mmap_init( ffile );
       /* reconfigure fields (needed if labels were used) */
       /* TODO(rgranata): implement reconfigure field
       if (reconfigure_filterkeys(&fk_conf, args, NULL, stream_reader) != 0) {
@@ -233,10 +260,14 @@ int filterkeys(struct cmdargs *args, int argc, char *argv[], int optind) {
         dbfr_getline(stream_reader);
     }
   }
-  if (t_keybuf)
-    free(t_keybuf);
+  dbfr_batch_destroy(&batch);
+  linesplit_destroy(&split);
 
   ht_destroy(&fk_conf.filter);
 
+  if (bufout_close(out) != 0) {
+    warn("%s", args->outfile ? args->outfile : "stdout");
+    return EXIT_FILE_ERR;
+  }
   return 0;
 }
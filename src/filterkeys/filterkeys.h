@@ -8,7 +8,6 @@
 struct fkeys_conf {
   ssize_t key_count;
 
-  size_t key_buffer_sz;
   int *aindexes, *bindexes;
   
   hashtbl_t filter;
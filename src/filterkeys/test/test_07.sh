@@ -0,0 +1,17 @@
+test_number=07
+description="filtered stream on stdin"
+
+# lines read from a pipe are passed through just as those from a mapped file.
+outfile="$test_dir/test_$test_number.actual"
+expected="$test_dir/test_02.expected"
+
+cat "$test_dir/test-1.in" |
+  $bin -p -v -a 1 -b 1 -f "$test_dir/test-filter.in" > "$outfile"
+
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number 1 "$description" FAIL
+else
+  test_status $test_number 1 "$description" PASS
+  rm "$outfile"
+fi
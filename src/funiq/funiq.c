@@ -15,12 +15,55 @@
  ********************************/
 #include "funiq_main.h"
 
+#include <crush/bufout.h>
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
+#include <crush/linesplit.h>
+
+/* the value of one key field in the last line which was written out. */
+typedef struct {
+  char *value;
+  size_t len;
+  size_t sz;
+} prev_field_t;
+
+/* the length of a line without its trailing linebreak. */
+static size_t line_body_len(const char *line, size_t len) {
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    len--;
+  return len;
+}
+
+/* compares the key fields of a split line with the previous unique line's,
+   then remembers the new values.  returns non-zero if they all matched. */
+static int update_prev_fields(prev_field_t *prev, const linesplit_t *split,
+                              const int *fields, size_t n_fields) {
+  const char *value;
+  size_t len, i;
+  int matched = 1;
 
-#define FIELD_LEN_LIMIT 255
+  for (i = 0; i < n_fields; i++) {
+    if (fields[i] <= split->n_fields) {
+      value = linesplit_field_ptr(split, fields[i] - 1);
+      len = linesplit_field_len(split, fields[i] - 1);
+    } else {
+      value = "";
+      len = 0;
+    }
+    if (len == prev[i].len && memcmp(value, prev[i].value, len) == 0)
+      continue;
 
+    matched = 0;
+    if (len > prev[i].sz) {
+      prev[i].sz = len * 2;
+      prev[i].value = xrealloc(prev[i].value, prev[i].sz);
+    }
+    memcpy(prev[i].value, value, len);
+    prev[i].len = len;
+  }
+  return matched;
+}
 
 /** @brief  
   * 
@@ -40,14 +83,21 @@ int funiq(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   FILE *in;
   dbfr_t *in_reader;
+  dbfr_batch_t batch;
+  dbfr_line_t *line;
+  linesplit_t split;
+  bufout_t *out;
 
-  char **prev_line;             /* fields from previous line of input */
-  char cur_field[FIELD_LEN_LIMIT];
+  prev_field_t *prev_fields;    /* fields from previous unique line */
+  char *header;
+  size_t body_len;
 
   int i;
+  size_t j;
 
-  int dup_count = 1;            /* used with -c option */
+  int dup_count = 0;            /* used with -c option */
   char linebreak[3];
+  size_t linebreak_len = 0;
 
   /* use the default delimiter if necessary */
   if (!args->delim) {
@@ -66,104 +116,108 @@ int funiq(struct cmdargs *args, int argc, char *argv[], int optind) {
     fprintf(stderr, "%s: no valid input files\n", argv[0]);
     return EXIT_HELP;
   }
-  in_reader = dbfr_init(in);
+  in_reader = dbfr_mmap_init(in);
 
   if (args->fields)
     n_fields = expand_nums(args->fields, &fields, &fields_sz);
-  else if (args->field_labels)
-    n_fields = expand_label_list(args->field_labels, in_reader->next_line,
+  else if (args->field_labels) {
+    header = dbfr_next_line_dup(in_reader);
+    n_fields = expand_label_list(args->field_labels, header,
                                  args->delim, &fields, &fields_sz);
+    free(header);
+  }
   if (n_fields < 0) {
     fprintf(stderr, "%s: error expanding field list\n", argv[0]);
     return EXIT_HELP;
   }
 
-  /* prepare the array of previous field values */
-  prev_line = xmalloc(sizeof(char *) * n_fields);
+  prev_fields = xmalloc(sizeof(prev_field_t) * n_fields);
   for (i = 0; i < n_fields; i++) {
-    prev_line[i] = xmalloc(sizeof(char *) * FIELD_LEN_LIMIT);
-  }
-
-  /* get the first line to seed the prev_line array */
-  i = dbfr_getline(in_reader);
-
-  /* preserve input linebreak style.  assume there can only be 1 or 2 chars
-   * in a linebreak sequence */
-  if (in_reader->current_line[i - 2] == '\r' ||
-      in_reader->current_line[i - 2] == '\n') {
-    linebreak[0] = in_reader->current_line[i - 2];
-    linebreak[1] = in_reader->current_line[i - 1];
-    linebreak[2] = '\0';
-  } else {
-    linebreak[0] = in_reader->current_line[i - 1];
-    linebreak[1] = '\0';
+    prev_fields[i].sz = 64;
+    prev_fields[i].value = xmalloc(prev_fields[i].sz);
+    prev_fields[i].len = 0;
   }
-  chomp(in_reader->current_line);
 
-  for (i = 0; i < n_fields; i++) {
-    get_line_field(prev_line[i], in_reader->current_line, FIELD_LEN_LIMIT - 1,
-                   fields[i] - 1, args->delim);
-  }
-  printf("%s", in_reader->current_line); /* first line is never a dup */
+  out = bufout_init(stdout);
+  linesplit_init(&split, 0);
+  dbfr_batch_init(&batch);
 
+  /* unique lines are passed through by reference whenever they end in the
+     same linebreak as the first line; the rest are rewritten. */
   while (in) {
-    int matching_fields;
-
-    while (dbfr_getline(in_reader) > 0) {
-      chomp(in_reader->current_line);
-
-      matching_fields = 0;
-
-      for (i = 0; i < n_fields; i++) {
-        /* extract the field from the input line */
-        get_line_field(cur_field, in_reader->current_line, FIELD_LEN_LIMIT - 1,
-                       fields[i] - 1, args->delim);
-
-        /* see if the field is a duplicate */
-        if (str_eq(cur_field, prev_line[i]))
-          matching_fields++;
-
-        /* store this line's value */
-        strcpy(prev_line[i], cur_field);
-      }
-
-      /* if not all of the fields matched, the line
-         wasn't a duplicate */
-      if (matching_fields != n_fields) {
+    while (dbfr_getlines(in_reader, &batch, DBFR_BATCH_LINES) > 0) {
+      for (j = 0; j < batch.n_lines; j++) {
+        line = &batch.lines[j];
+        body_len = line_body_len(line->line, line->len);
+        linesplit_n(&split, line->line, body_len, args->delim);
+
+        /* preserve input linebreak style.  assume there can only be 1 or 2
+         * chars in a linebreak sequence.  the first line is never a dup. */
+        if (linebreak_len == 0) {
+          if (line->len - body_len >= 2) {
+            linebreak[0] = line->line[line->len - 2];
+            linebreak[1] = line->line[line->len - 1];
+            linebreak_len = 2;
+          } else if (line->len - body_len == 1) {
+            linebreak[0] = line->line[line->len - 1];
+            linebreak_len = 1;
+          } else {
+            linebreak[0] = '\n';
+            linebreak_len = 1;
+          }
+          linebreak[linebreak_len] = '\0';
+          update_prev_fields(prev_fields, &split, fields, n_fields);
+        } else if (update_prev_fields(prev_fields, &split, fields, n_fields)) {
+          dup_count++;
+          continue;
+        } else if (args->count) {
+          /* print the number of dups for the previous output line */
+          bufout_puts(out, args->delim);
+          bufout_put_long(out, dup_count);
+          bufout_write(out, linebreak, linebreak_len);
+        }
+        dup_count = 1;
 
         if (args->count) {
-          /* print the number of dups for
-           * the previous output line */
-          printf("%s%d%s", args->delim, dup_count, linebreak);
+          bufout_write_ref(out, line->line, body_len);
+        } else if (line->len - body_len == linebreak_len &&
+                   memcmp(line->line + body_len, linebreak,
+                          linebreak_len) == 0) {
+          bufout_write_ref(out, line->line, line->len);
         } else {
-          /* give the previous output line a linebreak */
-          printf("%s", linebreak);
+          bufout_write(out, line->line, body_len);
+          bufout_write(out, linebreak, linebreak_len);
         }
-        printf("%s", in_reader->current_line);
-        dup_count = 1;
-      } else {
-        dup_count++;
       }
+      if (! dbfr_lines_persist(in_reader))
+        bufout_release(out);
     }
 
+    bufout_release(out);
     dbfr_close(in_reader);
     in = nextfile(argc, argv, &optind, "r");
     if (in)
-      in_reader = dbfr_init(in);
+      in_reader = dbfr_mmap_init(in);
   }
 
-  if (args->count) {
+  if (args->count && dup_count > 0) {
     /* print the number of dups for the last output line */
-    printf("%s%d%s", args->delim, dup_count, linebreak);
-  } else {
-    /* give the last output line a linebreak */
-    printf("%s", linebreak);
+    bufout_puts(out, args->delim);
+    bufout_put_long(out, dup_count);
+    bufout_write(out, linebreak, linebreak_len);
+  }
+
+  if (bufout_close(out) != 0) {
+    perror("stdout");
+    return EXIT_FILE_ERR;
   }
 
+  dbfr_batch_destroy(&batch);
+  linesplit_destroy(&split);
   for (i = 0; i < n_fields; i++) {
-    free(prev_line[i]);
+    free(prev_fields[i].value);
   }
-  free(prev_line);
+  free(prev_fields);
   free(fields);
   return EXIT_OKAY;
 }
@@ -0,0 +1,37 @@
+test_number=05
+description="keys longer than 254 bytes"
+
+input=$test_dir/test_$test_number.in
+expected=$test_dir/test_$test_number.expected
+
+# the keys only differ after their first 300 bytes, so none are duplicates.
+awk 'BEGIN { for (i = 0; i < 300; i++) prefix = prefix "x";
+             printf "f0\tf1\n%sa\t1\n%sb\t2\n%sa\t3\n", prefix, prefix,
+                    prefix }' > $input
+cp $input $expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.out
+$bin -f 1 $input > $output
+if [ $? -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (file)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (file)" PASS
+  rm $output
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.out
+cat $input | $bin -f 1 > $output
+if [ $? -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (stdin)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (stdin)" PASS
+  rm $output
+fi
+
+if [ ! $has_error ]; then
+  rm $expected $input
+fi
@@ -15,9 +15,77 @@
  ********************************/
 
 #include <crush/general.h>
+#include <crush/parchunk.h>
 #include "grepfield_main.h"
 #include "grepfield.h"
 
+/* the search to run, shared by every thread. */
+struct grep_conf {
+  const char *regex;            /* the pattern, before compilation */
+  int reg_flags;                /* flags to pass to regcomp() */
+  int match;                    /* the expected return value of regexec() */
+  const char *delim;
+  int field_no;                 /* the field number specified by the user */
+
+  /* function to pull the field out of the input line
+     using a pointer so the case of no field can be treated
+     the same as the normal case inside the file reading loop.
+   */
+  const char *(*field_to_scan) (const char *, size_t, linesplit_t *,
+                                const char *, int, size_t *);
+};
+
+/* each thread compiles the pattern for itself, since regexec() may lock a
+   compiled pattern while using it. */
+struct grep_worker {
+  const struct grep_conf *conf;
+  regex_t pattern;
+  linesplit_t split;
+  char *textbuf;                /* null-terminated copy of text, if needed */
+  size_t textbuf_sz;
+};
+
+static void * grep_thread_init(void *arg) {
+  struct grep_worker *worker = xmalloc(sizeof(struct grep_worker));
+  worker->conf = arg;
+  /* the pattern has already compiled once, so it will again. */
+  regcomp(&worker->pattern, worker->conf->regex, worker->conf->reg_flags);
+  linesplit_init(&worker->split, 0);
+  worker->textbuf = NULL;
+  worker->textbuf_sz = 0;
+  return worker;
+}
+
+static void grep_thread_destroy(void *state) {
+  struct grep_worker *worker = state;
+  regfree(&worker->pattern);
+  linesplit_destroy(&worker->split);
+  free(worker->textbuf);
+  free(worker);
+}
+
+/* passes through the lines of a chunk which match. */
+static int grep_chunk(void *state, const char *data, size_t len,
+                      size_t line_no, bufout_t *out) {
+  struct grep_worker *worker = state;
+  const struct grep_conf *conf = worker->conf;
+  const char *end = data + len;
+  const char *text;             /* the text to scan & its length */
+  size_t text_len, line_len;
+
+  for (; data < end; data += line_len) {
+    line_len = parchunk_line_len(data, end);
+    text = conf->field_to_scan(data, line_len, &worker->split, conf->delim,
+                               conf->field_no, &text_len);
+    if (text == NULL)
+      continue;
+    if (match_text(&worker->pattern, text, text_len, &worker->textbuf,
+                   &worker->textbuf_sz) == conf->match)
+      bufout_write_ref(out, data, line_len);
+  }
+  return 0;
+}
+
 /** @brief
   *
   * @param args contains the parsed cmd-line options & arguments.
@@ -35,18 +103,13 @@ int grepfield(struct cmdargs *args, int argc, char *argv[], int optind) {
   int reg_flags;                /* flags to pass to regcomp() */
   int err_code;                 /* holds the return value of regcomp() */
 
-  FILE *in, *out;               /* input & output files */
+  FILE *in, *outfile;           /* input & output files */
+  bufout_t *out;
   dbfr_t *in_reader;
-  int field_no;                 /* the field number specified by the user */
-
-  char *fieldval = NULL;        /* buffer for the field to scan & its size */
-  ssize_t fldsz = 0;
-
-  /* function to pull the field out of the input line
-     using a pointer so the case of no field can be treated
-     the same as the normal case inside the file reading loop.
-   */
-  char *(*field_to_scan) (char **, ssize_t *, char *, char *, int f);
+  struct grep_conf conf;
+  parchunk_ops_t ops = { grep_chunk, grep_thread_init, grep_thread_destroy,
+                         &conf };
+  int n_threads = 1;
 
   if (optind >= argc) {
     usage(argv[0]);
@@ -60,24 +123,34 @@ int grepfield(struct cmdargs *args, int argc, char *argv[], int optind) {
   }
   expand_chars(args->delim);
 
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", getenv("_"),
+            args->threads);
+    return EXIT_HELP;
+  }
+
   reg_flags = REG_EXTENDED;
   if (args->ignore_case)
     reg_flags |= REG_ICASE;
 
-  err_code = regcomp(&pattern, argv[optind++], reg_flags);
+  conf.regex = argv[optind++];
+  conf.reg_flags = reg_flags;
+  err_code = regcomp(&pattern, conf.regex, reg_flags);
   if (err_code != REG_OK) {
     re_perror(err_code, pattern);
     return EXIT_HELP;
   }
+  regfree(&pattern);
 
   if (args->outfile) {
-    if ((out = fopen(args->outfile, "w")) == NULL) {
+    if ((outfile = fopen(args->outfile, "w")) == NULL) {
       perror(args->outfile);
       exit(EXIT_FILE_ERR);
     }
   } else {
-    out = stdout;
+    outfile = stdout;
   }
+  out = bufout_init(outfile);
 
   if (optind < argc)
     in = nextfile(argc, argv, &optind, "r");
@@ -85,93 +158,108 @@ int grepfield(struct cmdargs *args, int argc, char *argv[], int optind) {
     in = stdin;
   if (! in)
     return EXIT_FILE_ERR;
-  in_reader = dbfr_init(in);
+  /* matching lines are written straight out of the mapped file. */
+  in_reader = dbfr_mmap_init(in);
 
   if (args->field) {
-    field_no = atoi(args->field) - 1;
-    field_to_scan = scan_field;
-    if (field_no < 0) {
-      fprintf(stderr, "%s: %d: invalid field number.\n", getenv("_"), field_no);
+    conf.field_no = atoi(args->field) - 1;
+    conf.field_to_scan = scan_field;
+    if (conf.field_no < 0) {
+      fprintf(stderr, "%s: %d: invalid field number.\n", getenv("_"),
+              conf.field_no);
       return EXIT_HELP;
     }
   } else if (args->field_label) {
-    field_no = field_str(args->field_label, in_reader->next_line, args->delim);
-    field_to_scan = scan_field;
-    if (field_no < 0) {
+    char *header = dbfr_next_line_dup(in_reader);
+    conf.field_no = field_str(args->field_label, header, args->delim);
+    free(header);
+    conf.field_to_scan = scan_field;
+    if (conf.field_no < 0) {
       fprintf(stderr, "%s: %s: invalid field label.\n",
               getenv("_"), args->field_label);
       return EXIT_HELP;
     }
     args->preserve_header = 1;
   } else {
-    field_no = -1;
-    field_to_scan = scan_wholeline;
+    conf.field_no = -1;
+    conf.field_to_scan = scan_wholeline;
   }
+  conf.delim = args->delim;
 
 
   /* set the flags variable to the expected return value
      of regexec() */
   if (args->invert)
-    reg_flags = REG_NOMATCH;
+    conf.match = REG_NOMATCH;
   else
-    reg_flags = 0;
+    conf.match = 0;
 
   if (args->preserve_header) {
     if (dbfr_getline(in_reader) > 0) {
-      fputs(in_reader->current_line, out);
+      bufout_write(out, in_reader->current_line, in_reader->current_line_len);
     }
   }
 
   while (in != NULL) {
-    while (dbfr_getline(in_reader) > 0) {
-      if (field_to_scan(&fieldval, &fldsz, in_reader->current_line,
-                        args->delim, field_no) == NULL)
-        continue;
-      if (regexec(&pattern, fieldval, 0, NULL, 0) == reg_flags)
-        fputs(in_reader->current_line, out);
-    }
+    parchunk_run(in_reader, out, n_threads, &ops);
 
     dbfr_close(in_reader);
     if((in = nextfile(argc, argv, &optind, "r"))) {
-      in_reader = dbfr_init(in);
+      in_reader = dbfr_mmap_init(in);
       /* discard header from subsequent files */
       if (args->preserve_header)
         dbfr_getline(in_reader);
     }
   }
 
-  regfree(&pattern);
-  fclose(out);
+  if (bufout_close(out) != 0) {
+    perror(args->outfile ? args->outfile : "stdout");
+    return EXIT_FILE_ERR;
+  }
+  fclose(outfile);
 
   return EXIT_OKAY;
 }
 
-/* just points the field buffer at the original line */
-char *scan_wholeline(char **field_buffer, ssize_t * field_buffer_size,
-                     char *orig_line, char *delim, int field_no) {
-  *field_buffer = orig_line;
-  return *field_buffer;
+/* just points at the original line */
+const char *scan_wholeline(const char *line, size_t line_len,
+                           linesplit_t *split, const char *delim,
+                           int field_no, size_t *text_len) {
+  *text_len = line_len;
+  return line;
 }
 
-/* (re)allocates memory for the field buffer as necessary and copies
- * the desired field into it.
+/* points at the desired field of the line, or returns NULL if the line has
+ * no such field.
  */
-char *scan_field(char **field_buffer, ssize_t * field_buffer_size,
-                 char *orig_line, char *delim, int field_no) {
-  if (*field_buffer_size < strlen(orig_line)) {
-    char *tmp;
-    if (*field_buffer)
-      tmp = xrealloc(*field_buffer, strlen(orig_line));
-    else
-      tmp = xmalloc(strlen(orig_line));
-    *field_buffer = tmp;
-  }
-
-  if (get_line_field
-      (*field_buffer, orig_line, *field_buffer_size, field_no, delim) < 0)
+const char *scan_field(const char *line, size_t line_len, linesplit_t *split,
+                       const char *delim, int field_no, size_t *text_len) {
+  if (linesplit_n(split, line, line_len, delim) <= field_no)
     return NULL;
+  *text_len = linesplit_field_len(split, field_no);
+  return linesplit_field_ptr(split, field_no);
+}
 
-  return *field_buffer;
+/* runs regexec() over text which need not be null-terminated.  where the
+ * regex library can't be told where the text ends, it is copied into
+ * textbuf first.
+ */
+int match_text(regex_t *pattern, const char *text, size_t text_len,
+               char **textbuf, size_t *textbuf_sz) {
+#ifdef REG_STARTEND
+  regmatch_t range;
+  range.rm_so = 0;
+  range.rm_eo = text_len;
+  return regexec(pattern, text, 1, &range, REG_STARTEND);
+#else
+  if (*textbuf_sz < text_len + 1) {
+    *textbuf_sz = text_len + 1;
+    *textbuf = xrealloc(*textbuf, *textbuf_sz);
+  }
+  memcpy(*textbuf, text, text_len);
+  (*textbuf)[text_len] = '\0';
+  return regexec(pattern, *textbuf, 0, NULL, 0);
+#endif
 }
 
 void re_perror(int err_code, regex_t pattern) {
@@ -30,8 +30,10 @@
 # include <stdlib.h>
 #endif
 
+#include <crush/bufout.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
+#include <crush/linesplit.h>
 
 #ifndef GREPFIELD_H
 #define GREPFIELD_H
@@ -41,8 +43,11 @@
 #endif
 
 
-char *scan_wholeline(char **, ssize_t *, char *, char *, int);
-char *scan_field(char **, ssize_t *, char *, char *, int);
+const char *scan_wholeline(const char *, size_t, linesplit_t *, const char *,
+                           int, size_t *);
+const char *scan_field(const char *, size_t, linesplit_t *, const char *, int,
+                       size_t *);
+int match_text(regex_t *, const char *, size_t, char **, size_t *);
 void re_perror(int err_code, regex_t pattern);
 
 #endif
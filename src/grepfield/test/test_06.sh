@@ -0,0 +1,41 @@
+test_number=06
+description="linebreaks and threads"
+
+input=$test_dir/test_$test_number.in
+expected=$test_dir/test_$test_number.expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.out
+$bin -f 2 a5 $input > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (mapped)" FAIL
+else
+  test_status $test_number $subtest "$description (mapped)" PASS
+  rm $output
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.out
+cat $input | $bin -T 2 -f 2 a5 > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (piped, threads)" FAIL
+else
+  test_status $test_number $subtest "$description (piped, threads)" PASS
+  rm $output
+fi
+
+# enough lines for several chunks, so that they are divided up between the
+# threads.  every other line matches, in 40 runs which must come out whole
+# and in order.
+subtest=3
+output=$test_dir/test_$test_number.$subtest.out
+expected=$test_dir/test_$test_number.big.expected
+awk 'BEGIN { for (i = 0; i < 200000; i++)
+               printf "r%d\t%d\tpadding\n", int(i / 5000), i % 2 }' |
+  $bin -T 3 -f 2 '^1$' | runs > $output
+if [ ${PIPESTATUS[1]} -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (several chunks)" FAIL
+else
+  test_status $test_number $subtest "$description (several chunks)" PASS
+  rm $output
+fi
@@ -0,0 +1,31 @@
+test_number=07
+description="last line without a linebreak"
+
+input=$test_dir/test_$test_number.in
+expected=$test_dir/test_$test_number.expected
+printf 'a\t1\nb\t2\nc\t1' > $input
+printf 'a\t1\nc\t1' > $expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.out
+$bin -f 2 1 $input > $output
+if [ $? -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (file)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (file)" PASS
+  rm $output
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.out
+cat $input | $bin -f 2 1 > $output
+if [ $? -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (stdin)" FAIL
+  has_error=1
+else
+  test_status $test_number $subtest "$description (stdin)" PASS
+  rm $output
+fi
+
+test $has_error || rm $input $expected
@@ -17,23 +17,86 @@
 # include <config.h>
 #endif
 
+#include <crush/bufout.h>
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
 #include <crush/hashtbl.h>
+#include <crush/linesplit.h>
+#include <crush/parchunk.h>
 
 #include "hashjoin_main.h"
 
 char default_delim[] = {0xfe, 0x00};
 
 static void extract_fields(int *field_list, size_t n_fields,
-                           const char *line, char *target, size_t target_sz,
-                           const char *ifs, const char *ofs);
+                           const linesplit_t *split, char *target,
+                           size_t target_sz, const char *ofs);
 
 static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht);
 
 static void decrement(int *lst, size_t n);
 
+/* the lookup to do, shared by every thread.  the dimension table is only
+   read once it has been loaded, so the threads can share it. */
+struct join_conf {
+  hashtbl_t *dimension;
+  const int *key_fields;
+  size_t n_key_fields;
+  const char *delim;
+  const char *empty_value;
+};
+
+/* the fields of a thread's current line, for building its key. */
+struct join_worker {
+  const struct join_conf *conf;
+  linesplit_t split;
+};
+
+static void * join_thread_init(void *arg) {
+  struct join_worker *worker = xmalloc(sizeof(struct join_worker));
+  worker->conf = arg;
+  linesplit_init(&worker->split, 0);
+  return worker;
+}
+
+static void join_thread_destroy(void *state) {
+  struct join_worker *worker = state;
+  linesplit_destroy(&worker->split);
+  free(worker);
+}
+
+/* the length of a line without its linebreak, as chomp() would leave it. */
+static size_t line_body_len(const char *line, size_t len) {
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    len--;
+  return len;
+}
+
+/* appends the dimension values to every line of a chunk. */
+static int join_chunk(void *state, const char *data, size_t len,
+                      size_t line_no, bufout_t *out) {
+  struct join_worker *worker = state;
+  const struct join_conf *conf = worker->conf;
+  const char *end = data + len, *value;
+  size_t line_len, body_len;
+
+  for (; data < end; data += line_len) {
+    line_len = parchunk_line_len(data, end);
+    body_len = line_body_len(data, line_len);
+    linesplit_n(&worker->split, data, body_len, conf->delim);
+    value = ht_get_fields(conf->dimension, &worker->split, conf->key_fields,
+                          conf->n_key_fields, conf->delim);
+    if (! value)
+      value = conf->empty_value;
+    bufout_write(out, data, body_len);
+    bufout_puts(out, conf->delim);
+    bufout_puts(out, value);
+    bufout_putc(out, '\n');
+  }
+  return 0;
+}
+
 /** @brief Application entry point.
   *
   * @param args contains the parsed cmd-line options & arguments.
@@ -47,16 +110,19 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
   hashtbl_t dimension;
   FILE *infile;
   dbfr_t *datareader;
+  bufout_t *out;
 
-  char *keybuffer = NULL;
-  size_t keybuffer_sz = 0;
-
-  char *value, *empty_value;
+  char *empty_value;
   size_t n_values, i;
 
   int *key_fields = NULL;
   size_t n_key_fields = 0;
 
+  struct join_conf conf;
+  parchunk_ops_t ops = { join_chunk, join_thread_init, join_thread_destroy,
+                         &conf };
+  int n_threads = 1;
+
   if (! args->key_labels &&
       ! (args->data_key_fields && args->dimension_key_fields)) {
     fprintf(stderr, "%s: missing key field argument(s)\n", getenv("_"));
@@ -80,6 +146,12 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
     args->dimension_delim = args->delim;
   }
 
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", getenv("_"),
+            args->threads);
+    return EXIT_HELP;
+  }
+
   ht_init(&dimension, 1024, NULL, NULL);
   n_values = hash_dimension_file(args, &dimension);
 
@@ -89,6 +161,8 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
     strcat(empty_value, args->delim);
   }
 
+  out = bufout_init(stdout);
+
   if (argc > optind)
     infile = nextfile(argc, argv, &optind, "r");
   else
@@ -100,69 +174,70 @@ int hashjoin (struct cmdargs *args, int argc, char *argv[], int optind) {
     decrement(key_fields, n_key_fields);
   }
 
+  conf.dimension = &dimension;
+  conf.delim = args->delim;
+  conf.empty_value = empty_value;
+
   while (infile) {
-    datareader = dbfr_init(infile);
+    datareader = dbfr_mmap_init(infile);
 
     if (args->key_labels) {
-      n_key_fields = expand_label_list(args->key_labels, datareader->next_line,
+      /* lines from a mapped file are not null-terminated. */
+      size_t header_len = datareader->next_line ? datareader->next_line_len
+                                                : 0;
+      char *header = xmalloc(header_len + 1);
+      memcpy(header, datareader->next_line, header_len);
+      header[header_len] = '\0';
+      n_key_fields = expand_label_list(args->key_labels, header,
                                        args->delim, &key_fields,
                                        &n_key_fields);
+      free(header);
       decrement(key_fields, n_key_fields);
     }
 
     /* Add user-supplied dimension labels to the header row. */
     if (args->dimension_labels && ! args->dimension_field_labels) {
       dbfr_getline(datareader);
-      chomp(datareader->current_line);
-      printf("%s%s%s\n", datareader->current_line,
-             args->delim, args->dimension_labels);
-    }
-
-    if (! keybuffer) {
-      keybuffer = xmalloc(datareader->next_line_len);
-      keybuffer_sz = datareader->next_line_len;
+      bufout_write(out, datareader->current_line,
+                   line_body_len(datareader->current_line,
+                                 datareader->current_line_len));
+      bufout_puts(out, args->delim);
+      bufout_puts(out, args->dimension_labels);
+      bufout_putc(out, '\n');
     }
 
-    while (dbfr_getline(datareader) > 0) {
-      if (datareader->current_line_len > keybuffer_sz) {
-        keybuffer = xrealloc(keybuffer, datareader->current_line_len);
-        keybuffer_sz = datareader->current_line_len;
-      }
-      chomp(datareader->current_line);
-      extract_fields(key_fields, n_key_fields, datareader->current_line,
-                     keybuffer, keybuffer_sz,
-                     args->delim, args->delim);
-
-      value = ht_get(&dimension, keybuffer);
-      if (! value)
-        value = empty_value;
-      printf("%s%s%s\n", datareader->current_line, args->delim, value);
-    }
+    conf.key_fields = key_fields;
+    conf.n_key_fields = n_key_fields;
+    parchunk_run(datareader, out, n_threads, &ops);
 
+    dbfr_close(datareader);
     infile = nextfile(argc, argv, &optind, "r");
   }
 
+  if (bufout_close(out) != 0) {
+    warn("stdout");
+    return EXIT_FAILURE;
+  }
   return EXIT_OKAY;
 }
 
 
-/** @brief Extracts a list of fields from a string and stores them in a target
-  * buffer.
+/** @brief Extracts a list of fields from a split line and stores them in a
+  * target buffer.
   *
-  * The field separator used in the input string can be different from the
+  * The field separator used in the input line can be different from the
   * output field separator.
   *
   * @param field_list an array of 0-based indexes.
   * @param n_fields the number of elements in field_list.
-  * @param line the input string.
+  * @param split the fields of the input line.
   * @param target the output string buffer.
   * @param target_sz the size of target.
-  * @param ifs field separator used in line.
   * @param ofs field separator to use in target.
   */
 static void extract_fields(int *field_list, size_t n_fields,
-                           const char *line, char *target, size_t target_sz,
-                           const char *ifs, const char *ofs) {
+                           const linesplit_t *split, char *target,
+                           size_t target_sz, const char *ofs) {
   int i;
   size_t target_len = 0,
          field_len,
@@ -170,19 +245,23 @@ static void extract_fields(int *field_list, size_t n_fields,
   target[0] = '\0';
 
   for (i=0; i < n_fields; i++) {
-    field_len = get_line_field(target + target_len, line,
-                               target_sz - target_len, field_list[i], ifs);
-    if (field_len < 0) {
-      /* TODO(jhinds): Maybe do something better than silently treating missing
-       * fields as empty. */
-      field_len = 0;
+    field_len = 0;
+    /* TODO(jhinds): Maybe do something better than silently treating missing
+     * fields as empty. */
+    if (field_list[i] < split->n_fields) {
+      field_len = linesplit_field_len(split, field_list[i]);
+      if (field_len > target_sz - target_len - 1)
+        field_len = target_sz - target_len - 1;
+      memcpy(target + target_len, linesplit_field_ptr(split, field_list[i]),
+             field_len);
     }
     target_len += field_len;
-    if (i < n_fields - 1) {
-      strncat(target, ofs, target_sz - target_len);
+    if (i < n_fields - 1 && ofs_len < target_sz - target_len) {
+      memcpy(target + target_len, ofs, ofs_len);
       target_len += ofs_len;
     }
   }
+  target[target_len] = '\0';
 }
 
 
@@ -214,6 +293,7 @@ static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
   int n_key_fields = 0,
       n_val_fields = 0;
   dbfr_t *dim_file = dbfr_open(args->dimension_file);
+  linesplit_t split;
 
   if (! dim_file) {
     warn(args->dimension_file);
@@ -256,6 +336,7 @@ static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
 
   field_buffer = xmalloc(dim_file->next_line_len);
   field_buffer_sz = dim_file->next_line_len;
+  linesplit_init(&split, 0);
 
   while (dbfr_getline(dim_file) > 0) {
     if (dim_file->current_line_len > field_buffer_sz) {
@@ -263,19 +344,16 @@ static size_t hash_dimension_file(struct cmdargs *args, hashtbl_t *ht) {
       field_buffer_sz = dim_file->current_line_len;
     }
 
-    extract_fields(val_fields, n_val_fields, dim_file->current_line,
-                   field_buffer, field_buffer_sz,
-                   args->dimension_delim, args->delim);
+    linesplit(&split, dim_file->current_line, args->dimension_delim);
+    extract_fields(val_fields, n_val_fields, &split,
+                   field_buffer, field_buffer_sz, args->delim);
     value = xstrdup(field_buffer);
 
-    extract_fields(key_fields, n_key_fields, dim_file->current_line,
-                   field_buffer, field_buffer_sz,
-                   args->dimension_delim, args->delim);
-
-    ht_put(ht, field_buffer, value);
+    ht_put_fields(ht, &split, key_fields, n_key_fields, args->delim, value);
   }
 
   dbfr_close(dim_file);
+  linesplit_destroy(&split);
   free(field_buffer);
 
   return n_val_fields;
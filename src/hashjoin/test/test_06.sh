@@ -0,0 +1,47 @@
+test_number=06
+description="linebreaks and threads"
+
+infile="$test_dir/test_$test_number.in"
+dimfile="$test_dir/test_$test_number.dim"
+
+# a cr/lf, or no linebreak at all, ends up as a plain linebreak after the
+# joined field.
+subtest=1
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+$bin -k 1 -l 1 -j 2 -f $dimfile $infile > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (mapped)" FAIL
+else
+  test_status $test_number $subtest "$description (mapped)" PASS
+  rm "$outfile"
+fi
+
+subtest=2
+outfile="$test_dir/test_$test_number.$subtest.actual"
+cat $infile | $bin -T 2 -k 1 -l 1 -j 2 -f $dimfile > "$outfile"
+if [ $? -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (piped, threads)" FAIL
+else
+  test_status $test_number $subtest "$description (piped, threads)" PASS
+  rm "$outfile"
+fi
+
+# enough lines for several chunks, so that they are divided up between the
+# threads, in 40 runs which must come out whole and in order.  only the even
+# keys are in the dimension file.
+subtest=3
+outfile="$test_dir/test_$test_number.$subtest.actual"
+expected="$test_dir/test_$test_number.$subtest.expected"
+awk 'BEGIN { for (i = 0; i < 200000; i++)
+               printf "%d,filler-text\n", int(i / 5000) }' |
+  $bin -T 3 -k 1 -l 1 -j 2 -f $dimfile | runs > "$outfile"
+if [ ${PIPESTATUS[1]} -ne 0 ] ||
+   [ "`diff -q $outfile $expected`" ]; then
+  test_status $test_number $subtest "$description (several chunks)" FAIL
+else
+  test_status $test_number $subtest "$description (several chunks)" PASS
+  rm "$outfile"
+fi
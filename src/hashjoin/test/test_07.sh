@@ -0,0 +1,6 @@
+test_number=07
+description="write errors are reported"
+
+test_write_error $test_number 1 "$description" stdout '' \
+  $bin -k 1,2 -l 1,2 -j 3,4 -f $test_dir/dimension_no_header.log \
+  $test_dir/input_no_header.log
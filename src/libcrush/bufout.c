@@ -0,0 +1,310 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#include <crush/bufout.h>
+#include <crush/general.h>
+
+/* whole numbers smaller than this are formatted without snprintf(). */
+#define BUFOUT_MAX_FAST_DOUBLE 1e18
+
+/* a run of referenced data is written out once it grows this long, so that
+   output keeps flowing while a long stretch of input is passed through. */
+#define BUFOUT_MAX_REF_SZ (16 * 1024 * 1024)
+
+/* the most zeros bufout_put_double() will append itself. */
+#define BUFOUT_MAX_FAST_PRECISION 32
+
+/* Write LEN bytes from BUF, retrying after partial writes and signals. */
+static int bufout_write_all(int fd, const char *buf, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Write the buffered output followed by LEN bytes of DATA, with a single
+   system call where possible. */
+static int bufout_write_through(bufout_t *out, const char *data, size_t len) {
+#ifdef HAVE_WRITEV
+  struct iovec iov[2];
+  ssize_t n;
+
+  iov[0].iov_base = out->buf;
+  iov[0].iov_len = out->len;
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = len;
+
+  do {
+    n = writev(out->fd, iov, 2);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return -1;
+
+  /* finish off whatever a partial write left behind. */
+  if (n < out->len) {
+    if (bufout_write_all(out->fd, out->buf + n, out->len - n) != 0)
+      return -1;
+    n = 0;
+  } else {
+    n -= out->len;
+  }
+  out->len = 0;
+  return bufout_write_all(out->fd, data + n, len - n);
+#else
+  if (bufout_write_all(out->fd, out->buf, out->len) != 0)
+    return -1;
+  out->len = 0;
+  return bufout_write_all(out->fd, data, len);
+#endif
+}
+
+/* Record a failed write.  Output is discarded from then on. */
+static int bufout_fail(bufout_t *out) {
+  if (! out->error)
+    out->error = errno ? errno : EIO;
+  out->len = 0;
+  out->ref = NULL;
+  out->ref_len = 0;
+  return -1;
+}
+
+/* Make room for at least N more bytes in a memory writer's buffer. */
+static void bufout_grow(bufout_t *out, size_t n) {
+  if (out->buf_sz - out->len >= n)
+    return;
+  out->buf_sz = (out->len + n) * 2;
+  out->buf = xrealloc(out->buf, out->buf_sz);
+}
+
+static bufout_t * bufout_new(int fd) {
+  bufout_t *out;
+
+  out = xmalloc(sizeof(bufout_t));
+  out->fd = fd;
+  out->buf_sz = BUFOUT_BUF_SZ;
+  out->buf = xmalloc(out->buf_sz);
+  out->len = 0;
+  out->error = 0;
+  out->ref = NULL;
+  out->ref_len = 0;
+  return out;
+}
+
+bufout_t * bufout_init(FILE *fp) {
+  fflush(fp);
+  return bufout_new(fileno(fp));
+}
+
+bufout_t * bufout_init_mem(void) {
+  return bufout_new(-1);
+}
+
+int bufout_flush(bufout_t *out) {
+  if (out->ref && bufout_release(out) != 0)
+    return -1;
+  if (out->error)
+    return -1;
+  if (out->fd < 0)
+    return 0;
+  if (out->len > 0 && bufout_write_all(out->fd, out->buf, out->len) != 0)
+    return bufout_fail(out);
+  out->len = 0;
+  return 0;
+}
+
+int bufout_write(bufout_t *out, const void *data, size_t len) {
+  if (out->ref && bufout_release(out) != 0)
+    return -1;
+  if (out->error)
+    return -1;
+
+  if (out->fd < 0)
+    bufout_grow(out, len);
+  if (len <= out->buf_sz - out->len) {
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    return 0;
+  }
+
+  /* data which would fill most of the buffer isn't worth copying. */
+  if (len >= out->buf_sz / 2) {
+    if (bufout_write_through(out, data, len) != 0)
+      return bufout_fail(out);
+    return 0;
+  }
+
+  if (bufout_flush(out) != 0)
+    return -1;
+  memcpy(out->buf, data, len);
+  out->len = len;
+  return 0;
+}
+
+int bufout_write_ref(bufout_t *out, const char *data, size_t len) {
+  if (out->error)
+    return -1;
+  if (out->ref && out->ref + out->ref_len == data) {
+    out->ref_len += len;
+    if (out->ref_len >= BUFOUT_MAX_REF_SZ)
+      return bufout_release(out);
+    return 0;
+  }
+  if (out->ref && bufout_release(out) != 0)
+    return -1;
+  out->ref = data;
+  out->ref_len = len;
+  return 0;
+}
+
+int bufout_release(bufout_t *out) {
+  const char *ref = out->ref;
+
+  if (! ref)
+    return 0;
+  out->ref = NULL;
+  return bufout_write(out, ref, out->ref_len);
+}
+
+int bufout_puts(bufout_t *out, const char *s) {
+  return bufout_write(out, s, strlen(s));
+}
+
+int bufout_putc(bufout_t *out, char c) {
+  if (out->ref && bufout_release(out) != 0)
+    return -1;
+  if (out->error)
+    return -1;
+  if (out->fd < 0)
+    bufout_grow(out, 1);
+  else if (out->len == out->buf_sz && bufout_flush(out) != 0)
+    return -1;
+  out->buf[out->len++] = c;
+  return 0;
+}
+
+int bufout_put_long(bufout_t *out, long long n) {
+  char digits[24], *p = digits + sizeof(digits);
+  unsigned long long u = n < 0 ? 0ULL - (unsigned long long) n : n;
+
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (n < 0)
+    *--p = '-';
+  return bufout_write(out, p, digits + sizeof(digits) - p);
+}
+
+int bufout_put_double(bufout_t *out, double d, int precision) {
+  char zeros[BUFOUT_MAX_FAST_PRECISION + 1];
+
+  /* -0.0 keeps its sign under printf(), but not once converted. */
+  if (precision >= 0 && precision <= BUFOUT_MAX_FAST_PRECISION &&
+      d > -BUFOUT_MAX_FAST_DOUBLE && d < BUFOUT_MAX_FAST_DOUBLE &&
+      d == (double) (long long) d && ! (d == 0 && signbit(d))) {
+    if (bufout_put_long(out, (long long) d) != 0)
+      return -1;
+    if (precision == 0)
+      return 0;
+    zeros[0] = '.';
+    memset(zeros + 1, '0', precision);
+    return bufout_write(out, zeros, precision + 1);
+  }
+  return bufout_printf(out, "%.*f", precision, d);
+}
+
+int bufout_printf(bufout_t *out, const char *fmt, ...) {
+  va_list ap;
+  char *tmp;
+  int n;
+
+  if (out->ref && bufout_release(out) != 0)
+    return -1;
+  if (out->error)
+    return -1;
+
+  va_start(ap, fmt);
+  n = vsnprintf(out->buf + out->len, out->buf_sz - out->len, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return bufout_fail(out);
+  if (n < out->buf_sz - out->len) {
+    out->len += n;
+    return 0;
+  }
+
+  /* it didn't fit: format it again into an empty buffer, or into space of
+     its own if it's bigger than that.  a memory writer just grows. */
+  if (out->fd < 0) {
+    bufout_grow(out, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(out->buf + out->len, out->buf_sz - out->len, fmt, ap);
+    va_end(ap);
+    out->len += n;
+    return 0;
+  }
+  if (n < out->buf_sz) {
+    if (bufout_flush(out) != 0)
+      return -1;
+    va_start(ap, fmt);
+    vsnprintf(out->buf, out->buf_sz, fmt, ap);
+    va_end(ap);
+    out->len = n;
+    return 0;
+  }
+
+  tmp = xmalloc(n + 1);
+  va_start(ap, fmt);
+  vsnprintf(tmp, n + 1, fmt, ap);
+  va_end(ap);
+  n = bufout_write(out, tmp, n);
+  free(tmp);
+  return n;
+}
+
+int bufout_close(bufout_t *out) {
+  int retval = 0;
+
+  if (bufout_flush(out) != 0) {
+    errno = out->error;
+    retval = -1;
+  }
+  free(out->buf);
+  free(out);
+  return retval;
+}
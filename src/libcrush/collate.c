@@ -0,0 +1,274 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#ifdef HAVE_LOCALE_H
+#include <locale.h>
+#endif
+
+#include <crush/collate.h>
+#include <crush/ffutils.h>
+#include <crush/general.h>
+
+/* runs of fewer entries than this are sorted by insertion instead of being
+   split up further by collate_sort(). */
+#define COLLATE_INSERTION_SORT_MAX 32
+
+/* the number of buckets a run is split into: one for keys which have ended,
+   and one for each byte value. */
+#define COLLATE_BUCKETS 257
+
+/* non-zero for byte order, zero for strxfrm(), -1 until it's been decided. */
+static int collate_byte_order = -1;
+
+/* a string to be sorted by collate_sort(), and where its key is. */
+struct collate_entry {
+  const char *key;
+  size_t offset;
+  size_t len;
+  char *string;
+};
+
+/* entries START to START + N of those being sorted, whose keys all begin
+   with the same DEPTH bytes. */
+struct collate_run {
+  size_t start;
+  size_t n;
+  size_t depth;
+};
+
+/* the bucket of an entry at DEPTH: 0 if its key is no longer than that, or
+   one more than the byte there. */
+#define collate_bucket(entry, depth) \
+  ((depth) < (entry)->len ? 1 + (unsigned char) (entry)->key[(depth)] : 0)
+
+/* Whether the named collation orders strings the same way strcmp() does. */
+static int collate_locale_is_bytewise(const char *name) {
+  return name == NULL || str_eq(name, "C") || str_eq(name, "POSIX") ||
+         str_eq(name, "C.UTF-8") || str_eq(name, "C.utf8");
+}
+
+void collate_init(int byte_order) {
+#ifdef HAVE_LOCALE_H
+  collate_byte_order = byte_order ||
+                       collate_locale_is_bytewise(setlocale(LC_COLLATE, NULL));
+#else
+  collate_byte_order = 1;
+#endif
+}
+
+int collate_is_byte_order(void) {
+  if (collate_byte_order < 0)
+    collate_init(0);
+  return collate_byte_order;
+}
+
+void collate_key_init(collate_key_t *key) {
+  memset(key, 0, sizeof(collate_key_t));
+}
+
+void collate_key_destroy(collate_key_t *key) {
+  free(key->data);
+  free(key->tmp);
+  memset(key, 0, sizeof(collate_key_t));
+}
+
+/* Make room for at least N more bytes in a key. */
+static void collate_key_reserve(collate_key_t *key, size_t n) {
+  if (key->sz - key->len >= n)
+    return;
+  key->sz = (key->len + n) * 2;
+  key->data = xrealloc(key->data, key->sz);
+}
+
+void collate_key_append(collate_key_t *key, const char *value, size_t len) {
+  size_t n;
+
+  if (collate_is_byte_order()) {
+    collate_key_reserve(key, len + 1);
+    memcpy(key->data + key->len, value, len);
+    key->len += len;
+    key->data[key->len++] = '\0';
+    return;
+  }
+
+  if (len + 1 > key->tmp_sz) {
+    key->tmp_sz = (len + 1) * 2;
+    key->tmp = xrealloc(key->tmp, key->tmp_sz);
+  }
+  memcpy(key->tmp, value, len);
+  key->tmp[len] = '\0';
+
+  /* transformed strings are typically a few times longer than the input. */
+  collate_key_reserve(key, len * 4 + 16);
+  n = strxfrm(key->data + key->len, key->tmp, key->sz - key->len);
+  if (n >= key->sz - key->len) {
+    collate_key_reserve(key, n + 1);
+    strxfrm(key->data + key->len, key->tmp, n + 1);
+  }
+  key->len += n + 1;
+}
+
+void collate_key_fields(collate_key_t *key, const linesplit_t *split,
+                        const int *fields, size_t n_fields) {
+  size_t i;
+
+  collate_key_clear(key);
+  for (i = 0; i < n_fields; i++) {
+    if (fields[i] >= 0 && fields[i] < split->n_fields)
+      collate_key_append(key, linesplit_field_ptr(split, fields[i]),
+                         linesplit_field_len(split, fields[i]));
+    else
+      collate_key_append(key, "", 0);
+  }
+}
+
+/* Compare two transformed keys.  Each value ends in a null byte, which sorts
+   before anything else, so a value collates before any value it's a prefix
+   of, and a key before any longer key it's a prefix of. */
+static int collate_cmp(const char *a, size_t a_len, const char *b,
+                       size_t b_len) {
+  int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (cmp != 0)
+    return cmp;
+  return a_len < b_len ? -1 : a_len > b_len;
+}
+
+int collate_key_cmp(const collate_key_t *a, const collate_key_t *b) {
+  return collate_cmp(a->data, a->len, b->data, b->len);
+}
+
+/* sorts a short run of entries which agree on their first DEPTH bytes. */
+static void collate_insertion_sort(struct collate_entry *entries, size_t n,
+                                   size_t depth) {
+  struct collate_entry entry;
+  size_t i, j;
+
+  for (i = 1; i < n; i++) {
+    entry = entries[i];
+    for (j = i; j > 0 && collate_cmp(entries[j - 1].key + depth,
+                                     entries[j - 1].len - depth,
+                                     entry.key + depth,
+                                     entry.len - depth) > 0; j--)
+      entries[j] = entries[j - 1];
+    entries[j] = entry;
+  }
+}
+
+/* sorts entries by key with a most-significant-byte-first radix sort:
+   each run is split into buckets by the next byte of its keys, and each
+   bucket is then sorted on its own.  this looks at each byte of a key
+   about once, where a comparison sort looks at the leading bytes of a key
+   on every comparison.  equal keys keep their order. */
+static void collate_radix_sort(struct collate_entry *entries, size_t n) {
+  struct collate_entry *moved = xmalloc(sizeof(struct collate_entry) * n);
+  struct collate_run *runs, run;
+  size_t n_runs = 0, runs_sz = 64, ends[COLLATE_BUCKETS], start, i, b;
+  struct collate_entry *first;
+
+  runs = xmalloc(sizeof(struct collate_run) * runs_sz);
+  runs[n_runs].start = 0;
+  runs[n_runs].n = n;
+  runs[n_runs++].depth = 0;
+  while (n_runs > 0) {
+    run = runs[--n_runs];
+    first = entries + run.start;
+    if (run.n < COLLATE_INSERTION_SORT_MAX) {
+      collate_insertion_sort(first, run.n, run.depth);
+      continue;
+    }
+
+    memset(ends, 0, sizeof(ends));
+    for (i = 0; i < run.n; i++)
+      ends[collate_bucket(&first[i], run.depth)]++;
+    b = collate_bucket(&first[0], run.depth);
+    if (ends[b] == run.n) {
+      /* a byte they all share, or the end of keys which are all equal. */
+      if (b != 0) {
+        run.depth++;
+        runs[n_runs++] = run;
+      }
+      continue;
+    }
+
+    /* the counts become where each bucket starts, and then, once the
+       entries have been moved into place, where it ends. */
+    for (start = 0, b = 0; b < COLLATE_BUCKETS; b++) {
+      start += ends[b];
+      ends[b] = start - ends[b];
+    }
+    for (i = 0; i < run.n; i++)
+      moved[ends[collate_bucket(&first[i], run.depth)]++] = first[i];
+    memcpy(first, moved, sizeof(struct collate_entry) * run.n);
+
+    /* keys which have ended are all equal, so bucket 0 is done. */
+    for (b = 1; b < COLLATE_BUCKETS; b++) {
+      if (ends[b] - ends[b - 1] < 2)
+        continue;
+      if (n_runs == runs_sz) {
+        runs_sz *= 2;
+        runs = xrealloc(runs, sizeof(struct collate_run) * runs_sz);
+      }
+      runs[n_runs].start = run.start + ends[b - 1];
+      runs[n_runs].n = ends[b] - ends[b - 1];
+      runs[n_runs++].depth = run.depth + 1;
+    }
+  }
+  free(runs);
+  free(moved);
+}
+
+void collate_sort(char **strings, size_t n, const char *delim) {
+  struct collate_entry *entries;
+  collate_key_t keys;
+  linesplit_t split;
+  size_t i, j;
+
+  if (n < 2)
+    return;
+
+  /* transform every string into one buffer, then point into it once it's
+     done moving. */
+  entries = xmalloc(sizeof(struct collate_entry) * n);
+  collate_key_init(&keys);
+  collate_key_reserve(&keys, n * 16);
+  linesplit_init(&split, 0);
+  for (i = 0; i < n; i++) {
+    entries[i].offset = keys.len;
+    entries[i].string = strings[i];
+    if (strings[i]) {
+      linesplit(&split, strings[i], delim);
+      for (j = 0; j < split.n_fields; j++)
+        collate_key_append(&keys, linesplit_field_ptr(&split, j),
+                           linesplit_field_len(&split, j));
+    }
+    entries[i].len = keys.len - entries[i].offset;
+  }
+  for (i = 0; i < n; i++)
+    entries[i].key = keys.data + entries[i].offset;
+
+  collate_radix_sort(entries, n);
+  for (i = 0; i < n; i++)
+    strings[i] = entries[i].string;
+
+  linesplit_destroy(&split);
+  collate_key_destroy(&keys);
+  free(entries);
+}
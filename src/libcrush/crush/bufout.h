@@ -0,0 +1,181 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file bufout.h
+  * @brief Buffered output of fields, delimiters and numbers.
+  *
+  * A bufout_t collects output in a large buffer and hands it to the
+  * operating system with write(2), or writev(2) when a single piece of data
+  * is too large to be worth copying.  Unlike stdio, there is no locking and
+  * no format string to parse for the common cases: field views, delimiters
+  * and numbers are appended directly.
+  *
+  * Data which is already in memory and will stay put - input lines from a
+  * memory-mapped file, say - can be appended by reference with
+  * bufout_write_ref().  Consecutive references to adjacent memory are
+  * coalesced, and a long run is handed to writev(2) without being copied at
+  * all, so passing most of an input file through costs little more than
+  * the system calls.
+  *
+  * A bufout_t writes to the file descriptor underneath a FILE, so nothing
+  * else should be written to that FILE until the bufout_t has been closed.
+  * One created with bufout_init_mem() instead keeps all of its output in
+  * memory, so that pieces of output produced out of order can be collected
+  * and written in order later.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef BUFOUT_H
+#define BUFOUT_H
+
+/** @brief the size of the output buffer. */
+#define BUFOUT_BUF_SZ (256 * 1024)
+
+/** @brief a buffered writer.  Members of this struct should not be modified
+  * by user code. */
+typedef struct {
+  int fd;         /**< @brief the file descriptor being written to, or -1
+                       if output is kept in memory. */
+  char *buf;      /**< @brief output which has not been written yet. */
+  size_t len;     /**< @brief the number of bytes in buf. */
+  size_t buf_sz;  /**< @brief the allocated size of buf. */
+  int error;      /**< @brief errno from the first failed write, or 0.  Once
+                       set, further output is discarded. */
+  const char *ref;  /**< @brief output appended by reference, which follows
+                         the contents of buf. */
+  size_t ref_len;   /**< @brief the number of bytes at ref. */
+} bufout_t;
+
+/** @brief creates a writer for an open file.
+  *
+  * Anything already buffered in fp is flushed first.
+  *
+  * @param fp the file to write to.
+  *
+  * @return a new writer.
+  */
+bufout_t * bufout_init(FILE *fp);
+
+/** @brief creates a writer which keeps its output in memory.
+  *
+  * The buffer grows as needed; buf and len hold everything written since
+  * the last bufout_mem_reset().
+  *
+  * @return a new writer.
+  */
+bufout_t * bufout_init_mem(void);
+
+/** @brief discards the output held by a memory writer. */
+#define bufout_mem_reset(out) ((out)->len = 0)
+
+/** @brief appends bytes to the output.
+  *
+  * @param out the writer.
+  * @param data the bytes to append.  They need not be null-terminated.
+  * @param len the number of bytes in data.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_write(bufout_t *out, const void *data, size_t len);
+
+/** @brief appends bytes to the output without copying them yet.
+  *
+  * If data immediately follows the bytes passed to the previous call, the
+  * two are merged into a single run.  The data must remain valid and
+  * unchanged until bufout_release() is called, or until any other bufout
+  * function is called with the same writer.
+  *
+  * @param out the writer.
+  * @param data the bytes to append.
+  * @param len the number of bytes in data.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_write_ref(bufout_t *out, const char *data, size_t len);
+
+/** @brief finishes with the data passed to bufout_write_ref().
+  *
+  * A long run of referenced data is written out directly; a short one is
+  * copied into the buffer.  Either way, the caller may then reuse the memory.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_release(bufout_t *out);
+
+/** @brief appends a null-terminated string to the output.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_puts(bufout_t *out, const char *s);
+
+/** @brief appends a single character to the output.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_putc(bufout_t *out, char c);
+
+/** @brief appends an integer in decimal notation, as printf("%lld") would.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_put_long(bufout_t *out, long long n);
+
+/** @brief appends a floating-point number, as printf("%.*f") would.
+  *
+  * Whole numbers are formatted directly; other values go through
+  * snprintf(), straight into the output buffer.
+  *
+  * @param out the writer.
+  * @param d the number.
+  * @param precision the number of digits after the decimal point.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_put_double(bufout_t *out, double d, int precision);
+
+/** @brief appends formatted output, like fprintf().
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_printf(bufout_t *out, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+/** @brief writes out everything which has been buffered.
+  *
+  * Output held by a memory writer stays where it is.
+  *
+  * @return 0 on success, or -1 if a write has failed.
+  */
+int bufout_flush(bufout_t *out);
+
+/** @brief flushes and deallocates a writer.
+  *
+  * The underlying file is not closed.
+  *
+  * @param out the writer.
+  *
+  * @return 0 on success, or -1 if any write failed (errno is set to the
+  *         error from the first failure).
+  */
+int bufout_close(bufout_t *out);
+
+#endif /* BUFOUT_H */
@@ -0,0 +1,129 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file collate.h
+  * @brief Comparison of field values in the collation order of the locale.
+  *
+  * The tools which sort or merge on keys order field values with strcoll(),
+  * so that they agree with sort(1) under the same locale.  strcoll() has to
+  * work out the collation weights of both strings on every call, though,
+  * and the same values tend to be compared many times over.
+  *
+  * A collate_key_t holds the strxfrm() transformation of one or more field
+  * values, which compares with memcmp() exactly as the values themselves
+  * would with strcoll(), field by field.  Under the C or POSIX locale, or
+  * when byte order is requested, no transformation is needed and the values
+  * are used as they are.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <crush/linesplit.h>
+
+#ifndef COLLATE_H
+#define COLLATE_H
+
+/** @brief a sort key for one or more field values.  Members of this struct
+  * should not be modified by user code. */
+typedef struct {
+  char *data;     /**< @brief the transformed values, each followed by a
+                       null byte. */
+  size_t len;     /**< @brief the number of bytes in data. */
+  size_t sz;      /**< @brief the allocated size of data. */
+  char *tmp;      /**< @brief scratch space for null-terminating a value. */
+  size_t tmp_sz;  /**< @brief the allocated size of tmp. */
+} collate_key_t;
+
+/** @brief chooses how values are to be collated.
+  *
+  * This should be called after setlocale().  Byte order is used when it is
+  * requested or when LC_COLLATE is the C or POSIX locale; otherwise values
+  * are collated with strxfrm().  If this is never called, the choice is
+  * made the first time a key is built.
+  *
+  * @param byte_order non-zero to compare values byte by byte regardless of
+  *                   the locale.
+  */
+void collate_init(int byte_order);
+
+/** @brief tells whether values are being compared in byte order.
+  *
+  * @return non-zero if values are compared byte by byte.
+  */
+int collate_is_byte_order(void);
+
+/** @brief initializes an empty key.
+  *
+  * @param key the key to initialize.
+  */
+void collate_key_init(collate_key_t *key);
+
+/** @brief releases the memory held by a key.
+  *
+  * The collate_key_t object itself is not deallocated.
+  *
+  * @param key a key initialized with collate_key_init().
+  */
+void collate_key_destroy(collate_key_t *key);
+
+/** @brief empties a key so that it can be rebuilt. */
+#define collate_key_clear(key) ((key)->len = 0)
+
+/** @brief adds a field value to the end of a key.
+  *
+  * @param key an initialized key.
+  * @param value the value, which need not be null-terminated.
+  * @param len the number of bytes in value.
+  */
+void collate_key_append(collate_key_t *key, const char *value, size_t len);
+
+/** @brief builds a key from selected fields of a split line.
+  *
+  * Fields which are not present in the line are treated as empty.
+  *
+  * @param key an initialized key, whose previous contents are discarded.
+  * @param split the split line.
+  * @param fields zero-based indexes of the fields, in order of significance.
+  * @param n_fields the number of elements in fields.
+  */
+void collate_key_fields(collate_key_t *key, const linesplit_t *split,
+                        const int *fields, size_t n_fields);
+
+/** @brief compares two keys.
+  *
+  * @return less than, equal to, or greater than zero if the values in a
+  *         collate before, the same as, or after those in b.
+  */
+int collate_key_cmp(const collate_key_t *a, const collate_key_t *b);
+
+/** @brief sorts delimited strings field by field in collation order.
+  *
+  * Each string is transformed once, rather than on every comparison as a
+  * qsort() with strcoll() would, and the transformed keys are then sorted
+  * with a radix sort, which looks at each of their bytes about once.
+  * Strings which collate the same keep their order.
+  *
+  * @param strings the strings to sort.
+  * @param n the number of elements in strings.
+  * @param delim the field separator.
+  */
+void collate_sort(char **strings, size_t n, const char *delim);
+
+#endif /* COLLATE_H */
@@ -21,6 +21,26 @@
   *
   * This is primarily useful for peeking at the next line of a file when
   * fseek(3) cannot be reliably used (e.g. when the file is stdin)
+  *
+  * Readers created with dbfr_mmap_open() or dbfr_mmap_init() map regular files
+  * into memory, and current_line and next_line then point directly into the
+  * mapping instead of into heap buffers.  Such lines are views: they are not
+  * null-terminated and must not be modified, so code using these readers
+  * must rely on current_line_len and next_line_len.
+  *
+  * Readers created with dbfr_readahead_open() or dbfr_readahead_init() start
+  * a background thread which reads the file into a ring of
+  * DBFR_READAHEAD_BLOCKS blocks, so that waiting on a pipe or a slow disk
+  * overlaps with the processing of lines which have already arrived.  Lines
+  * from these readers behave exactly like those from dbfr_init().  Since the
+  * thread reads the file descriptor directly, read-ahead is only used when
+  * asked for by one of these two functions, or by dbfr_mmap_init() for a
+  * file which cannot be mapped because it is not a regular file.
+  *
+  * dbfr_getlines() reads many lines at once into a dbfr_batch_t, so that
+  * callers can work through them in a tight loop.  dbfr_getchunk() reads
+  * whole lines as a single contiguous block, which is the unit of work for
+  * parchunk.h.
   */
 #ifndef DOUBLE_BUFFERED_FILE_READER_H
 #define DOUBLE_BUFFERED_FILE_READER_H
@@ -36,6 +56,26 @@
 #  include <sys/types.h>
 #endif
 
+/** \brief the size of each block read by a read-ahead reader's thread. */
+#define DBFR_READAHEAD_BLOCK_SZ (1024 * 1024)
+
+/** \brief the number of blocks a read-ahead reader may read ahead of the
+  * line being processed. */
+#define DBFR_READAHEAD_BLOCKS 4
+
+/** \brief the suggested number of lines to request from dbfr_getlines(). */
+#define DBFR_BATCH_LINES 1024
+
+/** \brief dbfr_getlines() stops adding lines to a batch once it holds at least
+  * this many bytes. */
+#define DBFR_BATCH_MAX_BYTES (1024 * 1024)
+
+/** \brief the size of each block read into a batch by dbfr_getlines(), when
+  * the reader does not map its file. */
+#define DBFR_BATCH_BLOCK_SZ (64 * 1024)
+
+struct dbfr_readahead;
+
 /** \brief a double-buffered file reader type.
   *
   * None of the fields in this structure should be modified by user code.
@@ -43,6 +83,8 @@
   */
 typedef struct {
   size_t line_no;           /**< \brief the line number of current_line. */
+  off_t current_line_offset; /**< \brief the byte offset of current_line,
+                                         relative to where reading began. */
   char *current_line;       /**< \brief holds the most recently read line. */
   ssize_t current_line_len; /**< \brief the length of the current line. */
   size_t current_line_sz;   /**< \brief the size of the current_line buffer. */
@@ -52,8 +94,48 @@ typedef struct {
   FILE *file;               /**< \brief the file being read. */
   int eof;                  /**< \brief non-zero when EOF is reached in the
                                         current line. */
+  char *map;                /**< \brief the memory-mapped file, or NULL when
+                                        reading through getline(). */
+  size_t map_sz;            /**< \brief the size of the mapping. */
+  size_t map_pos;           /**< \brief offset in map of the first byte after
+                                        next_line. */
+  struct dbfr_readahead *readahead; /**< \brief the state of the read-ahead
+                                                 thread, or NULL. */
+  char *pending;            /**< \brief whole lines after next_line which
+                                        dbfr_getlines() read but did not
+                                        return. */
+  size_t pending_len;       /**< \brief the number of bytes in pending. */
+  size_t pending_pos;       /**< \brief offset in pending of the first line
+                                        not yet read. */
+  size_t pending_sz;        /**< \brief the size of the pending buffer. */
 } dbfr_t;
 
+/** \brief a line returned by dbfr_getlines(). */
+typedef struct {
+  char *line;               /**< \brief the text of the line. */
+  size_t len;               /**< \brief the length of the line, including any
+                                        linebreak. */
+  size_t line_no;           /**< \brief the line number. */
+  off_t offset;             /**< \brief the byte offset of the line, relative
+                                        to where reading began. */
+} dbfr_line_t;
+
+/** \brief a batch of lines filled by dbfr_getlines().
+  *
+  * For a memory-mapped reader, the lines are views into the mapping.
+  * Otherwise they are views into the batch's buffer, which is filled a block
+  * at a time, and may be modified by the caller.  Either way, they are not
+  * null-terminated, consecutive lines are adjacent, and they remain valid
+  * until the next call to dbfr_getlines() with the same batch.
+  */
+typedef struct {
+  dbfr_line_t *lines;       /**< \brief the lines in the batch. */
+  size_t n_lines;           /**< \brief the number of elements in lines. */
+  size_t lines_sz;          /**< \brief the allocated size of lines. */
+  char *buf;                /**< \brief storage for lines which are read. */
+  size_t buf_sz;            /**< \brief the allocated size of buf. */
+} dbfr_batch_t;
+
 /** \brief opens FILENAME for reading with a double-buffered reader.
   *
   * Upon successful initialization, the next_line will be initialized to the
@@ -76,6 +158,77 @@ dbfr_t * dbfr_open(const char *filename);
   */
 dbfr_t * dbfr_init(FILE *fp);
 
+/** \brief opens FILENAME for reading with a memory-mapped reader.
+  *
+  * If the file is not a regular file (e.g. stdin attached to a pipe), this
+  * is equivalent to dbfr_open().
+  *
+  * \param filename if NULL or "-", the reader will attach to stdin.
+  *                 Otherwise the named file is opened for reading.
+  *
+  * \returns a double-buffered file reader object, or NULL if the file cannot
+  *          be opened.
+  */
+dbfr_t * dbfr_mmap_open(const char *filename);
+
+/** \brief initializes a memory-mapped reader from an already opened file.
+  *
+  * Reading begins at the current offset of FP.  If FP does not refer to a
+  * regular file, such as when it is a pipe, this is equivalent to
+  * dbfr_readahead_init(), and so nothing must have been read from FP through
+  * stdio beforehand.  If the file cannot be mapped, this is equivalent to
+  * dbfr_init().
+  *
+  * \param fp the readable file pointer to use.
+  *
+  * \return a new double-buffered reader object, or NULL if the file pointer
+  *         is invalid.
+  */
+dbfr_t * dbfr_mmap_init(FILE *fp);
+
+/** \brief tests whether the lines of a reader remain valid until the reader
+  * is closed.
+  *
+  * This is the case for readers which have mapped their file into memory,
+  * since their lines are views into the mapping, and consecutive lines are
+  * adjacent in memory.  Lines from any other reader are only valid until the
+  * next read.
+  */
+#define dbfr_lines_persist(reader) ((reader)->map != NULL)
+
+/** \brief copies next_line into a null-terminated string, such as for
+  * parsing the header of the file.
+  *
+  * \param reader a valid double-buffered reader object.
+  *
+  * \return a copy of next_line which the caller must free, or an empty string
+  *         if there is no next line.
+  */
+char * dbfr_next_line_dup(const dbfr_t *reader);
+
+/** \brief opens FILENAME for reading with a read-ahead reader.
+  *
+  * \param filename if NULL or "-", the reader will attach to stdin.
+  *                 Otherwise the named file is opened for reading.
+  *
+  * \returns a double-buffered file reader object, or NULL if the file cannot
+  *          be opened.
+  */
+dbfr_t * dbfr_readahead_open(const char *filename);
+
+/** \brief initializes a read-ahead reader from an already opened file.
+  *
+  * The background thread reads from the file descriptor underlying FP, so
+  * nothing must have been read from FP through stdio beforehand.  If threads
+  * are not available, this is equivalent to dbfr_init().
+  *
+  * \param fp the readable file pointer to use.
+  *
+  * \return a new double-buffered reader object, or NULL if the file pointer
+  *         is invalid.
+  */
+dbfr_t * dbfr_readahead_init(FILE *fp);
+
 /** \brief gets the next line of the file and stores it in the current_line
   *        buffer.
   *
@@ -90,6 +243,52 @@ dbfr_t * dbfr_init(FILE *fp);
   */
 ssize_t dbfr_getline(dbfr_t *reader);
 
+/** \brief initializes an empty batch of lines.
+  *
+  * \param batch the batch to initialize.
+  */
+void dbfr_batch_init(dbfr_batch_t *batch);
+
+/** \brief releases the memory held by a batch of lines.
+  *
+  * \param batch a batch initialized with dbfr_batch_init().
+  */
+void dbfr_batch_destroy(dbfr_batch_t *batch);
+
+/** \brief reads up to MAX_LINES lines into a batch.
+  *
+  * The lines are consumed as if by calling dbfr_getline() once for each, so
+  * afterward current_line is the last line in the batch and next_line is the
+  * line after it.  Fewer than MAX_LINES lines are returned at EOF, or when
+  * the lines read so far add up to DBFR_BATCH_MAX_BYTES.
+  *
+  * \param reader a valid double-buffered reader object.
+  * \param batch a batch initialized with dbfr_batch_init().
+  * \param max_lines the maximum number of lines to read.
+  *
+  * \returns the number of lines in the batch, zero on EOF or error.
+  */
+size_t dbfr_getlines(dbfr_t *reader, dbfr_batch_t *batch, size_t max_lines);
+
+/** \brief reads whole lines adding up to at least MIN_BYTES as one block.
+  *
+  * The lines are consumed as if by calling dbfr_getline() once for each, so
+  * afterward current_line is the last line in the block.  For a
+  * memory-mapped reader the block is a view into the mapping; otherwise the
+  * lines are copied into *buf, which is grown as needed and null-terminated.
+  * Fewer than MIN_BYTES bytes are returned only at EOF.
+  *
+  * \param reader a valid double-buffered reader object.
+  * \param min_bytes the least number of bytes to read, other than at EOF.
+  * \param buf a buffer for copies of the lines.  It may point to NULL.
+  * \param buf_sz the allocated size of *buf.
+  * \param chunk set to the first byte of the block.
+  *
+  * \returns the number of bytes in the block, zero on EOF or error.
+  */
+size_t dbfr_getchunk(dbfr_t *reader, size_t min_bytes, char **buf,
+                     size_t *buf_sz, const char **chunk);
+
 /** \brief closes a double-buffered reader's file and releases its resources.
   *
   * \param reader a double-buffered reader object.
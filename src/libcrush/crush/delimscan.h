@@ -0,0 +1,95 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file delimscan.h
+  * @brief Vectorized scanning of a block of memory for field delimiters and
+  * line breaks.
+  *
+  * delimscan() reports the offset of every byte in a block which matches
+  * either of two target bytes - typically the first byte of the field
+  * separator and '\\n'.  For multi-byte separators, the caller is responsible
+  * for verifying that the remaining bytes of the separator follow a hit.
+  *
+  * On x86 processors the scan is done 16 (SSE2) or 32 (AVX2) bytes at a time.
+  * The best implementation supported by the running CPU is selected the first
+  * time delimscan() is called.  Setting the environment variable
+  * CRUSH_DELIMSCAN to "scalar", "sse2" or "avx2" overrides the selection.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#ifndef DELIMSCAN_H
+#define DELIMSCAN_H
+
+/** @brief the available scanning implementations. */
+typedef enum {
+  delimscan_impl_auto = 0,  /**< @brief the best supported implementation. */
+  delimscan_impl_scalar,    /**< @brief portable byte-at-a-time loop. */
+  delimscan_impl_sse2,      /**< @brief 16 bytes per iteration. */
+  delimscan_impl_avx2       /**< @brief 32 bytes per iteration. */
+} delimscan_impl_t;
+
+/** @brief finds every occurrence of two bytes within a block.
+  *
+  * The scan stops early if max_hits offsets have been found.  In that case,
+  * *scanned is set to one past the offset of the last hit, so that the scan
+  * can be resumed from there.
+  *
+  * @param buf the block to be scanned.
+  * @param len the number of bytes in buf.
+  * @param c1 a byte to search for.
+  * @param c2 another byte to search for (may be the same as c1).
+  * @param hits an array to receive the offsets of matching bytes, in
+  *             ascending order.
+  * @param max_hits the number of elements in hits.
+  * @param scanned if not NULL, receives the number of bytes which were
+  *                examined.
+  *
+  * @return the number of offsets stored in hits.
+  */
+size_t delimscan(const char *buf, size_t len, unsigned char c1,
+                 unsigned char c2, size_t *hits, size_t max_hits,
+                 size_t *scanned);
+
+/** @brief counts the occurrences of a byte within a block.
+  *
+  * @param buf the block to be scanned.
+  * @param len the number of bytes in buf.
+  * @param c the byte to count.
+  *
+  * @return the number of bytes in buf equal to c.
+  */
+size_t delimscan_count(const char *buf, size_t len, unsigned char c);
+
+/** @brief selects the implementation used by delimscan() and
+  * delimscan_count().
+  *
+  * @param impl the desired implementation.
+  *
+  * @return 0 on success, or -1 if the implementation is not supported by this
+  *         build or CPU (in which case the current selection is unchanged).
+  */
+int delimscan_use(delimscan_impl_t impl);
+
+/** @brief gets the name of the implementation currently used by
+  * delimscan() and delimscan_count(). */
+const char *delimscan_impl_name(void);
+
+#endif /* DELIMSCAN_H */
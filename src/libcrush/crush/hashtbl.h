@@ -17,51 +17,74 @@
 /** @file hashtbl.h
   * @brief Interface for the hashtbl library.
   *
-  * This is a chained hashtable implementation, internally utilizing the
-  * bstree library.  Note that for all key comparisons (in ht_put(), ht_get(),
-  * ht_delete(), etc.) strcmp() is used for comparing the keys.  If support for
-  * keys containing null bytes is a requirement, use hashtbl2 instead.
+  * This is an open-addressing hashtable using linear probing.  The slots
+  * are kept in one flat array, alongside an array holding the hash of each
+  * slot's key, so most probes only touch the hash array and strcmp() is
+  * only called when two hashes match.  The table doubles in size whenever
+  * it becomes more than 3/4 full, so the size passed to ht_init() is just
+  * an initial capacity.
   *
-  * Because of the use of a mempool for key allocation, there is a
-  * 4095-character limit on key length.
+  * Note that for all key comparisons (in ht_put(), ht_get(), ht_delete(),
+  * etc.) strcmp() is used for comparing the keys.  If support for keys
+  * containing null bytes is a requirement, use hashtbl2 instead.
+  *
+  * Keys can also be given as a pointer and length (ht_get_n(), ht_put_n()),
+  * or as a list of fields from a split line which are joined by a separator
+  * (ht_get_fields(), ht_put_fields()).  These are hashed and compared in
+  * place, and only copied into the table when a new element is inserted.
+  * They are equivalent to the null-terminated string the key would be
+  * written as, so the same element can be found by either kind of call.
+  *
+  * With the default hash function, lookups do not modify the table, so
+  * several threads may look up keys at once as long as none of them adds
+  * or removes elements.
+  *
+  * Keys are copied into a mempool, which is released all at once by
+  * ht_destroy().
   */
 
 #include <stdlib.h>
 #include <string.h>  /* strcmp(), strlen() */
-#include <crush/bstree.h>
 #include <crush/hashfuncs.h>
+#include <crush/linesplit.h>
 #include <crush/mempool.h>
 
 
 #ifndef HASHTBL_H
 #define HASHTBL_H
 
+/** @brief a key/value pair within the hashtable */
+typedef struct _ht_elem {
+  char *key;  /**< string lookup key for the element */
+  void *data; /**< data to store in this element */
+} ht_elem_t;
+
 /** @brief the hashtable data type. */
 typedef struct _hashtbl {
   size_t nelems;  /**< number of elements in the hashtable */
-  size_t arrsz;   /**< size of the following array */
-  bstree_t **arr;  /**< array of binary trees */
+  size_t arrsz;   /**< number of slots in the table - a power of 2 */
+  unsigned int bits;     /**< log2(arrsz) */
+  ht_elem_t *arr;        /**< array of slots */
+  /** the hash of the key in each slot, or 0 for an empty slot */
+  unsigned int *hashes;
   /** hash function to use - see hashfuncs.h */
   unsigned int (*hash) (unsigned char *);
   /** memory-freeing function to call against an entry's data */
   void (*free) (void *);
-  mempool_t *ht_elem_pool; /**< a pool for allocating elements */
   mempool_t *key_pool;     /**< a pool for allocating key strings */
+  /** space for assembling keys given in pieces, when a custom hash function
+      needs them as a string */
+  char *scratch;
+  size_t scratch_sz;       /**< size of scratch */
 } hashtbl_t;
 
-/** @brief a key/value pair within the hashtable */
-typedef struct _ht_elem {
-  char *key;  /**< string lookup key for the element */
-  void *data; /**< data to store in this element */
-} ht_elem_t;
-
 /** @brief initializes a new hashtable.  the memfree function should be
   * specified iff the payload of a node will need to be deallocated when
   * the hashtable is destroyed.  if a NULL hash function is specified
   * the BKDRHash function will be used.
   *
   * @param tbl the table to be initialized.
-  * @param sz size to make the table.
+  * @param sz the number of slots to allocate initially.
   * @param hash function for hashing data when inserting or retrieving.
   * @param memfree function to free memory when destroying the hashtable.
   *
@@ -89,6 +112,23 @@ void ht_destroy(hashtbl_t * tbl);
   */
 int ht_put(hashtbl_t * tbl, char *key, void *data);
 
+/** @brief finds the entry for a key, adding one if none exists, and returns
+  * the location of its data.
+  *
+  * A new entry's data is NULL, so callers typically test *slot and
+  * initialize it if necessary.  This hashes and searches the table only once,
+  * where ht_get() followed by ht_put() does so twice.  The returned pointer is
+  * invalidated by the next insertion into or deletion from the table.
+  *
+  * @param tbl hashtable in which the entry should be found or put
+  * @param key string to use as the lookup key
+  * @param inserted if not NULL, set to 1 if a new entry was added, or 0 if
+  *                 the key was already present
+  *
+  * @return a pointer to the entry's data, or NULL on memory error
+  */
+void **ht_upsert(hashtbl_t * tbl, char *key, int *inserted);
+
 /** @brief retrieves an entry's data from a hashtable.
   *
   * @param tbl table in which the data is stored
@@ -99,6 +139,96 @@ int ht_put(hashtbl_t * tbl, char *key, void *data);
   */
 void *ht_get(hashtbl_t * tbl, char *key);
 
+/** @brief adds an entry to the hashtable, using the first LEN bytes of KEY
+  * as the lookup key.
+  *
+  * @param tbl hashtable in which the entry should be put
+  * @param key the lookup key, which need not be null-terminated
+  * @param len the length of the key
+  * @param data value to be stored.
+  *
+  * @return -1 on memory or 0 on success
+  */
+int ht_put_n(hashtbl_t * tbl, const char *key, size_t len, void *data);
+
+/** @brief ht_upsert() using the first LEN bytes of KEY as the lookup key.
+  *
+  * @param tbl hashtable in which the entry should be found or put
+  * @param key the lookup key, which need not be null-terminated
+  * @param len the length of the key
+  * @param inserted if not NULL, set to 1 if a new entry was added, or 0 if
+  *                 the key was already present
+  *
+  * @return a pointer to the entry's data, or NULL on memory error
+  */
+void **ht_upsert_n(hashtbl_t * tbl, const char *key, size_t len,
+                   int *inserted);
+
+/** @brief retrieves an entry's data using the first LEN bytes of KEY as the
+  * lookup key.
+  *
+  * @param tbl table in which the data is stored
+  * @param key the lookup key, which need not be null-terminated
+  * @param len the length of the key
+  *
+  * @return NULL if an element with the specified key does not exist, else
+  * the data in the entry.
+  */
+void *ht_get_n(hashtbl_t * tbl, const char *key, size_t len);
+
+/** @brief adds an entry to the hashtable, using some fields of a split line
+  * as the lookup key.
+  *
+  * The key is the text of the listed fields, in order, with SEP between
+  * them.  Fields missing from the line are treated as empty.
+  *
+  * @param tbl hashtable in which the entry should be put
+  * @param split a split line
+  * @param fields 0-based indexes of the fields making up the key
+  * @param n_fields the number of elements in fields
+  * @param sep the string to put between fields (may be "")
+  * @param data value to be stored.
+  *
+  * @return -1 on memory or 0 on success
+  */
+int ht_put_fields(hashtbl_t * tbl, const linesplit_t *split, const int *fields,
+                  size_t n_fields, const char *sep, void *data);
+
+/** @brief ht_upsert() using some fields of a split line as the lookup key.
+  *
+  * See ht_put_fields() for how the key is formed.
+  *
+  * @param tbl hashtable in which the entry should be found or put
+  * @param split a split line
+  * @param fields 0-based indexes of the fields making up the key
+  * @param n_fields the number of elements in fields
+  * @param sep the string between fields
+  * @param inserted if not NULL, set to 1 if a new entry was added, or 0 if
+  *                 the key was already present
+  *
+  * @return a pointer to the entry's data, or NULL on memory error
+  */
+void **ht_upsert_fields(hashtbl_t * tbl, const linesplit_t *split,
+                        const int *fields, size_t n_fields, const char *sep,
+                        int *inserted);
+
+/** @brief retrieves an entry's data, using some fields of a split line as
+  * the lookup key.
+  *
+  * See ht_put_fields() for how the key is formed.
+  *
+  * @param tbl table in which the data is stored
+  * @param split a split line
+  * @param fields 0-based indexes of the fields making up the key
+  * @param n_fields the number of elements in fields
+  * @param sep the string between fields
+  *
+  * @return NULL if an element with the specified key does not exist, else
+  * the data in the entry.
+  */
+void *ht_get_fields(hashtbl_t * tbl, const linesplit_t *split,
+                    const int *fields, size_t n_fields, const char *sep);
+
 /** @brief removes an entry from a hashtable
   *
   * @param tbl table in which the data is stored
@@ -127,9 +257,9 @@ void ht_call_for_each(hashtbl_t * tbl, void (*func) (void *));
   * hash algorithm performance.
   *
   * data is printed to sdterr and includes the allocated array size,
-  * the number of empty cells, the average length of non-empty cells,
-  * the maximum chain length, and the total number of elements in the
-  * hashtable.
+  * the number of empty slots, the total number of elements in the
+  * hashtable, and the average and maximum distance of an element from the
+  * slot its hash points to.
   *
   * @param tbl a hashtable
   */
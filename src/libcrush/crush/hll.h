@@ -0,0 +1,149 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file hll.h
+  * @brief HyperLogLog sketches, for counting distinct values approximately.
+  *
+  * A sketch estimates how many distinct values have been added to it in a
+  * fixed amount of memory: 2^precision one-byte registers, for a standard
+  * error of about 1.04 / sqrt(2^precision) - 0.8% at the default precision.
+  * Sketches with the same precision can be merged, giving the estimate for
+  * the union of the values added to either.
+  *
+  * Most groups in an aggregation see only a few distinct values, so a
+  * sketch starts out sparse: a sorted list of the registers that have been
+  * set, at a much finer precision (HLL_SPARSE_PRECISION), which counts
+  * small numbers of values almost exactly.  Once the list would take half
+  * the memory of the registers, it is converted to them.
+  *
+  * The estimate from the registers uses the improved estimator of Ertl
+  * ("New cardinality estimation algorithms for HyperLogLog sketches",
+  * 2017), which needs neither the empirical bias tables of HyperLogLog++
+  * nor a switch to linear counting for small counts.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef HLL_H
+#define HLL_H
+
+/** @brief the smallest precision a sketch may have. */
+#define HLL_MIN_PRECISION 4
+
+/** @brief the largest precision a sketch may have. */
+#define HLL_MAX_PRECISION 18
+
+/** @brief the precision used when none is given. */
+#define HLL_DEFAULT_PRECISION 14
+
+/** @brief the precision of the entries in a sparse sketch. */
+#define HLL_SPARSE_PRECISION 25
+
+/** @brief a HyperLogLog sketch.  Members of this struct should not be
+  * modified by user code. */
+typedef struct {
+  void *data;         /**< @brief the sparse entries (u_int32_t), or the
+                           registers (unsigned char) of a dense sketch.
+                           NULL while the sketch is empty. */
+  u_int32_t n_sparse; /**< @brief the number of sparse entries. */
+  unsigned char precision;  /**< @brief log2 of the number of registers. */
+  unsigned char dense;      /**< @brief non-zero once data holds the
+                                 registers. */
+} hll_t;
+
+/** @brief initializes an empty sketch.
+  *
+  * @param hll the sketch.
+  * @param precision log2 of the number of registers, from HLL_MIN_PRECISION
+  *                  to HLL_MAX_PRECISION.
+  *
+  * @return 0 on success, or -1 if the precision is out of range.
+  */
+int hll_init(hll_t *hll, int precision);
+
+/** @brief frees the memory held by a sketch.  It may be initialized
+  * again afterwards. */
+void hll_destroy(hll_t *hll);
+
+/** @brief empties a sketch, keeping its precision.  A dense sketch frees
+  * its registers and becomes sparse again. */
+void hll_clear(hll_t *hll);
+
+/** @brief hashes a value for hll_add_hash().
+  *
+  * @param data the value, which need not be null-terminated.
+  * @param len the length of the value.
+  *
+  * @return a 64-bit hash whose bits are all well mixed.
+  */
+u_int64_t hll_hash(const char *data, size_t len);
+
+/** @brief adds a value to a sketch, given its hash from hll_hash(). */
+void hll_add_hash(hll_t *hll, u_int64_t hash);
+
+/** @brief adds a value to a sketch.
+  *
+  * @param hll the sketch.
+  * @param data the value, which need not be null-terminated.
+  * @param len the length of the value.
+  */
+void hll_add(hll_t *hll, const char *data, size_t len);
+
+/** @brief adds the values of one sketch into another, so that the estimate
+  * of INTO is that of the union of the values added to both.
+  *
+  * @return 0 on success, or -1 if the sketches have different precisions.
+  */
+int hll_merge(hll_t *into, const hll_t *from);
+
+/** @brief estimates how many distinct values have been added to a sketch.
+  */
+double hll_estimate(const hll_t *hll);
+
+/** @brief tells how much memory a sketch has allocated, in bytes, not
+  * counting the hll_t itself. */
+size_t hll_size(const hll_t *hll);
+
+/** @brief writes a sketch to a file, in a form hll_load() can read back on
+  * the same kind of machine.
+  *
+  * @return 0 on success, or -1 if writing failed.
+  */
+int hll_save(const hll_t *hll, FILE *fp);
+
+/** @brief reads a sketch written by hll_save() into an uninitialized hll_t.
+  *
+  * @return 0 on success, or -1 if the file ended early or doesn't hold a
+  *         sketch.
+  */
+int hll_load(hll_t *hll, FILE *fp);
+
+/** @brief parses a precision given as text, such as on the command line.
+  *
+  * @param s the precision, or NULL for HLL_DEFAULT_PRECISION.
+  *
+  * @return the precision, or -1 if it isn't a whole number from
+  *         HLL_MIN_PRECISION to HLL_MAX_PRECISION.
+  */
+int hll_parse_precision(const char *s);
+
+#endif /* HLL_H */
@@ -0,0 +1,162 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file linesplit.h
+  * @brief A single-pass field tokenizer for delimited lines.
+  *
+  * The accessors in ffutils.h (get_line_field(), get_line_pos(),
+  * field_start()) rescan a line from its beginning for every field that is
+  * requested.  A linesplit_t instead records the offset and length of every
+  * field in one scan, so that any number of fields can then be accessed in
+  * constant time.
+  *
+  * The line itself is not copied or modified, so the views stored in a
+  * linesplit_t are only valid for as long as the line they refer to.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef LINESPLIT_H
+#define LINESPLIT_H
+
+/** @brief the initial number of fields a linesplit_t can hold if none is
+  * specified. */
+#define LINESPLIT_DEFAULT_CAPACITY 32
+
+/** @brief the location of a single field within a line. */
+typedef struct {
+  size_t offset;  /**< @brief index of the first byte of the field. */
+  size_t length;  /**< @brief number of bytes in the field. */
+} field_view_t;
+
+/** @brief the fields of a split line.  Members of this struct should not be
+  * modified by user code. */
+typedef struct {
+  const char *line;      /**< @brief the line which was most recently split. */
+  size_t n_fields;       /**< @brief the number of fields in line. */
+  size_t capacity;       /**< @brief the number of elements in fields. */
+  field_view_t *fields;  /**< @brief the location of each field in line. */
+} linesplit_t;
+
+/** @brief gets a pointer to the first byte of a field.  No bounds-checking
+  * is done. */
+#define linesplit_field_ptr(split, i) \
+  ((split)->line + (split)->fields[(i)].offset)
+
+/** @brief gets the length of a field.  No bounds-checking is done. */
+#define linesplit_field_len(split, i) \
+  ((split)->fields[(i)].length)
+
+/** @brief initializes a linesplit_t.
+  *
+  * @param split the object to be initialized.
+  * @param capacity the number of fields to reserve space for.  If zero,
+  *                 LINESPLIT_DEFAULT_CAPACITY is used.  The array grows as
+  *                 needed regardless.
+  *
+  * @return 0 on success.
+  */
+int linesplit_init(linesplit_t *split, size_t capacity);
+
+/** @brief releases the resources held by a linesplit_t.
+  *
+  * The linesplit_t object itself is not deallocated.
+  *
+  * @param split the object to be cleaned up.
+  */
+void linesplit_destroy(linesplit_t *split);
+
+/** @brief splits a null-terminated line into fields.
+  *
+  * Trailing linebreak characters are not considered part of the last field.
+  * If delim is NULL or empty, the whole line is treated as a single field.
+  *
+  * @param split an initialized linesplit_t.
+  * @param line the line to split.
+  * @param delim the field separator.
+  *
+  * @return the number of fields in line.
+  */
+size_t linesplit(linesplit_t *split, const char *line, const char *delim);
+
+/** @brief splits the first LEN bytes of a line into fields.
+  *
+  * Behaves like linesplit(), but LINE need not be null-terminated.
+  *
+  * @param split an initialized linesplit_t.
+  * @param line the line to split.
+  * @param len the number of bytes in line.
+  * @param delim the field separator.
+  *
+  * @return the number of fields in line.
+  */
+size_t linesplit_n(linesplit_t *split, const char *line, size_t len,
+                   const char *delim);
+
+/** @brief the linesplit_t equivalent of get_line_field().
+  *
+  * copies at most <i>n</i> - 1 characters from field <i>i</i> of a split line
+  * into <i>dest</i> and null-terminates it.
+  *
+  * @param dest destination buffer
+  * @param split a split line
+  * @param n size of the destination buffer
+  * @param i field to be copied (0-based)
+  *
+  * @return number of chars copied into the dest buffer, or -1 if i is greater
+  * than the number of fields in the line.
+  */
+int linesplit_get_field(char *dest, const linesplit_t *split, size_t n, int i);
+
+/** @brief the linesplit_t equivalent of field_start().
+  *
+  * @param split a split line
+  * @param fn the desired field number (1-based)
+  *
+  * @return a pointer into the line where the fn-th field begins, or NULL if
+  *  the field does not exist.
+  */
+const char *linesplit_field_start(const linesplit_t *split, size_t fn);
+
+/** @brief the linesplit_t equivalent of get_line_pos().
+  *
+  * @param split a split line
+  * @param i the field index (0-based)
+  * @param start the position of the start character, or -1 if the
+  *              field does not exist.
+  * @param end the position of the end character, or -1 if the field
+  *              does not exist.  For empty fields, end == start.
+  *
+  * @return the length of the field, or -1 if the field does not exist.
+  */
+int linesplit_get_pos(const linesplit_t *split, int i, int *start, int *end);
+
+/** @brief the linesplit_t equivalent of field_str().
+  *
+  * @param value the string to be located
+  * @param split a split line
+  *
+  * @return 0-based index of the first field having the specified value,
+  * -1 if not found, or -2 on error.
+  */
+ssize_t linesplit_field_str(const char *value, const linesplit_t *split);
+
+#endif /* LINESPLIT_H */
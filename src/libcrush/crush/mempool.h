@@ -16,76 +16,126 @@
 
 /** @file mempool.h
   * @brief A simple memory pool API.  Since space occupied by things in the
-  * pool cannot be reclaimed, this is mostly useful for situations where 
-  * objects in the pool have the same lifetime as the pool itself.
+  * pool cannot be reclaimed individually, this is mostly useful for
+  * situations where objects in the pool have the same lifetime as the pool
+  * itself.
   *
-  * To avoid problems when allocating very large amounts of contiguous memory,
-  * the pool consists of "pages" of memory blocks.  No item larger than
-  * the page size can be stored in the pool.  But ideally the page size will be
-  * enough to hold several items.  And optimally, the page size should be a
-  * multiple of the size of the things to be stored.
+  * The pool is an arena: memory is handed out by bumping a pointer through
+  * a "chunk" obtained from malloc(), so an allocation takes constant time.
+  * When a chunk is full, a new one twice the size of the last is added (up
+  * to MEMPOOL_MAX_CHUNK_SZ), so the number of chunks stays small however
+  * much is stored.  An allocation too big to share a chunk gets a chunk of
+  * its own, so there is no limit on the size of an item.
+  *
+  * mempool_mark() and mempool_reset() release everything allocated after a
+  * given point at once, for pools holding short-lived scratch data.
   */
 #include <stdlib.h>
 
 #ifndef MEMPOOL_H
 #define MEMPOOL_H
 
+/** @brief regular chunks do not grow beyond this size, unless the pool was
+  * created with a larger page size. */
+#define MEMPOOL_MAX_CHUNK_SZ (1024 * 1024)
+
 /** @brief for internal use only */
-struct _mempool_page {
-  size_t next; /* the next unreserved location in the buffer */
-  void *buffer; /* a block of of memory */
+struct _mempool_chunk {
+  struct _mempool_chunk *prev; /* the chunk allocated before this one */
+  size_t size;                 /* the capacity of the chunk */
+  size_t used;                 /* the number of bytes handed out */
 };
 
 /** @brief the memory pool data type.  Members of this struct should not be
  *  accessed by user code. */
 typedef struct _mempool {
-  size_t page_size;  /**< @brief the capacity of each "page" of memory. */
-  size_t n_pages;    /**< @brief the number of pages currently allocated. */
-  size_t next_unfull;/**< @brief the index of the first page with free space. */
-  struct _mempool_page *pages; /**< @brief list of pages */
+  size_t page_size;  /**< @brief the capacity of the first chunk. */
+  size_t next_size;  /**< @brief the capacity of the next regular chunk. */
+  size_t n_chunks;   /**< @brief the number of chunks currently allocated. */
+  struct _mempool_chunk *chunks;  /**< @brief the newest chunk. */
+  struct _mempool_chunk *current; /**< @brief the chunk being filled. */
+  size_t bytes_used;     /**< @brief bytes handed out, including padding. */
+  size_t bytes_reserved; /**< @brief bytes obtained from malloc(). */
 } mempool_t;
 
-/** @brief tells how much memory is being used by a mempool's buffers.
-  * Does not account for overhead. */
-#define mempool_size( p ) \
-	((p)->capacity * (p)->n_buffers)
+/** @brief a position in a memory pool, saved by mempool_mark(). */
+typedef struct {
+  struct _mempool_chunk *chunks;  /**< @brief the newest chunk. */
+  struct _mempool_chunk *current; /**< @brief the chunk being filled. */
+  size_t used;                    /**< @brief bytes used in current. */
+  size_t bytes_used;              /**< @brief the pool's bytes_used. */
+} mempool_mark_t;
+
+/** @brief tells how much memory is being used by a mempool's chunks,
+  * including unused space and overhead. */
+#define mempool_size( p ) ((p)->bytes_reserved)
+
+/** @brief tells how many bytes have been allocated from a mempool. */
+#define mempool_used( p ) ((p)->bytes_used)
 
 /** @brief creates a new memory pool.
-  * 
-  * @param page_size how many bytes each buffer in the memory pool should be
-  * able to hold.  This also represents the largest amount of memory which can
-  * be allocated.
-  * 
+  *
+  * @param page_size the capacity of the pool's first chunk of memory.  Later
+  * chunks grow geometrically from this size.
+  *
   * @return a newly-allocated memory pool
   */
 mempool_t *mempool_create(size_t page_size);
 
 /** @brief adds something to the memory pool.
-  * 
+  *
   * @param pool the pool to which the thing should be added
   * @param thing the thing to add to the pool
   * @param thing_size the size of the thing to add
-  * 
+  *
   * @return the address in the memory pool where the thing was stored, or NULL
-  * if the thing is larger than the pool's page size, or if there was an error
-  * allocating a new page.
+  * if thing_size is zero.
   */
 void *mempool_add(mempool_t * pool, const void *thing, size_t thing_size);
 
-/** @brief reserves space within a memory pool
-  * 
+/** @brief reserves space within a memory pool.  No alignment is performed,
+  * so this is best suited to strings; use mempool_alloc_aligned() for
+  * structures.
+  *
   * @param pool in which the space should be reserved
   * @param n_bytes the number of bytes to reserve
-  * 
-  * @return the address in the memory pool where the thing was stored,
-  * or NULL if n_bytes was zero, if n_bytes is larger than the pool's
-  * capacity, or allocating a new page failed.
+  *
+  * @return the address in the memory pool of the reserved space, or NULL if
+  * n_bytes was zero.
   */
 void *mempool_alloc(mempool_t * pool, size_t n_bytes);
 
+/** @brief reserves space within a memory pool at an aligned address.
+  *
+  * @param pool in which the space should be reserved
+  * @param n_bytes the number of bytes to reserve
+  * @param alignment the required alignment - a power of 2.
+  *
+  * @return the address in the memory pool of the reserved space, or NULL if
+  * n_bytes was zero or alignment is not a power of 2.
+  */
+void *mempool_alloc_aligned(mempool_t * pool, size_t n_bytes,
+                            size_t alignment);
+
+/** @brief records the current position of a memory pool.
+  *
+  * @param pool a memory pool
+  * @param mark receives the position
+  */
+void mempool_mark(mempool_t * pool, mempool_mark_t *mark);
+
+/** @brief releases everything allocated from a pool since a call to
+  * mempool_mark().  Chunks added since then are freed.
+  *
+  * @param pool a memory pool
+  * @param mark a position saved from the same pool, which must not have been
+  * reset to an earlier position since.
+  */
+void mempool_reset(mempool_t * pool, const mempool_mark_t *mark);
+
 /** @brief frees resources associated with a memory pool.
-  * 
-  * @param pool 
+  *
+  * @param pool
   */
 void mempool_destroy(mempool_t * pool);
 
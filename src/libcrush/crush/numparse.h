@@ -0,0 +1,72 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file numparse.h
+  * @brief Conversion of numeric fields, reporting their decimal precision.
+  *
+  * numparse() converts the text of a field in place - it need not be copied
+  * into a null-terminated buffer first - and counts the digits after the
+  * decimal point in the same pass.  Like atof(), it skips leading whitespace
+  * and converts the longest prefix which looks like a number.
+  *
+  * Numbers with up to 19 significant digits and a small exponent are
+  * converted without calling strtod(), which covers nearly all real data.
+  * The result is the same correctly-rounded double strtod() would return.
+  * The decimal point is always '.', regardless of the current locale.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef NUMPARSE_H
+#define NUMPARSE_H
+
+/** @brief the result of converting a number. */
+typedef struct {
+  double value;       /**< @brief the value of the number. */
+  int64_t int_value;  /**< @brief the exact value, if is_int is set. */
+  int is_int;         /**< @brief nonzero if the number was written as an
+                           integer which fits in an int64_t. */
+  int precision;      /**< @brief the number of digits written after the
+                           decimal point. */
+} numparse_t;
+
+/** @brief converts the number at the start of a buffer.
+  *
+  * @param s the text to be converted.  It need not be null-terminated.
+  * @param len the number of bytes in s.
+  * @param num receives the result.  If no number is found, all of its
+  *            members are set to zero.
+  *
+  * @return the number of bytes of s which were consumed (including leading
+  *         whitespace), or 0 if s does not begin with a number.
+  */
+size_t numparse(const char *s, size_t len, numparse_t *num);
+
+/** @brief converts a null-terminated string.
+  *
+  * @param s the string to be converted.
+  * @param num receives the result.
+  *
+  * @return as for numparse().
+  */
+size_t numparse_str(const char *s, numparse_t *num);
+
+#endif /* NUMPARSE_H */
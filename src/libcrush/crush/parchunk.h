@@ -0,0 +1,129 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file parchunk.h
+  * @brief Parallel processing of input in line-aligned chunks.
+  *
+  * Tools which transform each line independently of the others can spread
+  * the work over several threads.  parchunk_run() reads its input in chunks
+  * of whole lines with dbfr_getchunk(), hands them to a pool of worker
+  * threads, and writes the output of each chunk in input order.  No more
+  * than two chunks per thread are held at once, so memory use is bounded
+  * however large the input is.
+  *
+  * Memory-mapped files are divided up in place; other input is copied into
+  * the chunks line by line as it is read.  With one thread, or where
+  * threads are not available, the chunks are processed by the calling
+  * thread and written straight to the output.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <crush/bufout.h>
+#include <crush/dbfr.h>
+
+#ifndef PARCHUNK_H
+#define PARCHUNK_H
+
+/** @brief the least number of bytes of input in each chunk. */
+#define PARCHUNK_CHUNK_SZ (1024 * 1024)
+
+/** @brief the most threads parchunk_run() will start. */
+#define PARCHUNK_MAX_THREADS 256
+
+/** @brief the work to be done on each chunk. */
+typedef struct {
+  /** @brief processes one chunk.
+    *
+    * Called from a worker thread, possibly at the same time as calls for
+    * other chunks.
+    *
+    * @param state the worker's state, from thread_init().
+    * @param data whole lines of input.  The last line might not end with a
+    *             linebreak at the end of the input.  data is not
+    *             null-terminated in general.
+    * @param len the number of bytes in data.
+    * @param line_no the line number of the first line in data.
+    * @param out the writer for the chunk's output.
+    *
+    * @return 0 on success.  Anything else stops the run, and is returned
+    *         by parchunk_run().
+    */
+  int (*process)(void *state, const char *data, size_t len, size_t line_no,
+                 bufout_t *out);
+
+  /** @brief creates the state for one worker thread, if not NULL.
+    * Otherwise every worker is passed arg as its state. */
+  void * (*thread_init)(void *arg);
+
+  /** @brief releases a worker's state, if not NULL. */
+  void (*thread_destroy)(void *state);
+
+  /** @brief passed to thread_init(). */
+  void *arg;
+} parchunk_ops_t;
+
+/** @brief converts the argument of a --threads option.
+  *
+  * @param s a number of threads, or "0" for one per online processor.
+  *
+  * @return the number of threads, or -1 if s is not valid.
+  */
+int parchunk_threads(const char *s);
+
+/** @brief processes the rest of a reader's input in parallel.
+  *
+  * @param reader the input.  Any lines already read are not processed.
+  * @param out the writer for the output of every chunk, in input order.
+  * @param n_threads the number of worker threads.
+  * @param ops the work to do on each chunk.
+  *
+  * @return 0 on success, or the first non-zero value returned by
+  *         ops->process().
+  */
+int parchunk_run(dbfr_t *reader, bufout_t *out, int n_threads,
+                 const parchunk_ops_t *ops);
+
+/** @brief runs a task once for each of a number of items, spreading the
+  * items over several threads.
+  *
+  * Calls for different items may run at the same time; the calling thread
+  * does its share of the work.  This is meant for the steps which follow
+  * parchunk_run(), such as combining what each worker produced.
+  *
+  * @param n the number of items.
+  * @param n_threads the most threads to use.
+  * @param task the work to do, given arg and the index of an item.
+  * @param arg passed to task.
+  */
+void parchunk_each(size_t n, int n_threads,
+                   void (*task)(void *arg, size_t i), void *arg);
+
+/** @brief gets the length of the line beginning at LINE.
+  *
+  * @param line the start of a line within a chunk.
+  * @param end the end of the chunk.
+  *
+  * @return the number of bytes up to and including the next linebreak, or
+  *         to END if there is none.
+  */
+size_t parchunk_line_len(const char *line, const char *end);
+
+#endif /* PARCHUNK_H */
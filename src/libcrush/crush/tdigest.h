@@ -0,0 +1,142 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file tdigest.h
+  * @brief t-digests, for estimating quantiles of a stream of numbers.
+  *
+  * A t-digest summarizes the numbers added to it as a list of centroids -
+  * a mean and the number of values it stands for - which are kept small
+  * near the ends of the distribution and allowed to grow in the middle.
+  * Quantiles are estimated by interpolating between centroids, so the
+  * extreme ones (p99, p99.9) stay accurate while the digest stays a few
+  * kilobytes however many values it has seen.  Digests can be merged,
+  * giving a digest of the values added to either.
+  *
+  * This is the merging variant (Dunning and Ertl, "Computing extremely
+  * accurate quantiles using t-digests", 2019): new values are appended to
+  * a buffer, which is sorted and merged into the centroids when it fills,
+  * using the arcsine scale function.  The buffer starts small and grows as
+  * needed, so a digest of a handful of values takes little memory and
+  * reports their quantiles exactly.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+/** @brief the compression used when none is given.  Larger values keep more
+  * centroids, for more accuracy at the cost of memory. */
+#define TDIGEST_DEFAULT_COMPRESSION 100
+
+/** @brief a centroid of a t-digest. */
+typedef struct {
+  double mean;    /**< @brief the mean of the values it stands for. */
+  double weight;  /**< @brief how many values it stands for. */
+} tdigest_centroid_t;
+
+/** @brief a t-digest.  Members of this struct should not be modified by user
+  * code. */
+typedef struct {
+  tdigest_centroid_t *centroids;  /**< @brief the merged centroids, sorted
+                                       by mean, followed by values which
+                                       have not been merged yet. */
+  u_int32_t n;            /**< @brief the number of entries in centroids. */
+  u_int32_t n_merged;     /**< @brief how many of them are merged. */
+  u_int32_t sz;           /**< @brief the allocated size of centroids. */
+  u_int32_t compression;  /**< @brief the compression parameter. */
+  double min;             /**< @brief the smallest value added. */
+  double max;             /**< @brief the largest value added. */
+} tdigest_t;
+
+/** @brief initializes an empty digest.
+  *
+  * @param td the digest.
+  * @param compression roughly the most centroids to keep, at least 10.
+  *
+  * @return 0 on success, or -1 if the compression is too small.
+  */
+int tdigest_init(tdigest_t *td, int compression);
+
+/** @brief frees the memory held by a digest.  It may be initialized again
+  * afterwards. */
+void tdigest_destroy(tdigest_t *td);
+
+/** @brief empties a digest, keeping its compression. */
+void tdigest_clear(tdigest_t *td);
+
+/** @brief adds a value to a digest. */
+void tdigest_add(tdigest_t *td, double value);
+
+/** @brief adds the values of one digest to another, so that INTO becomes a
+  * digest of the values added to both. */
+void tdigest_merge(tdigest_t *into, const tdigest_t *from);
+
+/** @brief estimates a quantile of the values added to a digest.
+  *
+  * Any values which have not been merged into the centroids yet are merged
+  * first.  Quantiles of a digest with few values are exact, interpolating
+  * linearly between the two values either side where the quantile falls
+  * between them.
+  *
+  * @param td the digest.
+  * @param q the quantile, from 0 (the smallest value) to 1 (the largest).
+  *
+  * @return the estimate, or NaN if the digest is empty.
+  */
+double tdigest_quantile(tdigest_t *td, double q);
+
+/** @brief tells how many values have been added to a digest. */
+double tdigest_count(const tdigest_t *td);
+
+/** @brief tells how much memory a digest has allocated, in bytes, not
+  * counting the tdigest_t itself. */
+size_t tdigest_size(const tdigest_t *td);
+
+/** @brief writes a digest to a file, in a form tdigest_load() can read back
+  * on the same kind of machine.
+  *
+  * @return 0 on success, or -1 if writing failed.
+  */
+int tdigest_save(const tdigest_t *td, FILE *fp);
+
+/** @brief reads a digest written by tdigest_save() into an uninitialized
+  * tdigest_t.
+  *
+  * @return 0 on success, or -1 if the file ended early or doesn't hold a
+  *         digest.
+  */
+int tdigest_load(tdigest_t *td, FILE *fp);
+
+/** @brief parses a comma-separated list of percentiles, such as "50,95,99",
+  * for passing to tdigest_quantile() once divided by 100.
+  *
+  * @param s the list.
+  * @param percents set to a new array of the percentiles, each from 0 to 100,
+  *                 which the caller must free.
+  *
+  * @return how many percentiles there are, or -1 if the list isn't valid, in
+  *         which case nothing is allocated.
+  */
+int tdigest_parse_percents(const char *s, double **percents);
+
+#endif /* TDIGEST_H */
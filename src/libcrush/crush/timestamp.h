@@ -0,0 +1,124 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/** @file timestamp.h
+  * @brief Fast parsing and formatting of fixed-format timestamps.
+  *
+  * These convert the timestamps found in most logs to and from a number of
+  * seconds without going through strptime(), mktime() or strftime(): no
+  * locale, no time zone database and no struct tm, just a few integer
+  * operations.  The formats understood are
+  *
+  *   - YYYY-MM-DD, optionally followed by a space or a T and then HH:MM or
+  *     HH:MM:SS, optionally with a fraction of a second and a time zone
+  *     (Z, +HH, +HHMM or +HH:MM).  The date may be separated by slashes
+  *     instead of dashes.
+  *   - a whole or fractional number of seconds since the epoch.
+  *
+  * Times are taken as they are written: a time zone is kept, so that it can
+  * be written back out, but the time is not converted to UTC.  Seconds
+  * count from 1970-01-01 00:00:00 as written, without leap seconds.
+  *
+  * A timestamp can be written back out in the format it was read in,
+  * which is how a time is truncated to the start of a bucket of time
+  * without changing the look of it.
+  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+/** @brief the longest text timestamp_format() writes, without a trailing
+  * null. */
+#define TIMESTAMP_MAX_LEN 32
+
+/** @brief the kinds of timestamp which can be parsed. */
+typedef enum {
+  timestamp_epoch,     /**< @brief seconds since the epoch. */
+  timestamp_date,      /**< @brief a date with no time of day. */
+  timestamp_datetime   /**< @brief a date and a time of day. */
+} timestamp_style_t;
+
+/** @brief how a timestamp was written. */
+typedef struct {
+  timestamp_style_t style;  /**< @brief what the timestamp holds. */
+  char date_sep;      /**< @brief the separator in the date: - or /. */
+  char time_sep;      /**< @brief the separator between the date and the
+                           time of day: a space or T. */
+  int has_seconds;    /**< @brief whether the time of day has seconds. */
+  char zone[8];       /**< @brief the time zone as written, or "". */
+} timestamp_format_t;
+
+/** @brief parses a timestamp.
+  *
+  * @param s the text, which need not be null-terminated.
+  * @param len the number of bytes in s, all of which must be part of the
+  *            timestamp.
+  * @param seconds set to the time, as seconds since the epoch.  A fraction
+  *                of a second is dropped, rounding towards the past.
+  * @param format if not NULL, set to how the timestamp was written.
+  *
+  * @return 0 on success, or -1 if s isn't a valid timestamp.
+  */
+int timestamp_parse(const char *s, size_t len, long long *seconds,
+                    timestamp_format_t *format);
+
+/** @brief writes out a time, in the format a timestamp was read in.
+  *
+  * A fraction of a second is never written.
+  *
+  * @param dest the destination, with room for TIMESTAMP_MAX_LEN bytes.  It
+  *             is not null-terminated.
+  * @param seconds the time, as seconds since the epoch.
+  * @param format the format to write it in.
+  *
+  * @return the number of bytes written, or 0 if the time can't be written
+  *         in that format (its year isn't between 0 and 9999).
+  */
+size_t timestamp_format(char *dest, long long seconds,
+                        const timestamp_format_t *format);
+
+/** @brief the start of the bucket of time which a time falls in.
+  *
+  * Buckets are WIDTH seconds long, and one starts at the epoch, so a bucket
+  * a day or an hour wide starts on a day or an hour.
+  *
+  * @param seconds a time, as seconds since the epoch.
+  * @param width the width of a bucket, in seconds.  Must be positive.
+  *
+  * @return the first second of the bucket.
+  */
+long long timestamp_floor(long long seconds, long long width);
+
+/** @brief parses the width of a bucket of time.
+  *
+  * The width is "second", "minute", "hour" or "day", or a whole number
+  * followed by s, m, h or d for that many seconds, minutes, hours or days.
+  * A number on its own is a number of seconds.
+  *
+  * @param s the null-terminated width.
+  * @param width set to the width, in seconds.
+  *
+  * @return 0 on success, or -1 if s isn't a valid width.
+  */
+int timestamp_parse_width(const char *s, long long *width);
+
+#endif /* TIMESTAMP_H */
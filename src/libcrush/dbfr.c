@@ -39,6 +39,9 @@
 #  ifdef HAVE_SYS_STAT_H
 #    include <sys/stat.h>
 #  endif
+#  ifdef HAVE_SYS_MMAN_H
+#    include <sys/mman.h>
+#  endif
 #  ifndef HAVE_OPEN64
 #    define open64 open
 #  endif
@@ -53,6 +56,16 @@
 #  include <sys/stat.h>
 #endif /* HAVE_CONFIG_H */
 
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H
+#  define DBFR_USE_MMAP 1
+#endif
+
+#if defined HAVE_PTHREAD_CREATE && defined HAVE_PTHREAD_H
+#  define DBFR_USE_READAHEAD 1
+#  include <errno.h>
+#  include <pthread.h>
+#endif
+
 #include <crush/dbfr.h>
 
 #if defined HAVE_FCNTL_H || defined HAVE_SYS_FCNTL_H
@@ -78,23 +91,279 @@ static void * xmalloc(size_t size) {
   return ptr;
 }
 
-dbfr_t * dbfr_open(const char *filename) {
+static void * xrealloc(void *ptr, size_t size) {
+  ptr = realloc(ptr, size);
+  if (! ptr) {
+    fprintf(stderr, "%s: out of memory\n", getenv("_"));
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/* Open a file by name, treating NULL or "-" as stdin. */
+static FILE * dbfr_fopen(const char *filename) {
   int fd, flags;
-  FILE *fp;
   flags = O_RDONLY;
 #ifdef O_LARGEFILE
   flags |= O_LARGEFILE;
 #endif
   if (filename == NULL || strcmp(filename, "-") == 0)
-    return dbfr_init(stdin);
+    return stdin;
   if ((fd = open64(filename, flags)) < 0)
     return NULL;
-  if ((fp = fdopen(fd, "r")) == NULL)
+  return fdopen(fd, "r");
+}
+
+dbfr_t * dbfr_open(const char *filename) {
+  FILE *fp = dbfr_fopen(filename);
+  if (fp == NULL)
     return NULL;
   return dbfr_init(fp);
 }
 
-dbfr_t * dbfr_init(FILE *fp) {
+dbfr_t * dbfr_mmap_open(const char *filename) {
+  FILE *fp = dbfr_fopen(filename);
+  if (fp == NULL)
+    return NULL;
+  return dbfr_mmap_init(fp);
+}
+
+dbfr_t * dbfr_readahead_open(const char *filename) {
+  FILE *fp = dbfr_fopen(filename);
+  if (fp == NULL)
+    return NULL;
+  return dbfr_readahead_init(fp);
+}
+
+#ifdef DBFR_USE_READAHEAD
+/* The ring of blocks shared by a reader and its I/O thread.  The thread fills
+   blocks[tail], the reader consumes blocks[head]; n_filled counts the blocks
+   between the two, including the one being consumed. */
+struct dbfr_readahead {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;    /* signalled when a block is filled, or at EOF */
+  pthread_cond_t emptied;   /* signalled when a block is released */
+  int fd;
+  char *blocks[DBFR_READAHEAD_BLOCKS];
+  size_t block_len[DBFR_READAHEAD_BLOCKS];
+  size_t n_filled;
+  int done;                 /* the thread has reached EOF or an error */
+  int stop;                 /* the reader is being closed */
+
+  /* used only by the reading thread */
+  size_t head;
+  size_t pos;               /* offset of the next unread byte in head */
+  int holding;              /* non-zero if head is a filled block */
+};
+
+/* The I/O thread.  Cancellation is only allowed while blocked in read(), so
+   that dbfr_close() does not have to wait for more input to arrive. */
+static void * dbfr_readahead_thread(void *arg) {
+  struct dbfr_readahead *ra = arg;
+  size_t tail = 0;
+  ssize_t n;
+
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  for (;;) {
+    pthread_mutex_lock(&ra->lock);
+    while (ra->n_filled == DBFR_READAHEAD_BLOCKS && ! ra->stop)
+      pthread_cond_wait(&ra->emptied, &ra->lock);
+    if (ra->stop) {
+      pthread_mutex_unlock(&ra->lock);
+      break;
+    }
+    pthread_mutex_unlock(&ra->lock);
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    do {
+      n = read(ra->fd, ra->blocks[tail], DBFR_READAHEAD_BLOCK_SZ);
+    } while (n < 0 && errno == EINTR);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    pthread_mutex_lock(&ra->lock);
+    if (n <= 0) {
+      ra->done = 1;
+      pthread_cond_signal(&ra->filled);
+      pthread_mutex_unlock(&ra->lock);
+      break;
+    }
+    ra->block_len[tail] = n;
+    ra->n_filled++;
+    pthread_cond_signal(&ra->filled);
+    pthread_mutex_unlock(&ra->lock);
+    tail = (tail + 1) % DBFR_READAHEAD_BLOCKS;
+  }
+  return NULL;
+}
+
+/* Take the head of the ring if it has been filled, waiting for it if WAIT is
+   non-zero.  Returns zero if there is no block to read: at EOF, or when it
+   has not arrived. */
+static int dbfr_readahead_hold(struct dbfr_readahead *ra, int wait) {
+  if (! ra->holding) {
+    pthread_mutex_lock(&ra->lock);
+    while (wait && ra->n_filled == 0 && ! ra->done)
+      pthread_cond_wait(&ra->filled, &ra->lock);
+    ra->holding = (ra->n_filled > 0);
+    pthread_mutex_unlock(&ra->lock);
+  }
+  return ra->holding;
+}
+
+/* Consume N bytes of the head of the ring, handing it back to the I/O thread
+   once it is exhausted. */
+static void dbfr_readahead_consume(struct dbfr_readahead *ra, size_t n) {
+  ra->pos += n;
+  if (ra->pos == ra->block_len[ra->head]) {
+    pthread_mutex_lock(&ra->lock);
+    ra->n_filled--;
+    pthread_cond_signal(&ra->emptied);
+    pthread_mutex_unlock(&ra->lock);
+    ra->head = (ra->head + 1) % DBFR_READAHEAD_BLOCKS;
+    ra->pos = 0;
+    ra->holding = 0;
+  }
+}
+
+/* Read the next line out of the ring into reader->next_line.  Returns the
+   length of the line, or -1 at EOF, like getline(). */
+static ssize_t dbfr_readahead_line(dbfr_t *reader) {
+  struct dbfr_readahead *ra = reader->readahead;
+  size_t len = 0, avail, chunk;
+  char *start, *linebreak;
+
+  while (dbfr_readahead_hold(ra, 1)) {
+    start = ra->blocks[ra->head] + ra->pos;
+    avail = ra->block_len[ra->head] - ra->pos;
+    linebreak = memchr(start, '\n', avail);
+    chunk = linebreak ? linebreak - start + 1 : avail;
+
+    if (reader->next_line_sz < len + chunk + 1) {
+      reader->next_line_sz = (len + chunk + 1) * 2;
+      reader->next_line = xrealloc(reader->next_line, reader->next_line_sz);
+    }
+    memcpy(reader->next_line + len, start, chunk);
+    len += chunk;
+    dbfr_readahead_consume(ra, chunk);
+    if (linebreak)
+      break;
+  }
+
+  if (len == 0)
+    return -1;
+  reader->next_line[len] = '\0';
+  return len;
+}
+
+/* Copy up to N bytes out of the ring into BUF, waiting only if none have
+   arrived.  Returns the number copied, zero at EOF. */
+static size_t dbfr_readahead_block(dbfr_t *reader, char *buf, size_t n) {
+  struct dbfr_readahead *ra = reader->readahead;
+  size_t len = 0, chunk;
+
+  while (len < n && dbfr_readahead_hold(ra, len == 0)) {
+    chunk = ra->block_len[ra->head] - ra->pos;
+    if (chunk > n - len)
+      chunk = n - len;
+    memcpy(buf + len, ra->blocks[ra->head] + ra->pos, chunk);
+    len += chunk;
+    dbfr_readahead_consume(ra, chunk);
+  }
+  return len;
+}
+
+/* Start the I/O thread for READER.  Returns non-zero on failure, in which case
+   the reader is left reading through getline(). */
+static int dbfr_readahead_start(dbfr_t *reader) {
+  struct dbfr_readahead *ra = xmalloc(sizeof(struct dbfr_readahead));
+  int i;
+
+  memset(ra, 0, sizeof(*ra));
+  ra->fd = fileno(reader->file);
+  for (i = 0; i < DBFR_READAHEAD_BLOCKS; i++)
+    ra->blocks[i] = xmalloc(DBFR_READAHEAD_BLOCK_SZ);
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->filled, NULL);
+  pthread_cond_init(&ra->emptied, NULL);
+
+  reader->readahead = ra;
+  if (pthread_create(&ra->thread, NULL, dbfr_readahead_thread, ra) != 0) {
+    reader->readahead = NULL;
+    pthread_cond_destroy(&ra->emptied);
+    pthread_cond_destroy(&ra->filled);
+    pthread_mutex_destroy(&ra->lock);
+    for (i = 0; i < DBFR_READAHEAD_BLOCKS; i++)
+      free(ra->blocks[i]);
+    free(ra);
+    return 1;
+  }
+  return 0;
+}
+
+/* Stop the I/O thread and release the ring. */
+static void dbfr_readahead_stop(dbfr_t *reader) {
+  struct dbfr_readahead *ra = reader->readahead;
+  int i;
+
+  pthread_mutex_lock(&ra->lock);
+  ra->stop = 1;
+  pthread_cond_signal(&ra->emptied);
+  pthread_mutex_unlock(&ra->lock);
+  pthread_cancel(ra->thread);
+  pthread_join(ra->thread, NULL);
+
+  pthread_cond_destroy(&ra->emptied);
+  pthread_cond_destroy(&ra->filled);
+  pthread_mutex_destroy(&ra->lock);
+  for (i = 0; i < DBFR_READAHEAD_BLOCKS; i++)
+    free(ra->blocks[i]);
+  free(ra);
+  reader->readahead = NULL;
+}
+#endif /* DBFR_USE_READAHEAD */
+
+/* Move the first of the lines left over by dbfr_getlines() into the reader's
+   next_line buffer. */
+static ssize_t dbfr_pending_line(dbfr_t *reader) {
+  char *start = reader->pending + reader->pending_pos;
+  size_t avail = reader->pending_len - reader->pending_pos;
+  char *linebreak = memchr(start, '\n', avail);
+  size_t len = linebreak ? linebreak - start + 1 : avail;
+
+  if (reader->next_line_sz < len + 1) {
+    reader->next_line_sz = (len + 1) * 2;
+    reader->next_line = xrealloc(reader->next_line, reader->next_line_sz);
+  }
+  memcpy(reader->next_line, start, len);
+  reader->next_line[len] = '\0';
+  reader->pending_pos += len;
+  return len;
+}
+
+/* Read a line into the reader's next_line buffer. */
+static ssize_t dbfr_read_line(dbfr_t *reader) {
+  if (reader->pending_pos < reader->pending_len)
+    return dbfr_pending_line(reader);
+#ifdef DBFR_USE_READAHEAD
+  if (reader->readahead)
+    return dbfr_readahead_line(reader);
+#endif
+  return getline(&(reader->next_line), &(reader->next_line_sz), reader->file);
+}
+
+/* Read up to N bytes of the file into BUF, picking up where the last line
+   read left off.  Returns the number of bytes read, zero at EOF or on
+   error. */
+static size_t dbfr_read_block(dbfr_t *reader, char *buf, size_t n) {
+#ifdef DBFR_USE_READAHEAD
+  if (reader->readahead)
+    return dbfr_readahead_block(reader, buf, n);
+#endif
+  return fread(buf, 1, n, reader->file);
+}
+
+static dbfr_t * dbfr_new(FILE *fp, int readahead) {
   dbfr_t *reader;
   if (fp == NULL || ! dbfr_is_readable(fp))
     return NULL;
@@ -102,26 +371,129 @@ dbfr_t * dbfr_init(FILE *fp) {
   memset(reader, 0, sizeof(*reader));
   reader->file = fp;
 
-  if ((reader->next_line_len = getline(&(reader->next_line),
-                                      &(reader->next_line_sz),
-                                      reader->file)) <= 0) {
+#ifdef DBFR_USE_READAHEAD
+  if (readahead)
+    dbfr_readahead_start(reader);
+#endif
+
+  if ((reader->next_line_len = dbfr_read_line(reader)) <= 0) {
     reader->eof = 1;
   }
   return reader;
 }
 
+dbfr_t * dbfr_init(FILE *fp) {
+  return dbfr_new(fp, 0);
+}
+
+dbfr_t * dbfr_readahead_init(FILE *fp) {
+  return dbfr_new(fp, 1);
+}
+
+#ifdef DBFR_USE_MMAP
+/* Make the line beginning at map_pos the next line. */
+static void dbfr_map_next_line(dbfr_t *reader) {
+  char *start, *linebreak;
+  size_t remaining = reader->map_sz - reader->map_pos;
+
+  if (remaining == 0) {
+    reader->next_line = NULL;
+    reader->next_line_len = -1;
+    return;
+  }
+
+  start = reader->map + reader->map_pos;
+  linebreak = memchr(start, '\n', remaining);
+  reader->next_line = start;
+  reader->next_line_len = linebreak ? linebreak - start + 1 : remaining;
+  reader->map_pos += reader->next_line_len;
+}
+
+dbfr_t * dbfr_mmap_init(FILE *fp) {
+  dbfr_t *reader;
+  struct stat st;
+  off_t offset;
+  void *map;
+
+  if (fp == NULL || ! dbfr_is_readable(fp))
+    return NULL;
+
+  /* pipes, terminals etc. are read ahead by a thread instead, since
+     nothing has been read from them yet; empty files use getline(). */
+  if (fstat(fileno(fp), &st) != 0)
+    return dbfr_init(fp);
+  if (! S_ISREG(st.st_mode))
+    return dbfr_readahead_init(fp);
+  if ((offset = ftello(fp)) < 0 || offset >= st.st_size)
+    return dbfr_init(fp);
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  if (map == MAP_FAILED)
+    return dbfr_init(fp);
+#ifdef HAVE_MADVISE
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  reader = xmalloc(sizeof(dbfr_t));
+  memset(reader, 0, sizeof(*reader));
+  reader->file = fp;
+  reader->map = map;
+  reader->map_sz = st.st_size;
+  reader->map_pos = offset;
+
+  dbfr_map_next_line(reader);
+  if (reader->next_line_len <= 0)
+    reader->eof = 1;
+  return reader;
+}
+
+/* dbfr_getline() for memory-mapped readers. */
+static ssize_t dbfr_map_getline(dbfr_t *reader) {
+  if (reader->next_line_len < 1) {
+    reader->eof = 1;
+    return reader->next_line_len;
+  }
+  reader->current_line_offset += reader->current_line_len;
+  reader->current_line = reader->next_line;
+  reader->current_line_len = reader->next_line_len;
+  dbfr_map_next_line(reader);
+  reader->line_no++;
+  return reader->current_line_len;
+}
+#else
+dbfr_t * dbfr_mmap_init(FILE *fp) {
+  return dbfr_init(fp);
+}
+#endif /* DBFR_USE_MMAP */
+
+char * dbfr_next_line_dup(const dbfr_t *reader) {
+  size_t len = reader->next_line_len > 0 ? reader->next_line_len : 0;
+  char *copy = xmalloc(len + 1);
+
+  if (len > 0)
+    memcpy(copy, reader->next_line, len);
+  copy[len] = '\0';
+  return copy;
+}
+
 ssize_t dbfr_getline(dbfr_t *reader) {
   /* swap buffers, to make the old "next" line the new "current" */
   char *cur = reader->current_line;
   size_t cur_sz = reader->current_line_sz;
   ssize_t cur_len = reader->current_line_len;
 
+#ifdef DBFR_USE_MMAP
+  if (reader->map)
+    return dbfr_map_getline(reader);
+#endif
+
   if (reader->next_line_len < 1) {
     /* do not nullify current_line on EOF */
     reader->eof = 1;
     return reader->next_line_len;
   }
 
+  reader->current_line_offset += cur_len;
   reader->current_line = reader->next_line;
   reader->current_line_sz = reader->next_line_sz;
   reader->current_line_len = reader->next_line_len;
@@ -131,9 +503,7 @@ ssize_t dbfr_getline(dbfr_t *reader) {
   reader->next_line_len = cur_len;
 
   /* read in the new "next" line */
-  reader->next_line_len = getline(&(reader->next_line),
-                                  &(reader->next_line_sz),
-                                  reader->file);
+  reader->next_line_len = dbfr_read_line(reader);
   if (reader->next_line_len < 1) {
     free(reader->next_line);
     reader->next_line = NULL;
@@ -143,13 +513,230 @@ ssize_t dbfr_getline(dbfr_t *reader) {
   return reader->current_line_len;
 }
 
+void dbfr_batch_init(dbfr_batch_t *batch) {
+  memset(batch, 0, sizeof(*batch));
+}
+
+void dbfr_batch_destroy(dbfr_batch_t *batch) {
+  free(batch->lines);
+  free(batch->buf);
+  memset(batch, 0, sizeof(*batch));
+}
+
+/* dbfr_getlines() for memory-mapped readers: the lines are already views. */
+static size_t dbfr_map_getlines(dbfr_t *reader, dbfr_batch_t *batch,
+                                size_t max_lines) {
+  size_t bytes = 0;
+  ssize_t len;
+  dbfr_line_t *l;
+
+  while (batch->n_lines < max_lines && bytes < DBFR_BATCH_MAX_BYTES &&
+         (len = dbfr_getline(reader)) > 0) {
+    if (batch->n_lines == batch->lines_sz) {
+      batch->lines_sz = batch->lines_sz ? batch->lines_sz * 2 : 64;
+      batch->lines = xrealloc(batch->lines,
+                              batch->lines_sz * sizeof(dbfr_line_t));
+    }
+    l = &batch->lines[batch->n_lines++];
+    l->line = reader->current_line;
+    l->len = len;
+    l->line_no = reader->line_no;
+    l->offset = reader->current_line_offset;
+    bytes += len;
+  }
+  return batch->n_lines;
+}
+
+size_t dbfr_getlines(dbfr_t *reader, dbfr_batch_t *batch, size_t max_lines) {
+  size_t buf_len, pos = 0, bytes = 0, pending, n, i;
+  off_t offset = reader->current_line_offset + reader->current_line_len;
+  dbfr_line_t *l;
+  char *linebreak;
+  int eof = 0;
+
+  batch->n_lines = 0;
+  if (reader->map)
+    return dbfr_map_getlines(reader, batch, max_lines);
+  if (reader->next_line_len < 1) {
+    reader->eof = 1;
+    return 0;
+  }
+  if (max_lines == 0)
+    return 0;
+
+  /* the batch starts with next_line and whatever the last batch read beyond
+     it, and the rest is read a block at a time.  reading goes on until the
+     line after the batch is whole, since it becomes next_line. */
+  pending = reader->pending_len - reader->pending_pos;
+  buf_len = reader->next_line_len + pending;
+  if (batch->buf_sz < buf_len + DBFR_BATCH_BLOCK_SZ) {
+    batch->buf_sz = (buf_len + DBFR_BATCH_BLOCK_SZ) * 2;
+    batch->buf = xrealloc(batch->buf, batch->buf_sz);
+  }
+  memcpy(batch->buf, reader->next_line, reader->next_line_len);
+  memcpy(batch->buf + reader->next_line_len,
+         reader->pending + reader->pending_pos, pending);
+  reader->pending_len = reader->pending_pos = 0;
+
+  for (;;) {
+    linebreak = memchr(batch->buf + pos, '\n', buf_len - pos);
+    if (linebreak || (eof && pos < buf_len)) {
+      n = linebreak ? linebreak - (batch->buf + pos) + 1 : buf_len - pos;
+      if (batch->n_lines == max_lines || bytes >= DBFR_BATCH_MAX_BYTES)
+        break;
+      if (batch->n_lines == batch->lines_sz) {
+        batch->lines_sz = batch->lines_sz ? batch->lines_sz * 2 : 64;
+        batch->lines = xrealloc(batch->lines,
+                                batch->lines_sz * sizeof(dbfr_line_t));
+      }
+      l = &batch->lines[batch->n_lines++];
+      l->len = n;
+      l->line_no = reader->line_no + batch->n_lines;
+      l->offset = offset + bytes;
+      bytes += n;
+      pos += n;
+      continue;
+    }
+    if (eof)
+      break;
+    if (batch->buf_sz < buf_len + DBFR_BATCH_BLOCK_SZ) {
+      batch->buf_sz = (buf_len + DBFR_BATCH_BLOCK_SZ) * 2;
+      batch->buf = xrealloc(batch->buf, batch->buf_sz);
+    }
+    n = dbfr_read_block(reader, batch->buf + buf_len, DBFR_BATCH_BLOCK_SZ);
+    eof = (n == 0);
+    buf_len += n;
+  }
+
+  /* the buffer may have moved as it grew, so the lines are located once it
+     is full. */
+  for (i = 0; i < batch->n_lines; i++)
+    batch->lines[i].line = batch->buf + (batch->lines[i].offset - offset);
+
+  /* leave the reader as dbfr_getline() would have: the last line of the
+     batch is current_line, and the line after it next_line. */
+  l = &batch->lines[batch->n_lines - 1];
+  if (reader->current_line_sz < l->len + 1) {
+    reader->current_line_sz = (l->len + 1) * 2;
+    reader->current_line = xrealloc(reader->current_line,
+                                    reader->current_line_sz);
+  }
+  memcpy(reader->current_line, l->line, l->len);
+  reader->current_line[l->len] = '\0';
+  reader->current_line_len = l->len;
+  reader->current_line_offset = l->offset;
+  reader->line_no = l->line_no;
+
+  if (pos == buf_len) {
+    reader->eof = 1;
+    free(reader->next_line);
+    reader->next_line = NULL;
+    reader->next_line_sz = 0;
+    reader->next_line_len = -1;
+    return batch->n_lines;
+  }
+  linebreak = memchr(batch->buf + pos, '\n', buf_len - pos);
+  n = linebreak ? linebreak - (batch->buf + pos) + 1 : buf_len - pos;
+  if (reader->next_line_sz < n + 1) {
+    reader->next_line_sz = (n + 1) * 2;
+    reader->next_line = xrealloc(reader->next_line, reader->next_line_sz);
+  }
+  memcpy(reader->next_line, batch->buf + pos, n);
+  reader->next_line[n] = '\0';
+  reader->next_line_len = n;
+
+  /* and the whole lines after it wait for the next read. */
+  pending = buf_len - pos - n;
+  if (reader->pending_sz < pending) {
+    reader->pending_sz = pending * 2;
+    reader->pending = xrealloc(reader->pending, reader->pending_sz);
+  }
+  memcpy(reader->pending, batch->buf + pos + n, pending);
+  reader->pending_len = pending;
+  return batch->n_lines;
+}
+
+#ifdef DBFR_USE_MMAP
+/* dbfr_getchunk() for memory-mapped readers: the block runs from next_line
+   to the end of the line which holds byte MIN_BYTES. */
+static size_t dbfr_map_getchunk(dbfr_t *reader, size_t min_bytes,
+                                const char **chunk) {
+  char *start = reader->next_line, *end = reader->map + reader->map_sz;
+  char *p, *last, *linebreak;
+  size_t n_lines = 0;
+
+  if (reader->next_line_len < 1) {
+    reader->eof = 1;
+    return 0;
+  }
+
+  if (min_bytes > 0 && min_bytes < end - start &&
+      (linebreak = memchr(start + min_bytes - 1, '\n',
+                          end - start - min_bytes + 1)) != NULL)
+    end = linebreak + 1;
+  if (end < start + reader->next_line_len)
+    end = start + reader->next_line_len;
+
+  for (last = p = start; p < end; n_lines++) {
+    last = p;
+    linebreak = memchr(p, '\n', end - p);
+    p = linebreak ? linebreak + 1 : end;
+  }
+
+  reader->current_line_offset += reader->current_line_len + (last - start);
+  reader->current_line = last;
+  reader->current_line_len = end - last;
+  reader->line_no += n_lines;
+  reader->map_pos = end - reader->map;
+  dbfr_map_next_line(reader);
+
+  *chunk = start;
+  return end - start;
+}
+#endif
+
+size_t dbfr_getchunk(dbfr_t *reader, size_t min_bytes, char **buf,
+                     size_t *buf_sz, const char **chunk) {
+  size_t chunk_len = 0;
+  ssize_t len;
+
+#ifdef DBFR_USE_MMAP
+  if (reader->map)
+    return dbfr_map_getchunk(reader, min_bytes, chunk);
+#endif
+
+  while (chunk_len < min_bytes && (len = dbfr_getline(reader)) > 0) {
+    if (*buf_sz < chunk_len + len + 1) {
+      *buf_sz = (chunk_len + len + 1) * 2;
+      *buf = xrealloc(*buf, *buf_sz);
+    }
+    memcpy(*buf + chunk_len, reader->current_line, len);
+    chunk_len += len;
+  }
+  if (chunk_len > 0)
+    (*buf)[chunk_len] = '\0';
+  *chunk = *buf;
+  return chunk_len;
+}
+
 void dbfr_close(dbfr_t *reader) {
   if (! reader)
     return;
+#ifdef DBFR_USE_MMAP
+  if (reader->map) {
+    munmap(reader->map, reader->map_sz);
+    reader->next_line = reader->current_line = NULL;
+  }
+#endif
+#ifdef DBFR_USE_READAHEAD
+  if (reader->readahead)
+    dbfr_readahead_stop(reader);
+#endif
   if (reader->next_line)
     free(reader->next_line);
   if (reader->current_line)
     free(reader->current_line);
+  free(reader->pending);
   if (reader->file)
     fclose(reader->file);
   free(reader);
@@ -0,0 +1,271 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <crush/delimscan.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(HAVE_IMMINTRIN_H)
+# define DELIMSCAN_X86 1
+# include <immintrin.h>
+#endif
+
+typedef size_t (*delimscan_func_t) (const char *, size_t, unsigned char,
+                                    unsigned char, size_t *, size_t,
+                                    size_t *);
+typedef size_t (*delimscan_count_func_t) (const char *, size_t,
+                                          unsigned char);
+
+/* one implementation of the scanning functions. */
+struct delimscan_vtable {
+  const char *name;
+  delimscan_func_t scan;
+  delimscan_count_func_t count;
+};
+
+static void delimscan_select(void);
+
+
+/* Byte-at-a-time scan, used on its own where no vector unit is available and
+   for the tail of a block by the vectorized versions. */
+static size_t delimscan_scalar(const char *buf, size_t len, unsigned char c1,
+                               unsigned char c2, size_t *hits,
+                               size_t max_hits, size_t *scanned) {
+  const unsigned char *p = (const unsigned char *) buf;
+  size_t i, n = 0;
+
+  for (i = 0; i < len && n < max_hits; i++) {
+    if (p[i] == c1 || p[i] == c2)
+      hits[n++] = i;
+  }
+  if (scanned)
+    *scanned = i;
+  return n;
+}
+
+static size_t delimscan_count_scalar(const char *buf, size_t len,
+                                     unsigned char c) {
+  const unsigned char *p = (const unsigned char *) buf;
+  size_t i, n = 0;
+
+  for (i = 0; i < len; i++)
+    n += (p[i] == c);
+  return n;
+}
+
+static const struct delimscan_vtable delimscan_vtable_scalar = {
+  "scalar", delimscan_scalar, delimscan_count_scalar
+};
+
+
+#ifdef DELIMSCAN_X86
+
+/* Finish a vectorized scan of the bytes from offset I onward, which number
+   fewer than one vector's width, with the scalar loop. */
+static size_t delimscan_tail(const char *buf, size_t len, size_t i,
+                             unsigned char c1, unsigned char c2, size_t *hits,
+                             size_t n, size_t max_hits, size_t *scanned) {
+  size_t j, tail_n, tail_scanned;
+
+  tail_n = delimscan_scalar(buf + i, len - i, c1, c2, hits + n, max_hits - n,
+                            &tail_scanned);
+  for (j = n; j < n + tail_n; j++)
+    hits[j] += i;
+  if (scanned)
+    *scanned = i + tail_scanned;
+  return n + tail_n;
+}
+
+/* Record the hits in one vector's worth of comparison results, returning
+   early from the enclosing function if the hits array fills up. */
+#define DELIMSCAN_DRAIN_MASK(mask, base) \
+  do { \
+    while (mask) { \
+      if (n == max_hits) { \
+        if (scanned) \
+          *scanned = hits[n - 1] + 1; \
+        return n; \
+      } \
+      hits[n++] = (base) + __builtin_ctz(mask); \
+      mask &= mask - 1; \
+    } \
+  } while (0)
+
+__attribute__((target("sse2")))
+static size_t delimscan_sse2(const char *buf, size_t len, unsigned char c1,
+                             unsigned char c2, size_t *hits, size_t max_hits,
+                             size_t *scanned) {
+  __m128i v1 = _mm_set1_epi8((char) c1);
+  __m128i v2 = _mm_set1_epi8((char) c2);
+  size_t i = 0, n = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+    unsigned int mask = _mm_movemask_epi8(
+                          _mm_or_si128(_mm_cmpeq_epi8(block, v1),
+                                       _mm_cmpeq_epi8(block, v2)));
+    DELIMSCAN_DRAIN_MASK(mask, i);
+  }
+
+  return delimscan_tail(buf, len, i, c1, c2, hits, n, max_hits, scanned);
+}
+
+__attribute__((target("sse2,popcnt")))
+static size_t delimscan_count_sse2(const char *buf, size_t len,
+                                   unsigned char c) {
+  __m128i v = _mm_set1_epi8((char) c);
+  size_t i = 0, n = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, v)));
+  }
+  return n + delimscan_count_scalar(buf + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t delimscan_avx2(const char *buf, size_t len, unsigned char c1,
+                             unsigned char c2, size_t *hits, size_t max_hits,
+                             size_t *scanned) {
+  __m256i v1 = _mm256_set1_epi8((char) c1);
+  __m256i v2 = _mm256_set1_epi8((char) c2);
+  size_t i = 0, n = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *) (buf + i));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+                          _mm256_or_si256(_mm256_cmpeq_epi8(block, v1),
+                                          _mm256_cmpeq_epi8(block, v2)));
+    DELIMSCAN_DRAIN_MASK(mask, i);
+  }
+
+  return delimscan_tail(buf, len, i, c1, c2, hits, n, max_hits, scanned);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t delimscan_count_avx2(const char *buf, size_t len,
+                                   unsigned char c) {
+  __m256i v = _mm256_set1_epi8((char) c);
+  size_t i = 0, n = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *) (buf + i));
+    n += __builtin_popcount((unsigned int)
+                            _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, v)));
+  }
+  return n + delimscan_count_scalar(buf + i, len - i, c);
+}
+
+#undef DELIMSCAN_DRAIN_MASK
+
+static const struct delimscan_vtable delimscan_vtable_sse2 = {
+  "sse2", delimscan_sse2, delimscan_count_sse2
+};
+
+static const struct delimscan_vtable delimscan_vtable_avx2 = {
+  "avx2", delimscan_avx2, delimscan_count_avx2
+};
+
+#endif /* DELIMSCAN_X86 */
+
+
+/* the implementation in use.  resolved on the first call to delimscan(). */
+static const struct delimscan_vtable *delimscan_vtable = NULL;
+
+int delimscan_use(delimscan_impl_t impl) {
+  switch (impl) {
+    case delimscan_impl_auto:
+#ifdef DELIMSCAN_X86
+      if (delimscan_use(delimscan_impl_avx2) == 0 ||
+          delimscan_use(delimscan_impl_sse2) == 0)
+        return 0;
+#endif
+      return delimscan_use(delimscan_impl_scalar);
+
+    case delimscan_impl_scalar:
+      delimscan_vtable = &delimscan_vtable_scalar;
+      return 0;
+
+#ifdef DELIMSCAN_X86
+    case delimscan_impl_sse2:
+      __builtin_cpu_init();
+      if (! (__builtin_cpu_supports("sse2") &&
+             __builtin_cpu_supports("popcnt")))
+        return -1;
+      delimscan_vtable = &delimscan_vtable_sse2;
+      return 0;
+
+    case delimscan_impl_avx2:
+      __builtin_cpu_init();
+      if (! (__builtin_cpu_supports("avx2") &&
+             __builtin_cpu_supports("popcnt")))
+        return -1;
+      delimscan_vtable = &delimscan_vtable_avx2;
+      return 0;
+#endif
+
+    default:
+      return -1;
+  }
+}
+
+/* Select the implementation named by CRUSH_DELIMSCAN, or the best one
+   supported by the CPU. */
+static void delimscan_select(void) {
+  const char *forced = getenv("CRUSH_DELIMSCAN");
+  int retval = -1;
+
+  if (forced) {
+    if (strcmp(forced, "scalar") == 0)
+      retval = delimscan_use(delimscan_impl_scalar);
+    else if (strcmp(forced, "sse2") == 0)
+      retval = delimscan_use(delimscan_impl_sse2);
+    else if (strcmp(forced, "avx2") == 0)
+      retval = delimscan_use(delimscan_impl_avx2);
+  }
+  if (retval != 0)
+    delimscan_use(delimscan_impl_auto);
+}
+
+const char *delimscan_impl_name(void) {
+  if (! delimscan_vtable)
+    delimscan_select();
+  return delimscan_vtable->name;
+}
+
+size_t delimscan(const char *buf, size_t len, unsigned char c1,
+                 unsigned char c2, size_t *hits, size_t max_hits,
+                 size_t *scanned) {
+  if (max_hits == 0) {
+    if (scanned)
+      *scanned = 0;
+    return 0;
+  }
+  if (! delimscan_vtable)
+    delimscan_select();
+  return delimscan_vtable->scan(buf, len, c1, c2, hits, max_hits, scanned);
+}
+
+size_t delimscan_count(const char *buf, size_t len, unsigned char c) {
+  if (! delimscan_vtable)
+    delimscan_select();
+  return delimscan_vtable->count(buf, len, c);
+}
@@ -18,6 +18,7 @@
 #include <config.h>
 #endif
 
+#include <crush/delimscan.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
 #include <fcntl.h>              /* open64() and O_* flags */
@@ -27,8 +28,12 @@
 #define open64 open
 #endif
 
+/* the number of delimiter candidates located per call to delimscan(). */
+#define FIELDS_IN_LINE_SCAN_HITS 64
+
 size_t fields_in_line(const char *l, const char *d) {
-  char *p = (char *) l;
+  const char *p = l, *end, *hit, *next = l;
+  size_t hits[FIELDS_IN_LINE_SCAN_HITS], n_hits, scanned, h;
   size_t f = 1;
   size_t dl;
 
@@ -36,9 +41,25 @@ size_t fields_in_line(const char *l, const char *d) {
     return 0;
 
   dl = strlen(d);
-  while ((p = strstr(p, d)) != NULL) {
-    f++;
-    p += dl;
+  if (dl == 0)
+    return 1;
+
+  end = l + strlen(l);
+  if (dl == 1)
+    return f + delimscan_count(l, end - l, d[0]);
+
+  while (p < end) {
+    n_hits = delimscan(p, end - p, d[0], d[0],
+                       hits, FIELDS_IN_LINE_SCAN_HITS, &scanned);
+    for (h = 0; h < n_hits; h++) {
+      hit = p + hits[h];
+      /* delimiters don't overlap, and must match in full. */
+      if (hit < next || end - hit < dl || memcmp(hit, d, dl) != 0)
+        continue;
+      f++;
+      next = hit + dl;
+    }
+    p += scanned;
   }
   return f;
 }
@@ -18,18 +18,190 @@
 #include <crush/general.h>
 #include <crush/hashtbl.h>
 
+/* grow the table when it is more than HT_MAX_LOAD_NUM / HT_MAX_LOAD_DEN
+   full. */
+#define HT_MAX_LOAD_NUM 3
+#define HT_MAX_LOAD_DEN 4
+
+/* the smallest table allowed, as a power of 2. */
+#define HT_MIN_BITS 3
+
+/* Zero marks an empty slot in the hashes array, so a key which hashes to
+   zero is stored with a hash of 1 instead. */
+#define ht_fingerprint(h) ((h) ? (h) : 1)
+
+/* Map a hash to its home slot.  Multiplying by 2^64 / phi and keeping the
+   high bits spreads out hash functions which are weak in their low bits. */
+static size_t ht_home(const hashtbl_t *tbl, unsigned int h) {
+  return (size_t) (((unsigned long long) h * 0x9E3779B97F4A7C15ULL) >>
+                   (64 - tbl->bits));
+}
 
-static int ht_key_cmp(const void *a, const void *b) {
-  return strcmp(((ht_elem_t *) a)->key,
-                ((ht_elem_t *) b)->key);
+/* Find the slot holding KEY, or the empty slot at which probing for it
+   stopped. */
+static size_t ht_find_slot(const hashtbl_t *tbl, const char *key,
+                           unsigned int h) {
+  size_t mask = tbl->arrsz - 1;
+  size_t i = ht_home(tbl, h);
+
+  while (tbl->hashes[i]) {
+    if (tbl->hashes[i] == h && strcmp(tbl->arr[i].key, key) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+  return i;
 }
 
-static void ht_free_tree_data(void (*free_fn) (void *), bst_node_t *node) {
-  if (! node)
-    return;
-  ht_free_tree_data(free_fn, node->r);
-  ht_free_tree_data(free_fn, node->l);
-  free_fn(((ht_elem_t *) node->data)->data);
+/* A lookup key given in pieces: either KEY_LEN bytes at PTR, or the
+   listed fields of SPLIT joined by SEP. */
+struct ht_key {
+  const char *ptr;
+  size_t len;
+  const linesplit_t *split;
+  const int *fields;
+  size_t n_fields;
+  const char *sep;
+  size_t sep_len;
+};
+
+#define ht_key_n_parts(k) ((k)->split ? (k)->n_fields : 1)
+
+/* Get piece I of a key, not counting separators. */
+static void ht_key_part(const struct ht_key *k, size_t i, const char **ptr,
+                        size_t *len) {
+  if (! k->split) {
+    *ptr = k->ptr;
+    *len = k->len;
+  } else if (k->fields[i] < k->split->n_fields) {
+    *ptr = linesplit_field_ptr(k->split, k->fields[i]);
+    *len = linesplit_field_len(k->split, k->fields[i]);
+  } else {
+    *ptr = "";
+    *len = 0;
+  }
+}
+
+static size_t ht_key_len(const struct ht_key *k) {
+  size_t i, len, total = 0;
+  const char *ptr;
+  for (i = 0; i < ht_key_n_parts(k); i++) {
+    ht_key_part(k, i, &ptr, &len);
+    total += len + (i ? k->sep_len : 0);
+  }
+  return total;
+}
+
+/* Write a key into DEST as a null-terminated string. */
+static void ht_key_copy(const struct ht_key *k, char *dest) {
+  size_t i, len;
+  const char *ptr;
+  for (i = 0; i < ht_key_n_parts(k); i++) {
+    if (i) {
+      memcpy(dest, k->sep, k->sep_len);
+      dest += k->sep_len;
+    }
+    ht_key_part(k, i, &ptr, &len);
+    memcpy(dest, ptr, len);
+    dest += len;
+  }
+  *dest = '\0';
+}
+
+/* Continue a BKDRHash() over LEN more bytes. */
+static unsigned int ht_bkdr_update(unsigned int hash, const char *str,
+                                   size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++)
+    hash = (hash * 131) + str[i];
+  return hash;
+}
+
+/* Hash a key the same way tbl->hash would hash it as a string. */
+static unsigned int ht_key_hash(hashtbl_t *tbl, const struct ht_key *k) {
+  unsigned int hash = 0;
+  size_t i, len;
+  const char *ptr;
+
+  if (tbl->hash == BKDRHash) {
+    for (i = 0; i < ht_key_n_parts(k); i++) {
+      if (i)
+        hash = ht_bkdr_update(hash, k->sep, k->sep_len);
+      ht_key_part(k, i, &ptr, &len);
+      hash = ht_bkdr_update(hash, ptr, len);
+    }
+    return ht_fingerprint(hash & 0x7FFFFFFF);
+  }
+
+  len = ht_key_len(k) + 1;
+  if (tbl->scratch_sz < len) {
+    tbl->scratch = xrealloc(tbl->scratch, len);
+    tbl->scratch_sz = len;
+  }
+  ht_key_copy(k, tbl->scratch);
+  return ht_fingerprint(tbl->hash((unsigned char *) tbl->scratch));
+}
+
+/* Compare a key to a string stored in the table. */
+static int ht_key_eq(const struct ht_key *k, const char *stored) {
+  size_t i, len;
+  const char *ptr;
+  for (i = 0; i < ht_key_n_parts(k); i++) {
+    if (i) {
+      if (strncmp(stored, k->sep, k->sep_len) != 0)
+        return 0;
+      stored += k->sep_len;
+    }
+    ht_key_part(k, i, &ptr, &len);
+    if (strncmp(stored, ptr, len) != 0)
+      return 0;
+    stored += len;
+  }
+  return *stored == '\0';
+}
+
+/* ht_find_slot() for keys given in pieces. */
+static size_t ht_find_key_slot(const hashtbl_t *tbl, const struct ht_key *k,
+                               unsigned int h) {
+  size_t mask = tbl->arrsz - 1;
+  size_t i = ht_home(tbl, h);
+
+  while (tbl->hashes[i]) {
+    if (tbl->hashes[i] == h && ht_key_eq(k, tbl->arr[i].key))
+      break;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* Allocate an empty set of slots for a table of 2^bits slots. */
+static void ht_alloc_slots(hashtbl_t *tbl, unsigned int bits) {
+  tbl->bits = bits;
+  tbl->arrsz = (size_t) 1 << bits;
+  tbl->arr = xmalloc(sizeof(ht_elem_t) * tbl->arrsz);
+  tbl->hashes = xmalloc(sizeof(unsigned int) * tbl->arrsz);
+  memset(tbl->hashes, 0, sizeof(unsigned int) * tbl->arrsz);
+}
+
+/* Double the size of a table.  The stored hashes are reused, so no keys need
+   to be rehashed. */
+static void ht_grow(hashtbl_t *tbl) {
+  ht_elem_t *old_arr = tbl->arr;
+  unsigned int *old_hashes = tbl->hashes;
+  size_t old_sz = tbl->arrsz, mask, i, j;
+
+  ht_alloc_slots(tbl, tbl->bits + 1);
+  mask = tbl->arrsz - 1;
+  for (i = 0; i < old_sz; i++) {
+    if (! old_hashes[i])
+      continue;
+    j = ht_home(tbl, old_hashes[i]);
+    while (tbl->hashes[j])
+      j = (j + 1) & mask;
+    tbl->hashes[j] = old_hashes[i];
+    tbl->arr[j] = old_arr[i];
+  }
+  free(old_arr);
+  free(old_hashes);
 }
 
 /* initialize a table. */
@@ -37,27 +209,25 @@ int ht_init(hashtbl_t * tbl,
             size_t sz,
             unsigned int (*hash) (unsigned char *),
             void (*memfree) (void *)) {
+  unsigned int bits = HT_MIN_BITS;
 
   /* some things are required */
   if (tbl == NULL || sz == 0)
     return 1;
 
-  sz = ht_next_prime(sz);
-
-  tbl->arr = xmalloc(sizeof(bstree_t *) * sz);
-  memset(tbl->arr, 0, sizeof(bstree_t *) * sz);
-
-  tbl->ht_elem_pool = mempool_create(sizeof(ht_elem_t) * 128);
-  if (tbl->ht_elem_pool == NULL)
-    return -1;
+  while (((size_t) 1 << bits) < sz)
+    bits++;
+  ht_alloc_slots(tbl, bits);
 
-  /* since keys are free-form text, the pool size is arbitrary. */
-  tbl->key_pool = mempool_create(4096);
+  /* since keys are free-form text, the pool size is arbitrary, but a small
+     table starts with a small pool; the pool's chunks grow as it fills. */
+  tbl->key_pool = mempool_create(sz < 256 ? sz * 16 : 4096);
   if (tbl->key_pool == NULL)
     return -1;
 
   tbl->nelems = 0;
-  tbl->arrsz = sz;
+  tbl->scratch = NULL;
+  tbl->scratch_sz = 0;
   tbl->free = memfree;  /* NULL ok here */
   if (hash)             /* set a default hash function if none specified */
     tbl->hash = hash;
@@ -70,144 +240,196 @@ int ht_init(hashtbl_t * tbl,
 
 /* destroy a table */
 void ht_destroy(hashtbl_t * tbl) {
-  int i;
+  size_t i;
 
-  /* Loop through the array of trees, freeing data if necessary, then
-   * deallocating the tree. */
-  for (i = 0; i < tbl->arrsz; i++) {
-    if (tbl->arr[i]) {
-      if (tbl->free)
-        ht_free_tree_data(tbl->free, tbl->arr[i]->root);
-      bst_destroy(tbl->arr[i]);
+  if (tbl->free) {
+    for (i = 0; i < tbl->arrsz; i++) {
+      if (tbl->hashes[i])
+        tbl->free(tbl->arr[i].data);
     }
-    free(tbl->arr[i]);
   }
   free(tbl->arr);
-  mempool_destroy(tbl->ht_elem_pool);
+  free(tbl->hashes);
+  free(tbl->scratch);
   mempool_destroy(tbl->key_pool);
   memset(tbl, 0, sizeof(hashtbl_t));
 }
 
-/* Put a new key/value pair into a table. */
-int ht_put(hashtbl_t * tbl, char *key, void *data) {
-  unsigned long h;
-  bst_node_t *treenode;
-  ht_elem_t *elem, key_elem;
-
-  key_elem.key = key;
-  elem = mempool_alloc(tbl->ht_elem_pool, sizeof(ht_elem_t));
-  if (! elem)
-    return -1;
-  elem->key = mempool_alloc(tbl->key_pool,
-                            sizeof(char) * strlen(key) + 1);
-  if (! elem->key) {
-    /* elem leaks here, but we cannot free it from the mempool. */
+/* Store data in a slot returned by an upsert, freeing any data it replaces. */
+static int ht_store(hashtbl_t *tbl, void **slot, int inserted, void *data) {
+  if (! slot)
     return -1;
+  if (! inserted && tbl->free && *slot != data)
+    tbl->free(*slot);
+  *slot = data;
+  return 0;
+}
+
+/* Store a new element in the empty slot I, which may move if the table has
+   to grow first.  Returns the slot used. */
+static size_t ht_insert(hashtbl_t *tbl, size_t i, unsigned int h, char *key,
+                        void *data) {
+  size_t mask;
+
+  if ((tbl->nelems + 1) * HT_MAX_LOAD_DEN > tbl->arrsz * HT_MAX_LOAD_NUM) {
+    ht_grow(tbl);
+    mask = tbl->arrsz - 1;
+    for (i = ht_home(tbl, h); tbl->hashes[i]; i = (i + 1) & mask)
+      ;
   }
-  strcpy(elem->key, key);
-  elem->data = data;
+  tbl->hashes[i] = h;
+  tbl->arr[i].key = key;
+  tbl->arr[i].data = data;
+  tbl->nelems++;
+  return i;
+}
 
-  h = tbl->hash((unsigned char *) elem->key) % tbl->arrsz;
+/* Find or add an element, returning a pointer to its data. */
+void **ht_upsert(hashtbl_t * tbl, char *key, int *inserted) {
+  unsigned int h = ht_fingerprint(tbl->hash((unsigned char *) key));
+  size_t i = ht_find_slot(tbl, key, h);
+  char *key_copy;
 
-  if (!tbl->arr[h]) {
-    tbl->arr[h] = xmalloc(sizeof(bstree_t));
-    /* No free() fn for the bst, since its elements are in a mempool. */
-    bst_init(tbl->arr[h], ht_key_cmp, NULL);
-    bst_insert(tbl->arr[h], elem);
-    tbl->nelems++;
-    return 0;
-  }
+  if (inserted)
+    *inserted = ! tbl->hashes[i];
+  if (tbl->hashes[i])
+    return &tbl->arr[i].data;
 
-  treenode = bst_find(tbl->arr[h], &key_elem);
+  key_copy = mempool_alloc(tbl->key_pool, sizeof(char) * strlen(key) + 1);
+  if (! key_copy)
+    return NULL;
+  strcpy(key_copy, key);
+  i = ht_insert(tbl, i, h, key_copy, NULL);
+  return &tbl->arr[i].data;
+}
 
-  /* If no match is found, insert the new element and increase the counter.
-   * Otherwise, replace the old data with the new. */
-  if (!treenode) {
-    bst_insert(tbl->arr[h], elem);
-    tbl->nelems++;
-  } else {
-    if (tbl->free)
-      tbl->free(((ht_elem_t *) treenode->data)->data);
-    treenode->data = elem;
-  }
-  return 0;
+/* Put a new key/value pair into a table. */
+int ht_put(hashtbl_t * tbl, char *key, void *data) {
+  int inserted;
+  void **slot = ht_upsert(tbl, key, &inserted);
+  return ht_store(tbl, slot, inserted, data);
 }
 
 /* retrieve a value from a table */
 void *ht_get(hashtbl_t * tbl, char *key) {
-  unsigned long h;
-  bstree_t *tree;
-  bst_node_t *treenode;
-  ht_elem_t key_elem;
+  unsigned int h = ht_fingerprint(tbl->hash((unsigned char *) key));
+  size_t i = ht_find_slot(tbl, key, h);
+
+  if (! tbl->hashes[i])
+    return NULL;
+  return tbl->arr[i].data;
+}
 
-  h = tbl->hash((unsigned char *) key) % tbl->arrsz;
-  tree = tbl->arr[h];
+/* ht_upsert() and ht_get() for keys given in pieces. */
+static void ** ht_upsert_key(hashtbl_t *tbl, const struct ht_key *k,
+                             int *inserted) {
+  unsigned int h = ht_key_hash(tbl, k);
+  size_t i = ht_find_key_slot(tbl, k, h);
+  char *key_copy;
 
-  if (! tree)  /* invalid key - nothing in this slot yet */
+  if (inserted)
+    *inserted = ! tbl->hashes[i];
+  if (tbl->hashes[i])
+    return &tbl->arr[i].data;
+
+  key_copy = mempool_alloc(tbl->key_pool, ht_key_len(k) + 1);
+  if (! key_copy)
     return NULL;
-  key_elem.key = key;
-  treenode = bst_find(tree, &key_elem);
-  if (! treenode)
+  ht_key_copy(k, key_copy);
+  i = ht_insert(tbl, i, h, key_copy, NULL);
+  return &tbl->arr[i].data;
+}
+
+static void * ht_get_key(hashtbl_t *tbl, const struct ht_key *k) {
+  size_t i = ht_find_key_slot(tbl, k, ht_key_hash(tbl, k));
+
+  if (! tbl->hashes[i])
     return NULL;
-  return ((ht_elem_t *) treenode->data)->data;
+  return tbl->arr[i].data;
 }
 
-/* remove a key/value pair from a table */
-void ht_delete(hashtbl_t * tbl, char *key) {
-  unsigned long h;
-  bstree_t *tree;
-  bst_node_t *treenode;
-  ht_elem_t key_elem;
+void **ht_upsert_n(hashtbl_t * tbl, const char *key, size_t len,
+                   int *inserted) {
+  struct ht_key k = { key, len, NULL, NULL, 0, NULL, 0 };
+  return ht_upsert_key(tbl, &k, inserted);
+}
 
-  h = tbl->hash((unsigned char *) key) % tbl->arrsz;
-  tree = tbl->arr[h];
+int ht_put_n(hashtbl_t * tbl, const char *key, size_t len, void *data) {
+  int inserted;
+  void **slot = ht_upsert_n(tbl, key, len, &inserted);
+  return ht_store(tbl, slot, inserted, data);
+}
 
-  if (! tree)  /* A NULL slot means the key is unknown. */
-    return;
-  key_elem.key = key;
-  treenode = bst_find(tree, &key_elem);
-  if (treenode) {
-    if (tbl->free)
-      tbl->free(((ht_elem_t *) treenode->data)->data);
-    bst_delete(tree, &key_elem);
-    tbl->nelems--;
-  }
+void *ht_get_n(hashtbl_t * tbl, const char *key, size_t len) {
+  struct ht_key k = { key, len, NULL, NULL, 0, NULL, 0 };
+  return ht_get_key(tbl, &k);
+}
+
+void **ht_upsert_fields(hashtbl_t * tbl, const linesplit_t *split,
+                        const int *fields, size_t n_fields, const char *sep,
+                        int *inserted) {
+  struct ht_key k = { NULL, 0, split, fields, n_fields, sep, strlen(sep) };
+  return ht_upsert_key(tbl, &k, inserted);
+}
+
+int ht_put_fields(hashtbl_t * tbl, const linesplit_t *split, const int *fields,
+                  size_t n_fields, const char *sep, void *data) {
+  int inserted;
+  void **slot = ht_upsert_fields(tbl, split, fields, n_fields, sep, &inserted);
+  return ht_store(tbl, slot, inserted, data);
+}
+
+void *ht_get_fields(hashtbl_t * tbl, const linesplit_t *split,
+                    const int *fields, size_t n_fields, const char *sep) {
+  struct ht_key k = { NULL, 0, split, fields, n_fields, sep, strlen(sep) };
+  return ht_get_key(tbl, &k);
 }
 
-static void ht_keys_bst_traverse(bst_node_t *node,
-                                 char **array,
-                                 int *index) {
-  if (! node)
+/* remove a key/value pair from a table */
+void ht_delete(hashtbl_t * tbl, char *key) {
+  unsigned int h = ht_fingerprint(tbl->hash((unsigned char *) key));
+  size_t mask = tbl->arrsz - 1;
+  size_t i = ht_find_slot(tbl, key, h), j, home;
+
+  if (! tbl->hashes[i])  /* An empty slot means the key is unknown. */
     return;
-  array[*index] = ((ht_elem_t *) node->data)->key;
-  (*index)++;
-  ht_keys_bst_traverse(node->l, array, index);
-  ht_keys_bst_traverse(node->r, array, index);
+  if (tbl->free)
+    tbl->free(tbl->arr[i].data);
+  tbl->nelems--;
+
+  /* Shift later elements of the probe sequence back into the hole, so that
+     lookups never need to skip over deleted slots.  An element can fill the
+     hole at i only if its home slot is not cyclically within (i, j]. */
+  for (j = i;;) {
+    tbl->hashes[i] = 0;
+    do {
+      j = (j + 1) & mask;
+      if (! tbl->hashes[j])
+        return;
+      home = ht_home(tbl, tbl->hashes[j]);
+    } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+    tbl->hashes[i] = tbl->hashes[j];
+    tbl->arr[i] = tbl->arr[j];
+    i = j;
+  }
 }
 
 int ht_keys(hashtbl_t *tbl, char **array) {
-  int i, j = 0;
+  size_t i;
+  int j = 0;
   for (i = 0; i < tbl->arrsz; i++) {
-    if (tbl->arr[i])
-      ht_keys_bst_traverse(tbl->arr[i]->root, array, &j);
+    if (tbl->hashes[i])
+      array[j++] = tbl->arr[i].key;
   }
   return j;
 }
 
-static void ht_call_bst_traverse(bst_node_t *node, void (*func) (void *)) {
-  if (! node)
-    return;
-  func(((ht_elem_t *)node->data)->data);
-  ht_call_bst_traverse(node->l, func);
-  ht_call_bst_traverse(node->r, func);
-}
-
 /* Execute some function for all of the elements in a table. */
 void ht_call_for_each(hashtbl_t * tbl, void (*func) (void *)) {
-  int i;
+  size_t i;
   for (i = 0; i < tbl->arrsz; i++) {
-    if (tbl->arr[i])
-      ht_call_bst_traverse(tbl->arr[i]->root, func);
+    if (tbl->hashes[i])
+      func(tbl->arr[i].data);
   }
 }
 
@@ -215,18 +437,25 @@ void ht_call_for_each(hashtbl_t * tbl, void (*func) (void *)) {
    a hashing algorithm is performing.
  */
 void ht_dump_stats(hashtbl_t * tbl) {
-  size_t uninitialized = 0;
-  int i;
+  size_t empty = 0, distance, total_distance = 0, max_distance = 0, i;
+
   for (i = 0; i < tbl->arrsz; i++) {
-    if ((!tbl->arr[i])) {
-      uninitialized++;
+    if (! tbl->hashes[i]) {
+      empty++;
+      continue;
     }
+    distance = (i - ht_home(tbl, tbl->hashes[i])) & (tbl->arrsz - 1);
+    total_distance += distance;
+    if (distance > max_distance)
+      max_distance = distance;
   }
 
-  /** @todo Provide average bucket-fill metric here. */
   fprintf(stderr,
-          "size:\t%lu\nuninitialized buckets:\t%lu\nelements:\t%lu",
-          tbl->arrsz, uninitialized, tbl->nelems);
+          "size:\t%lu\nempty slots:\t%lu\nelements:\t%lu\n"
+          "average probe distance:\t%.2f\nmaximum probe distance:\t%lu\n",
+          tbl->arrsz, empty, tbl->nelems,
+          tbl->nelems ? (double) total_distance / tbl->nelems : 0.0,
+          max_distance);
 }
 
 
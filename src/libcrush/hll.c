@@ -0,0 +1,327 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <crush/general.h>
+#include <crush/hll.h>
+
+/* a sparse entry holds the index of a register at the sparse precision
+   above the number of leading zeros its hash gave, which needs this many
+   bits. */
+#define HLL_RHO_BITS 6
+
+/* the number of bits of a hash left after the sparse index. */
+#define HLL_SPARSE_REST (64 - HLL_SPARSE_PRECISION)
+
+/* the register of a hash, at some precision. */
+static u_int32_t hll_index(u_int64_t hash, int precision) {
+  return hash >> (64 - precision);
+}
+
+/* one more than the number of leading zeros in the bits of a hash after
+   the register index, at some precision. */
+static int hll_rho(u_int64_t hash, int precision) {
+  return __builtin_clzll((hash << precision) |
+                         ((u_int64_t) 1 << (precision - 1))) + 1;
+}
+
+/* the register and value a sparse entry stands for at the sketch's own
+   precision, just as if its hash had been added to the registers. */
+static void hll_sparse_register(u_int32_t entry, int precision,
+                                u_int32_t *index, int *rho) {
+  u_int32_t sparse_index = entry >> HLL_RHO_BITS;
+  int extra = HLL_SPARSE_PRECISION - precision;
+  u_int32_t extra_bits = sparse_index & ((1U << extra) - 1);
+
+  *index = sparse_index >> extra;
+  if (extra_bits)
+    *rho = extra - (31 - __builtin_clz(extra_bits));
+  else
+    *rho = extra + (entry & ((1 << HLL_RHO_BITS) - 1));
+}
+
+/* the number of entries a sparse list of N entries has room for. */
+static u_int32_t hll_sparse_capacity(u_int32_t n) {
+  u_int32_t capacity = 4;
+  while (capacity < n)
+    capacity *= 2;
+  return capacity;
+}
+
+static void hll_set_register(unsigned char *registers, u_int32_t index,
+                             int rho) {
+  if (registers[index] < rho)
+    registers[index] = rho;
+}
+
+/* replaces the sparse list of a sketch with the registers. */
+static void hll_make_dense(hll_t *hll) {
+  unsigned char *registers = xcalloc(1 << hll->precision, 1);
+  u_int32_t *sparse = hll->data, index, i;
+  int rho;
+
+  for (i = 0; i < hll->n_sparse; i++) {
+    hll_sparse_register(sparse[i], hll->precision, &index, &rho);
+    hll_set_register(registers, index, rho);
+  }
+  free(sparse);
+  hll->data = registers;
+  hll->n_sparse = 0;
+  hll->dense = 1;
+}
+
+/* adds an entry to a sparse list, keeping it sorted by index and keeping
+   the largest rho for each index. */
+static void hll_sparse_add(hll_t *hll, u_int32_t entry) {
+  u_int32_t *sparse = hll->data;
+  u_int32_t lo = 0, hi = hll->n_sparse, mid;
+  u_int32_t index = entry >> HLL_RHO_BITS;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if ((sparse[mid] >> HLL_RHO_BITS) < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < hll->n_sparse && (sparse[lo] >> HLL_RHO_BITS) == index) {
+    if (sparse[lo] < entry)
+      sparse[lo] = entry;
+    return;
+  }
+
+  if (! sparse || hll->n_sparse == hll_sparse_capacity(hll->n_sparse)) {
+    sparse = xrealloc(sparse, sizeof(u_int32_t) *
+                      (sparse ? hll->n_sparse * 2 : 4));
+    hll->data = sparse;
+  }
+  memmove(sparse + lo + 1, sparse + lo,
+          sizeof(u_int32_t) * (hll->n_sparse - lo));
+  sparse[lo] = entry;
+  hll->n_sparse++;
+
+  /* past half the size of the registers, the registers are smaller. */
+  if (hll->n_sparse * sizeof(u_int32_t) > (1U << hll->precision) / 2)
+    hll_make_dense(hll);
+}
+
+int hll_init(hll_t *hll, int precision) {
+  if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+    return -1;
+  hll->data = NULL;
+  hll->n_sparse = 0;
+  hll->precision = precision;
+  hll->dense = 0;
+  return 0;
+}
+
+void hll_destroy(hll_t *hll) {
+  free(hll->data);
+  hll->data = NULL;
+  hll->n_sparse = 0;
+  hll->dense = 0;
+}
+
+void hll_clear(hll_t *hll) {
+  /* the registers are given up, so that a sketch which is cleared after
+     each of many small groups doesn't stay as big as the largest. */
+  if (hll->dense)
+    hll_destroy(hll);
+  else
+    hll->n_sparse = 0;
+}
+
+u_int64_t hll_hash(const char *data, size_t len) {
+  u_int64_t hash = 14695981039346656037ULL;
+  size_t i;
+
+  /* FNV-1a, which is quick but leaves the high bits poorly mixed, followed
+     by the finalizer of MurmurHash3. */
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) data[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+void hll_add_hash(hll_t *hll, u_int64_t hash) {
+  if (hll->dense) {
+    hll_set_register(hll->data, hll_index(hash, hll->precision),
+                     hll_rho(hash, hll->precision));
+  } else {
+    hll_sparse_add(hll, hll_index(hash, HLL_SPARSE_PRECISION)
+                        << HLL_RHO_BITS |
+                        hll_rho(hash, HLL_SPARSE_PRECISION));
+  }
+}
+
+void hll_add(hll_t *hll, const char *data, size_t len) {
+  hll_add_hash(hll, hll_hash(data, len));
+}
+
+int hll_merge(hll_t *into, const hll_t *from) {
+  const unsigned char *from_registers = from->data;
+  const u_int32_t *sparse = from->data;
+  u_int32_t index, i;
+  int rho;
+
+  if (into->precision != from->precision)
+    return -1;
+  if (! from->dense) {
+    for (i = 0; i < from->n_sparse; i++) {
+      if (into->dense) {
+        hll_sparse_register(sparse[i], into->precision, &index, &rho);
+        hll_set_register(into->data, index, rho);
+      } else {
+        hll_sparse_add(into, sparse[i]);
+      }
+    }
+    return 0;
+  }
+
+  if (! into->dense)
+    hll_make_dense(into);
+  for (i = 0; i < 1U << into->precision; i++)
+    hll_set_register(into->data, i, from_registers[i]);
+  return 0;
+}
+
+/* the sigma and tau functions of Ertl's estimator, computed by their
+   series until they stop changing. */
+static double hll_sigma(double x) {
+  double y = 1, z = x, prev;
+
+  if (x == 1)
+    return INFINITY;
+  do {
+    x *= x;
+    prev = z;
+    z += x * y;
+    y += y;
+  } while (z != prev);
+  return z;
+}
+
+static double hll_tau(double x) {
+  double y = 1, z = 1 - x, prev;
+
+  if (x == 0 || x == 1)
+    return 0;
+  do {
+    x = sqrt(x);
+    prev = z;
+    y *= 0.5;
+    z -= (1 - x) * (1 - x) * y;
+  } while (z != prev);
+  return z / 3;
+}
+
+double hll_estimate(const hll_t *hll) {
+  const unsigned char *registers = hll->data;
+  double m = 1 << hll->precision, sparse_m = 1 << HLL_SPARSE_PRECISION, z;
+  u_int32_t counts[64 + 2];
+  int q = 64 - hll->precision, k;
+  u_int32_t i;
+
+  if (! hll->dense) {
+    /* linear counting, which is nearly exact for this many registers. */
+    return sparse_m * log(sparse_m / (sparse_m - hll->n_sparse));
+  }
+
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < m; i++)
+    counts[registers[i]]++;
+  z = m * hll_tau(1 - counts[q + 1] / m);
+  for (k = q; k >= 1; k--)
+    z = 0.5 * (z + counts[k]);
+  z += m * hll_sigma(counts[0] / m);
+  return m * m / (2 * log(2) * z);
+}
+
+size_t hll_size(const hll_t *hll) {
+  if (hll->dense)
+    return 1 << hll->precision;
+  if (! hll->data)
+    return 0;
+  return sizeof(u_int32_t) * hll_sparse_capacity(hll->n_sparse);
+}
+
+int hll_save(const hll_t *hll, FILE *fp) {
+  unsigned char header[2];
+  size_t len;
+
+  header[0] = hll->precision;
+  header[1] = hll->dense;
+  len = hll->dense ? 1 << hll->precision
+                   : sizeof(u_int32_t) * hll->n_sparse;
+  if (fwrite(header, sizeof(header), 1, fp) != 1 ||
+      fwrite(&hll->n_sparse, sizeof(hll->n_sparse), 1, fp) != 1 ||
+      (len > 0 && fwrite(hll->data, len, 1, fp) != 1))
+    return -1;
+  return 0;
+}
+
+int hll_load(hll_t *hll, FILE *fp) {
+  unsigned char header[2];
+  u_int32_t n_sparse;
+  size_t len;
+
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      fread(&n_sparse, sizeof(n_sparse), 1, fp) != 1 ||
+      hll_init(hll, header[0]) != 0 ||
+      n_sparse > (1U << header[0]) / 2 / sizeof(u_int32_t))
+    return -1;
+
+  if (header[1]) {
+    len = 1 << hll->precision;
+    hll->data = xmalloc(len);
+    hll->dense = 1;
+  } else {
+    len = sizeof(u_int32_t) * n_sparse;
+    if (n_sparse > 0)
+      hll->data = xmalloc(sizeof(u_int32_t) * hll_sparse_capacity(n_sparse));
+    hll->n_sparse = n_sparse;
+  }
+  if (len > 0 && fread(hll->data, len, 1, fp) != 1) {
+    hll_destroy(hll);
+    return -1;
+  }
+  return 0;
+}
+
+int hll_parse_precision(const char *s) {
+  char *end;
+  long precision;
+
+  if (s == NULL)
+    return HLL_DEFAULT_PRECISION;
+  precision = strtol(s, &end, 10);
+  if (end == s || *end != '\0' ||
+      precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+    return -1;
+  return precision;
+}
@@ -0,0 +1,153 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <crush/delimscan.h>
+#include <crush/general.h>
+#include <crush/linesplit.h>
+
+/* the number of delimiter candidates located per call to delimscan(). */
+#define LINESPLIT_SCAN_HITS 64
+
+/* Add a field to the end of the list, growing the array if necessary. */
+static void linesplit_append(linesplit_t *split, size_t offset,
+                             size_t length) {
+  if (split->n_fields == split->capacity) {
+    split->capacity *= 2;
+    split->fields = xrealloc(split->fields,
+                             sizeof(field_view_t) * split->capacity);
+  }
+  split->fields[split->n_fields].offset = offset;
+  split->fields[split->n_fields].length = length;
+  split->n_fields++;
+}
+
+int linesplit_init(linesplit_t *split, size_t capacity) {
+  memset(split, 0, sizeof(linesplit_t));
+  if (capacity == 0)
+    capacity = LINESPLIT_DEFAULT_CAPACITY;
+  split->fields = xmalloc(sizeof(field_view_t) * capacity);
+  split->capacity = capacity;
+  return 0;
+}
+
+void linesplit_destroy(linesplit_t *split) {
+  free(split->fields);
+  memset(split, 0, sizeof(linesplit_t));
+}
+
+size_t linesplit(linesplit_t *split, const char *line, const char *delim) {
+  return linesplit_n(split, line, strlen(line), delim);
+}
+
+size_t linesplit_n(linesplit_t *split, const char *line, size_t len,
+                   const char *delim) {
+  const char *p, *end, *hit, *field;
+  size_t dl = 0;
+  size_t hits[LINESPLIT_SCAN_HITS], n_hits, scanned, h;
+
+  split->line = line;
+  split->n_fields = 0;
+
+  /* don't include linebreaks as field data. */
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    len--;
+
+  if (delim)
+    dl = strlen(delim);
+
+  field = p = line;
+  end = line + len;
+
+  while (dl > 0 && p < end) {
+    n_hits = delimscan(p, end - p, delim[0], delim[0],
+                       hits, LINESPLIT_SCAN_HITS, &scanned);
+    for (h = 0; h < n_hits; h++) {
+      hit = p + hits[h];
+      /* skip candidates inside the previous delimiter, and partial matches
+         of a multi-byte delimiter, which are field data. */
+      if (hit < field ||
+          (dl > 1 && (end - hit < dl || memcmp(hit + 1, delim + 1, dl - 1))))
+        continue;
+      linesplit_append(split, field - line, hit - field);
+      field = hit + dl;
+    }
+    p += scanned;
+  }
+
+  /* everything after the last delimiter is the final field. */
+  linesplit_append(split, field - line, end - field);
+
+  return split->n_fields;
+}
+
+int linesplit_get_field(char *dest, const linesplit_t *split, size_t n,
+                        int i) {
+  size_t field_len;
+
+  if (i < 0 || i >= split->n_fields) {
+    dest[0] = '\0';
+    return -1;
+  }
+
+  field_len = split->fields[i].length;
+  if (field_len > n - 1)
+    field_len = n - 1;
+  memcpy(dest, linesplit_field_ptr(split, i), field_len);
+  dest[field_len] = '\0';
+  return field_len;
+}
+
+const char *linesplit_field_start(const linesplit_t *split, size_t fn) {
+  if (fn < 1 || fn > split->n_fields)
+    return NULL;
+  return linesplit_field_ptr(split, fn - 1);
+}
+
+int linesplit_get_pos(const linesplit_t *split, int i, int *start, int *end) {
+  if (i < 0 || i >= split->n_fields) {
+    *start = -1;
+    *end = -1;
+    return -1;
+  }
+
+  *start = split->fields[i].offset;
+  if (split->fields[i].length == 0)
+    *end = *start;
+  else
+    *end = *start + split->fields[i].length - 1;
+  return split->fields[i].length;
+}
+
+ssize_t linesplit_field_str(const char *value, const linesplit_t *split) {
+  size_t i, value_len;
+
+  if (value == NULL)
+    return -2;
+
+  value_len = strlen(value);
+  for (i = 0; i < split->n_fields; i++) {
+    if (split->fields[i].length == value_len &&
+        memcmp(linesplit_field_ptr(split, i), value, value_len) == 0)
+      return i;
+  }
+  return -1;
+}
@@ -16,28 +16,31 @@
 
 #include <crush/general.h>
 #include <crush/mempool.h>
+#include <stdint.h>             /* uintptr_t */
 #include <string.h>             /* memcpy() */
 
-/* returns the amount of memory remaining within a given page. */
-#define bytes_available_in_page(pool, page_idx) \
-  ((pool)->page_size - (pool)->pages[page_idx].next)
-
-/* Add a page of memory to the pool. */
-static void * _mempool_add_page(mempool_t *pool) {
-  void *tmp;
-  int i = pool->n_pages;
-  if (! pool->pages) {
-    tmp = xmalloc(sizeof(struct _mempool_page));
-  } else {
-    tmp = xrealloc(pool->pages,
-                   sizeof(struct _mempool_page) * (pool->n_pages + 1));
-  }
-  pool->pages = tmp;
-  pool->n_pages++;
-
-  pool->pages[i].next = 0;
-  pool->pages[i].buffer = xmalloc(pool->page_size);
-  return pool->pages;
+/* the size of a chunk header, rounded up so that the data following it is
+   suitably aligned for any type. */
+#define CHUNK_HEADER_SZ \
+  ((sizeof(struct _mempool_chunk) + 15) & ~((size_t) 15))
+
+#define chunk_data(chunk) ((char *) (chunk) + CHUNK_HEADER_SZ)
+
+/* the number of bytes needed to bring ADDR up to a multiple of ALIGNMENT. */
+#define align_padding(addr, alignment) \
+  ((size_t) (-(uintptr_t) (addr)) & ((alignment) - 1))
+
+/* Allocate a chunk with room for SIZE bytes and link it into the pool. */
+static struct _mempool_chunk * _mempool_add_chunk(mempool_t *pool,
+                                                  size_t size) {
+  struct _mempool_chunk *chunk = xmalloc(CHUNK_HEADER_SZ + size);
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->prev = pool->chunks;
+  pool->chunks = chunk;
+  pool->n_chunks++;
+  pool->bytes_reserved += CHUNK_HEADER_SZ + size;
+  return chunk;
 }
 
 /* Allocate and initialize a mempool. */
@@ -46,13 +49,11 @@ mempool_t *mempool_create(size_t page_size) {
 
   pool = xmalloc(sizeof(mempool_t));
   memset(pool, 0, sizeof(mempool_t));
+  if (page_size == 0)
+    page_size = 1;
   pool->page_size = page_size;
-
-  if (! _mempool_add_page(pool)) {
-    free(pool);
-    return NULL;
-  }
-  pool->next_unfull = 0;
+  pool->next_size = page_size;
+  pool->current = _mempool_add_chunk(pool, page_size);
   return pool;
 }
 
@@ -67,48 +68,73 @@ void * mempool_add(mempool_t * pool, const void *thing, size_t thing_size) {
   return location;
 }
 
-/* Reserve memory within the mempool */
 void * mempool_alloc(mempool_t * pool, size_t n_bytes) {
-  void *location = NULL;
-  int i;
-  if (!pool || n_bytes == 0 || n_bytes > pool->page_size)
+  return mempool_alloc_aligned(pool, n_bytes, 1);
+}
+
+/* Reserve memory within the mempool */
+void * mempool_alloc_aligned(mempool_t * pool, size_t n_bytes,
+                             size_t alignment) {
+  struct _mempool_chunk *chunk;
+  size_t padding;
+
+  if (!pool || n_bytes == 0 || alignment == 0 ||
+      (alignment & (alignment - 1)) != 0)
     return NULL;
 
-  /* find a page with enough room, or make a new page. */
-  for (i = pool->next_unfull; i < pool->n_pages; i++) {
-    if (bytes_available_in_page(pool, i) >= n_bytes)
-      break;
+  chunk = pool->current;
+  padding = align_padding(chunk_data(chunk) + chunk->used, alignment);
+  if (chunk->size - chunk->used < padding + n_bytes) {
+    if (n_bytes + alignment - 1 > pool->next_size / 2) {
+      /* Too big to share a chunk: give it one of its own, leaving the
+         current chunk to be filled by later allocations. */
+      chunk = _mempool_add_chunk(pool, n_bytes + alignment - 1);
+    } else {
+      chunk = _mempool_add_chunk(pool, pool->next_size);
+      pool->current = chunk;
+      if (pool->next_size < MEMPOOL_MAX_CHUNK_SZ)
+        pool->next_size *= 2;
+    }
+    padding = align_padding(chunk_data(chunk), alignment);
   }
 
-  if (i == pool->n_pages) {
-    if (! _mempool_add_page(pool))
-      return NULL;
-  }
+  chunk->used += padding;
+  pool->bytes_used += padding + n_bytes;
+  chunk->used += n_bytes;
+  return chunk_data(chunk) + chunk->used - n_bytes;
+}
 
-  location = pool->pages[i].buffer + pool->pages[i].next;
-  pool->pages[i].next += n_bytes;
+void mempool_mark(mempool_t * pool, mempool_mark_t *mark) {
+  mark->chunks = pool->chunks;
+  mark->current = pool->current;
+  mark->used = pool->current->used;
+  mark->bytes_used = pool->bytes_used;
+}
 
-  /* reduce search time for subsequent allocations */
-  for (i = pool->next_unfull;
-       i < pool->n_pages && bytes_available_in_page(pool, i) == 0;
-       i++) {
-    pool->next_unfull++;
-  }
+void mempool_reset(mempool_t * pool, const mempool_mark_t *mark) {
+  struct _mempool_chunk *chunk;
 
-  return location;
+  while (pool->chunks != mark->chunks) {
+    chunk = pool->chunks;
+    pool->chunks = chunk->prev;
+    pool->n_chunks--;
+    pool->bytes_reserved -= CHUNK_HEADER_SZ + chunk->size;
+    free(chunk);
+  }
+  pool->current = mark->current;
+  pool->current->used = mark->used;
+  pool->bytes_used = mark->bytes_used;
 }
 
 /* Free resources associated with a mempool. */
 void mempool_destroy(mempool_t * pool) {
-  int i;
+  struct _mempool_chunk *chunk, *prev;
   if (!pool)
     return;
 
-  for (i = 0; i < pool->n_pages; i++) {
-    if (pool->pages[i].buffer) {
-      free(pool->pages[i].buffer);
-    }
+  for (chunk = pool->chunks; chunk; chunk = prev) {
+    prev = chunk->prev;
+    free(chunk);
   }
-  free(pool->pages);
   free(pool);
 }
@@ -0,0 +1,169 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <locale.h>
+#include <string.h>
+
+#include <crush/general.h>
+#include <crush/numparse.h>
+
+/* the most significant digits which always fit in a uint64_t. */
+#define NUMPARSE_MAX_DIGITS 19
+
+/* the largest power of ten which is exactly representable as a double. */
+#define NUMPARSE_MAX_EXACT_POW10 22
+
+/* the largest mantissa which is exactly representable as a double. */
+#define NUMPARSE_MAX_EXACT_MANTISSA (((uint64_t) 1) << 53)
+
+/* inputs shorter than this are copied to the stack for strtod(). */
+#define NUMPARSE_BUF_SZ 128
+
+/* caps the exponent so that accumulating it cannot overflow. */
+#define NUMPARSE_MAX_EXPONENT 100000
+
+static const double numparse_pow10[NUMPARSE_MAX_EXACT_POW10 + 1] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Convert the first LEN bytes of S with strtod(), for the inputs which the
+   fast path in numparse() doesn't handle.  Any '.' is translated to the
+   locale's decimal point first, so that the result doesn't depend on the
+   locale.  Returns the number of bytes consumed. */
+static size_t numparse_strtod(const char *s, size_t len, double *value) {
+  char stackbuf[NUMPARSE_BUF_SZ], *buf = stackbuf, *end, *p;
+  const char *point = localeconv()->decimal_point;
+  size_t consumed;
+
+  if (len >= sizeof(stackbuf))
+    buf = xmalloc(len + 1);
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+
+  if (point[0] != '.' && point[0] != '\0' && point[1] == '\0') {
+    for (p = buf; *p; p++) {
+      if (*p == '.')
+        *p = point[0];
+    }
+  }
+
+  *value = strtod(buf, &end);
+  consumed = end - buf;
+  if (buf != stackbuf)
+    free(buf);
+  return consumed;
+}
+
+size_t numparse(const char *s, size_t len, numparse_t *num) {
+  const char *p = s, *end = s + len, *q;
+  uint64_t mantissa = 0;
+  int negative = 0, n_digits = 0, n_sig = 0, too_long = 0;
+  int has_point = 0, has_exponent = 0, exponent = 0, exp_negative = 0;
+  int scale;
+
+  memset(num, 0, sizeof(numparse_t));
+
+  while (p < end && isspace((unsigned char) *p))
+    p++;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  /* leave hexadecimal, infinity and nan to strtod(). */
+  if (p < end && (*p == 'i' || *p == 'I' || *p == 'n' || *p == 'N' ||
+                  (*p == '0' && p + 1 < end && (p[1] == 'x' || p[1] == 'X'))))
+    return numparse_strtod(s, len, &num->value);
+
+  /* leading zeros are not significant, so they don't count toward the
+     digits which must fit in the mantissa. */
+  for (; p < end && isdigit((unsigned char) *p); p++, n_digits++) {
+    if (mantissa == 0 && *p == '0')
+      continue;
+    if (n_sig++ < NUMPARSE_MAX_DIGITS)
+      mantissa = mantissa * 10 + (*p - '0');
+    else
+      too_long = 1;
+  }
+
+  if (p < end && *p == '.') {
+    has_point = 1;
+    for (p++; p < end && isdigit((unsigned char) *p); p++, n_digits++) {
+      num->precision++;
+      if (mantissa == 0 && *p == '0')
+        continue;
+      if (n_sig++ < NUMPARSE_MAX_DIGITS)
+        mantissa = mantissa * 10 + (*p - '0');
+      else
+        too_long = 1;
+    }
+  }
+
+  if (n_digits == 0) {
+    num->precision = 0;
+    return 0;
+  }
+
+  /* an exponent is only part of the number if it has at least one digit. */
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    q = p + 1;
+    if (q < end && (*q == '-' || *q == '+')) {
+      exp_negative = (*q == '-');
+      q++;
+    }
+    if (q < end && isdigit((unsigned char) *q)) {
+      has_exponent = 1;
+      for (; q < end && isdigit((unsigned char) *q); q++) {
+        if (exponent < NUMPARSE_MAX_EXPONENT)
+          exponent = exponent * 10 + (*q - '0');
+      }
+      p = q;
+    }
+  }
+
+  if (! has_point && ! has_exponent && ! too_long &&
+      mantissa <= (uint64_t) INT64_MAX + negative) {
+    num->is_int = 1;
+    num->int_value = negative ? (int64_t) (0 - mantissa) : (int64_t) mantissa;
+  }
+
+  /* both the mantissa and the power of ten are exact, so a single multiply
+     or divide gives the correctly rounded result. */
+  scale = (exp_negative ? -exponent : exponent) - num->precision;
+  if (! too_long && mantissa <= NUMPARSE_MAX_EXACT_MANTISSA &&
+      scale >= -NUMPARSE_MAX_EXACT_POW10 && scale <= NUMPARSE_MAX_EXACT_POW10) {
+    if (scale >= 0)
+      num->value = (double) mantissa * numparse_pow10[scale];
+    else
+      num->value = (double) mantissa / numparse_pow10[-scale];
+    if (negative)
+      num->value = -num->value;
+  } else {
+    numparse_strtod(s, p - s, &num->value);
+  }
+
+  return p - s;
+}
+
+size_t numparse_str(const char *s, numparse_t *num) {
+  return numparse(s, strlen(s), num);
+}
@@ -0,0 +1,292 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#if defined HAVE_PTHREAD_CREATE && defined HAVE_PTHREAD_H
+#  define PARCHUNK_USE_THREADS 1
+#  include <pthread.h>
+#endif
+
+#include <crush/general.h>
+#include <crush/parchunk.h>
+
+int parchunk_threads(const char *s) {
+  char *end;
+  long n = strtol(s, &end, 10);
+
+  if (end == s || *end != '\0' || n < 0)
+    return -1;
+  if (n == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+      n = 1;
+  }
+  return n > PARCHUNK_MAX_THREADS ? PARCHUNK_MAX_THREADS : n;
+}
+
+size_t parchunk_line_len(const char *line, const char *end) {
+  const char *linebreak = memchr(line, '\n', end - line);
+  return linebreak ? linebreak - line + 1 : end - line;
+}
+
+/* Process every chunk in the calling thread. */
+static int parchunk_run_serial(dbfr_t *reader, bufout_t *out,
+                               const parchunk_ops_t *ops) {
+  void *state = ops->thread_init ? ops->thread_init(ops->arg) : ops->arg;
+  char *buf = NULL;
+  size_t buf_sz = 0, len, line_no = reader->line_no + 1;
+  const char *data;
+  int status = 0;
+
+  while (status == 0 &&
+         (len = dbfr_getchunk(reader, PARCHUNK_CHUNK_SZ, &buf, &buf_sz,
+                              &data)) > 0) {
+    status = ops->process(state, data, len, line_no, out);
+    line_no = reader->line_no + 1;
+    /* the copied lines are about to be overwritten. */
+    if (! dbfr_lines_persist(reader))
+      bufout_release(out);
+  }
+  bufout_release(out);
+
+  if (ops->thread_destroy)
+    ops->thread_destroy(state);
+  free(buf);
+  return status;
+}
+
+#ifdef PARCHUNK_USE_THREADS
+/* a chunk of input, and the output it produced. */
+struct parchunk_slot {
+  const char *data;
+  size_t len;
+  size_t line_no;         /* the line number of the first line in data */
+  char *buf;              /* copies of lines from an unmapped reader */
+  size_t buf_sz;
+  bufout_t *out;
+  int done;
+  int status;
+};
+
+struct parchunk {
+  const parchunk_ops_t *ops;
+  struct parchunk_slot *slots;
+  size_t n_slots;
+  size_t n_read;          /* the number of chunks read so far */
+  size_t n_taken;         /* the number of chunks taken by workers */
+  int finished;           /* set when no more chunks will be read */
+  pthread_mutex_t lock;
+  pthread_cond_t ready;   /* signalled when a chunk is read, or at the end */
+  pthread_cond_t done;    /* signalled when a chunk is processed */
+};
+
+/* Take chunks in order and process them until there are no more. */
+static void * parchunk_worker(void *arg) {
+  struct parchunk *pc = arg;
+  const parchunk_ops_t *ops = pc->ops;
+  void *state = ops->thread_init ? ops->thread_init(ops->arg) : ops->arg;
+  struct parchunk_slot *slot;
+  int status;
+
+  for (;;) {
+    pthread_mutex_lock(&pc->lock);
+    while (pc->n_taken == pc->n_read && ! pc->finished)
+      pthread_cond_wait(&pc->ready, &pc->lock);
+    if (pc->n_taken == pc->n_read) {
+      pthread_mutex_unlock(&pc->lock);
+      break;
+    }
+    slot = &pc->slots[pc->n_taken++ % pc->n_slots];
+    pthread_mutex_unlock(&pc->lock);
+
+    status = ops->process(state, slot->data, slot->len, slot->line_no,
+                          slot->out);
+    bufout_release(slot->out);
+
+    pthread_mutex_lock(&pc->lock);
+    slot->status = status;
+    slot->done = 1;
+    pthread_cond_signal(&pc->done);
+    pthread_mutex_unlock(&pc->lock);
+  }
+
+  if (ops->thread_destroy)
+    ops->thread_destroy(state);
+  return NULL;
+}
+
+int parchunk_run(dbfr_t *reader, bufout_t *out, int n_threads,
+                 const parchunk_ops_t *ops) {
+  struct parchunk pc;
+  struct parchunk_slot *slot;
+  pthread_t *threads;
+  size_t n_written = 0, len, i;
+  int n_started, status = 0, eof = 0;
+
+  if (n_threads <= 1)
+    return parchunk_run_serial(reader, out, ops);
+  if (n_threads > PARCHUNK_MAX_THREADS)
+    n_threads = PARCHUNK_MAX_THREADS;
+
+  memset(&pc, 0, sizeof(pc));
+  pc.ops = ops;
+  pc.n_slots = n_threads * 2;
+  pc.slots = xmalloc(sizeof(struct parchunk_slot) * pc.n_slots);
+  memset(pc.slots, 0, sizeof(struct parchunk_slot) * pc.n_slots);
+  for (i = 0; i < pc.n_slots; i++)
+    pc.slots[i].out = bufout_init_mem();
+  pthread_mutex_init(&pc.lock, NULL);
+  pthread_cond_init(&pc.ready, NULL);
+  pthread_cond_init(&pc.done, NULL);
+
+  threads = xmalloc(sizeof(pthread_t) * n_threads);
+  for (n_started = 0; n_started < n_threads; n_started++) {
+    if (pthread_create(&threads[n_started], NULL, parchunk_worker, &pc) != 0)
+      break;
+  }
+
+  /* keep every slot full, and write out the oldest chunk as soon as it's
+     done.  a slot is only refilled once its output has been written. */
+  while (n_started > 0) {
+    while (status == 0 && ! eof && pc.n_read - n_written < pc.n_slots) {
+      slot = &pc.slots[pc.n_read % pc.n_slots];
+      slot->line_no = reader->line_no + 1;
+      len = dbfr_getchunk(reader, PARCHUNK_CHUNK_SZ, &slot->buf,
+                          &slot->buf_sz, &slot->data);
+      if (len == 0) {
+        eof = 1;
+        break;
+      }
+      slot->len = len;
+      slot->done = 0;
+      pthread_mutex_lock(&pc.lock);
+      pc.n_read++;
+      pthread_cond_signal(&pc.ready);
+      pthread_mutex_unlock(&pc.lock);
+    }
+    if (n_written == pc.n_read)
+      break;
+
+    slot = &pc.slots[n_written % pc.n_slots];
+    pthread_mutex_lock(&pc.lock);
+    while (! slot->done)
+      pthread_cond_wait(&pc.done, &pc.lock);
+    pthread_mutex_unlock(&pc.lock);
+
+    if (status == 0 && (status = slot->status) == 0)
+      bufout_write(out, slot->out->buf, slot->out->len);
+    bufout_mem_reset(slot->out);
+    n_written++;
+  }
+
+  pthread_mutex_lock(&pc.lock);
+  pc.finished = 1;
+  pthread_cond_broadcast(&pc.ready);
+  pthread_mutex_unlock(&pc.lock);
+  for (i = 0; i < n_started; i++)
+    pthread_join(threads[i], NULL);
+
+  /* if no thread could be started, fall back to doing the work here. */
+  if (n_started == 0)
+    status = parchunk_run_serial(reader, out, ops);
+
+  for (i = 0; i < pc.n_slots; i++) {
+    bufout_close(pc.slots[i].out);
+    free(pc.slots[i].buf);
+  }
+  free(pc.slots);
+  free(threads);
+  pthread_cond_destroy(&pc.done);
+  pthread_cond_destroy(&pc.ready);
+  pthread_mutex_destroy(&pc.lock);
+  return status;
+}
+
+/* items handed out to the threads of parchunk_each(). */
+struct parchunk_each {
+  void (*task)(void *arg, size_t i);
+  void *arg;
+  size_t n;
+  size_t next;            /* the next item to be taken */
+  pthread_mutex_t lock;
+};
+
+static void * parchunk_each_worker(void *arg) {
+  struct parchunk_each *pe = arg;
+  size_t i;
+
+  for (;;) {
+    pthread_mutex_lock(&pe->lock);
+    i = pe->next++;
+    pthread_mutex_unlock(&pe->lock);
+    if (i >= pe->n)
+      break;
+    pe->task(pe->arg, i);
+  }
+  return NULL;
+}
+
+void parchunk_each(size_t n, int n_threads,
+                   void (*task)(void *arg, size_t i), void *arg) {
+  struct parchunk_each pe;
+  pthread_t *threads;
+  int n_started = 0;
+
+  if (n_threads > PARCHUNK_MAX_THREADS)
+    n_threads = PARCHUNK_MAX_THREADS;
+  if (n_threads > n)
+    n_threads = n;
+
+  pe.task = task;
+  pe.arg = arg;
+  pe.n = n;
+  pe.next = 0;
+  pthread_mutex_init(&pe.lock, NULL);
+
+  /* the calling thread is one of the workers. */
+  threads = xmalloc(sizeof(pthread_t) * (n_threads > 1 ? n_threads - 1 : 1));
+  for (; n_started < n_threads - 1; n_started++) {
+    if (pthread_create(&threads[n_started], NULL, parchunk_each_worker,
+                       &pe) != 0)
+      break;
+  }
+  parchunk_each_worker(&pe);
+  while (n_started > 0)
+    pthread_join(threads[--n_started], NULL);
+
+  free(threads);
+  pthread_mutex_destroy(&pe.lock);
+}
+#else
+int parchunk_run(dbfr_t *reader, bufout_t *out, int n_threads,
+                 const parchunk_ops_t *ops) {
+  return parchunk_run_serial(reader, out, ops);
+}
+
+void parchunk_each(size_t n, int n_threads,
+                   void (*task)(void *arg, size_t i), void *arg) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    task(arg, i);
+}
+#endif /* PARCHUNK_USE_THREADS */
@@ -0,0 +1,274 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <crush/general.h>
+#include <crush/tdigest.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* the most entries a digest holds, merged and buffered, for each unit of
+   compression. */
+#define TDIGEST_SZ_FACTOR 6
+
+/* the number of entries first allocated. */
+#define TDIGEST_INITIAL_SZ 4
+
+/* the arcsine scale function, which maps quantiles to a scale on which
+   each centroid may span at most 1. */
+static double tdigest_k(double q, double compression) {
+  return compression / (2 * M_PI) * asin(2 * q - 1);
+}
+
+static double tdigest_k_inverse(double k, double compression) {
+  double x = k * 2 * M_PI / compression;
+
+  if (x >= M_PI / 2)
+    return 1;
+  return (sin(x) + 1) / 2;
+}
+
+static u_int32_t tdigest_max_sz(const tdigest_t *td) {
+  return TDIGEST_SZ_FACTOR * td->compression + 10;
+}
+
+static int tdigest_centroid_cmp(const void *a, const void *b) {
+  double x = ((const tdigest_centroid_t *) a)->mean;
+  double y = ((const tdigest_centroid_t *) b)->mean;
+  return x < y ? -1 : x > y;
+}
+
+/* sorts all of the entries and merges neighbours wherever the scale
+   function allows. */
+static void tdigest_compress(tdigest_t *td) {
+  tdigest_centroid_t *c = td->centroids;
+  double total = 0, weight_so_far = 0, limit, proposed;
+  u_int32_t i, j;
+
+  if (td->n == td->n_merged)
+    return;
+  for (i = 0; i < td->n; i++)
+    total += c[i].weight;
+  qsort(c, td->n, sizeof(tdigest_centroid_t), tdigest_centroid_cmp);
+
+  limit = total * tdigest_k_inverse(tdigest_k(0, td->compression) + 1,
+                                    td->compression);
+  for (j = 0, i = 1; i < td->n; i++) {
+    proposed = c[j].weight + c[i].weight;
+    if (weight_so_far + proposed <= limit) {
+      c[j].mean += (c[i].mean - c[j].mean) * c[i].weight / proposed;
+      c[j].weight = proposed;
+    } else {
+      weight_so_far += c[j].weight;
+      limit = total * tdigest_k_inverse(
+          tdigest_k(weight_so_far / total, td->compression) + 1,
+          td->compression);
+      c[++j] = c[i];
+    }
+  }
+  td->n = td->n_merged = j + 1;
+}
+
+/* adds a value which stands for WEIGHT values to the buffer. */
+static void tdigest_add_weighted(tdigest_t *td, double mean, double weight) {
+  if (td->n == td->sz) {
+    if (td->sz < tdigest_max_sz(td)) {
+      td->sz = td->sz ? td->sz * 2 : TDIGEST_INITIAL_SZ;
+      if (td->sz > tdigest_max_sz(td))
+        td->sz = tdigest_max_sz(td);
+      td->centroids = xrealloc(td->centroids,
+                               sizeof(tdigest_centroid_t) * td->sz);
+    } else {
+      tdigest_compress(td);
+    }
+  }
+  td->centroids[td->n].mean = mean;
+  td->centroids[td->n].weight = weight;
+  td->n++;
+}
+
+int tdigest_init(tdigest_t *td, int compression) {
+  if (compression < 10)
+    return -1;
+  td->centroids = NULL;
+  td->n = td->n_merged = td->sz = 0;
+  td->compression = compression;
+  td->min = td->max = 0;
+  return 0;
+}
+
+void tdigest_destroy(tdigest_t *td) {
+  free(td->centroids);
+  td->centroids = NULL;
+  td->n = td->n_merged = td->sz = 0;
+}
+
+void tdigest_clear(tdigest_t *td) {
+  td->n = td->n_merged = 0;
+}
+
+void tdigest_add(tdigest_t *td, double value) {
+  if (td->n == 0) {
+    td->min = td->max = value;
+  } else if (value < td->min) {
+    td->min = value;
+  } else if (value > td->max) {
+    td->max = value;
+  }
+  tdigest_add_weighted(td, value, 1);
+}
+
+void tdigest_merge(tdigest_t *into, const tdigest_t *from) {
+  u_int32_t i;
+
+  if (from->n == 0)
+    return;
+  if (into->n == 0) {
+    into->min = from->min;
+    into->max = from->max;
+  } else {
+    if (from->min < into->min)
+      into->min = from->min;
+    if (from->max > into->max)
+      into->max = from->max;
+  }
+  for (i = 0; i < from->n; i++)
+    tdigest_add_weighted(into, from->centroids[i].mean,
+                         from->centroids[i].weight);
+}
+
+double tdigest_quantile(tdigest_t *td, double q) {
+  tdigest_centroid_t *c;
+  double total, index, center, next_center;
+  u_int32_t i, last;
+
+  if (td->n == 0)
+    return NAN;
+  tdigest_compress(td);
+  c = td->centroids;
+  last = td->n - 1;
+  total = tdigest_count(td);
+  index = q * total;
+
+  /* below the middle of the first centroid or above that of the last, the
+     values lie between it and the extreme value. */
+  if (index <= c[0].weight / 2) {
+    if (c[0].weight == 1)
+      return c[0].mean;
+    return td->min + (c[0].mean - td->min) * index / (c[0].weight / 2);
+  }
+  if (index >= total - c[last].weight / 2) {
+    if (c[last].weight == 1)
+      return c[last].mean;
+    return td->max - (td->max - c[last].mean) * (total - index) /
+                     (c[last].weight / 2);
+  }
+
+  center = next_center = c[0].weight / 2;
+  for (i = 0; i < last; i++) {
+    next_center = center + (c[i].weight + c[i + 1].weight) / 2;
+    if (index <= next_center)
+      break;
+    center = next_center;
+  }
+  return c[i].mean + (c[i + 1].mean - c[i].mean) * (index - center) /
+                     (next_center - center);
+}
+
+double tdigest_count(const tdigest_t *td) {
+  double total = 0;
+  u_int32_t i;
+
+  for (i = 0; i < td->n; i++)
+    total += td->centroids[i].weight;
+  return total;
+}
+
+size_t tdigest_size(const tdigest_t *td) {
+  return sizeof(tdigest_centroid_t) * td->sz;
+}
+
+int tdigest_save(const tdigest_t *td, FILE *fp) {
+  u_int32_t header[3];
+  double extremes[2];
+
+  header[0] = td->compression;
+  header[1] = td->n;
+  header[2] = td->n_merged;
+  extremes[0] = td->min;
+  extremes[1] = td->max;
+  if (fwrite(header, sizeof(header), 1, fp) != 1 ||
+      fwrite(extremes, sizeof(extremes), 1, fp) != 1 ||
+      (td->n > 0 &&
+       fwrite(td->centroids, sizeof(tdigest_centroid_t), td->n, fp) != td->n))
+    return -1;
+  return 0;
+}
+
+int tdigest_load(tdigest_t *td, FILE *fp) {
+  u_int32_t header[3];
+  double extremes[2];
+
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      fread(extremes, sizeof(extremes), 1, fp) != 1 ||
+      tdigest_init(td, header[0]) != 0 ||
+      header[1] > tdigest_max_sz(td) || header[2] > header[1])
+    return -1;
+
+  td->min = extremes[0];
+  td->max = extremes[1];
+  if (header[1] > 0) {
+    td->sz = header[1];
+    td->centroids = xmalloc(sizeof(tdigest_centroid_t) * td->sz);
+    if (fread(td->centroids, sizeof(tdigest_centroid_t), header[1], fp) !=
+        header[1]) {
+      tdigest_destroy(td);
+      return -1;
+    }
+  }
+  td->n = header[1];
+  td->n_merged = header[2];
+  return 0;
+}
+
+int tdigest_parse_percents(const char *s, double **percents) {
+  int n = 0, sz = 4;
+  char *end;
+
+  *percents = xmalloc(sizeof(double) * sz);
+  do {
+    if (n == sz)
+      *percents = xrealloc(*percents, sizeof(double) * (sz *= 2));
+    (*percents)[n] = strtod(s, &end);
+    if (end == s || (*end != ',' && *end != '\0') ||
+        (*percents)[n] < 0 || (*percents)[n] > 100) {
+      free(*percents);
+      *percents = NULL;
+      return -1;
+    }
+    n++;
+    s = end + 1;
+  } while (*end == ',');
+  return n;
+}
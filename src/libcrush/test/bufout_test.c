@@ -0,0 +1,175 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <crush/bufout.h>
+#include "unittest.h"
+
+/* reads back everything written to a temp file. */
+char * slurp(FILE *fp, size_t *len) {
+  char *data;
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  data = malloc(*len + 1);
+  fseek(fp, 0, SEEK_SET);
+  *len = fread(data, 1, *len, fp);
+  data[*len] = '\0';
+  return data;
+}
+
+int test_fields() {
+  FILE *fp = tmpfile();
+  bufout_t *out;
+  char *data;
+  size_t len;
+
+  unittest_has_error = 0;
+  fputs("header\n", fp);
+  out = bufout_init(fp);
+  bufout_write(out, "abcdef", 3);
+  bufout_puts(out, "|");
+  bufout_putc(out, 'x');
+  bufout_putc(out, '\n');
+  ASSERT_LONG_EQ(0, bufout_close(out), "bufout_close: success");
+
+  data = slurp(fp, &len);
+  ASSERT_STR_EQ("header\nabc|x\n", data,
+                "bufout: stdio output is flushed first");
+  free(data);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+int test_numbers() {
+  double doubles[] = { 0, -0.0, 1, -1, 2.5, 1.005, 0.125, 1e18, 1e300,
+                       -123456789.0, 3.0 / 7, 42 };
+  long long longs[] = { 0, 1, -1, 9223372036854775807LL,
+                        -9223372036854775807LL - 1 };
+  int precisions[] = { 0, 1, 2, 6, 40 };
+  char expected[8192], *p = expected, *data;
+  FILE *fp = tmpfile();
+  bufout_t *out = bufout_init(fp);
+  size_t len;
+  int i, j;
+
+  unittest_has_error = 0;
+  for (i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+    for (j = 0; j < sizeof(precisions) / sizeof(precisions[0]); j++) {
+      bufout_put_double(out, doubles[i], precisions[j]);
+      bufout_putc(out, ' ');
+      p += sprintf(p, "%.*f ", precisions[j], doubles[i]);
+    }
+  }
+  for (i = 0; i < sizeof(longs) / sizeof(longs[0]); i++) {
+    bufout_put_long(out, longs[i]);
+    bufout_printf(out, "<%d>", i);
+    p += sprintf(p, "%lld<%d>", longs[i], i);
+  }
+  bufout_close(out);
+
+  data = slurp(fp, &len);
+  ASSERT_STR_EQ(expected, data, "bufout: numbers formatted like printf");
+  free(data);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+/* writes that straddle, fill and exceed the buffer must come out intact and
+   in order. */
+int test_large_writes() {
+  size_t sizes[] = { 10, BUFOUT_BUF_SZ - 5, 7, BUFOUT_BUF_SZ / 2 + 1, 3,
+                     BUFOUT_BUF_SZ * 3, 1 };
+  size_t total = 0, len, i, j;
+  char *chunk = malloc(BUFOUT_BUF_SZ * 3), *data;
+  FILE *fp = tmpfile();
+  bufout_t *out = bufout_init(fp);
+  int ok = 1;
+
+  unittest_has_error = 0;
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    memset(chunk, 'a' + i, sizes[i]);
+    bufout_write(out, chunk, sizes[i]);
+    total += sizes[i];
+  }
+  bufout_printf(out, "%*d", BUFOUT_BUF_SZ + 1, 5);
+  total += BUFOUT_BUF_SZ + 1;
+  bufout_close(out);
+
+  data = slurp(fp, &len);
+  ASSERT_LONG_EQ(total, len, "bufout: large writes are all written");
+  for (len = 0, i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    for (j = 0; j < sizes[i]; j++, len++) {
+      if (data[len] != 'a' + i)
+        ok = 0;
+    }
+  }
+  ASSERT_TRUE(ok, "bufout: large writes are in order");
+  ASSERT_TRUE(data[total - 1] == '5', "bufout: oversized printf output");
+  free(data);
+  free(chunk);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+int test_write_ref() {
+  size_t block_sz = BUFOUT_BUF_SZ * 2, len, i;
+  char *block = malloc(block_sz), *data;
+  FILE *fp = tmpfile();
+  bufout_t *out = bufout_init(fp);
+  int ok = 1;
+
+  unittest_has_error = 0;
+  for (i = 0; i < block_sz; i++)
+    block[i] = 'a' + i % 26;
+
+  bufout_write_ref(out, block, 10);
+  bufout_write_ref(out, block + 10, 20);
+  ASSERT_LONG_EQ(30, out->ref_len, "bufout_write_ref: adjacent runs merge");
+  bufout_write(out, "|", 1);
+  ASSERT_TRUE(out->ref == NULL, "bufout_write: releases references");
+
+  /* a short run gets copied; a long one is written in place. */
+  bufout_write_ref(out, block, 5);
+  bufout_write_ref(out, block + 100, block_sz - 100);
+  bufout_release(out);
+  bufout_write_ref(out, block, 3);
+  ASSERT_LONG_EQ(0, bufout_close(out), "bufout_close: releases references");
+
+  data = slurp(fp, &len);
+  ASSERT_LONG_EQ(30 + 1 + 5 + block_sz - 100 + 3, len,
+                 "bufout_write_ref: everything is written");
+  ok = memcmp(data, block, 30) == 0 && data[30] == '|' &&
+       memcmp(data + 31, block, 5) == 0 &&
+       memcmp(data + 36, block + 100, block_sz - 100) == 0 &&
+       memcmp(data + 36 + block_sz - 100, block, 3) == 0;
+  ASSERT_TRUE(ok, "bufout_write_ref: everything is written in order");
+  free(data);
+  free(block);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_fields();
+  errs += test_numbers();
+  errs += test_large_writes();
+  errs += test_write_ref();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
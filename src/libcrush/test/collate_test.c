@@ -0,0 +1,197 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <crush/collate.h>
+#include "unittest.h"
+
+/* the order strcoll() gives two keys compared field by field. */
+int reference_cmp(const char **a, const char **b, size_t n) {
+  size_t i;
+  int cmp;
+  for (i = 0; i < n; i++) {
+    if ((cmp = strcoll(a[i], b[i])) != 0)
+      return cmp;
+  }
+  return 0;
+}
+
+int sign(int n) {
+  return n < 0 ? -1 : n > 0;
+}
+
+/* keys built from random values must order exactly as strcoll() does. */
+int check_keys(const char *locale_name) {
+  const char *alphabet = "aAbB -_.,1 9zZ";
+  char values[4][2][8];
+  const char *a[2], *b[2];
+  collate_key_t key_a, key_b;
+  int i, j, k, errs = 0;
+
+  collate_key_init(&key_a);
+  collate_key_init(&key_b);
+  srand(3);
+  for (i = 0; i < 20000 && errs < 5; i++) {
+    for (j = 0; j < 4; j++) {
+      for (k = 0; k < 2; k++) {
+        int len = rand() % 4, c;
+        for (c = 0; c < len; c++)
+          values[j][k][c] = alphabet[rand() % strlen(alphabet)];
+        values[j][k][len] = '\0';
+      }
+    }
+    collate_key_clear(&key_a);
+    collate_key_clear(&key_b);
+    for (j = 0; j < 2; j++) {
+      a[j] = values[j][rand() % 2];
+      b[j] = values[j][rand() % 2];
+      collate_key_append(&key_a, a[j], strlen(a[j]));
+      collate_key_append(&key_b, b[j], strlen(b[j]));
+    }
+    if (sign(collate_key_cmp(&key_a, &key_b)) != sign(reference_cmp(a, b, 2))) {
+      FAIL("collate_key_cmp(%s): [%s|%s] vs [%s|%s]", locale_name,
+           a[0], a[1], b[0], b[1]);
+      errs++;
+    }
+  }
+  if (errs == 0)
+    PASS("collate_key_cmp(%s): agrees with strcoll()", locale_name);
+  collate_key_destroy(&key_a);
+  collate_key_destroy(&key_b);
+  return errs;
+}
+
+int test_byte_order() {
+  unittest_has_error = 0;
+  setlocale(LC_COLLATE, "C");
+  collate_init(0);
+  ASSERT_TRUE(collate_is_byte_order(), "collate_init: C locale is byte order");
+  collate_init(1);
+  ASSERT_TRUE(collate_is_byte_order(), "collate_init: byte order forced");
+  return unittest_has_error + check_keys("C");
+}
+
+/* the transformation is only exercised where a real locale is installed. */
+int test_locale() {
+  const char *names[] = { "en_US.UTF-8", "en_US.utf8", "de_DE.UTF-8" };
+  int i, errs;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (setlocale(LC_COLLATE, names[i])) {
+      collate_init(0);
+      unittest_has_error = 0;
+      ASSERT_TRUE(! collate_is_byte_order(),
+                  "collate_init: real locale is not byte order");
+      errs = unittest_has_error + check_keys(names[i]);
+      setlocale(LC_COLLATE, "C");
+      collate_init(0);
+      return errs;
+    }
+  }
+  return 0;
+}
+
+int test_fields() {
+  const char *line = "x,b,a";
+  int fields[] = { 2, 5, 1 };
+  linesplit_t split;
+  collate_key_t key;
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 0);
+  collate_key_init(&key);
+  linesplit(&split, line, ",");
+  collate_key_fields(&key, &split, fields, 3);
+  ASSERT_LONG_EQ(5, key.len, "collate_key_fields: missing fields are empty");
+  ASSERT_TRUE(memcmp(key.data, "a\0\0b", 5) == 0,
+              "collate_key_fields: fields in order");
+  collate_key_destroy(&key);
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int test_sort() {
+  char *strings[] = { "b,1", "a,2", "a", "a,10", "", "a,1" };
+  char *expected[] = { "", "a", "a,1", "a,10", "a,2", "b,1" };
+
+  unittest_has_error = 0;
+  collate_sort(strings, 6, ",");
+  ASSERT_STR_ARRAY_EQ(expected, strings, 6, "collate_sort: field order");
+  return unittest_has_error;
+}
+
+/* many strings, sharing long prefixes and with duplicates among them, come
+   out in order, and equal strings keep their order.  they are laid out one
+   after another, so their original order is that of their addresses. */
+int test_sort_large() {
+  const char *prefix = "prefix,shared,by,most,of,the,strings";
+  size_t n = 20000, width = 48, i, len, c;
+  char **strings = malloc(sizeof(char *) * n), *buf = malloc(n * width);
+  collate_key_t keys[2];
+  linesplit_t split;
+  int in_order = 1, stable = 1;
+
+  unittest_has_error = 0;
+  srand(7);
+  for (i = 0; i < n; i++) {
+    strings[i] = buf + i * width;
+    len = rand() % 3 ? strlen(prefix) + rand() % 4 : rand() % 6;
+    for (c = 0; c < len; c++)
+      strings[i][c] = c < strlen(prefix) ? prefix[c] : "ab,"[rand() % 3];
+    strings[i][len] = '\0';
+  }
+  collate_sort(strings, n, ",");
+
+  collate_key_init(&keys[0]);
+  collate_key_init(&keys[1]);
+  linesplit_init(&split, 0);
+  for (i = 0; i < n; i++) {
+    linesplit(&split, strings[i], ",");
+    collate_key_fields(&keys[i % 2], &split, NULL, 0);
+    for (c = 0; c < split.n_fields; c++)
+      collate_key_append(&keys[i % 2], linesplit_field_ptr(&split, c),
+                         linesplit_field_len(&split, c));
+    if (i > 0 && collate_key_cmp(&keys[(i - 1) % 2], &keys[i % 2]) > 0)
+      in_order = 0;
+    if (i > 0 && strcmp(strings[i - 1], strings[i]) == 0 &&
+        strings[i - 1] > strings[i])
+      stable = 0;
+  }
+  ASSERT_TRUE(in_order, "collate_sort: many strings");
+  ASSERT_TRUE(stable, "collate_sort: equal strings keep their order");
+
+  free(buf);
+  free(strings);
+  collate_key_destroy(&keys[0]);
+  collate_key_destroy(&keys[1]);
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_byte_order();
+  errs += test_locale();
+  errs += test_fields();
+  errs += test_sort();
+  errs += test_sort_large();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include <crush/dbfr.h>
 #include "unittest.h"
 
@@ -120,6 +121,394 @@ int test_dbfr_getline_2() {
   return 0;
 }
 
+/* a memory-mapped reader should see the same lines as dbfr_getline(), as
+   views into the mapping. */
+int test_dbfr_mmap_getline() {
+  dbfr_t *reader = dbfr_mmap_open(TEST_FILENAME);
+  char expected[80];
+  ssize_t retval;
+  int i = 0;
+  unittest_has_error = 0;
+
+  ASSERT_TRUE(reader != NULL, "dbfr_mmap_open: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  ASSERT_TRUE(reader->map != NULL, "dbfr_mmap_open: regular file is mapped");
+  ASSERT_TRUE(reader->current_line == NULL,
+              "dbfr_mmap_open: initialize current_line to NULL");
+  ASSERT_LONG_EQ(strlen("this is line 1\n"), reader->next_line_len,
+                 "dbfr_mmap_open: next_line_len set");
+  ASSERT_TRUE(strncmp("this is line 1\n", reader->next_line,
+                      reader->next_line_len) == 0,
+              "dbfr_mmap_open: next_line viewed");
+
+  while (i < LINES_IN_TEST_FILE) {
+    i++;
+    retval = dbfr_getline(reader);
+    sprintf(expected, "this is line %d\n", i);
+    ASSERT_LONG_EQ(strlen(expected), retval,
+                   "dbfr_getline (mmap): correct return value");
+    ASSERT_TRUE(strncmp(expected, reader->current_line, retval) == 0,
+                "dbfr_getline (mmap): correct line content");
+    ASSERT_LONG_EQ(i, reader->line_no,
+                   "dbfr_getline (mmap): line_no incremented");
+  }
+  ASSERT_TRUE(reader->next_line == NULL, "next_line NULL at EOF (mmap)");
+
+  retval = dbfr_getline(reader);
+  ASSERT_LONG_GT(0, retval, "dbfr_getline() (mmap) returns < 0 at EOF");
+  ASSERT_TRUE(reader->eof, "dbfr_t.eof set at EOF (mmap)");
+  ASSERT_TRUE(reader->current_line != NULL,
+              "current_line not NULL at EOF (mmap)");
+
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* the last line of a mapped file need not end with a linebreak. */
+int test_dbfr_mmap_no_trailing_newline() {
+  dbfr_t *reader;
+  char *dup;
+  FILE *f = fopen("test_input_3.log", "w");
+  unittest_has_error = 0;
+  fputs("first\nlast", f);
+  fclose(f);
+
+  reader = dbfr_mmap_open("test_input_3.log");
+  unlink("test_input_3.log");
+  ASSERT_TRUE(reader != NULL, "dbfr_mmap_open: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  dup = dbfr_next_line_dup(reader);
+  ASSERT_STR_EQ("first\n", dup, "dbfr_next_line_dup (mmap): copy of a view");
+  free(dup);
+  dbfr_getline(reader);
+  ASSERT_LONG_EQ(4, dbfr_getline(reader),
+                 "dbfr_getline (mmap): unterminated last line length");
+  ASSERT_TRUE(strncmp("last", reader->current_line, 4) == 0,
+              "dbfr_getline (mmap): unterminated last line content");
+  dup = dbfr_next_line_dup(reader);
+  ASSERT_STR_EQ("", dup, "dbfr_next_line_dup (mmap): empty at EOF");
+  free(dup);
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* pipes cannot be mapped, so the reader should fall back to reading ahead,
+   which gives the same lines. */
+int test_dbfr_mmap_pipe_fallback() {
+  dbfr_t *reader;
+  int fds[2];
+  unittest_has_error = 0;
+
+  if (pipe(fds) != 0)
+    return 1;
+  write(fds[1], "piped line\n", 11);
+  close(fds[1]);
+
+  reader = dbfr_mmap_init(fdopen(fds[0], "r"));
+  ASSERT_TRUE(reader != NULL, "dbfr_mmap_init: return non-null for pipe");
+  if (! reader) {
+    return 1;
+  }
+  ASSERT_TRUE(reader->map == NULL, "dbfr_mmap_init: pipe is not mapped");
+  ASSERT_STR_EQ("piped line\n", reader->next_line,
+                "dbfr_mmap_init: pipe read");
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* a read-ahead reader should produce exactly what dbfr_getline() does. */
+int test_dbfr_readahead_getline() {
+  dbfr_t *reader = dbfr_readahead_open(TEST_FILENAME);
+  char expected[80];
+  int i = 0;
+  unittest_has_error = 0;
+
+  ASSERT_TRUE(reader != NULL, "dbfr_readahead_open: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  ASSERT_STR_EQ("this is line 1\n", reader->next_line,
+                "dbfr_readahead_open: read next_line");
+  while (dbfr_getline(reader) > 0) {
+    i++;
+    sprintf(expected, "this is line %d\n", i);
+    ASSERT_STR_EQ(expected, reader->current_line,
+                  "dbfr_getline (read-ahead): correct line content");
+  }
+  ASSERT_LONG_EQ(LINES_IN_TEST_FILE, reader->line_no,
+                 "dbfr_getline (read-ahead): all lines read");
+  ASSERT_TRUE(reader->next_line == NULL, "next_line NULL at EOF (read-ahead)");
+  ASSERT_TRUE(reader->eof, "dbfr_t.eof set at EOF (read-ahead)");
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* lines written to a pipe in small pieces arrive in separate blocks, and a
+   line longer than the pipe's capacity spans several of them. */
+int test_dbfr_readahead_pipe() {
+  dbfr_t *reader;
+  int fds[2], i;
+  size_t long_len = 3 * 65536 + 17;
+  char *long_line;
+  pid_t pid;
+  unittest_has_error = 0;
+
+  long_line = malloc(long_len + 1);
+  memset(long_line, 'x', long_len - 1);
+  long_line[long_len - 1] = '\n';
+  long_line[long_len] = '\0';
+
+  if (pipe(fds) != 0)
+    return 1;
+  if ((pid = fork()) == 0) {
+    close(fds[0]);
+    write(fds[1], "fir", 3);
+    usleep(10000);
+    write(fds[1], "st\n", 3);
+    write(fds[1], long_line, long_len);
+    write(fds[1], "last", 4);
+    _exit(0);
+  }
+  close(fds[1]);
+
+  reader = dbfr_readahead_init(fdopen(fds[0], "r"));
+  ASSERT_TRUE(reader != NULL, "dbfr_readahead_init: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  dbfr_getline(reader);
+  ASSERT_STR_EQ("first\n", reader->current_line,
+                "dbfr_getline (read-ahead): line split across reads");
+  dbfr_getline(reader);
+  ASSERT_LONG_EQ(long_len, reader->current_line_len,
+                 "dbfr_getline (read-ahead): long line length");
+  ASSERT_TRUE(strcmp(long_line, reader->current_line) == 0,
+              "dbfr_getline (read-ahead): long line content");
+  dbfr_getline(reader);
+  ASSERT_STR_EQ("last", reader->current_line,
+                "dbfr_getline (read-ahead): unterminated last line");
+  ASSERT_LONG_GT(0, dbfr_getline(reader),
+                 "dbfr_getline() (read-ahead) returns < 0 at EOF");
+  dbfr_close(reader);
+  waitpid(pid, &i, 0);
+  free(long_line);
+  return unittest_has_error;
+}
+
+/* closing a reader whose thread is blocked on an idle pipe must not hang. */
+int test_dbfr_readahead_close_early() {
+  dbfr_t *reader;
+  int fds[2];
+  unittest_has_error = 0;
+
+  if (pipe(fds) != 0)
+    return 1;
+  write(fds[1], "only line\n", 10);
+
+  reader = dbfr_readahead_init(fdopen(fds[0], "r"));
+  ASSERT_TRUE(reader != NULL, "dbfr_readahead_init: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  ASSERT_STR_EQ("only line\n", reader->next_line,
+                "dbfr_readahead_init: first line available before EOF");
+  dbfr_close(reader);
+  close(fds[1]);
+  PASS("dbfr_close (read-ahead): returns while input is pending");
+  return unittest_has_error;
+}
+
+/* checks one batch of lines from the test file, starting at line FIRST. */
+void check_batch(dbfr_batch_t *batch, int first, size_t expected_lines,
+                 const char *msg) {
+  char expected[80];
+  off_t offset = 0;
+  int i, local_error = 0;
+
+  for (i = 1; i < first; i++)
+    offset += sprintf(expected, "this is line %d\n", i);
+  if (batch->n_lines != expected_lines) {
+    FAIL("%s: got %lu lines, expected %lu", msg, batch->n_lines,
+         expected_lines);
+    return;
+  }
+  for (i = 0; i < batch->n_lines; i++) {
+    dbfr_line_t *l = &batch->lines[i];
+    sprintf(expected, "this is line %d\n", first + i);
+    if (l->len != strlen(expected) ||
+        strncmp(expected, l->line, l->len) != 0 ||
+        l->line_no != first + i || l->offset != offset) {
+      FAIL("%s: line %d is \"%.*s\" (line_no %lu, offset %ld)", msg,
+           first + i, (int) l->len, l->line, l->line_no, (long) l->offset);
+      local_error = 1;
+    }
+    offset += l->len;
+  }
+  if (! local_error)
+    PASS("%s", msg);
+}
+
+int test_dbfr_getlines() {
+  dbfr_t *reader = dbfr_open(TEST_FILENAME);
+  dbfr_batch_t batch;
+  unittest_has_error = 0;
+
+  ASSERT_TRUE(reader != NULL, "dbfr_open: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  dbfr_batch_init(&batch);
+  dbfr_getlines(reader, &batch, 4);
+  check_batch(&batch, 1, 4, "dbfr_getlines: first batch");
+  ASSERT_TRUE(batch.lines[0].line == batch.buf &&
+              batch.lines[3].line ==
+              batch.lines[2].line + batch.lines[2].len,
+              "dbfr_getlines: lines are adjacent in the buffer");
+  ASSERT_LONG_EQ(4, reader->line_no, "dbfr_getlines: line_no advanced");
+  ASSERT_STR_EQ("this is line 4\n", reader->current_line,
+                "dbfr_getlines: current_line is the last of the batch");
+  ASSERT_STR_EQ("this is line 5\n", reader->next_line,
+                "dbfr_getlines: next_line follows the batch");
+  /* the rest of the block that was read is not lost to dbfr_getline(). */
+  dbfr_getline(reader);
+  ASSERT_STR_EQ("this is line 6\n", reader->next_line,
+                "dbfr_getline: next_line follows a batch's next_line");
+  ASSERT_LONG_EQ(4 * 15, reader->current_line_offset,
+                 "dbfr_getline: offset after a batch");
+  dbfr_getlines(reader, &batch, DBFR_BATCH_LINES);
+  check_batch(&batch, 6, LINES_IN_TEST_FILE - 5,
+              "dbfr_getlines: batch at EOF");
+  ASSERT_LONG_EQ(0, dbfr_getlines(reader, &batch, DBFR_BATCH_LINES),
+                 "dbfr_getlines: empty batch after EOF");
+  dbfr_batch_destroy(&batch);
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* a batch read ahead from a pipe may end part way through a line which is
+   longer than a block, and the last line may have no linebreak. */
+int test_dbfr_readahead_getlines() {
+  dbfr_t *reader;
+  dbfr_batch_t batch;
+  int fds[2], i;
+  size_t long_len = 2 * DBFR_BATCH_BLOCK_SZ + 17, n_lines = 0;
+  char *long_line;
+  pid_t pid;
+  unittest_has_error = 0;
+
+  long_line = malloc(long_len);
+  memset(long_line, 'x', long_len - 1);
+  long_line[long_len - 1] = '\n';
+
+  if (pipe(fds) != 0)
+    return 1;
+  if ((pid = fork()) == 0) {
+    close(fds[0]);
+    write(fds[1], "first\nsecond\n", 13);
+    write(fds[1], long_line, long_len);
+    write(fds[1], "last", 4);
+    _exit(0);
+  }
+  close(fds[1]);
+
+  reader = dbfr_readahead_init(fdopen(fds[0], "r"));
+  ASSERT_TRUE(reader != NULL, "dbfr_readahead_init: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  dbfr_batch_init(&batch);
+  dbfr_getlines(reader, &batch, 1);
+  n_lines += batch.n_lines;
+  ASSERT_TRUE(batch.n_lines == 1 && batch.lines[0].len == 6 &&
+              strncmp(batch.lines[0].line, "first\n", 6) == 0,
+              "dbfr_getlines (read-ahead): first batch");
+  ASSERT_STR_EQ("second\n", reader->next_line,
+                "dbfr_getlines (read-ahead): next_line follows the batch");
+  dbfr_getlines(reader, &batch, 2);
+  n_lines += batch.n_lines;
+  ASSERT_TRUE(batch.n_lines == 2 && batch.lines[1].len == long_len &&
+              memcmp(batch.lines[1].line, long_line, long_len) == 0,
+              "dbfr_getlines (read-ahead): line longer than a block");
+  ASSERT_LONG_EQ(13, batch.lines[1].offset,
+                 "dbfr_getlines (read-ahead): offset of the long line");
+  dbfr_getlines(reader, &batch, DBFR_BATCH_LINES);
+  n_lines += batch.n_lines;
+  ASSERT_TRUE(batch.n_lines == 1 && batch.lines[0].len == 4 &&
+              strncmp(batch.lines[0].line, "last", 4) == 0,
+              "dbfr_getlines (read-ahead): unterminated last line");
+  ASSERT_LONG_EQ(n_lines, reader->line_no,
+                 "dbfr_getlines (read-ahead): line_no at EOF");
+  ASSERT_LONG_EQ(0, dbfr_getlines(reader, &batch, DBFR_BATCH_LINES),
+                 "dbfr_getlines (read-ahead): empty batch after EOF");
+  dbfr_batch_destroy(&batch);
+  dbfr_close(reader);
+  waitpid(pid, &i, 0);
+  free(long_line);
+  return unittest_has_error;
+}
+
+/* batches from a mapped file are views into the mapping. */
+int test_dbfr_mmap_getlines() {
+  dbfr_t *reader = dbfr_mmap_open(TEST_FILENAME);
+  dbfr_batch_t batch;
+  unittest_has_error = 0;
+
+  ASSERT_TRUE(reader != NULL, "dbfr_mmap_open: return non-null");
+  if (! reader) {
+    return 1;
+  }
+  dbfr_batch_init(&batch);
+  dbfr_getlines(reader, &batch, 3);
+  dbfr_getlines(reader, &batch, 3);
+  check_batch(&batch, 4, 3, "dbfr_getlines (mmap): second batch");
+  ASSERT_TRUE(batch.buf == NULL, "dbfr_getlines (mmap): lines not copied");
+  ASSERT_TRUE(batch.lines[0].line >= reader->map &&
+              batch.lines[0].line < reader->map + reader->map_sz,
+              "dbfr_getlines (mmap): lines point into the mapping");
+  dbfr_batch_destroy(&batch);
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+/* chunks end on line boundaries and leave the reader as dbfr_getline()
+   would, whether or not the file is mapped. */
+int check_getchunk(dbfr_t *reader, const char *desc) {
+  char *buf = NULL;
+  size_t buf_sz = 0;
+  const char *chunk;
+  unittest_has_error = 0;
+
+  ASSERT_LONG_EQ(30, dbfr_getchunk(reader, 20, &buf, &buf_sz, &chunk),
+                 "dbfr_getchunk: whole lines");
+  ASSERT_TRUE(strncmp(chunk, "this is line 1\nthis is line 2\n", 30) == 0,
+              "dbfr_getchunk: contents");
+  ASSERT_LONG_EQ(2, reader->line_no, "dbfr_getchunk: line_no advanced");
+  ASSERT_TRUE(strncmp(reader->current_line, "this is line 2\n", 15) == 0,
+              "dbfr_getchunk: current_line is the last line");
+  ASSERT_TRUE(strncmp(reader->next_line, "this is line 3\n", 15) == 0,
+              "dbfr_getchunk: next_line follows the chunk");
+  ASSERT_LONG_EQ(121, dbfr_getchunk(reader, 1000, &buf, &buf_sz, &chunk),
+                 "dbfr_getchunk: short chunk at EOF");
+  ASSERT_LONG_EQ(LINES_IN_TEST_FILE, reader->line_no,
+                 "dbfr_getchunk: line_no at EOF");
+  ASSERT_LONG_EQ(0, dbfr_getchunk(reader, 1000, &buf, &buf_sz, &chunk),
+                 "dbfr_getchunk: empty chunk after EOF");
+  if (unittest_has_error)
+    FAIL("dbfr_getchunk: %s", desc);
+  free(buf);
+  dbfr_close(reader);
+  return unittest_has_error;
+}
+
+int test_dbfr_getchunk() {
+  return check_getchunk(dbfr_open(TEST_FILENAME), "copied lines") +
+         check_getchunk(dbfr_mmap_open(TEST_FILENAME), "mapped lines");
+}
+
 int main (int argc, char *argv[]) {
   int has_failures = 0;
 
@@ -133,6 +522,16 @@ int main (int argc, char *argv[]) {
   has_failures += test_dbfr_init();
   has_failures += test_dbfr_getline_1();
   has_failures += test_dbfr_getline_2();
+  has_failures += test_dbfr_mmap_getline();
+  has_failures += test_dbfr_mmap_no_trailing_newline();
+  has_failures += test_dbfr_mmap_pipe_fallback();
+  has_failures += test_dbfr_readahead_getline();
+  has_failures += test_dbfr_readahead_pipe();
+  has_failures += test_dbfr_readahead_close_early();
+  has_failures += test_dbfr_getlines();
+  has_failures += test_dbfr_readahead_getlines();
+  has_failures += test_dbfr_mmap_getlines();
+  has_failures += test_dbfr_getchunk();
 
   teardown();
   if (has_failures)
@@ -0,0 +1,137 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/* Measures the throughput of delimiter scanning.  This is not run by
+   "make check"; use "make bench" instead.
+
+   usage: delimscan_bench [megabytes [fields-per-line]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <crush/delimscan.h>
+#include <crush/ffutils.h>
+#include <crush/linesplit.h>
+
+static char delim[] = { 0xfe, 0x00 };
+
+static double now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, size_t bytes, double elapsed,
+                   size_t result) {
+  printf("%-28s %10.1f MB/s  (%lu)\n", name,
+         bytes / elapsed / (1024 * 1024), (unsigned long) result);
+}
+
+/* the strstr()-based field counting used before delimscan() existed. */
+static size_t strstr_fields_in_line(const char *l, const char *d) {
+  const char *p = l;
+  size_t f = 1, dl = strlen(d);
+  while ((p = strstr(p, d)) != NULL) {
+    f++;
+    p += dl;
+  }
+  return f;
+}
+
+/* build a block of null-terminated lines with random-length fields. */
+static char * make_data(size_t size, int fields_per_line, size_t *n_lines) {
+  char *data = malloc(size + 1), *p = data, *end = data + size;
+  int f, c, len;
+
+  *n_lines = 0;
+  srand(1);
+  while (p + fields_per_line * 13 + 2 < end) {
+    for (f = 0; f < fields_per_line; f++) {
+      len = rand() % 12;
+      for (c = 0; c < len; c++)
+        *p++ = 'a' + rand() % 26;
+      if (f < fields_per_line - 1)
+        *p++ = delim[0];
+    }
+    *p++ = '\n';
+    *p++ = '\0';
+    (*n_lines)++;
+  }
+  *p = '\0';
+  return data;
+}
+
+int main(int argc, char *argv[]) {
+  size_t mb = argc > 1 ? atoi(argv[1]) : 64;
+  int fields_per_line = argc > 2 ? atoi(argv[2]) : 200;
+  size_t n_lines, size = mb * 1024 * 1024, total, i, n, scanned;
+  size_t hits[256];
+  delimscan_impl_t impls[] = { delimscan_impl_scalar, delimscan_impl_sse2,
+                               delimscan_impl_avx2 };
+  char name[64], *data, *line;
+  linesplit_t split;
+  double start;
+  int j;
+
+  data = make_data(size, fields_per_line, &n_lines);
+  printf("%lu MB, %lu lines of %d fields\n\n", (unsigned long) mb,
+         (unsigned long) n_lines, fields_per_line);
+
+  start = now();
+  for (total = 0, line = data, i = 0; i < n_lines; i++) {
+    total += strstr_fields_in_line(line, delim);
+    line += strlen(line) + 1;
+  }
+  report("strstr fields_in_line", size, now() - start, total);
+
+  for (j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+    if (delimscan_use(impls[j]) != 0)
+      continue;
+
+    start = now();
+    for (total = 0, i = 0; i < size; i += scanned) {
+      n = delimscan(data + i, size - i, delim[0], '\n',
+                    hits, sizeof(hits) / sizeof(hits[0]), &scanned);
+      total += n;
+    }
+    sprintf(name, "delimscan block (%s)", delimscan_impl_name());
+    report(name, size, now() - start, total);
+
+    start = now();
+    for (total = 0, line = data, i = 0; i < n_lines; i++) {
+      total += fields_in_line(line, delim);
+      line += strlen(line) + 1;
+    }
+    sprintf(name, "fields_in_line (%s)", delimscan_impl_name());
+    report(name, size, now() - start, total);
+
+    linesplit_init(&split, 0);
+    start = now();
+    for (total = 0, line = data, i = 0; i < n_lines; i++) {
+      total += linesplit(&split, line, delim);
+      line += strlen(line) + 1;
+    }
+    sprintf(name, "linesplit (%s)", delimscan_impl_name());
+    report(name, size, now() - start, total);
+    linesplit_destroy(&split);
+  }
+
+  free(data);
+  return 0;
+}
@@ -0,0 +1,147 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <crush/delimscan.h>
+#include <crush/ffutils.h>
+#include "unittest.h"
+
+#define TEST_BUF_SZ 1000
+
+char test_buf[TEST_BUF_SZ];
+size_t expected_hits[TEST_BUF_SZ];
+size_t n_expected;
+size_t n_expected_delims;
+
+/* fill the test buffer with a mix of data bytes, 0xfe and linebreaks. */
+void setup() {
+  int i;
+  srand(42);
+  n_expected = n_expected_delims = 0;
+  for (i = 0; i < TEST_BUF_SZ; i++) {
+    switch (rand() % 8) {
+      case 0: test_buf[i] = (char) 0xfe; break;
+      case 1: test_buf[i] = '\n'; break;
+      default: test_buf[i] = 'a' + rand() % 26; break;
+    }
+    if (test_buf[i] == (char) 0xfe || test_buf[i] == '\n')
+      expected_hits[n_expected++] = i;
+    if (test_buf[i] == (char) 0xfe)
+      n_expected_delims++;
+  }
+}
+
+/* scans the test buffer in pieces of max_hits, resuming after each. */
+int check_impl(delimscan_impl_t impl, size_t max_hits) {
+  size_t hits[TEST_BUF_SZ], n = 0, pos = 0, scanned, found, i;
+  int local_error = 0;
+
+  if (delimscan_use(impl) != 0)
+    return 0;
+
+  while (pos < TEST_BUF_SZ) {
+    found = delimscan(test_buf + pos, TEST_BUF_SZ - pos, 0xfe, '\n',
+                      hits + n, max_hits, &scanned);
+    for (i = n; i < n + found; i++)
+      hits[i] += pos;
+    n += found;
+    pos += scanned;
+  }
+
+  if (n != n_expected) {
+    FAIL("delimscan(%s, %lu): found %lu hits, expected %lu",
+         delimscan_impl_name(), max_hits, n, n_expected);
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    if (hits[i] != expected_hits[i]) {
+      FAIL("delimscan(%s, %lu): hit %lu at %lu, expected %lu",
+           delimscan_impl_name(), max_hits, i, hits[i], expected_hits[i]);
+      local_error = 1;
+      break;
+    }
+  }
+  if (! local_error)
+    PASS("delimscan(%s, %lu): all hits found", delimscan_impl_name(),
+         max_hits);
+
+  n = delimscan_count(test_buf, TEST_BUF_SZ, 0xfe);
+  if (n != n_expected_delims) {
+    FAIL("delimscan_count(%s): counted %lu, expected %lu",
+         delimscan_impl_name(), n, n_expected_delims);
+    local_error = 1;
+  }
+  return local_error;
+}
+
+int test_delimscan() {
+  delimscan_impl_t impls[] = { delimscan_impl_scalar, delimscan_impl_sse2,
+                               delimscan_impl_avx2 };
+  size_t max_hits[] = { 1, 7, 64, TEST_BUF_SZ };
+  int i, j, errs = 0;
+
+  for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    for (j = 0; j < sizeof(max_hits) / sizeof(max_hits[0]); j++)
+      errs += check_impl(impls[i], max_hits[j]);
+  }
+  delimscan_use(delimscan_impl_auto);
+  return errs;
+}
+
+int test_delimscan_edges() {
+  size_t hits[4], scanned;
+
+  unittest_has_error = 0;
+  ASSERT_LONG_EQ(0, delimscan("", 0, ',', '\n', hits, 4, &scanned),
+                 "delimscan: empty buffer");
+  ASSERT_LONG_EQ(0, scanned, "delimscan: nothing scanned in empty buffer");
+  ASSERT_LONG_EQ(0, delimscan("a,b", 3, ',', '\n', hits, 0, &scanned),
+                 "delimscan: no room for hits");
+  ASSERT_LONG_EQ(2, delimscan("a,b,c", 5, ',', ',', hits, 2, &scanned),
+                 "delimscan: identical target bytes");
+  ASSERT_LONG_EQ(4, scanned, "delimscan: stops after the last hit if full");
+  return unittest_has_error;
+}
+
+/* fields_in_line() is built on delimscan(); make sure multi-byte and
+   overlapping delimiters are still counted like strstr() would. */
+int test_fields_in_line() {
+  char line[80], delim[40];
+
+  /* a delimiter longer than a vector register, with a spare comma. */
+  memset(delim, ',', 39);
+  delim[39] = '\0';
+  sprintf(line, "a%sb,", delim);
+
+  unittest_has_error = 0;
+  ASSERT_LONG_EQ(3, fields_in_line("a|||b||c", "||"),
+                 "fields_in_line: overlapping delimiter candidates");
+  ASSERT_LONG_EQ(2, fields_in_line(line, delim),
+                 "fields_in_line: delimiter longer than a vector");
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  setup();
+  errs += test_delimscan();
+  errs += test_delimscan_edges();
+  errs += test_fields_in_line();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
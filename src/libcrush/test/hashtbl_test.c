@@ -28,6 +28,137 @@ void call_for_each_test(void *data) {
 }
 
 
+/* a hash function which puts every key in the same probe sequence. */
+unsigned int constant_hash(unsigned char *s) {
+  return 0;
+}
+
+/* inserts enough keys to make the table grow several times, then deletes
+   every other one. */
+int test_growth_and_delete(unsigned int (*hash) (unsigned char *),
+                           int n_keys, const char *hash_name) {
+  hashtbl_t ht;
+  char key[32];
+  long i, n_wrong = 0;
+  size_t initial_sz;
+
+  unittest_has_error = 0;
+  ht_init(&ht, 8, hash, NULL);
+  initial_sz = ht.arrsz;
+  for (i = 0; i < n_keys; i++) {
+    sprintf(key, "key %ld", i);
+    ht_put(&ht, key, (void *) (i + 1));
+  }
+  ASSERT_LONG_EQ(n_keys, ht.nelems, "ht_put: all keys inserted");
+  ASSERT_TRUE(ht.arrsz > initial_sz, "ht_put: table grows");
+  ASSERT_TRUE(ht.nelems * 4 <= ht.arrsz * 3,
+              "ht_put: load factor kept below 3/4");
+
+  for (i = 0; i < n_keys; i += 2) {
+    sprintf(key, "key %ld", i);
+    ht_delete(&ht, key);
+  }
+  for (i = 0; i < n_keys; i++) {
+    sprintf(key, "key %ld", i);
+    if (ht_get(&ht, key) != (i % 2 ? (void *) (i + 1) : NULL))
+      n_wrong++;
+  }
+  if (n_wrong)
+    FAIL("ht_delete (%s): %ld lookups wrong after deletes", hash_name,
+         n_wrong);
+  else
+    PASS("ht_delete (%s): remaining keys found after deletes", hash_name);
+  ASSERT_LONG_EQ(n_keys / 2, ht.nelems,
+                 "ht_delete: element count after deletes");
+  ht_destroy(&ht);
+  return unittest_has_error;
+}
+
+/* keys given as (ptr,len) or as fields must find the same elements as the
+   equivalent strings. */
+int test_key_pieces(unsigned int (*hash) (unsigned char *),
+                    const char *hash_name) {
+  hashtbl_t ht;
+  linesplit_t split;
+  int fields[] = { 2, 0 }, missing[] = { 0, 7 };
+  char buf[] = "alpha beta gamma";
+
+  unittest_has_error = 0;
+  ht_init(&ht, 8, hash, NULL);
+  linesplit_init(&split, 0);
+  linesplit(&split, "a,bb,ccc\n", ",");
+
+  ht_put(&ht, "alpha", (void *) 1);
+  ht_put_n(&ht, buf + 6, 4, (void *) 2);
+  ht_put_fields(&ht, &split, fields, 2, "::", (void *) 3);
+  ht_put_fields(&ht, &split, missing, 2, "|", (void *) 4);
+  ht_put(&ht, "x\xfey", (void *) 5);
+
+  ASSERT_TRUE(ht_get_n(&ht, buf, 5) == (void *) 1,
+              "ht_get_n: finds key put with ht_put");
+  ASSERT_TRUE(ht_get_n(&ht, buf, 4) == NULL,
+              "ht_get_n: prefix of a key does not match");
+  ASSERT_TRUE(ht_get(&ht, "beta") == (void *) 2,
+              "ht_get: finds key put with ht_put_n");
+  ASSERT_TRUE(ht_get(&ht, "ccc::a") == (void *) 3,
+              "ht_get: finds key put with ht_put_fields");
+  ASSERT_TRUE(ht_get_fields(&ht, &split, fields, 2, "::") == (void *) 3,
+              "ht_get_fields: finds key put with ht_put_fields");
+  ASSERT_TRUE(ht_get_fields(&ht, &split, fields, 2, ":") == NULL,
+              "ht_get_fields: separator is part of the key");
+  ASSERT_TRUE(ht_get(&ht, "a|") == (void *) 4,
+              "ht_put_fields: missing fields are empty");
+  ASSERT_TRUE(ht_get_n(&ht, "x\xfeyz", 3) == (void *) 5,
+              "ht_get_n: bytes above 0x7f hash like ht_get");
+  ASSERT_LONG_EQ(5, ht.nelems, "ht_put_n/ht_put_fields: element count");
+  if (unittest_has_error)
+    fprintf(stderr, "  (hash function: %s)\n", hash_name);
+
+  linesplit_destroy(&split);
+  ht_destroy(&ht);
+  return unittest_has_error;
+}
+
+int test_upsert() {
+  hashtbl_t ht;
+  linesplit_t split;
+  int fields[] = { 1 }, inserted;
+  void **slot;
+  size_t pool_used;
+
+  unittest_has_error = 0;
+  ht_init(&ht, 8, NULL, NULL);
+  linesplit_init(&split, 0);
+
+  slot = ht_upsert(&ht, "one", &inserted);
+  ASSERT_TRUE(slot != NULL && *slot == NULL,
+              "ht_upsert: new entry has NULL data");
+  ASSERT_INT_EQ(1, inserted, "ht_upsert: reports insertion");
+  *slot = (void *) 1;
+  slot = ht_upsert(&ht, "one", &inserted);
+  ASSERT_TRUE(*slot == (void *) 1, "ht_upsert: finds existing entry");
+  ASSERT_INT_EQ(0, inserted, "ht_upsert: reports existing entry");
+
+  linesplit(&split, "x,one,y", ",");
+  slot = ht_upsert_fields(&ht, &split, fields, 1, ",", &inserted);
+  ASSERT_TRUE(*slot == (void *) 1 && ! inserted,
+              "ht_upsert_fields: finds entry added by ht_upsert");
+  slot = ht_upsert_n(&ht, "two", 3, &inserted);
+  ASSERT_TRUE(inserted, "ht_upsert_n: adds missing key");
+  ASSERT_LONG_EQ(2, ht.nelems, "ht_upsert: element count");
+
+  /* replacing an entry's data must not copy its key again. */
+  pool_used = mempool_used(ht.key_pool);
+  ht_put(&ht, "one", (void *) 2);
+  ASSERT_LONG_EQ(pool_used, mempool_used(ht.key_pool),
+                 "ht_put: replacing data allocates nothing");
+  ASSERT_TRUE(ht_get(&ht, "one") == (void *) 2, "ht_put: data replaced");
+
+  linesplit_destroy(&split);
+  ht_destroy(&ht);
+  return unittest_has_error;
+}
+
 int main(int argc, char *argv[]) {
   hashtbl_t ht;
   char **keys;
@@ -64,6 +195,14 @@ int main(int argc, char *argv[]) {
   ASSERT_TRUE(ht_get(&ht, "hello 0") == NULL,
               "ht_delete: removes entry successfully");
   ASSERT_LONG_EQ(9, ht.nelems, "ht_delete: updates element count correctly");
+  if (unittest_has_error)
+    has_failures = 1;
 
-  return unittest_has_error;
+  has_failures += test_growth_and_delete(NULL, 100000, "BKDRHash");
+  has_failures += test_growth_and_delete(constant_hash, 500, "collisions");
+  has_failures += test_key_pieces(NULL, "BKDRHash");
+  has_failures += test_key_pieces(djb2, "djb2");
+  has_failures += test_upsert();
+
+  return has_failures;
 }
@@ -0,0 +1,206 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <crush/hll.h>
+#include "unittest.h"
+
+/* adds the values FIRST to FIRST + N - 1 to a sketch. */
+void add_range(hll_t *hll, int first, int n) {
+  char value[32];
+  int i;
+  for (i = first; i < first + n; i++)
+    hll_add(hll, value, sprintf(value, "value %d", i));
+}
+
+/* whether an estimate is within a fraction of the true count. */
+int close_to(double estimate, double n, double error) {
+  return fabs(estimate - n) <= n * error;
+}
+
+int test_sparse() {
+  hll_t hll;
+
+  unittest_has_error = 0;
+  hll_init(&hll, HLL_DEFAULT_PRECISION);
+  ASSERT_TRUE(hll_estimate(&hll) == 0, "hll_estimate: empty sketch");
+
+  add_range(&hll, 0, 100);
+  add_range(&hll, 0, 100);
+  ASSERT_TRUE(! hll.dense, "hll_add: few values stay sparse");
+  ASSERT_LONG_EQ(100, (long) floor(hll_estimate(&hll) + 0.5),
+                 "hll_estimate: small counts are exact");
+
+  hll_clear(&hll);
+  ASSERT_TRUE(hll_estimate(&hll) == 0, "hll_clear: empties the sketch");
+  hll_destroy(&hll);
+  return unittest_has_error;
+}
+
+int test_dense() {
+  int counts[] = { 3000, 20000, 100000, 1000000 };
+  hll_t hll;
+  int i;
+
+  unittest_has_error = 0;
+  hll_init(&hll, HLL_DEFAULT_PRECISION);
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    hll_clear(&hll);
+    add_range(&hll, 0, counts[i]);
+    add_range(&hll, 0, counts[i] / 2);
+    ASSERT_TRUE(close_to(hll_estimate(&hll), counts[i], 0.03),
+                "hll_estimate: within 3 percent at the default precision");
+  }
+  ASSERT_TRUE(hll.dense, "hll_add: many values make the sketch dense");
+  ASSERT_LONG_EQ(1 << HLL_DEFAULT_PRECISION, hll_size(&hll),
+                 "hll_size: a register per byte");
+
+  hll_clear(&hll);
+  ASSERT_TRUE(! hll.dense && hll_size(&hll) == 0,
+              "hll_clear: a dense sketch frees its registers");
+  add_range(&hll, 0, 10);
+  ASSERT_LONG_EQ(10, (long) floor(hll_estimate(&hll) + 0.5),
+                 "hll_clear: a cleared dense sketch counts again");
+  hll_destroy(&hll);
+  return unittest_has_error;
+}
+
+/* merging sketches gives the estimate of the union, however the values
+   were split between them. */
+int test_merge() {
+  hll_t all, a, b, c;
+
+  unittest_has_error = 0;
+  hll_init(&all, 10);
+  hll_init(&a, 10);
+  hll_init(&b, 10);
+  hll_init(&c, 10);
+  add_range(&all, 0, 5000);
+  add_range(&a, 0, 3000);
+  add_range(&b, 2000, 3000);
+  add_range(&c, 4990, 10);
+
+  hll_merge(&c, &b);
+  hll_merge(&c, &a);
+  ASSERT_TRUE(hll_estimate(&c) == hll_estimate(&all),
+              "hll_merge: the union of dense sketches");
+
+  hll_destroy(&a);
+  hll_destroy(&b);
+  hll_destroy(&c);
+  hll_init(&a, 10);
+  hll_init(&b, 10);
+  hll_init(&c, 10);
+  add_range(&a, 0, 20);
+  add_range(&b, 10, 20);
+  hll_merge(&c, &a);
+  hll_merge(&c, &b);
+  ASSERT_TRUE(! c.dense, "hll_merge: sparse sketches stay sparse");
+  ASSERT_LONG_EQ(30, (long) floor(hll_estimate(&c) + 0.5),
+                 "hll_merge: the union of sparse sketches");
+
+  hll_destroy(&b);
+  hll_init(&b, 11);
+  ASSERT_LONG_EQ(-1, hll_merge(&c, &b),
+                 "hll_merge: precisions must match");
+  hll_destroy(&all);
+  hll_destroy(&a);
+  hll_destroy(&b);
+  hll_destroy(&c);
+  return unittest_has_error;
+}
+
+/* a sparse sketch turns into the registers it would have had if it had
+   been dense from the start. */
+int test_conversion() {
+  hll_t sparse, dense;
+
+  unittest_has_error = 0;
+  hll_init(&sparse, 12);
+  hll_init(&dense, 12);
+  add_range(&dense, 0, 10000);
+  add_range(&sparse, 0, 100);
+  ASSERT_TRUE(! sparse.dense, "hll_add: still sparse");
+  add_range(&sparse, 100, 9900);
+  ASSERT_TRUE(sparse.dense, "hll_add: converted to registers");
+  ASSERT_TRUE(memcmp(sparse.data, dense.data, 1 << 12) == 0,
+              "hll_add: conversion gives the same registers");
+  hll_destroy(&sparse);
+  hll_destroy(&dense);
+  return unittest_has_error;
+}
+
+int test_save_load() {
+  FILE *fp = tmpfile();
+  hll_t small, large, loaded;
+
+  unittest_has_error = 0;
+  hll_init(&small, 8);
+  hll_init(&large, 8);
+  add_range(&small, 0, 5);
+  add_range(&large, 0, 1000);
+  ASSERT_LONG_EQ(0, hll_save(&small, fp), "hll_save: sparse");
+  ASSERT_LONG_EQ(0, hll_save(&large, fp), "hll_save: dense");
+
+  rewind(fp);
+  ASSERT_LONG_EQ(0, hll_load(&loaded, fp), "hll_load: sparse");
+  ASSERT_TRUE(hll_estimate(&loaded) == hll_estimate(&small),
+              "hll_load: the same sparse sketch");
+  hll_destroy(&loaded);
+  ASSERT_LONG_EQ(0, hll_load(&loaded, fp), "hll_load: dense");
+  ASSERT_TRUE(hll_estimate(&loaded) == hll_estimate(&large),
+              "hll_load: the same dense sketch");
+  hll_destroy(&loaded);
+  ASSERT_LONG_EQ(-1, hll_load(&loaded, fp), "hll_load: end of file");
+
+  hll_destroy(&small);
+  hll_destroy(&large);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+int test_parse_precision() {
+  unittest_has_error = 0;
+  ASSERT_LONG_EQ(HLL_DEFAULT_PRECISION, hll_parse_precision(NULL),
+                 "hll_parse_precision: default");
+  ASSERT_LONG_EQ(HLL_MIN_PRECISION, hll_parse_precision("4"),
+                 "hll_parse_precision: smallest");
+  ASSERT_LONG_EQ(HLL_MAX_PRECISION, hll_parse_precision("18"),
+                 "hll_parse_precision: largest");
+  ASSERT_LONG_EQ(-1, hll_parse_precision("3"),
+                 "hll_parse_precision: too small");
+  ASSERT_LONG_EQ(-1, hll_parse_precision("19"),
+                 "hll_parse_precision: too large");
+  ASSERT_LONG_EQ(-1, hll_parse_precision(""), "hll_parse_precision: empty");
+  ASSERT_LONG_EQ(-1, hll_parse_precision("12x"),
+                 "hll_parse_precision: trailing text");
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_sparse();
+  errs += test_dense();
+  errs += test_merge();
+  errs += test_conversion();
+  errs += test_save_load();
+  errs += test_parse_precision();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <crush/ffutils.h>
+#include <crush/linesplit.h>
+#include "unittest.h"
+
+
+int test_linesplit_n_fields() {
+  linesplit_t split;
+  size_t n;
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 2);
+
+  n = linesplit(&split, "", "|");
+  ASSERT_LONG_EQ(1, n, "linesplit: empty line has one field");
+
+  n = linesplit(&split, " hello world", " ");
+  ASSERT_LONG_EQ(3, n, "linesplit: leading delimiter");
+
+  n = linesplit(&split, "hello||dev||prac||", "||");
+  ASSERT_LONG_EQ(4, n, "linesplit: multi-char delimiter");
+  ASSERT_LONG_EQ(fields_in_line("hello||dev||prac||", "||"), n,
+                 "linesplit: agrees with fields_in_line()");
+
+  n = linesplit(&split, "a|b||c|||d\n", "||");
+  ASSERT_LONG_EQ(3, n, "linesplit: partial delimiter matches are data");
+
+  n = linesplit(&split, "a,b,c,d,e,f,g,h,i,j\n", ",");
+  ASSERT_LONG_EQ(10, n, "linesplit: grows beyond initial capacity");
+
+  n = linesplit(&split, "a,b,c\n", "");
+  ASSERT_LONG_EQ(1, n, "linesplit: empty delimiter means one field");
+
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int test_linesplit_get_field() {
+  linesplit_t split;
+  char buffer[6];
+  char *line = "this,is,a,test\n";
+  char *long_line = "a,verylongfield,c";
+  int n;
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 0);
+
+  linesplit(&split, line, ",");
+  n = linesplit_get_field(buffer, &split, sizeof(buffer), 0);
+  ASSERT_INT_EQ(4, n, "linesplit_get_field: correct return value (1)");
+  ASSERT_STR_EQ("this", buffer, "linesplit_get_field: correct value (1)");
+
+  n = linesplit_get_field(buffer, &split, sizeof(buffer), 3);
+  ASSERT_INT_EQ(4, n, "linesplit_get_field: correct return value (2)");
+  ASSERT_STR_EQ("test", buffer,
+                "linesplit_get_field: linebreak excluded from last field");
+
+  n = linesplit_get_field(buffer, &split, sizeof(buffer), 4);
+  ASSERT_INT_EQ(-1, n, "linesplit_get_field: nonexistent field");
+  ASSERT_STR_EQ("", buffer, "linesplit_get_field: nonexistent field value");
+
+  linesplit(&split, long_line, ",");
+  n = linesplit_get_field(buffer, &split, sizeof(buffer), 1);
+  ASSERT_INT_EQ(5, n, "linesplit_get_field: truncated return value");
+  ASSERT_STR_EQ("veryl", buffer, "linesplit_get_field: truncated value");
+
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+/* linesplit_get_pos() must agree with get_line_pos() on every field. */
+int test_linesplit_get_pos() {
+  linesplit_t split;
+  char *lines[] = { "hello\n", "hello,,\n", ",x,,yy,\r\n", "a" };
+  int i, j, n_lines = sizeof(lines) / sizeof(lines[0]);
+  int start, end, ret, lp_start, lp_end, lp_ret;
+  int local_error = 0;
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 0);
+
+  for (i = 0; i < n_lines; i++) {
+    linesplit(&split, lines[i], ",");
+    for (j = 0; j <= split.n_fields; j++) {
+      ret = get_line_pos(lines[i], j, ",", &start, &end);
+      lp_ret = linesplit_get_pos(&split, j, &lp_start, &lp_end);
+      if (ret != lp_ret || start != lp_start || end != lp_end) {
+        FAIL("linesplit_get_pos: line %d field %d\n"
+             "  expected: %d (%d-%d)\n  got: %d (%d-%d)",
+             i, j, ret, start, end, lp_ret, lp_start, lp_end);
+        local_error = 1;
+      }
+    }
+  }
+  if (! local_error)
+    PASS("linesplit_get_pos: agrees with get_line_pos()");
+
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int test_linesplit_field_start() {
+  linesplit_t split;
+  char *line = "one::two::three";
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 0);
+  linesplit(&split, line, "::");
+
+  ASSERT_PTR_EQ(line, linesplit_field_start(&split, 1),
+                "linesplit_field_start: first field");
+  ASSERT_PTR_EQ(line + 10, linesplit_field_start(&split, 3),
+                "linesplit_field_start: last field");
+  ASSERT_TRUE(linesplit_field_start(&split, 4) == NULL,
+              "linesplit_field_start: nonexistent field");
+  ASSERT_TRUE(linesplit_field_start(&split, 0) == NULL,
+              "linesplit_field_start: field 0 is invalid");
+
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int test_linesplit_field_str() {
+  linesplit_t split;
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 0);
+  linesplit(&split, "foo,bar,foobar,baz\n", ",");
+
+  ASSERT_LONG_EQ(1, linesplit_field_str("bar", &split),
+                 "linesplit_field_str: finds middle field");
+  ASSERT_LONG_EQ(3, linesplit_field_str("baz", &split),
+                 "linesplit_field_str: finds last field");
+  ASSERT_LONG_EQ(-1, linesplit_field_str("ba", &split),
+                 "linesplit_field_str: no prefix matches");
+  ASSERT_LONG_EQ(-2, linesplit_field_str(NULL, &split),
+                 "linesplit_field_str: NULL value");
+
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int test_linesplit_n() {
+  linesplit_t split;
+  char *block = "a,b\nc,d,e\n";
+
+  unittest_has_error = 0;
+  linesplit_init(&split, 0);
+
+  ASSERT_LONG_EQ(2, linesplit_n(&split, block, 4, ","),
+                 "linesplit_n: stops at the given length");
+  ASSERT_LONG_EQ(1, linesplit_field_len(&split, 1),
+                 "linesplit_n: linebreak excluded from last field");
+  ASSERT_LONG_EQ(3, linesplit_n(&split, block + 4, 6, ","),
+                 "linesplit_n: splits a line within a block");
+  ASSERT_TRUE(linesplit_field_ptr(&split, 2) == block + 8,
+              "linesplit_n: field pointers refer to the original block");
+
+  linesplit_destroy(&split);
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_linesplit_n_fields();
+  errs += test_linesplit_get_field();
+  errs += test_linesplit_get_pos();
+  errs += test_linesplit_field_start();
+  errs += test_linesplit_field_str();
+  errs += test_linesplit_n();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -20,23 +20,93 @@
 #include "unittest.h"
 
 
+int test_large_and_aligned() {
+  mempool_t *pool = mempool_create(16);
+  char *big, *small;
+  double *d;
+  size_t used;
+
+  unittest_has_error = 0;
+  small = mempool_alloc(pool, 3);
+  big = mempool_alloc(pool, 10000);
+  ASSERT_TRUE(big != NULL, "mempool_alloc: larger than the page size");
+  memset(big, 'x', 10000);
+  ASSERT_TRUE(mempool_alloc(pool, 3) == small + 3,
+              "mempool_alloc: large item leaves current chunk in use");
+
+  d = mempool_alloc_aligned(pool, sizeof(double), sizeof(double));
+  ASSERT_LONG_EQ(0, (size_t) d % sizeof(double),
+                 "mempool_alloc_aligned: address is aligned");
+  ASSERT_TRUE(mempool_alloc_aligned(pool, 8, 3) == NULL,
+              "mempool_alloc_aligned: rejects alignment not a power of 2");
+
+  used = mempool_used(pool);
+  mempool_alloc(pool, 5);
+  ASSERT_LONG_EQ(used + 5, mempool_used(pool),
+                 "mempool_used: counts allocated bytes");
+  ASSERT_TRUE(mempool_size(pool) >= 10000 + 16,
+              "mempool_size: counts reserved bytes");
+  mempool_destroy(pool);
+  return unittest_has_error;
+}
+
+int test_growth() {
+  mempool_t *pool = mempool_create(64);
+  int i;
+
+  unittest_has_error = 0;
+  for (i = 0; i < 100000; i++)
+    mempool_alloc(pool, 10);
+  ASSERT_LONG_EQ(1000000, mempool_used(pool),
+                 "mempool_alloc: many small items");
+  ASSERT_TRUE(pool->n_chunks < 40, "mempool_alloc: chunks grow geometrically");
+  mempool_destroy(pool);
+  return unittest_has_error;
+}
+
+int test_mark_reset() {
+  mempool_t *pool = mempool_create(32);
+  mempool_mark_t mark;
+  size_t size;
+  char *a, *b;
+  int i;
+
+  unittest_has_error = 0;
+  mempool_alloc(pool, 4);
+  mempool_mark(pool, &mark);
+  size = mempool_size(pool);
+  a = mempool_alloc(pool, 4);
+  for (i = 0; i < 100; i++)
+    mempool_alloc(pool, 20);
+  mempool_alloc(pool, 5000);
+  mempool_reset(pool, &mark);
+
+  ASSERT_LONG_EQ(4, mempool_used(pool), "mempool_reset: restores bytes used");
+  ASSERT_LONG_EQ(size, mempool_size(pool),
+                 "mempool_reset: frees chunks added after the mark");
+  b = mempool_alloc(pool, 4);
+  ASSERT_TRUE(a == b, "mempool_reset: space is reused");
+  mempool_destroy(pool);
+  return unittest_has_error;
+}
+
 int main(int argc, char *argv[]) {
   int test_int = 0xffffffff;
   void *ptr_a, *ptr_b;
   mempool_t *pool = NULL;
+  int has_failures = 0;
   pool = mempool_create(16);
 
   ASSERT_TRUE(pool != NULL, "mempool_create returns valid pointer");
   ASSERT_LONG_EQ(16, pool->page_size, "mempool_create sets page size");
-  ASSERT_LONG_EQ(1, pool->n_pages, "mempool_create initializes one page");
-  ASSERT_TRUE(pool->pages != NULL, "mempool_create page list not null");
-  ASSERT_TRUE(pool->pages[0].buffer != NULL, "mempool_create allocates page");
-  ASSERT_LONG_EQ(0, pool->pages[0].next,
-                 "mempool_create initializes page->next");
+  ASSERT_LONG_EQ(1, pool->n_chunks, "mempool_create initializes one chunk");
+  ASSERT_TRUE(pool->chunks != NULL, "mempool_create allocates chunk");
+  ASSERT_LONG_EQ(0, mempool_used(pool),
+                 "mempool_create initializes bytes used");
 
   ptr_a = mempool_alloc(pool, sizeof(test_int));
   ASSERT_TRUE(ptr_a != NULL, "mempool_alloc returns valid pointer");
-  ASSERT_LONG_EQ(sizeof(test_int), pool->pages[0].next,
+  ASSERT_LONG_EQ(sizeof(test_int), pool->current->used,
                  "mempool_alloc sets next location correctly");
 
   *((int *) ptr_a) = test_int;
@@ -48,14 +118,18 @@ int main(int argc, char *argv[]) {
                 "mempool_add doesn't clobber pool data");
   ASSERT_TRUE(ptr_b == ptr_a + sizeof(test_int),
               "mempool_add puts new data in correct place");
-  ASSERT_LONG_EQ(1, pool->next_unfull,
+  ASSERT_LONG_EQ(16, pool->current->used,
                  "mempool_alloc detects full buffer");
-  ASSERT_LONG_EQ(1, pool->n_pages,
-                 "mempool_alloc doesn't allocate new pages needlessly");
+  ASSERT_LONG_EQ(1, pool->n_chunks,
+                 "mempool_alloc doesn't allocate new chunks needlessly");
   mempool_add(pool, "goodbye world", strlen("goodbye world") + 1);
-  ASSERT_LONG_EQ(2, pool->n_pages,
-                 "mempool_alloc adds new pages as necessary");
+  ASSERT_LONG_EQ(2, pool->n_chunks,
+                 "mempool_alloc adds new chunks as necessary");
   mempool_destroy(pool);
+  has_failures = unittest_has_error;
 
-  return 0;
+  has_failures += test_large_and_aligned();
+  has_failures += test_growth();
+  has_failures += test_mark_reset();
+  return has_failures;
 }
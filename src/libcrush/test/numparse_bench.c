@@ -0,0 +1,98 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+/* Measures the speed of converting numeric fields.  This is not run by
+   "make check"; use "make bench" instead.
+
+   usage: numparse_bench [millions-of-numbers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <crush/numparse.h>
+
+#define FIELD_SZ 24
+
+static double now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, size_t n, double elapsed, double sum) {
+  printf("%-32s %8.1f M/s  (%.4f)\n", name, n / elapsed / 1e6, sum);
+}
+
+/* the precision computation aggregate and pivot used with atof(). */
+static int float_str_precision(const char *d) {
+  const char *p = strchr(d, '.');
+  if (p == NULL)
+    return 0;
+  return strlen(d) - (p - d + 1);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = (argc > 1 ? atoi(argv[1]) : 5) * 1000000, i;
+  char *fields = malloc(n * FIELD_SZ), *f;
+  double start, sum, value;
+  int precision;
+  numparse_t num;
+
+  /* a mix of integers and prices, like most of the data we aggregate. */
+  srand(1);
+  for (i = 0; i < n; i++) {
+    f = fields + i * FIELD_SZ;
+    if (i % 2)
+      sprintf(f, "%d", rand() % 1000000);
+    else
+      sprintf(f, "%d.%02d", rand() % 10000, rand() % 100);
+  }
+  printf("%lu numbers\n\n", (unsigned long) n);
+
+  start = now();
+  for (sum = 0, precision = 0, i = 0; i < n; i++) {
+    f = fields + i * FIELD_SZ;
+    sum += atof(f);
+    precision += float_str_precision(f);
+  }
+  report("atof + float_str_precision", n, now() - start, sum);
+
+  start = now();
+  for (sum = 0, i = 0; i < n; i++) {
+    sscanf(fields + i * FIELD_SZ, "%lf", &value);
+    sum += value;
+  }
+  report("sscanf(\"%lf\")", n, now() - start, sum);
+
+  start = now();
+  for (sum = 0, i = 0; i < n; i++)
+    sum += strtod(fields + i * FIELD_SZ, NULL);
+  report("strtod", n, now() - start, sum);
+
+  start = now();
+  for (sum = 0, precision = 0, i = 0; i < n; i++) {
+    numparse_str(fields + i * FIELD_SZ, &num);
+    sum += num.value;
+    precision += num.precision;
+  }
+  report("numparse_str (with precision)", n, now() - start, sum);
+
+  free(fields);
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <crush/numparse.h>
+#include "unittest.h"
+
+/* every value numparse() produces should be bit-for-bit what strtod()
+   produces for the same text. */
+int check_against_strtod(const char *s) {
+  numparse_t num;
+  char *end;
+  double expected = strtod(s, &end);
+  size_t consumed = numparse_str(s, &num);
+
+  if (consumed != end - s) {
+    FAIL("numparse(\"%s\"): consumed %lu bytes, expected %lu", s,
+         (unsigned long) consumed, (unsigned long) (end - s));
+    return 1;
+  }
+  if (memcmp(&num.value, &expected, sizeof(double)) != 0) {
+    FAIL("numparse(\"%s\"): got %.17g, expected %.17g", s, num.value,
+         expected);
+    return 1;
+  }
+  return 0;
+}
+
+int test_values() {
+  const char *inputs[] = {
+    "0", "-0", "1", "-1", "+7", "  42", "3.14159", "-2.5", ".5", "5.",
+    "0.000123", "1e3", "1.5E-3", "2e", "2e+", "1.7976931348623157e308",
+    "4.9e-324", "1e400", "123456789012345678901234567890",
+    "0.1000000000000000055511151231257827", "9007199254740993",
+    "12abc", "1,5", "0x1A", "inf", "-nan", "1e-30", "99999999999999999999",
+    "0.30000000000000004"
+  };
+  char buf[64];
+  int i, errs = 0;
+
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+    errs += check_against_strtod(inputs[i]);
+
+  srand(7);
+  for (i = 0; i < 100000; i++) {
+    switch (i % 3) {
+      case 0:
+        sprintf(buf, "%.*f", rand() % 8, (rand() - RAND_MAX / 2) / 997.0);
+        break;
+      case 1:
+        sprintf(buf, "%d.%0*d", rand(), rand() % 10 + 1, rand() % 100000);
+        break;
+      default:
+        sprintf(buf, "%de%d", rand() % 100000, rand() % 60 - 30);
+        break;
+    }
+    errs += check_against_strtod(buf);
+  }
+
+  if (errs == 0)
+    PASS("numparse: values match strtod()");
+  return errs;
+}
+
+int test_precision() {
+  numparse_t num;
+
+  unittest_has_error = 0;
+  numparse_str("12", &num);
+  ASSERT_INT_EQ(0, num.precision, "numparse: integer has no precision");
+  numparse_str("12.500", &num);
+  ASSERT_INT_EQ(3, num.precision, "numparse: trailing zeros count");
+  numparse_str("-0.05e2", &num);
+  ASSERT_INT_EQ(2, num.precision, "numparse: exponent is not precision");
+  numparse_str("abc", &num);
+  ASSERT_INT_EQ(0, num.precision, "numparse: no number has no precision");
+  return unittest_has_error;
+}
+
+int test_integers() {
+  numparse_t num;
+
+  unittest_has_error = 0;
+  numparse_str("9007199254740993", &num);
+  ASSERT_TRUE(num.is_int && num.int_value == 9007199254740993LL,
+              "numparse: integer beyond double precision is exact");
+  numparse_str("-9223372036854775808", &num);
+  ASSERT_TRUE(num.is_int && num.int_value == INT64_MIN,
+              "numparse: smallest int64");
+  numparse_str("9223372036854775808", &num);
+  ASSERT_TRUE(! num.is_int, "numparse: int64 overflow is not an integer");
+  numparse_str("3.0", &num);
+  ASSERT_TRUE(! num.is_int, "numparse: decimal is not an integer");
+  numparse_str("3e2", &num);
+  ASSERT_TRUE(! num.is_int, "numparse: exponent is not an integer");
+  return unittest_has_error;
+}
+
+int test_views() {
+  const char *line = "17.25,3,x";
+  numparse_t num;
+
+  unittest_has_error = 0;
+  ASSERT_LONG_EQ(2, numparse(line, 2, &num),
+                 "numparse: stops at the end of the view");
+  ASSERT_TRUE(num.value == 17 && num.is_int,
+              "numparse: converts only the view");
+  ASSERT_LONG_EQ(5, numparse(line, 9, &num),
+                 "numparse: stops at a delimiter");
+  ASSERT_TRUE(num.value == 17.25, "numparse: converts up to a delimiter");
+  ASSERT_LONG_EQ(0, numparse(line + 8, 1, &num),
+                 "numparse: no number in the view");
+  ASSERT_LONG_EQ(0, numparse(line, 0, &num), "numparse: empty view");
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_values();
+  errs += test_precision();
+  errs += test_integers();
+  errs += test_views();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
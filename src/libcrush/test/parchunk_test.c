@@ -0,0 +1,182 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <crush/parchunk.h>
+#include "unittest.h"
+
+#define TEST_FILENAME "parchunk_test.txt"
+#define LINES_IN_TEST_FILE 200000
+
+/* writes the number of each line in front of it. */
+int number_lines(void *state, const char *data, size_t len, size_t line_no,
+                 bufout_t *out) {
+  const char *end = data + len;
+  size_t line_len;
+
+  while (data < end) {
+    line_len = parchunk_line_len(data, end);
+    bufout_put_long(out, line_no++);
+    bufout_putc(out, ':');
+    bufout_write_ref(out, data, line_len);
+    data += line_len;
+  }
+  return 0;
+}
+
+/* fails on any chunk but the first. */
+int fail_later(void *state, const char *data, size_t len, size_t line_no,
+               bufout_t *out) {
+  int *n_chunks = state;
+  return __sync_fetch_and_add(n_chunks, 1) > 0 ? 42 : 0;
+}
+
+char * slurp(FILE *fp, size_t *len) {
+  char *data;
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  data = malloc(*len + 1);
+  fseek(fp, 0, SEEK_SET);
+  *len = fread(data, 1, *len, fp);
+  data[*len] = '\0';
+  return data;
+}
+
+/* the output must be the same, in the same order, however the input is
+   read and however many threads do the work. */
+int check_run(const char *expected, size_t expected_len, int mapped,
+              int n_threads) {
+  parchunk_ops_t ops = { number_lines, NULL, NULL, NULL };
+  FILE *fp = tmpfile();
+  bufout_t *out = bufout_init(fp);
+  dbfr_t *reader = mapped ? dbfr_mmap_open(TEST_FILENAME) :
+                            dbfr_open(TEST_FILENAME);
+  char *data;
+  size_t len;
+  int errs = 0;
+
+  /* the header is read separately, and must not be processed again. */
+  dbfr_getline(reader);
+  if (parchunk_run(reader, out, n_threads, &ops) != 0) {
+    FAIL("parchunk_run: failed with %d threads", n_threads);
+    errs++;
+  }
+  bufout_close(out);
+  dbfr_close(reader);
+
+  data = slurp(fp, &len);
+  if (len != expected_len || memcmp(data, expected, len) != 0) {
+    FAIL("parchunk_run: wrong output (%s, %d threads)",
+         mapped ? "mapped" : "copied", n_threads);
+    errs++;
+  }
+  free(data);
+  fclose(fp);
+  return errs;
+}
+
+int test_run() {
+  FILE *fp = fopen(TEST_FILENAME, "w");
+  char *expected, *p, line[64];
+  int threads[] = { 1, 2, 7 };
+  int i, errs = 0;
+
+  fputs("header\n", fp);
+  p = expected = malloc(LINES_IN_TEST_FILE * 64);
+  for (i = 0; i < LINES_IN_TEST_FILE; i++) {
+    sprintf(line, "line %d of the test file%s", i,
+            i == LINES_IN_TEST_FILE - 1 ? "" : "\n");
+    fputs(line, fp);
+    p += sprintf(p, "%d:%s", i + 2, line);
+  }
+  fclose(fp);
+
+  for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+    errs += check_run(expected, p - expected, 1, threads[i]);
+    errs += check_run(expected, p - expected, 0, threads[i]);
+  }
+  if (errs == 0)
+    PASS("parchunk_run: output is complete and in order");
+  free(expected);
+  return errs;
+}
+
+int test_failure() {
+  parchunk_ops_t ops = { fail_later, NULL, NULL, NULL };
+  dbfr_t *reader = dbfr_mmap_open(TEST_FILENAME);
+  FILE *fp = tmpfile();
+  bufout_t *out = bufout_init(fp);
+  int n_chunks = 0;
+
+  unittest_has_error = 0;
+  ops.arg = &n_chunks;
+  ASSERT_INT_EQ(42, parchunk_run(reader, out, 4, &ops),
+                "parchunk_run: a failure is returned");
+  bufout_close(out);
+  dbfr_close(reader);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+int test_threads() {
+  unittest_has_error = 0;
+  ASSERT_INT_EQ(3, parchunk_threads("3"), "parchunk_threads: number");
+  ASSERT_TRUE(parchunk_threads("0") >= 1, "parchunk_threads: all processors");
+  ASSERT_INT_EQ(-1, parchunk_threads("x"), "parchunk_threads: not a number");
+  ASSERT_INT_EQ(-1, parchunk_threads("-2"), "parchunk_threads: negative");
+  return unittest_has_error;
+}
+
+/* squares its item. */
+void square(void *arg, size_t i) {
+  long *squares = arg;
+  squares[i] = (long) i * i;
+}
+
+int test_each() {
+  long squares[1000];
+  int threads[] = { 1, 3, 2000 };
+  int i, j, ok = 1;
+
+  unittest_has_error = 0;
+  for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+    memset(squares, 0, sizeof(squares));
+    parchunk_each(1000, threads[i], square, squares);
+    for (j = 0; j < 1000; j++) {
+      if (squares[j] != (long) j * j)
+        ok = 0;
+    }
+  }
+  ASSERT_TRUE(ok, "parchunk_each: every item is done once");
+  parchunk_each(0, 4, square, NULL);
+  PASS("parchunk_each: no items");
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_run();
+  errs += test_failure();
+  errs += test_threads();
+  errs += test_each();
+  unlink(TEST_FILENAME);
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <crush/tdigest.h>
+#include "unittest.h"
+
+/* the values 1 to N in a scrambled order. */
+double scrambled(int i, int n) {
+  return (double) ((i * 7919L) % n) + 1;
+}
+
+int test_small() {
+  double values[] = { 3, 1, 4, 1, 5 };
+  tdigest_t td;
+  int i;
+
+  unittest_has_error = 0;
+  tdigest_init(&td, TDIGEST_DEFAULT_COMPRESSION);
+  ASSERT_TRUE(isnan(tdigest_quantile(&td, 0.5)),
+              "tdigest_quantile: empty digest");
+  for (i = 0; i < 5; i++)
+    tdigest_add(&td, values[i]);
+  ASSERT_TRUE(tdigest_quantile(&td, 0) == 1, "tdigest_quantile: minimum");
+  ASSERT_TRUE(tdigest_quantile(&td, 0.5) == 3, "tdigest_quantile: median");
+  ASSERT_TRUE(tdigest_quantile(&td, 1) == 5, "tdigest_quantile: maximum");
+  ASSERT_TRUE(tdigest_quantile(&td, 0.6) == 3.5,
+              "tdigest_quantile: interpolates between values");
+
+  tdigest_add(&td, 9);
+  ASSERT_TRUE(tdigest_quantile(&td, 0.5) == 3.5,
+              "tdigest_quantile: values added after a quantile");
+  ASSERT_LONG_EQ(6, (long) tdigest_count(&td), "tdigest_count");
+
+  tdigest_clear(&td);
+  ASSERT_TRUE(isnan(tdigest_quantile(&td, 0.5)),
+              "tdigest_clear: empties the digest");
+  tdigest_destroy(&td);
+  return unittest_has_error;
+}
+
+/* quantiles of a large uniform stream are within a small fraction of the
+   range, and the digest stays bounded. */
+int test_large() {
+  double qs[] = { 0.001, 0.01, 0.5, 0.95, 0.99, 0.999 };
+  int n = 1000000, i, ok = 1;
+  tdigest_t td;
+
+  unittest_has_error = 0;
+  tdigest_init(&td, TDIGEST_DEFAULT_COMPRESSION);
+  for (i = 0; i < n; i++)
+    tdigest_add(&td, scrambled(i, n));
+  for (i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+    if (fabs(tdigest_quantile(&td, qs[i]) - qs[i] * n) > n * 0.002)
+      ok = 0;
+  }
+  ASSERT_TRUE(ok, "tdigest_quantile: within 0.2 percent of the range");
+  ASSERT_TRUE(tdigest_quantile(&td, 0) == 1 &&
+              tdigest_quantile(&td, 1) == n,
+              "tdigest_quantile: the extremes are exact");
+  ASSERT_TRUE(tdigest_size(&td) < 16 * 1024,
+              "tdigest_size: bounded by the compression");
+  tdigest_destroy(&td);
+  return unittest_has_error;
+}
+
+/* digests of parts of a stream merge into a digest of the whole. */
+int test_merge() {
+  int n = 100000, i, ok = 1;
+  tdigest_t parts[3], all;
+
+  unittest_has_error = 0;
+  tdigest_init(&all, TDIGEST_DEFAULT_COMPRESSION);
+  for (i = 0; i < 3; i++)
+    tdigest_init(&parts[i], TDIGEST_DEFAULT_COMPRESSION);
+  for (i = 0; i < n; i++)
+    tdigest_add(&parts[i % 3], scrambled(i, n));
+  tdigest_merge(&all, &parts[0]);
+  tdigest_merge(&all, &parts[1]);
+  tdigest_merge(&all, &parts[2]);
+
+  ASSERT_LONG_EQ(n, (long) tdigest_count(&all), "tdigest_merge: count");
+  for (i = 1; i < 100; i++) {
+    if (fabs(tdigest_quantile(&all, i / 100.0) - i * n / 100.0) > n * 0.005)
+      ok = 0;
+  }
+  ASSERT_TRUE(ok, "tdigest_merge: quantiles of the whole");
+  ASSERT_TRUE(tdigest_quantile(&all, 1) == n, "tdigest_merge: maximum");
+  for (i = 0; i < 3; i++)
+    tdigest_destroy(&parts[i]);
+  tdigest_destroy(&all);
+  return unittest_has_error;
+}
+
+int test_save_load() {
+  FILE *fp = tmpfile();
+  tdigest_t td, loaded;
+  int i;
+
+  unittest_has_error = 0;
+  tdigest_init(&td, 50);
+  for (i = 0; i < 10000; i++)
+    tdigest_add(&td, scrambled(i, 10000));
+  ASSERT_LONG_EQ(0, tdigest_save(&td, fp), "tdigest_save");
+  rewind(fp);
+  ASSERT_LONG_EQ(0, tdigest_load(&loaded, fp), "tdigest_load");
+  ASSERT_TRUE(tdigest_quantile(&loaded, 0.9) == tdigest_quantile(&td, 0.9),
+              "tdigest_load: the same digest");
+  ASSERT_LONG_EQ(-1, tdigest_load(&loaded, fp), "tdigest_load: end of file");
+  tdigest_destroy(&td);
+  fclose(fp);
+  return unittest_has_error;
+}
+
+int test_parse_percents() {
+  double *percents;
+
+  unittest_has_error = 0;
+  ASSERT_LONG_EQ(5, tdigest_parse_percents("0,50,99.9,100,1", &percents),
+                 "tdigest_parse_percents: count");
+  ASSERT_TRUE(percents[0] == 0 && percents[1] == 50 && percents[2] == 99.9 &&
+              percents[3] == 100 && percents[4] == 1,
+              "tdigest_parse_percents: values");
+  free(percents);
+  ASSERT_LONG_EQ(-1, tdigest_parse_percents("50,101", &percents),
+                 "tdigest_parse_percents: over 100");
+  ASSERT_TRUE(percents == NULL, "tdigest_parse_percents: nothing allocated");
+  ASSERT_LONG_EQ(-1, tdigest_parse_percents("-1", &percents),
+                 "tdigest_parse_percents: negative");
+  ASSERT_LONG_EQ(-1, tdigest_parse_percents("50,", &percents),
+                 "tdigest_parse_percents: empty item");
+  ASSERT_LONG_EQ(-1, tdigest_parse_percents("50;95", &percents),
+                 "tdigest_parse_percents: bad separator");
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_small();
+  errs += test_large();
+  errs += test_merge();
+  errs += test_save_load();
+  errs += test_parse_percents();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
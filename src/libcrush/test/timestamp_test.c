@@ -0,0 +1,156 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <crush/timestamp.h>
+#include "unittest.h"
+
+/* parses S and writes the start of its bucket of WIDTH seconds back out in
+   BUF, or "" if S doesn't parse. */
+char * bucket(const char *s, long long width, char *buf) {
+  timestamp_format_t format;
+  long long seconds;
+  size_t len = 0;
+
+  if (timestamp_parse(s, strlen(s), &seconds, &format) == 0)
+    len = timestamp_format(buf, timestamp_floor(seconds, width), &format);
+  buf[len] = '\0';
+  return buf;
+}
+
+int test_parse() {
+  const char *bad[] = { "", "abc", "2024-13-01", "2024-02-30", "2023-02-29",
+                        "2024-01-01 24:00:00", "2024-01-01 10:60",
+                        "2024-01-01X10:00:00", "2024-01-01 10:00:00.",
+                        "2024-01-01 10:00:00 UTC", "2024-01-01 10",
+                        "2024-01/01", "12.", "-", "1e9", "2024-01-01 10:0x" };
+  long long seconds;
+  timestamp_format_t format;
+  int i, n_rejected = 0;
+
+  unittest_has_error = 0;
+  ASSERT_LONG_EQ(0, timestamp_parse("1970-01-01", 10, &seconds, &format),
+                 "timestamp_parse: a date");
+  ASSERT_LONG_EQ(0, (long) seconds, "timestamp_parse: the epoch");
+  ASSERT_TRUE(format.style == timestamp_date, "timestamp_parse: date style");
+
+  timestamp_parse("2024-02-29T13:45:07.999+02:00", 29, &seconds, &format);
+  ASSERT_LONG_EQ(1709214307, (long) seconds,
+                 "timestamp_parse: a time, ignoring its zone and fraction");
+  ASSERT_STR_EQ("+02:00", format.zone, "timestamp_parse: keeps the zone");
+  ASSERT_TRUE(format.time_sep == 'T' && format.has_seconds,
+              "timestamp_parse: time format");
+
+  ASSERT_LONG_EQ(0, timestamp_parse("-1.5", 4, &seconds, NULL),
+                 "timestamp_parse: negative epoch seconds");
+  ASSERT_LONG_EQ(-2, (long) seconds,
+                 "timestamp_parse: fraction rounds down");
+  ASSERT_LONG_EQ(0, timestamp_parse("1700000000xyz", 10, &seconds, &format),
+                 "timestamp_parse: only LEN bytes are read");
+  ASSERT_LONG_EQ(1700000000, (long) seconds,
+                 "timestamp_parse: epoch seconds");
+
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    if (timestamp_parse(bad[i], strlen(bad[i]), &seconds, NULL) == 0)
+      fprintf(stderr, "accepted: %s\n", bad[i]);
+    else
+      n_rejected++;
+  }
+  ASSERT_LONG_EQ((long) (sizeof(bad) / sizeof(bad[0])), (long) n_rejected,
+                 "timestamp_parse: bad timestamps");
+  return unittest_has_error;
+}
+
+/* dates over a few centuries agree with gmtime() and round-trip. */
+int test_calendar() {
+  char expected[64], got[TIMESTAMP_MAX_LEN + 1];
+  timestamp_format_t format = { timestamp_datetime, '-', ' ', 1, "" };
+  long long seconds, parsed;
+  time_t t;
+  struct tm tm;
+  int ok = 1;
+
+  unittest_has_error = 0;
+  for (seconds = -5000000000LL; seconds < 8000000000LL;
+       seconds += 86400LL * 37 + 3607) {
+    t = seconds;
+    gmtime_r(&t, &tm);
+    strftime(expected, sizeof(expected), "%Y-%m-%d %H:%M:%S", &tm);
+    got[timestamp_format(got, seconds, &format)] = '\0';
+    if (strcmp(expected, got) != 0 ||
+        timestamp_parse(got, strlen(got), &parsed, NULL) != 0 ||
+        parsed != seconds) {
+      ok = 0;
+      fprintf(stderr, "%lld: expected %s, got %s\n", seconds, expected, got);
+      break;
+    }
+  }
+  ASSERT_TRUE(ok, "timestamp_format: agrees with gmtime()");
+  return unittest_has_error;
+}
+
+int test_buckets() {
+  char buf[TIMESTAMP_MAX_LEN + 1];
+  long long width;
+
+  unittest_has_error = 0;
+  ASSERT_STR_EQ("2024-03-10 13:00:00",
+                bucket("2024-03-10 13:59:59", 3600, buf),
+                "timestamp_floor: hour");
+  ASSERT_STR_EQ("2024-03-10T13:45Z", bucket("2024-03-10T13:52Z", 900, buf),
+                "timestamp_floor: keeps the format");
+  ASSERT_STR_EQ("2024/03/10 00:00:00",
+                bucket("2024/03/10 23:59:59.75", 86400, buf),
+                "timestamp_floor: day");
+  ASSERT_STR_EQ("2024-03-10", bucket("2024-03-10", 3600, buf),
+                "timestamp_floor: date only");
+  ASSERT_STR_EQ("1699999800", bucket("1700000000.5", 300, buf),
+                "timestamp_floor: epoch seconds");
+  ASSERT_STR_EQ("-300", bucket("-1", 300, buf),
+                "timestamp_floor: before the epoch");
+  ASSERT_STR_EQ("", bucket("yesterday", 300, buf),
+                "timestamp_parse: not a timestamp");
+
+  ASSERT_LONG_EQ(0, timestamp_parse_width("hour", &width),
+                 "timestamp_parse_width: hour");
+  ASSERT_LONG_EQ(3600, (long) width, "timestamp_parse_width: hour");
+  timestamp_parse_width("15m", &width);
+  ASSERT_LONG_EQ(900, (long) width, "timestamp_parse_width: 15m");
+  timestamp_parse_width("2d", &width);
+  ASSERT_LONG_EQ(172800, (long) width, "timestamp_parse_width: 2d");
+  timestamp_parse_width("30", &width);
+  ASSERT_LONG_EQ(30, (long) width, "timestamp_parse_width: seconds");
+  ASSERT_LONG_EQ(-1, timestamp_parse_width("0", &width),
+                 "timestamp_parse_width: zero");
+  ASSERT_LONG_EQ(-1, timestamp_parse_width("", &width),
+                 "timestamp_parse_width: empty");
+  ASSERT_LONG_EQ(-1, timestamp_parse_width("5 minutes", &width),
+                 "timestamp_parse_width: unknown unit");
+  return unittest_has_error;
+}
+
+int main(int argc, char *argv[]) {
+  int errs = 0;
+  errs += test_parse();
+  errs += test_calendar();
+  errs += test_buckets();
+  if (errs)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
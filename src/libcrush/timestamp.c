@@ -0,0 +1,287 @@
+/*****************************************
+   Copyright 2010 Google Inc.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *****************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <limits.h>
+#include <string.h>
+
+#include <crush/timestamp.h>
+
+#define SECONDS_PER_DAY 86400LL
+
+/* converts N digits.  returns -1 if they aren't all digits. */
+static int timestamp_digits(const char *s, int n) {
+  int value = 0;
+
+  while (n-- > 0) {
+    if (*s < '0' || *s > '9')
+      return -1;
+    value = value * 10 + (*s++ - '0');
+  }
+  return value;
+}
+
+/* writes the last N digits of VALUE, with leading zeros. */
+static char * timestamp_put_digits(char *dest, int value, int n) {
+  int i;
+
+  for (i = n - 1; i >= 0; i--) {
+    dest[i] = '0' + value % 10;
+    value /= 10;
+  }
+  return dest + n;
+}
+
+static int timestamp_leap_year(int year) {
+  return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+static int timestamp_days_in_month(int year, int month) {
+  static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return month == 2 && timestamp_leap_year(year) ? 29 : days[month - 1];
+}
+
+/* the number of days from 1970-01-01 to a date in the proleptic Gregorian
+   calendar, counting in 400-year eras of 146097 days each. */
+static long long timestamp_days_from_civil(long long year, int month,
+                                           int day) {
+  long long era, year_of_era, day_of_year, day_of_era;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  year_of_era = year - era * 400;
+  day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+               day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+/* the inverse of timestamp_days_from_civil(). */
+static void timestamp_civil_from_days(long long days, long long *year,
+                                      int *month, int *day) {
+  long long era, day_of_era, year_of_era, day_of_year, shifted_month;
+
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  day_of_era = days - era * 146097;
+  year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                 day_of_era / 146096) / 365;
+  day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 -
+                              year_of_era / 100);
+  shifted_month = (5 * day_of_year + 2) / 153;
+  *day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+  *month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+  *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+/* parses a number of seconds since the epoch, with an optional sign and
+   fraction. */
+static int timestamp_parse_epoch(const char *s, size_t len,
+                                 long long *seconds) {
+  const char *end = s + len;
+  long long value = 0;
+  int negative = 0, fraction = 0;
+
+  if (s < end && *s == '-') {
+    negative = 1;
+    s++;
+  }
+  if (s == end || *s < '0' || *s > '9')
+    return -1;
+  for (; s < end && *s >= '0' && *s <= '9'; s++) {
+    if (value > (LLONG_MAX - 9) / 10)
+      return -1;
+    value = value * 10 + (*s - '0');
+  }
+  if (s < end && *s == '.') {
+    if (++s == end)
+      return -1;
+    for (; s < end && *s >= '0' && *s <= '9'; s++)
+      fraction |= *s != '0';
+  }
+  if (s != end)
+    return -1;
+  /* a fraction is dropped towards the past, as for any other timestamp. */
+  *seconds = negative ? -value - fraction : value;
+  return 0;
+}
+
+/* parses a time zone: Z, +HH, +HHMM or +HH:MM. */
+static int timestamp_parse_zone(const char *s, size_t len, char *zone) {
+  if (len == 1 && *s == 'Z')
+    goto valid;
+  if (len < 3 || (*s != '+' && *s != '-') || timestamp_digits(s + 1, 2) < 0)
+    return -1;
+  if (len == 3 ||
+      (len == 5 && timestamp_digits(s + 3, 2) >= 0) ||
+      (len == 6 && s[3] == ':' && timestamp_digits(s + 4, 2) >= 0))
+    goto valid;
+  return -1;
+
+valid:
+  memcpy(zone, s, len);
+  zone[len] = '\0';
+  return 0;
+}
+
+int timestamp_parse(const char *s, size_t len, long long *seconds,
+                    timestamp_format_t *format) {
+  timestamp_format_t parsed;
+  int year, month, day, hour = 0, minute = 0, second = 0;
+  size_t pos;
+
+  memset(&parsed, 0, sizeof(parsed));
+  if (len < 10 || (s[4] != '-' && s[4] != '/') || s[7] != s[4]) {
+    if (timestamp_parse_epoch(s, len, seconds) != 0)
+      return -1;
+    if (format) {
+      parsed.style = timestamp_epoch;
+      *format = parsed;
+    }
+    return 0;
+  }
+
+  parsed.date_sep = s[4];
+  if ((year = timestamp_digits(s, 4)) < 0 ||
+      (month = timestamp_digits(s + 5, 2)) < 1 || month > 12 ||
+      (day = timestamp_digits(s + 8, 2)) < 1 ||
+      day > timestamp_days_in_month(year, month))
+    return -1;
+
+  parsed.style = timestamp_date;
+  if (len > 10) {
+    parsed.style = timestamp_datetime;
+    parsed.time_sep = s[10];
+    if ((s[10] != ' ' && s[10] != 'T') || len < 16 || s[13] != ':' ||
+        (hour = timestamp_digits(s + 11, 2)) < 0 || hour > 23 ||
+        (minute = timestamp_digits(s + 14, 2)) < 0 || minute > 59)
+      return -1;
+    pos = 16;
+    if (pos < len && s[pos] == ':') {
+      parsed.has_seconds = 1;
+      if (len < 19 || (second = timestamp_digits(s + 17, 2)) < 0 ||
+          second > 60)
+        return -1;
+      pos = 19;
+      if (pos < len && s[pos] == '.') {
+        if (++pos == len || s[pos] < '0' || s[pos] > '9')
+          return -1;
+        while (pos < len && s[pos] >= '0' && s[pos] <= '9')
+          pos++;
+      }
+    }
+    if (pos < len && timestamp_parse_zone(s + pos, len - pos, parsed.zone))
+      return -1;
+  }
+
+  *seconds = timestamp_days_from_civil(year, month, day) * SECONDS_PER_DAY +
+             hour * 3600 + minute * 60 + second;
+  if (format)
+    *format = parsed;
+  return 0;
+}
+
+size_t timestamp_format(char *dest, long long seconds,
+                        const timestamp_format_t *format) {
+  char digits[24], *p = digits + sizeof(digits), *start = dest;
+  unsigned long long u;
+  long long days, year;
+  int month, day, time_of_day;
+
+  if (format->style == timestamp_epoch) {
+    u = seconds < 0 ? 0ULL - (unsigned long long) seconds : seconds;
+    do {
+      *--p = '0' + u % 10;
+      u /= 10;
+    } while (u);
+    if (seconds < 0)
+      *--p = '-';
+    memcpy(dest, p, digits + sizeof(digits) - p);
+    return digits + sizeof(digits) - p;
+  }
+
+  days = seconds / SECONDS_PER_DAY;
+  time_of_day = seconds % SECONDS_PER_DAY;
+  if (time_of_day < 0) {
+    days--;
+    time_of_day += SECONDS_PER_DAY;
+  }
+  timestamp_civil_from_days(days, &year, &month, &day);
+  if (year < 0 || year > 9999)
+    return 0;
+
+  dest = timestamp_put_digits(dest, year, 4);
+  *dest++ = format->date_sep;
+  dest = timestamp_put_digits(dest, month, 2);
+  *dest++ = format->date_sep;
+  dest = timestamp_put_digits(dest, day, 2);
+  if (format->style == timestamp_date)
+    return dest - start;
+
+  *dest++ = format->time_sep;
+  dest = timestamp_put_digits(dest, time_of_day / 3600, 2);
+  *dest++ = ':';
+  dest = timestamp_put_digits(dest, time_of_day / 60 % 60, 2);
+  if (format->has_seconds) {
+    *dest++ = ':';
+    dest = timestamp_put_digits(dest, time_of_day % 60, 2);
+  }
+  memcpy(dest, format->zone, strlen(format->zone));
+  dest += strlen(format->zone);
+  return dest - start;
+}
+
+long long timestamp_floor(long long seconds, long long width) {
+  long long offset = seconds % width;
+
+  if (offset < 0)
+    offset += width;
+  return seconds - offset;
+}
+
+int timestamp_parse_width(const char *s, long long *width) {
+  static const struct {
+    const char *name;
+    long long seconds;
+  } units[] = {
+    { "second", 1 }, { "minute", 60 }, { "hour", 3600 },
+    { "day", SECONDS_PER_DAY }, { "s", 1 }, { "m", 60 }, { "h", 3600 },
+    { "d", SECONDS_PER_DAY }, { "", 1 }
+  };
+  long long n = 1;
+  char *end = (char *) s;
+  int i;
+
+  if (*s == '\0')
+    return -1;
+  if (*s >= '0' && *s <= '9') {
+    n = strtoll(s, &end, 10);
+    if (n <= 0)
+      return -1;
+  }
+  for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+    if (strcmp(end, units[i].name) == 0) {
+      if (n > LLONG_MAX / units[i].seconds)
+        return -1;
+      *width = n * units[i].seconds;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -15,6 +15,7 @@
  ********************************/
 
 #include <crush/general.h>
+#include <crush/linesplit.h>
 
 #include "mergekeys_main.h"
 #include "mergekeys.h"
@@ -37,6 +38,13 @@ int *left_mergefields = NULL;
 int *right_mergefields = NULL;
 size_t left_ntomerge, right_ntomerge;
 
+/* holds the fields of a line while it is being printed */
+linesplit_t print_split;
+
+/* holds the fields of a line while its key is being built */
+linesplit_t key_split;
+struct line_keys left_line_keys, right_line_keys;
+
 
 /** @brief opens all the files necessary, sets a default
   * delimiter if none was specified, and calls the
@@ -54,6 +62,7 @@ int mergekeys(struct cmdargs *args, int argc, char *argv[], int optind) {
   FILE *out; /* the output file ptrs */
   dbfr_t *left_reader, *right_reader;
   int fd_tmp, retval; /* file descriptor and return value */
+  int i;
 
   enum join_type_t join_type;
 
@@ -129,12 +138,21 @@ int mergekeys(struct cmdargs *args, int argc, char *argv[], int optind) {
     join_type = join_type_outer;
 
 
-  /* set locale with values from the environment so strcoll()
-     will work correctly. */
+  /* set locale with values from the environment so keys
+     collate correctly. */
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
+  collate_init(args->byte_order);
 
+  linesplit_init(&print_split, 0);
+  linesplit_init(&key_split, 0);
   retval = merge_files(left_reader, right_reader, join_type, out, args);
+  linesplit_destroy(&key_split);
+  linesplit_destroy(&print_split);
+  for (i = 0; i < 2; i++) {
+    collate_key_destroy(&left_line_keys.keys[i]);
+    collate_key_destroy(&right_line_keys.keys[i]);
+  }
 
   dbfr_close(left_reader);
   dbfr_close(right_reader);
@@ -243,12 +261,12 @@ left_file_loop:
           break;
         free(left->current_line);
         left->current_line = NULL;
-        keycmp = compare_keys(left->current_line, right->current_line);
+        keycmp = compare_keys(left, right);
         goto right_file_loop;
       }
     }
 
-    keycmp = compare_keys(left->current_line, right->current_line);
+    keycmp = compare_keys(left, right);
 
     if (LEFT_LT_RIGHT(keycmp)) {
       if (join_type == join_type_outer || join_type == join_type_left_outer)
@@ -261,7 +279,7 @@ left_file_loop:
       join_lines(left->current_line, right->current_line,
                  args->merge_default, out);
 
-      if (peek_keys(left->next_line, left->current_line, left_keyfields) == 0) {
+      if (peek_keys(left, &left_line_keys, left_keyfields) == 0) {
         /* the keys in the next line of LEFT are the same.
            handle "many:1"
          */
@@ -283,7 +301,7 @@ left_file_loop:
         free(right->current_line);
         right->current_line = NULL;
       }
-      keycmp = compare_keys(left->current_line, right->current_line);
+      keycmp = compare_keys(left, right);
 
       if (LEFT_LT_RIGHT(keycmp)) {
 
@@ -305,8 +323,7 @@ left_file_loop:
 
         /* if the keys in the next line of LEFT are the same,
            handle "many:1". */
-        peek_cmp = peek_keys(left->next_line, left->current_line,
-                             left_keyfields);
+        peek_cmp = peek_keys(left, &left_line_keys, left_keyfields);
         if ((args->inner && peek_cmp <= 0) || peek_cmp == 0) {
           goto left_file_loop;
         }
@@ -315,7 +332,7 @@ left_file_loop:
            handle "1:many" by staying in this inner loop.  otherwise,
            go back to the outer loop. */
 
-        if (peek_keys(right->next_line, right->current_line, right_keyfields)
+        if (peek_keys(right, &right_line_keys, right_keyfields)
             != 0) {
           /* need a new line from RIGHT */
           if (dbfr_getline(right) <= 0) {
@@ -346,17 +363,21 @@ left_file_loop:
 static void extract_and_print_fields(char *line, int *field_list,
                                      size_t nfields, char *delim, FILE *out) {
   int i;
-  char field_buffer[MAX_FIELD_LEN + 1];
+  size_t field_len;
   if (nfields == 0)
     return;
-  for (i = 0; i < nfields - 1; i++) {
-    field_buffer[0] = '\0';
-    get_line_field(field_buffer, line, MAX_FIELD_LEN, field_list[i], delim);
-    fputs(field_buffer, out);
-    fputs(delim, out);
+  linesplit(&print_split, line, delim);
+  for (i = 0; i < nfields; i++) {
+    if (i > 0)
+      fputs(delim, out);
+    if (field_list[i] >= print_split.n_fields)
+      continue;
+    field_len = linesplit_field_len(&print_split, field_list[i]);
+    if (field_len > MAX_FIELD_LEN - 1)
+      field_len = MAX_FIELD_LEN - 1;
+    fwrite(linesplit_field_ptr(&print_split, field_list[i]), 1, field_len,
+           out);
   }
-  get_line_field(field_buffer, line, MAX_FIELD_LEN, field_list[i], delim);
-  fputs(field_buffer, out);
 }
 
 
@@ -545,56 +566,51 @@ void classify_fields(char *left_header, char *right_header) {
 }
 
 
-int compare_keys(char *buffer_left, char *buffer_right) {
-  int keycmp = 0;
-  int i;
-  char field_left[MAX_FIELD_LEN + 1];
-  char field_right[MAX_FIELD_LEN + 1];
+/* gets the collation key of line LINE_NO of an input, building it if it isn't
+   already in the cache. */
+static const collate_key_t * line_key(struct line_keys *cache, size_t line_no,
+                                      const char *line, const int *keyfields) {
+  int slot = line_no % 2;
 
-  if (buffer_left == NULL && buffer_right == NULL)
+  if (cache->line_no[slot] != line_no) {
+    linesplit(&key_split, line, delim);
+    collate_key_fields(&cache->keys[slot], &key_split, keyfields, nkeys);
+    cache->line_no[slot] = line_no;
+  }
+  return &cache->keys[slot];
+}
+
+
+int compare_keys(dbfr_t *left, dbfr_t *right) {
+  if (left->current_line == NULL && right->current_line == NULL)
     return LEFT_RIGHT_EQUAL;
 
   /* these special cases may seem counter-intuitive, but saying that
      a NULL line is greater than a non-NULL line results in
      the non-NULL line getting printed and a new line read in.
    */
-  if (buffer_left == NULL)
+  if (left->current_line == NULL)
     return LEFT_GREATER;
 
-  if (buffer_right == NULL)
+  if (right->current_line == NULL)
     return RIGHT_GREATER;
 
-  for (i = 0; i < nkeys; i++) {
-    get_line_field(field_left, buffer_left, MAX_FIELD_LEN,
-                   left_keyfields[i], delim);
-    get_line_field(field_right, buffer_right, MAX_FIELD_LEN,
-                   right_keyfields[i], delim);
-    if ((keycmp = strcoll(field_left, field_right)) != 0)
-      break;
-  }
-  return keycmp;
+  return collate_key_cmp(line_key(&left_line_keys, left->line_no,
+                                  left->current_line, left_keyfields),
+                         line_key(&right_line_keys, right->line_no,
+                                  right->current_line, right_keyfields));
 }
 
 
 /* compares keys of the current and the next line.  Basically the same
  * as compare_keys(), but using the same keyfield list for both lines. */
-int peek_keys(char *peek_line, char *current_line, const int *keyfields) {
-  int keycmp = 0;
-  int i;
-  char field_cur[MAX_FIELD_LEN + 1];
-  char field_next[MAX_FIELD_LEN + 1];
-
+int peek_keys(dbfr_t *reader, struct line_keys *cache, const int *keyfields) {
   /* no next line, so current line's fields are greater. */
-  if (peek_line == NULL)
+  if (reader->next_line == NULL)
     return 1;
 
-  for (i = 0; i < nkeys; i++) {
-    get_line_field(field_cur, current_line, MAX_FIELD_LEN,
-                   keyfields[i], delim);
-    get_line_field(field_next, peek_line, MAX_FIELD_LEN,
-                   keyfields[i], delim);
-    if ((keycmp = strcoll(field_cur, field_next)) != 0)
-      break;
-  }
-  return keycmp;
+  return collate_key_cmp(line_key(cache, reader->line_no,
+                                  reader->current_line, keyfields),
+                         line_key(cache, reader->line_no + 1,
+                                  reader->next_line, keyfields));
 }
@@ -18,6 +18,7 @@
 # include <config.h>
 #endif
 
+#include <crush/collate.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
 
@@ -75,6 +76,14 @@ enum join_type_t {
   join_type_right_outer,
 };
 
+/* the collation keys of the current and next lines of one input file,
+   indexed by line number so that each line is only transformed once, no
+   matter how many times it is compared. */
+struct line_keys {
+  collate_key_t keys[2];
+  size_t line_no[2];
+};
+
 int merge_files(dbfr_t *a, dbfr_t *b, enum join_type_t join_type, FILE * out,
                 struct cmdargs *args);
 
@@ -82,10 +91,11 @@ void classify_fields(char *left_header, char *right_header);
 int set_key_lists(struct cmdargs *args, const char *left_line,
                   const char *right_line, const char *delim);
 int set_field_types();
-int compare_keys(char *buffer_left, char *buffer_right);
+int compare_keys(dbfr_t *left, dbfr_t *right);
 void join_lines(char *left_line, char *right_line, char *merge_default,
                 FILE * out);
-int peek_keys(char *peek_line, char *current_line, const int *keyfields);
+int peek_keys(dbfr_t *reader, struct line_keys *cache,
+              const int *keyfields);
 
 /* extract each element of fields from line and print them, separated by delim.
    the delimiter will not be printed after the last field. */
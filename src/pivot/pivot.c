@@ -17,11 +17,14 @@
 #include <locale.h>
 #include <assert.h>
 
+#include <crush/collate.h>
 #include <crush/dbfr.h>
 #include <crush/ffutils.h>
 #include <crush/general.h>
 #include <crush/hashtbl.h>
 #include <crush/linklist.h>
+#include <crush/linesplit.h>
+#include <crush/numparse.h>
 
 #include "pivot_main.h"
 
@@ -50,8 +53,6 @@ void decrement_values(int *array, size_t sz);
 void *realloc_if_needed(char **target, size_t * cur_sz, const size_t new_sz);
 void extract_fields_to_string(char *line, char *destbuf, size_t destbuf_sz,
                               int *fields, size_t nfields, char *delim);
-int key_strcmp(char **a, char **b);
-int float_str_precision(char *d);
 
 char *delim;
 
@@ -71,7 +72,7 @@ void free_hash(void *t) {
   */
 int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
-  int i, j, tmplen;
+  int i, j;
 
   char default_delim[] = { 0xFE, 0x00 };
 
@@ -95,6 +96,8 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   char *fieldbuf = NULL;        /* to hold fields extracted from input */
   size_t fieldbuf_sz = 0;       /* size of field buffer */
+  linesplit_t split;            /* fields of the current line */
+  numparse_t num;               /* numeric value of a field */
 
   FILE *fin;                    /* input file */
   dbfr_t *in_reader;
@@ -121,11 +124,13 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
     return EXIT_FILE_ERR;
   }
   in_reader = dbfr_init(fin);
+  linesplit_init(&split, 0);
 
-  /* set locale with values from the environment so strcoll()
-     will work correctly. */
+  /* set locale with values from the environment so keys
+     collate correctly. */
   setlocale(LC_ALL, "");
   setlocale(LC_COLLATE, "");
+  collate_init(args->byte_order);
 
   memset(&conf, 0, sizeof(conf));
   if (configure_pivot(&conf, args, in_reader->next_line, delim) != 0) {
@@ -187,8 +192,7 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
   while (fin != NULL) {
 
     while (dbfr_getline(in_reader) > 0) {
-      int value_in_hash = 1;
-      int pivot_in_hash = 1;
+      void **slot;
 
       chomp(in_reader->current_line);
       if (conf.n_keys) {
@@ -225,51 +229,53 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
         fprintf(stderr, "pivot string: %s\n", pivstr);
 #endif
 
-      /* get hashtable value */
-      pivot_hash = (hashtbl_t *) ht_get(&key_hash, keystr);
-      if (!pivot_hash) {
-        pivot_hash = xmalloc(sizeof(hashtbl_t));
-        ht_init(pivot_hash, PIVOT_HASH_SZ, NULL, free);
-        pivot_in_hash = 0;
+      /* get hashtable value, adding an empty one if needed */
+      slot = ht_upsert(&key_hash, keystr, NULL);
+      if (!slot) {
+        fprintf(stderr, "%s: failed to store value in hashtable.\n",
+                getenv("_"));
+        continue;
       }
+      if (!*slot) {
+        *slot = xmalloc(sizeof(hashtbl_t));
+        ht_init((hashtbl_t *) *slot, PIVOT_HASH_SZ, NULL, free);
+      }
+      pivot_hash = (hashtbl_t *) *slot;
 
-      line_values = ht_get(pivot_hash, pivstr);
-      if (!line_values) {
-        line_values = xmalloc(sizeof(double) * conf.n_values);
-        memset(line_values, 0, sizeof(double) * conf.n_values);
-        value_in_hash = 0;
+      slot = ht_upsert(pivot_hash, pivstr, NULL);
+      if (!slot) {
+        fprintf(stderr, "%s: failed to store value in hashtable.\n",
+                getenv("_"));
+        continue;
+      }
+      if (!*slot) {
+        *slot = xmalloc(sizeof(double) * conf.n_values);
+        memset(*slot, 0, sizeof(double) * conf.n_values);
       }
+      line_values = (double *) *slot;
 
 
       /* add in values */
+      linesplit(&split, in_reader->current_line, delim);
       for (i = 0; i < conf.n_values; i++) {
-        tmplen =
-          get_line_field(fieldbuf, in_reader->current_line, fieldbuf_sz - 1,
-                         conf.values[i], delim);
-        if (tmplen > 0) {
-          line_values[i] += atof(fieldbuf);
+        if (conf.values[i] < split.n_fields &&
+            linesplit_field_len(&split, conf.values[i]) > 0) {
+          numparse(linesplit_field_ptr(&split, conf.values[i]),
+                   linesplit_field_len(&split, conf.values[i]), &num);
+          line_values[i] += num.value;
 
           /* remember the greatest input floating-point precision for each
            * field */
-          tmplen = float_str_precision(fieldbuf);
-          if (conf.value_precisions[i] < tmplen) {
+          if (conf.value_precisions[i] < num.precision) {
 #ifdef CRUSH_DEBUG
-            fprintf(stderr, "setting precision to %d for field %d\n", tmplen,
-                    i);
+            fprintf(stderr, "setting precision to %d for field %d\n",
+                    num.precision, i);
 #endif
-            conf.value_precisions[i] = tmplen;
+            conf.value_precisions[i] = num.precision;
           }
         }
       }
 
-      /* store hashtable value */
-      if (!value_in_hash)
-        ht_put(pivot_hash, pivstr, line_values);
-
-      if (!pivot_in_hash) {
-        ht_put(&key_hash, keystr, pivot_hash);
-      }
-
       /* store the pivot key string for later use */
       ht_put(&uniq_pivots, pivstr, (void *) 1);
     }
@@ -298,8 +304,7 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
   /* sort the collection of all pivot key strings */
   pivot_array = xmalloc(sizeof(char *) * n_pivot_keys);
   ht_keys(&uniq_pivots, pivot_array);
-  qsort(pivot_array, n_pivot_keys, sizeof(char *),
-        (int (*)(const void *, const void *)) key_strcmp);
+  collate_sort(pivot_array, n_pivot_keys, delim);
 #ifdef CRUSH_DEBUG
   fprintf(stderr, "sorted pivot strings:\n");
   for (i = 0; i < n_pivot_keys; i++) {
@@ -382,8 +387,7 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
     assert(j == n_key_strings);
 
     /* sort the keys */
-    qsort(key_array, n_key_strings, sizeof(char *),
-          (int (*)(const void *, const void *)) key_strcmp);
+    collate_sort(key_array, n_key_strings, delim);
 
     /* loop through all key strings */
     for (i = 0; i < n_key_strings; i++) {
@@ -427,6 +431,7 @@ int pivot(struct cmdargs *args, int argc, char *argv[], int optind) {
     free(pivot_array);
   if (fieldbuf)
     free(fieldbuf);
+  linesplit_destroy(&split);
 
   return EXIT_OKAY;
 }
@@ -523,43 +528,3 @@ void extract_fields_to_string(char *line, char *destbuf, size_t destbuf_sz,
   }
 }
 
-int key_strcmp(char **a, char **b) {
-  char fa[256], fb[256];
-  int retval = 0;
-  int i;
-  size_t alen, blen;
-
-  /* avoid comparing nulls */
-  if (!*a && !*b)
-    return 0;
-  if (!*a && *b)
-    return -1;
-  if (*a && !*b)
-    return 1;
-
-  i = 0;
-  while (retval == 0) {
-    alen = get_line_field(fa, *a, 255, i, delim);
-    blen = get_line_field(fb, *b, 255, i, delim);
-    if (alen < 0 || blen < 0)
-      break;
-    retval = strcoll(fa, fb);
-    i++;
-  }
-
-  return retval;
-}
-
-int float_str_precision(char *d) {
-  char *p;
-  int after_dot;
-  if (!d)
-    return 0;
-
-  p = strchr(d, '.');
-  if (p == NULL) {
-    return 0;
-  }
-  after_dot = p - d + 1;
-  return (strlen(d) - after_dot);
-}
@@ -14,20 +14,130 @@
    limitations under the License.
  ********************************/
 
+#include <err.h>
+
 #include <crush/general.h>
+#include <crush/parchunk.h>
 
 #include "reorder_main.h"
 #include "reorder.h"
 
 llist_t *swap_arg_list = NULL;
 
+/* the rearrangement to apply, shared by every thread. */
+struct reorder_conf {
+  const char *delim;
+  const int *order;           /* fields to output, for -f and -F */
+  size_t order_elems;
+  llist_t *swap_list;         /* swaps and moves, otherwise */
+};
+
+/* swaps and moves are done in place, so each thread has copies of its
+   line to work on. */
+struct reorder_worker {
+  const struct reorder_conf *conf;
+  linesplit_t split;          /* fields of the current line */
+  crushstr_t line;            /* writable copy of the current line */
+  crushstr_t wbuf;            /* line buffer */
+};
+
+static void * reorder_thread_init(void *arg) {
+  struct reorder_worker *worker = xmalloc(sizeof(struct reorder_worker));
+  worker->conf = arg;
+  linesplit_init(&worker->split, 0);
+  worker->line.buffer = NULL;   /* so crushstr_resize() will init */
+  worker->wbuf.buffer = NULL;
+  return worker;
+}
+
+static void reorder_thread_destroy(void *state) {
+  struct reorder_worker *worker = state;
+  linesplit_destroy(&worker->split);
+  if (worker->line.buffer)
+    crushstr_destroy(&worker->line);
+  if (worker->wbuf.buffer)
+    crushstr_destroy(&worker->wbuf);
+  free(worker);
+}
+
+/* rearranges the fields of every line of a chunk. */
+static int reorder_chunk(void *state, const char *data, size_t len,
+                         size_t line_no, bufout_t *out) {
+  struct reorder_worker *worker = state;
+  const struct reorder_conf *conf = worker->conf;
+  const char *end = data + len;
+  size_t line_len, buf_sz;
+
+  for (; data < end; data += line_len) {
+    line_len = parchunk_line_len(data, end);
+    if (! conf->swap_list) {
+      docut(out, &worker->split, data, line_len, conf->delim,
+            conf->order, conf->order_elems);
+      continue;
+    }
+
+    /* doswap() works in place on a null-terminated line, and may grow it
+       by a delimiter and a linebreak. */
+    buf_sz = line_len + 2 * strlen(conf->delim) + 2;
+    crushstr_resize(&worker->line, buf_sz);
+    crushstr_resize(&worker->wbuf, buf_sz);
+    memcpy(worker->line.buffer, data, line_len);
+    worker->line.buffer[line_len] = '\0';
+    memset(worker->wbuf.buffer, 0, buf_sz);
+    doswap(conf->swap_list, worker->wbuf.buffer, worker->line.buffer,
+           conf->delim);
+    bufout_puts(out, worker->wbuf.buffer);
+  }
+  return 0;
+}
+
+/* returns a null-terminated copy of the first line of the input, or NULL if
+   there isn't one.  lines from a mapped file are not null-terminated. */
+static char * reorder_header(const dbfr_t *reader) {
+  if (! reader->next_line)
+    return NULL;
+  return dbfr_next_line_dup(reader);
+}
+
+/* works out the output field order for a new input file from its header.
+   returns nonzero after printing a message if that cannot be done. */
+static int reorder_labels(struct cmdargs *args, dbfr_t *reader,
+                          int **order, size_t *order_sz, size_t *order_elems) {
+  char *header = reorder_header(reader);
+  int elems;
+
+  elems = expand_label_list(args->field_labels, header, args->delim,
+                            order, order_sz);
+  free(header);
+  if (elems == -1) {
+    fprintf(stderr, "%s: one or more labels in -F were not found.\n",
+            getenv("_"));
+    return 1;
+  } else if (elems < 1) {
+    fprintf(stderr, "%s: error translating labels in -F.\n",
+            getenv("_"));
+    return 1;
+  }
+  *order_elems = elems;
+  return 0;
+}
+
+/* parses the swaps and moves against the header of a new input file. */
+static int reorder_swaps(dbfr_t *reader, llist_t *swap_list,
+                         const char *delim) {
+  char *header = reorder_header(reader);
+  int retval;
+
+  ll_list_init(swap_list, free, NULL);
+  retval = parse_swap_list(swap_arg_list, swap_list, header, delim);
+  free(header);
+  return retval;
+}
+
 int reorder(struct cmdargs *args, int argc, char *argv[], int optind) {
-  FILE *fp, *fpout;
+  FILE *fp;
   dbfr_t *reader;
-
-  crushstr_t wbuf;            /* line buffer */
-  crushstr_t fbuf;            /* field buffer */
-  wbuf.buffer = fbuf.buffer = NULL;  /* so crushstr_resize() will init */
+  bufout_t *out;
 
   int *order = NULL;
   size_t order_sz = 0;
@@ -35,6 +145,11 @@ int reorder(struct cmdargs *args, int argc, char *argv[], int optind) {
 
   llist_t swap_list;
 
+  struct reorder_conf conf;
+  parchunk_ops_t ops = { reorder_chunk, reorder_thread_init,
+                         reorder_thread_destroy, &conf };
+  int n_threads = 1;
+
   char default_delim[] = { 0xfe, 0x00 };
 
   if (!args->delim) {
@@ -44,15 +159,20 @@ int reorder(struct cmdargs *args, int argc, char *argv[], int optind) {
   }
   expand_chars(args->delim);
 
-  /* may add output option later */
-  fpout = stdout;
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", getenv("_"),
+            args->threads);
+    return EXIT_HELP;
+  }
 
   if (optind == argc)
     fp = stdin;
   else
     fp = nextfile(argc, argv, &optind, "r");
 
-  reader = dbfr_init(fp);
+  if (fp == NULL)
+    return EXIT_FILE_ERR;
+  reader = dbfr_mmap_init(fp);
 
   if (reader == NULL)
     return EXIT_FILE_ERR;
@@ -69,17 +189,8 @@ int reorder(struct cmdargs *args, int argc, char *argv[], int optind) {
       fprintf(stderr, "\n");
     }
   } else if (args->field_labels) {
-    order_elems = expand_label_list(args->field_labels, reader->next_line,
-                                    args->delim, &order, &order_sz);
-    if (order_elems == -1) {
-      fprintf(stderr, "%s: one or more labels in -F were not found.\n",
-              getenv("_"));
+    if (reorder_labels(args, reader, &order, &order_sz, &order_elems) != 0)
       return EXIT_FAILURE;
-    } else if (order_elems < 1) {
-      fprintf(stderr, "%s: error translating labels in -F.\n",
-              getenv("_"));
-      return EXIT_FAILURE;
-    }
     if (args->verbose) {
     	int idx;
     	fprintf(stderr, "%s: %d field translated from labels: ",
@@ -90,63 +201,49 @@ int reorder(struct cmdargs *args, int argc, char *argv[], int optind) {
       fputs("\n", stderr);
     }
   } else if (swap_arg_list) {
-    ll_list_init(&swap_list, free, NULL);
-    if (parse_swap_list(swap_arg_list, &swap_list, reader->next_line,
-                        args->delim) != 0) {
+    if (reorder_swaps(reader, &swap_list, args->delim) != 0)
       return EXIT_FAILURE;
-    }
+  } else {
+    ll_list_init(&swap_list, free, NULL);
   }
 
+  /* may add output option later */
+  out = bufout_init(stdout);
+
+  conf.delim = args->delim;
+  conf.order = order;
+  conf.order_elems = order_elems;
+  conf.swap_list = NULL;
+  if (!args->fields && !args->field_labels)
+    conf.swap_list = &swap_list;
+
   while (fp != NULL) {
-    while (dbfr_getline(reader) > 0) {
-      /* make sure there's enough room in the line and field buffers */
-      crushstr_resize(&wbuf, reader->current_line_sz);
-      crushstr_resize(&fbuf, reader->current_line_sz);
-      memset(wbuf.buffer, 0, wbuf.capacity);
-
-      if (!args->fields && !args->field_labels) {
-        doswap(&swap_list, wbuf.buffer, reader->current_line, args->delim);
-      } else {
-        if (docut(&wbuf, &fbuf, reader->current_line, args->delim,
-                  order, order_elems) < 0) {
-          fprintf(stderr, "%s: out of memory.\n", getenv("_"));
-          return EXIT_MEM_ERR;
-        }
-      }
-      fputs(wbuf.buffer, fpout);
-    }
+    parchunk_run(reader, out, n_threads, &ops);
 
     dbfr_close(reader);
     fp = nextfile(argc, argv, &optind, "r");
     if (fp) {
-      reader = dbfr_init(fp);
+      reader = dbfr_mmap_init(fp);
       if (args->field_labels) {
-        order_elems = expand_label_list(args->field_labels, reader->next_line,
-                                        args->delim, &order, &order_sz);
-        if (order_elems == -1) {
-          fprintf(stderr, "%s: one or more labels in -F were not found.\n",
-                  getenv("_"));
-          return EXIT_FAILURE;
-        } else if (order_elems < 1) {
-          fprintf(stderr, "%s: error translating labels in -F.\n",
-                  getenv("_"));
+        if (reorder_labels(args, reader, &order, &order_sz, &order_elems) != 0)
           return EXIT_FAILURE;
-        }
+        conf.order = order;
+        conf.order_elems = order_elems;
       } else if (swap_arg_list) {
         ll_destroy(&swap_list);
-        ll_list_init(&swap_list, free, NULL);
-        if (parse_swap_list(swap_arg_list, &swap_list, reader->next_line,
-                            args->delim) != 0) {
+        if (reorder_swaps(reader, &swap_list, args->delim) != 0)
           return EXIT_FAILURE;
-        }
       }
       /* TODO(jhinds): should the first line of subsequent files be tossed
        * if labels were used? */
     }
   }
 
-  fflush(fpout);
-  fclose(fpout);
+  if (bufout_close(out) != 0) {
+    warn("stdout");
+    return EXIT_FILE_ERR;
+  }
+  fclose(stdout);
   return EXIT_OKAY;
 }
 
@@ -260,35 +357,19 @@ void doswap(llist_t *list, char *s, char *ct, const char *d) {
 
 
 
-int docut(crushstr_t *wbuf, crushstr_t *fbuf, const char *ct, const char *d,
-          const int *order, const size_t n) {
+void docut(bufout_t *out, linesplit_t *split, const char *ct, size_t len,
+           const char *d, const int *order, const size_t n) {
   int i;
-  size_t s_len;
-  size_t buf_len;
-  size_t delim_len;
-  char *s = wbuf->buffer;
-  char *buffer = fbuf->buffer;
-
-  s[0] = '\0';
-  s_len = 0;
-  delim_len = strlen(d);
 
+  linesplit_n(split, ct, len, d);
   for (i = 0; i < n; i++) {
-
-    if ((buf_len = get_line_field(buffer, ct, fbuf->capacity,
-                                  order[i] - 1, (char *) d)) >= 0) {
-      chomp(buffer);
-      strcat(s, buffer);
-      s_len += buf_len;
-
-      if (i < n - 1) {
-        strcat(s, d);
-        s_len += delim_len;
-      }
-    }
+    if (order[i] >= 1 && order[i] <= split->n_fields)
+      bufout_write(out, linesplit_field_ptr(split, order[i] - 1),
+                   linesplit_field_len(split, order[i] - 1));
+    if (i < n - 1)
+      bufout_puts(out, d);
   }
-  s[s_len] = '\n';
-  return s_len + 1;
+  bufout_putc(out, '\n');
 }
 
 
@@ -26,10 +26,12 @@
 # include <assert.h>
 #endif
 
+#include <crush/bufout.h>
 #include <crush/ffutils.h>
 #include <crush/dbfr.h>
 #include <crush/linklist.h>
 #include <crush/crushstr.h>
+#include <crush/linesplit.h>
 
 #ifndef REORDER_H
 #define REORDER_H
@@ -70,23 +72,21 @@ void doswap(llist_t *list, char *s, char *ct, const char *d);
 int parse_swap_list(llist_t *args, llist_t *pairs,
                     const char *header, const char *delim);
 
-/** @brief creates in s a new string delimited by d, containing the fields
-  * from ct in the order specified by o.
+/** @brief writes a new line delimited by d, containing the fields from ct in
+  * the order specified by o.
   *
-  * because a field may be included multiple times in the destination buffer,
-  * it is entirely possible for the output to be larger than the input, so
-  * this function may dynamically resize s as necessary.
+  * a field may be included multiple times in the output.  fields which are
+  * not present in ct are output as empty strings.
   *
-  * @param s address of crushstr_t containing destination buffer
-  * @param s address of crushstr_t containing field buffer
-  * @param ct source buffer
+  * @param out the output destination
+  * @param split used to split ct into fields
+  * @param ct source line
+  * @param len the length of ct, which need not be null-terminated
   * @param d delimiter
   * @param o array of field numbers
   * @param n number of elements in o
-  *
-  * @return the length of s on success; < 0 on error
   */
-int docut(crushstr_t *wbuf, crushstr_t *fbuf, const char *ct, const char *d,
-          const int *order, const size_t n);
+void docut(bufout_t *out, linesplit_t *split, const char *ct, size_t len,
+           const char *d, const int *order, const size_t n);
 
 #endif /* REORDER_H */
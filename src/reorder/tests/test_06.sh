@@ -0,0 +1,46 @@
+test_number=06
+description="linebreaks and threads"
+
+# every line comes out with a plain linebreak, even one that had a cr/lf or
+# none at all.
+subtest=0
+$bin -f 3,1 $test_dir/test_$test_number.in \
+  > $test_dir/test_$test_number.$subtest.out 2>&1
+if [ $? -ne 0 ] ||
+   [ "`diff -q $test_dir/test_$test_number.$subtest.expected \
+            $test_dir/test_$test_number.$subtest.out`" ]; then
+  test_status $test_number $subtest "$description (mapped)" FAIL
+else
+  rm $test_dir/test_$test_number.$subtest.out
+  test_status $test_number $subtest "$description (mapped)" PASS
+fi
+
+subtest=1
+cat $test_dir/test_$test_number.in | $bin -T 2 -s 1,3 \
+  > $test_dir/test_$test_number.$subtest.out 2>&1
+if [ $? -ne 0 ] ||
+   [ "`diff -q $test_dir/test_$test_number.$subtest.expected \
+            $test_dir/test_$test_number.$subtest.out`" ]; then
+  test_status $test_number $subtest "$description (piped swap, threads)" FAIL
+else
+  rm $test_dir/test_$test_number.$subtest.out
+  test_status $test_number $subtest "$description (piped swap, threads)" PASS
+fi
+
+# enough lines for several chunks, so that they are divided up between the
+# threads, in 40 runs which must come out whole and in order.
+subtest=2
+awk 'BEGIN { for (i = 0; i < 200000; i++)
+               printf "x%d\tr%d\t\tz\n", i, int(i / 5000) }' \
+  > $test_dir/test_$test_number.big.in
+$bin -T 3 -f 4,3,2 $test_dir/test_$test_number.big.in | runs \
+  > $test_dir/test_$test_number.$subtest.out
+if [ ${PIPESTATUS[0]} -ne 0 ] ||
+   [ "`diff -q $test_dir/test_$test_number.$subtest.expected \
+            $test_dir/test_$test_number.$subtest.out`" ]; then
+  test_status $test_number $subtest "$description (several chunks)" FAIL
+else
+  rm $test_dir/test_$test_number.$subtest.out \
+     $test_dir/test_$test_number.big.in
+  test_status $test_number $subtest "$description (several chunks)" PASS
+fi
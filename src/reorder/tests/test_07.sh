@@ -0,0 +1,6 @@
+test_number=07
+description="write errors are reported"
+
+# swaps are printed differently from -f.
+test_write_error $test_number 1 "$description (swaps)" stdout \
+  'a\tb\tc\nd\te\tf\n' $bin -s 1,3
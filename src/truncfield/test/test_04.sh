@@ -0,0 +1,64 @@
+test_number=04
+description="empty fields"
+
+input=$test_dir/test_$test_number.in
+expected=$test_dir/test_$test_number.expected
+
+# the delimiter after an empty field, and the linebreak after an empty last
+# field, are kept: both kinds of linebreak, or none on the last line.
+printf 'f0\tf1\tf2\n\t01\t02\r\n10\t\t12\n20\t21\t\r\n30\t31\t32' > $input
+printf 'f0\tf1\t\n\t01\t\r\n10\t\t\n20\t21\t\r\n30\t31\t' > $expected
+
+subtest=1
+output=$test_dir/test_$test_number.$subtest.out
+$bin -f 3 -d '\t' $input > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (file)" FAIL
+  has_error=1
+else
+  rm "$output"
+  test_status $test_number $subtest "$description (file)" PASS
+fi
+
+subtest=2
+output=$test_dir/test_$test_number.$subtest.out
+cat $input | $bin -f 3 -d '\t' > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (pipe)" FAIL
+  has_error=1
+else
+  rm "$output"
+  test_status $test_number $subtest "$description (pipe)" PASS
+fi
+
+subtest=3
+output=$test_dir/test_$test_number.$subtest.out
+$bin -T 2 -f 3 -d '\t' $input > $output
+if [ $? -ne 0 ] || ! cmp -s $expected $output; then
+  test_status $test_number $subtest "$description (threads)" FAIL
+  has_error=1
+else
+  rm "$output"
+  test_status $test_number $subtest "$description (threads)" PASS
+fi
+
+if [ ! $has_error ]; then
+  rm "$expected" "$input"
+fi
+
+# several chunks' worth, piped to several threads: the middle field is
+# emptied, leaving 40 runs of identical lines.
+subtest=4
+output=$test_dir/test_$test_number.$subtest.out
+expected=$test_dir/test_$test_number.$subtest.expected
+awk 'BEGIN { for (r = 0; r < 40; r++) print 5000, "r" r "\t\tend" }' \
+  > $expected
+awk 'BEGIN { for (i = 0; i < 200000; i++)
+               printf "r%d\t%d\tend\n", int(i / 5000), i }' |
+  $bin -T 3 -f 2 -d '\t' | runs > $output
+if [ ${PIPESTATUS[1]} -ne 0 ] || [ "`diff -q $expected $output`" ]; then
+  test_status $test_number $subtest "$description (several chunks)" FAIL
+else
+  rm "$output" "$expected"
+  test_status $test_number $subtest "$description (several chunks)" PASS
+fi
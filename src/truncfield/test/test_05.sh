@@ -0,0 +1,6 @@
+test_number=05
+description="write errors are reported"
+
+# each thread's output is written out in turn, by the main thread.
+test_write_error $test_number 1 "$description (threads)" stdout \
+  'a\tb\nc\td\n' $bin -T 2 -f 1 -d '\t'
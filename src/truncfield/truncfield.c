@@ -16,10 +16,77 @@
 #include "truncfield_main.h"
 #include <err.h>
 
+#include <crush/bufout.h>
 #include <crush/ffutils.h>
+#include <crush/general.h>
+#include <crush/linesplit.h>
+#include <crush/parchunk.h>
 #include <crush/qsort_helper.h>
 #include <crush/dbfr.h>
 
+/* the fields to empty, shared by every thread. */
+struct trunc_conf {
+  const char *delim;
+  const int *field_list;
+  size_t field_list_sz;
+};
+
+/* only the split of the line being truncated differs between threads. */
+struct trunc_worker {
+  const struct trunc_conf *conf;
+  linesplit_t split;
+};
+
+static void * trunc_thread_init(void *arg) {
+  struct trunc_worker *worker = xmalloc(sizeof(struct trunc_worker));
+  worker->conf = arg;
+  linesplit_init(&worker->split, 0);
+  return worker;
+}
+
+static void trunc_thread_destroy(void *state) {
+  struct trunc_worker *worker = state;
+  linesplit_destroy(&worker->split);
+  free(worker);
+}
+
+/* empties the configured fields in every line of a chunk. */
+static int trunc_chunk(void *state, const char *data, size_t len,
+                       size_t line_no, bufout_t *out) {
+  struct trunc_worker *worker = state;
+  const struct trunc_conf *conf = worker->conf;
+  linesplit_t *split = &worker->split;
+  const char *end = data + len, *tail;
+  size_t line_len, n_fields;
+  size_t next_field_to_trunc;   /* index into field_list */
+  int i;                        /* index of current input field */
+
+  for (; data < end; data += line_len) {
+    line_len = parchunk_line_len(data, end);
+    n_fields = linesplit_n(split, data, line_len, conf->delim);
+    next_field_to_trunc = 0;
+
+    for (i = 0; i < n_fields; i++) {
+      if (i > 0)
+        bufout_puts(out, conf->delim);
+      if (next_field_to_trunc < conf->field_list_sz &&
+          conf->field_list[next_field_to_trunc] == i + 1) {
+        ++next_field_to_trunc;
+        continue;
+      }
+      bufout_write(out, linesplit_field_ptr(split, i),
+                   linesplit_field_len(split, i));
+    }
+
+    /* print everything after the last field in the
+     * line (preserves input line-break style) */
+    tail = linesplit_field_ptr(split, n_fields - 1) +
+           linesplit_field_len(split, n_fields - 1);
+    bufout_write(out, tail, data + line_len - tail);
+  }
+  return 0;
+}
+
 /** @brief  
   * 
   * @param args contains the parsed cmd-line options & arguments.
@@ -34,15 +101,23 @@ int truncfield(struct cmdargs *args, int argc, char *argv[], int optind) {
   char default_delim[] = { 0xfe, 0x00 };
   FILE *in;
   dbfr_t *in_reader;
+  bufout_t *out;
   int *field_list = NULL;       /* list of fields to remove */
   size_t field_list_sz = 0;
+  struct trunc_conf conf;
+  parchunk_ops_t ops = { trunc_chunk, trunc_thread_init, trunc_thread_destroy,
+                         &conf };
+  int n_threads = 1;
+  char *header;
 
-  size_t n_fields = 0;          /* the number of fields from input
-                                   file */
   if (! args->fields && ! args->field_labels) {
     fprintf(stderr, "%s: -f or -F must be specified.\n", argv[0]);
     return EXIT_HELP;
   }
+  if (args->threads && (n_threads = parchunk_threads(args->threads)) < 0) {
+    fprintf(stderr, "%s: bad number of threads: %s\n", argv[0], args->threads);
+    return EXIT_HELP;
+  }
   if (args->output_fname) {
     if (!freopen(args->output_fname, "w", stdout)) {
       warn(args->output_fname);
@@ -70,13 +145,15 @@ int truncfield(struct cmdargs *args, int argc, char *argv[], int optind) {
     fprintf(stderr, "%s: no valid input files.\n", argv[0]);
     return EXIT_FILE_ERR;
   }
-  in_reader = dbfr_init(in);
+  in_reader = dbfr_mmap_init(in);
 
   if (args->fields) {
     field_list_sz = expand_nums(args->fields, &field_list, &field_list_sz);
-  } else if (args->field_labels) {
-    field_list_sz = expand_label_list(args->field_labels, in_reader->next_line,
+  } else if (args->field_labels && in_reader->next_line) {
+    header = dbfr_next_line_dup(in_reader);
+    field_list_sz = expand_label_list(args->field_labels, header,
                                       args->delim, &field_list, &field_list_sz);
+    free(header);
   }
   if (field_list_sz < 1) {
     fprintf(stderr, "%s: error expanding field list.\n", argv[0]);
@@ -85,53 +162,25 @@ int truncfield(struct cmdargs *args, int argc, char *argv[], int optind) {
   qsort(field_list, field_list_sz, sizeof(field_list[0]),
         (qsort_cmp_func_t) qsort_intcmp);
 
-  while (in) {
-
-    int next_field_to_trunc;    /* index into field_list */
-    int i;                      /* index of current input field */
-    int f_first, f_last;        /* position of first and last char
-                                   in a field */
-    int first_field_printed;    /* used to control delimiter output */
-
-    while (dbfr_getline(in_reader) > 0) {
-      next_field_to_trunc = 0;
-      n_fields = fields_in_line(in_reader->current_line, args->delim);
-      first_field_printed = 0;
-
-      for (i = 0; i < n_fields; i++) {
-        if (field_list[next_field_to_trunc] == i + 1) {
-          ++next_field_to_trunc;
-          if (i > 0)
-            printf("%s", args->delim);
-          first_field_printed = 1;
-          continue;
-        }
-        if (!get_line_pos(in_reader->current_line, i, args->delim,
-                          &f_first, &f_last))
-          continue;
-
-        if (first_field_printed)
-          printf("%s", args->delim);
-
-        printf("%.*s", f_last - f_first + 1,
-               &(in_reader->current_line[f_first]));
-        first_field_printed = 1;
-      }
-
-      /* print everything after the last field in the
-       * line (preserves input line-break style) */
-      get_line_pos(in_reader->current_line, n_fields - 1,
-                   args->delim, &f_first, &f_last);
-      printf("%s", &(in_reader->current_line[f_last + 1]));
+  conf.delim = args->delim;
+  conf.field_list = field_list;
+  conf.field_list_sz = field_list_sz;
+  out = bufout_init(stdout);
 
-    }
+  while (in) {
+    parchunk_run(in_reader, out, n_threads, &ops);
     dbfr_close(in_reader);
     in = nextfile(argc, argv, &optind, "r");
     if (in)
-      in_reader = dbfr_init(in);
+      in_reader = dbfr_mmap_init(in);
   }
 
   free(field_list);
 
+  if (bufout_close(out) != 0) {
+    warn("%s", args->output_fname ? args->output_fname :
+                args->append_fname ? args->append_fname : "stdout");
+    return EXIT_FILE_ERR;
+  }
   return EXIT_OKAY;
 }